@@ -0,0 +1,409 @@
+-- loopback benchmarks for lsock
+--
+--	lua bench/bench.lua [-q] [name...]
+--
+-- names: tcp_stream unix_stream tcp_pingpong unix_pingpong udp_pps connect_rate select_scaling
+-- timer_lateness
+-- (all of them when none are given); -q runs a much shorter pass, good for smoke-testing.
+--
+-- every result is one JSON object on its own line on stdout, so runs can be
+-- diffed or fed to a tracker; progress and errors go to stderr
+
+local l = require "lsock"
+
+for n, v in pairs(l.constants) do l[n] = v end
+
+local quick = false
+local only  = {}
+
+for _, a in ipairs({ ... }) do
+	if "-q" == a then
+		quick = true
+	else
+		only[a] = true
+	end
+end
+
+local function scale(full, short)
+	return quick and short or full
+end
+
+local function now()
+	return l.monotonic_ns() / 1e9
+end
+
+-- lsock errors are nil, msg, errno; abort the run on anything unexpected
+local function check(what, ok, msg, errno, ...)
+	if nil == ok then
+		error(string.format("%s: %s (errno %s)", what, tostring(msg), tostring(errno)), 2)
+	end
+
+	return ok, msg, errno, ...
+end
+
+-- setsockopt() returns nothing when it works
+local function setopt(s, level, option, value)
+	local _, msg, errno = l.setsockopt(s, level, option, value)
+
+	if nil ~= msg then
+		error(string.format("setsockopt: %s (errno %s)", msg, tostring(errno)), 2)
+	end
+end
+
+local function would_block(errno)
+	return errno == l.EAGAIN or errno == l.EWOULDBLOCK
+end
+
+-- JSON Lines, keys sorted so identical runs produce identical text
+local function report(bench, result)
+	local keys = {}
+
+	result.bench = bench
+
+	for k in pairs(result) do
+		keys[#keys + 1] = k
+	end
+
+	table.sort(keys)
+
+	for i, k in ipairs(keys) do
+		local v = result[k]
+
+		if "number" == type(v) then
+			v = (v == math.floor(v) and math.abs(v) < 2^53) and string.format("%d", v) or string.format("%.6g", v)
+		else
+			v = string.format("%q", tostring(v))
+		end
+
+		keys[i] = string.format("%q:%s", k, v)
+	end
+
+	io.stdout:write("{", table.concat(keys, ","), "}\n")
+	io.stdout:flush()
+end
+
+local loopback = l.pack_sockaddr({ sin_family = l.AF_INET, sin_addr = "127.0.0.1", sin_port = 0 })
+
+local function listener(backlog)
+	local s = check("socket", l.socket(l.AF_INET, l.SOCK_STREAM))
+
+	setopt(s, l.SOL_SOCKET, l.SO_REUSEADDR, true)
+
+	check("bind",   l.bind(s, loopback))
+	check("listen", l.listen(s, backlog or 128))
+
+	return s, check("getsockname", l.getsockname(s))
+end
+
+-- a connected TCP pair over 127.0.0.1, Nagle off so ping-pong measures the stack and not the delay
+local function tcp_pair()
+	local serv, addr = listener(1)
+	local c = check("socket", l.socket(l.AF_INET, l.SOCK_STREAM))
+
+	check("connect", l.connect(c, addr))
+
+	local s = check("accept", l.accept(serv))
+
+	l.close(serv)
+
+	for _, x in ipairs({ c, s }) do
+		setopt(x, l.IPPROTO_TCP, l.TCP_NODELAY, true)
+	end
+
+	return c, s
+end
+
+local function unix_pair()
+	return check("socketpair", l.socketpair(l.AF_UNIX, l.SOCK_STREAM, 0))
+end
+
+-- read whatever is queued without blocking, returns bytes read
+local function drain(s, buflen)
+	local got = 0
+
+	while true do
+		local data, msg, errno = l.recv(s, buflen, l.MSG_DONTWAIT)
+
+		if nil == data then
+			if would_block(errno) then
+				return got
+			end
+
+			check("recv", data, msg, errno)
+		end
+
+		if 0 == #data then
+			return got
+		end
+
+		got = got + #data
+	end
+end
+
+-- push messages until the socket buffer is full, then drain the other end; one process, no threads
+local function stream(name, pair)
+	local total = scale(256 * 2^20, 16 * 2^20)
+
+	for _, size in ipairs({ 64, 512, 4096, 65536 }) do
+		local a, b = pair()
+		local msg  = string.rep("x", size)
+		local sent, got, msgs = 0, 0, 0
+		local start = now()
+
+		while got < total do
+			local n, err, errno = l.send(a, msg, l.MSG_DONTWAIT)
+
+			if nil == n then
+				if not would_block(errno) then
+					check("send", n, err, errno)
+				end
+
+				got = got + drain(b, 65536)
+			else
+				sent = sent + n
+				msgs = msgs + 1
+
+				if sent - got >= 4 * 65536 then
+					got = got + drain(b, 65536)
+				end
+			end
+		end
+
+		local secs = now() - start
+
+		report(name, { size = size, bytes = got, messages = msgs, seconds = secs, mb_per_s = got / secs / 2^20, msgs_per_s = msgs / secs })
+
+		l.close(a)
+		l.close(b)
+	end
+end
+
+local function recv_exactly(s, n)
+	local got = 0
+
+	repeat
+		got = got + #check("recv", l.recv(s, n - got, 0))
+	until got >= n
+end
+
+-- request/response round trips; each RTT lands in an lsock histogram
+local function pingpong(name, pair)
+	local rounds = scale(100000, 5000)
+
+	for _, size in ipairs({ 1, 64, 1024 }) do
+		local a, b = pair()
+		local msg  = string.rep("p", size)
+		local h    = l.histogram(1e-7, 10, 50)
+		local start = now()
+
+		for _ = 1, rounds do
+			local t0 = now()
+
+			check("send", l.send(a, msg, 0))
+			recv_exactly(b, size)
+			check("send", l.send(b, msg, 0))
+			recv_exactly(a, size)
+
+			l.histogram_add(h, now() - t0)
+		end
+
+		local secs = now() - start
+		local st   = l.histogram_stats(h, { 50, 99, 99.9 })
+
+		report(name, {
+			size = size, rounds = rounds, seconds = secs, rtt_per_s = rounds / secs,
+			mean_us = st.mean * 1e6, min_us = st.min * 1e6, max_us = st.max * 1e6,
+			p50_us = st.p50 * 1e6, p99_us = st.p99 * 1e6, p999_us = st["p99.9"] * 1e6,
+		})
+
+		l.close(a)
+		l.close(b)
+	end
+end
+
+local function udp_socket()
+	local s = check("socket", l.socket(l.AF_INET, l.SOCK_DGRAM))
+
+	setopt(s, l.SOL_SOCKET, l.SO_RCVBUF, 4 * 2^20)
+	check("bind", l.bind(s, loopback))
+
+	return s, check("getsockname", l.getsockname(s))
+end
+
+-- datagrams through recvfrom() so its per-call buffer setup is part of the number
+local function udp_pps()
+	local count = scale(1000000, 50000)
+
+	for _, size in ipairs({ 16, 64, 512, 1400 }) do
+		local tx      = udp_socket()
+		local rx, to  = udp_socket()
+		local msg     = string.rep("u", size)
+		local sent, got, dropped = 0, 0, 0
+		local start   = now()
+
+		local function pull()
+			while true do
+				local data, err, errno = l.recvfrom(rx, 2048, l.MSG_DONTWAIT)
+
+				if nil == data then
+					if would_block(errno) then
+						return
+					end
+
+					check("recvfrom", data, err, errno)
+				end
+
+				got = got + 1
+			end
+		end
+
+		while sent + dropped < count do
+			local n, err, errno = l.sendto(tx, msg, l.MSG_DONTWAIT, to)
+
+			if nil == n then
+				if not (would_block(errno) or errno == l.ENOBUFS) then
+					check("sendto", n, err, errno)
+				end
+
+				dropped = dropped + 1
+				pull()
+			else
+				sent = sent + 1
+
+				if 0 == sent % 64 then
+					pull()
+				end
+			end
+		end
+
+		pull()
+
+		local secs = now() - start
+
+		report("udp_pps", { size = size, sent = sent, received = got, send_failures = dropped, seconds = secs, pps = got / secs, lost = sent - got })
+
+		l.close(tx)
+		l.close(rx)
+	end
+end
+
+-- full socket()/connect()/accept()/close() cycles against one listener
+local function connect_rate()
+	local count = scale(10000, 500)
+	local serv, addr = listener(1024)
+	local start = now()
+
+	for _ = 1, count do
+		local c = check("socket", l.socket(l.AF_INET, l.SOCK_STREAM))
+
+		check("connect", l.connect(c, addr))
+
+		local s = check("accept", l.accept(serv))
+
+		-- server closes first so TIME_WAIT piles up on its side, not on the client ports we keep drawing
+		l.close(s)
+		l.close(c)
+	end
+
+	local secs = now() - start
+
+	report("connect_rate", { connections = count, seconds = secs, conns_per_s = count / secs })
+
+	l.close(serv)
+end
+
+-- one ready descriptor among n: the cost is all in building and scanning the fd_sets
+local function select_scaling()
+	local calls = scale(20000, 1000)
+
+	for _, n in ipairs({ 2, 16, 64, 256, 512 }) do
+		local socks, peers = {}, {}
+
+		for i = 1, n / 2 do
+			local a, b = unix_pair()
+
+			socks[#socks + 1] = a
+			socks[#socks + 1] = b
+			peers[#peers + 1] = { a, b }
+		end
+
+		check("send", l.send(peers[#peers][2], "!", 0))
+
+		local start = now()
+
+		for _ = 1, calls do
+			local r = check("select", l.select(socks, {}, {}, 0))
+
+			if 1 ~= #r then
+				error("select: expected 1 readable descriptor, got " .. #r)
+			end
+		end
+
+		local secs = now() - start
+
+		report("select_scaling", { fds = n, calls = calls, seconds = secs, us_per_call = secs / calls * 1e6 })
+
+		for _, s in ipairs(socks) do
+			l.close(s)
+		end
+	end
+end
+
+-- how late select() delivers wheel timers; the second timer sits a level below the
+-- first, so a wheel that only looks at level 0 sleeps past the first one
+local function timer_lateness()
+	local rounds = scale(20, 3)
+	local h      = l.histogram(1e-6, 1, 50)
+
+	for _ = 1, rounds do
+		local w  = l.timer_wheel(0.001)
+		local t0 = now()
+
+		l.timer_add(w, 0.070, "a")
+
+		check("select", l.select({}, {}, {}, 0.040))
+		l.timer_advance(w)
+
+		l.timer_add(w, 0.060, "b")
+
+		local fired = 0
+
+		while fired < 2 do
+			local _, _, _, expired = check("select", l.select({}, {}, {}, 1, w))
+
+			-- b is due 30ms after a; getting both at once means a waited for b
+			if 2 == #expired then
+				error("timer_lateness: the 70ms timer fired together with the 100ms one")
+			end
+
+			if "a" == expired[1] then
+				l.histogram_add(h, now() - t0 - 0.070)
+			end
+
+			fired = fired + #expired
+		end
+	end
+
+	local st = l.histogram_stats(h, { 50, 99 })
+
+	report("timer_lateness", { rounds = rounds, mean_us = st.mean * 1e6, max_us = st.max * 1e6, p50_us = st.p50 * 1e6, p99_us = st.p99 * 1e6 })
+end
+
+local benches =
+{
+	{ "tcp_stream",     function () stream("tcp_stream",  tcp_pair)      end },
+	{ "unix_stream",    function () stream("unix_stream", unix_pair)     end },
+	{ "tcp_pingpong",   function () pingpong("tcp_pingpong",  tcp_pair)  end },
+	{ "unix_pingpong",  function () pingpong("unix_pingpong", unix_pair) end },
+	{ "udp_pps",        udp_pps                                               },
+	{ "connect_rate",   connect_rate                                          },
+	{ "select_scaling", select_scaling                                        },
+	{ "timer_lateness", timer_lateness                                        },
+}
+
+for _, b in ipairs(benches) do
+	if not next(only) or only[b[1]] then
+		io.stderr:write(b[1], "\n")
+		b[2]()
+	end
+end
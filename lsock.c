@@ -1,8 +1,12 @@
-/* compile: gcc -o lsock.{so,c} -shared -fPIC -pedantic -std=c89 -W -Wall -Wextra -Werror -llua -fstack-protector-all -fvisibility=hidden -Os -s */
+/* compile: gcc -o lsock.{so,c} -shared -fPIC -pedantic -std=c89 -W -Wall -Wextra -Werror -llua -fstack-protector-all -fvisibility=hidden -Os -s -lpthread -lm */
 
 /* cross-platform includes */
 #include <sys/types.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <math.h>
+#include <ctype.h>
+#include <limits.h>
 #include <lauxlib.h>
 #include <lualib.h>
 
@@ -28,6 +32,16 @@
 #	define _GNU_SOURCE
 #	include <stropts.h>
 #	include <sys/sendfile.h>
+#	include <sys/timerfd.h>
+#	include <linux/filter.h>
+#	include <sys/eventfd.h>
+#	include <sched.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <linux/net_tstamp.h>
+#	include <linux/errqueue.h>
+#	include <linux/if_packet.h>
+#	include <linux/if_ether.h>
 #endif
 
 /* Mac OS X + Linux */
@@ -47,6 +61,9 @@
 #	include <fcntl.h>
 #	include <sys/ioctl.h>
 #	include <sys/select.h>
+#	include <pthread.h>
+#	include <time.h>
+#	include <poll.h>
 #endif
 
 /* platform-specific defines */
@@ -155,6 +172,49 @@ static size_t posrelat(ptrdiff_t pos, size_t len)
 		return len - ((size_t) -pos) + 1;
 }
 
+/* read-only memfd mappings from recv_payload(), and frames still sitting in a packet_ring();
+** strij() takes either wherever it takes a string */
+#define LSOCK_PAYLOAD "lsock.payload"
+#define LSOCK_FRAME   "lsock.frame"
+
+typedef struct
+{
+	const char * data;
+	size_t       len;
+} lsock_payload;
+
+/* a payload or a frame, else NULL */
+static lsock_payload * payload_test(lua_State * L, int idx)
+{
+	lsock_payload * p = (lsock_payload *) luaL_testudata(L, idx, LSOCK_PAYLOAD);
+
+	return NULL != p ? p : (lsock_payload *) luaL_testudata(L, idx, LSOCK_FRAME);
+}
+
+#ifdef __linux
+static lsock_payload * payload_check(lua_State * L, int idx)
+{
+	lsock_payload * p = payload_test(L, idx);
+
+	if (NULL == p)
+		luaL_argerror(L, idx, "payload or frame expected");
+
+	return p;
+}
+#endif
+
+static const char * payload_or_string(lua_State * L, int idx, size_t * len)
+{
+	lsock_payload * p = payload_test(L, idx);
+
+	if (NULL == p)
+		return luaL_optlstring(L, idx, "", len);
+
+	*len = p->len;
+
+	return p->data;
+}
+
 static void strij(lua_State * L, int idx, const char ** s, size_t * count)
 {
 	int t;
@@ -167,11 +227,11 @@ static void strij(lua_State * L, int idx, const char ** s, size_t * count)
 	idx = lua_absindex(L, idx);
 	t   = lua_type(L, idx);
 
-	luaL_argcheck(L, LUA_TSTRING == t || LUA_TTABLE == t, idx, "string or table expected");
+	luaL_argcheck(L, LUA_TSTRING == t || LUA_TTABLE == t || LUA_TUSERDATA == t, idx, "string, payload or table expected");
 
-	if (LUA_TSTRING == t)
+	if (LUA_TTABLE != t)
 	{
-		*s = luaL_optlstring(L, idx, "", count);
+		*s = payload_or_string(L, idx, count);
 		return;
 	}
 
@@ -186,7 +246,8 @@ static void strij(lua_State * L, int idx, const char ** s, size_t * count)
 	lua_pushnumber(L, 1);
 	lua_gettable(L, idx);
 
-	str = luaL_optlstring(L, -1, "", &l);
+	/* still referenced by the table after the pop */
+	str = payload_or_string(L, -1, &l);
 	lua_pop(L, 1);
 
 	/* starting_index = t[2] or t.i or 1 */
@@ -326,6 +387,40 @@ static FILE * sock_to_file(lua_State * L, lsocket sock, char * mode)
 	return fd_to_file(L, sock_to_fd(L, sock), mode);
 }
 
+/* nanoseconds on a clock that doesn't jump with the wall clock; only good for deadlines */
+static double monotonic_ns(void)
+{
+#ifdef _WIN32
+	return GetTickCount() * 1e6;
+#else
+#	ifdef CLOCK_MONOTONIC
+	struct timespec t;
+
+	if (0 == clock_gettime(CLOCK_MONOTONIC, &t))
+		return t.tv_sec * 1e9 + t.tv_nsec;
+#	endif
+	{
+		struct timeval tv;
+
+		gettimeofday(&tv, NULL);
+
+		return tv.tv_sec * 1e9 + tv.tv_usec * 1e3;
+	}
+#endif
+}
+
+static double monotonic_seconds(void)
+{
+	return monotonic_ns() / 1e9;
+}
+
+static int api_monotonic_ns(lua_State * L)
+{
+	lua_pushnumber(L, monotonic_ns());
+
+	return 1;
+}
+
 #if 0
 static void
 timeval_to_table(lua_State * L, struct timeval * t)
@@ -337,13 +432,23 @@ timeval_to_table(lua_State * L, struct timeval * t)
 }
 #endif
 
-static struct timeval * table_to_timeval(lua_State * L, int idx)
+/* a { tv_sec, tv_usec } table or plain seconds, into caller storage */
+static void table_to_timeval(lua_State * L, int idx, struct timeval * t)
 {
-	struct timeval * t;
-
 	idx = lua_absindex(L, idx);
 
-	t = (struct timeval *) LSOCK_NEWUDATA(L, sizeof(struct timeval));
+	ZERO_OUT(t, sizeof(struct timeval));
+
+	if (lua_isnumber(L, idx))
+	{
+		lua_Number n = lua_tonumber(L, idx);
+
+		t->tv_sec  = (long) n;
+		t->tv_usec = (long) ((n - t->tv_sec) * 1e6);
+		return;
+	}
+
+	luaL_checktype(L, idx, LUA_TTABLE);
 
 	lua_getfield(L, idx, "tv_sec");
 
@@ -358,8 +463,6 @@ static struct timeval * table_to_timeval(lua_State * L, int idx)
 		t->tv_usec = (long) lua_tonumber(L, -1);
 
 	lua_pop(L, 1);
-
-	return t;
 }
 
 static void linger_to_table(lua_State * L, struct linger * l)
@@ -647,1052 +750,11774 @@ static int api_unpack_sockaddr(lua_State * L)
 	return sockaddr_to_table(L, s, l);
 }
 
-static int close_stream(lua_State * L)
-{
-	luaL_Stream * p = LSOCK_CHECKFH(L, 1);
+/* address interning: repeated peers map to one long-lived unpacked table,
+** bounded by an LRU so a scan of the address space cannot grow it forever */
 
-#ifdef _WIN32
-	SOCKET s = file_to_sock(p->f);
+#define LSOCK_ADDRCACHE "lsock.addrcache"
 
-	return luaL_fileresult(L, (closesocket(s) && 0 == fclose(p->f)), NULL);
-#else
-	return luaL_fileresult(L, (0 == fclose(p->f)), NULL);
-#endif
-}
+/* keeps the power-of-two bucket count and the allocation size well inside int/size_t */
+#define ADDRCACHE_MAX (1 << 24)
 
-/* based directly on: newprefile() & newfile() from Lua 5.2 sources */
-static luaL_Stream * newfile(lua_State * L)
+typedef struct
 {
-	luaL_Stream * p = (luaL_Stream *) LSOCK_NEWUDATA(L, sizeof(luaL_Stream));
+	int       prev, next; /* LRU order, most recently used at the head */
+	int       chain;      /* next entry in the same bucket */
+	unsigned  hash;
+	socklen_t len;
+	lsockaddr sa;
+} addrcache_entry;
+
+typedef struct
+{
+	int cap, count, mask;
+	int head, tail;
 
-	luaL_setmetatable(L, LUA_FILEHANDLE);
+	unsigned long hits, misses, evictions;
 
-	p->f      = NULL;
-	p->closef = &close_stream;
+	int             * buckets;
+	addrcache_entry * entries;
+} addrcache;
 
-	return p;
-}
+/* FNV-1a */
+static unsigned hash_bytes(const char * s, size_t l)
+{
+	unsigned h = 2166136261u;
 
+	while (l--)
+		h = (h ^ (unsigned char) *s++) * 16777619u;
 
-static int api_htons(lua_State * L)
+	return h;
+}
+
+static void addrcache_reset(addrcache * c)
 {
-	lua_Number n = luaL_checknumber(L, 1);
-	uint16_t   s = (uint16_t) n;
+	int i;
 
-	if (s != n) /* type promotion back to lua_Number */
-	{
-		lua_pushnil(L);
-		lua_pushfstring(L, "number cannot be represented as [network] short (%s)", s > n ? "underflow" : "overflow");
-		return 2;
-	}
+	c->count = 0;
+	c->head  = c->tail = -1;
 
-	s = htons(s);
+	for (i = 0; i <= c->mask; i++)
+		c->buckets[i] = -1;
+}
 
-	lua_pushlstring(L, (char *) &s, sizeof(uint16_t));
+static void addrcache_unlink(addrcache * c, int i)
+{
+	addrcache_entry * e = &c->entries[i];
 
-	return 1;
+	if (-1 == e->prev) c->head = e->next; else c->entries[e->prev].next = e->next;
+	if (-1 == e->next) c->tail = e->prev; else c->entries[e->next].prev = e->prev;
 }
 
-static int api_ntohs(lua_State * L)
+static void addrcache_push_front(addrcache * c, int i)
 {
-	uint16_t     h = 0;
-	size_t       l = 0;
-	const char * s = luaL_checklstring(L, 1, &l);
+	addrcache_entry * e = &c->entries[i];
 
-	if (sizeof(uint16_t) != l) /* obviously 2 bytes... */
-	{
-		lua_pushnil(L);
-		lua_pushliteral(L, "string length must be sizeof(uint16_t) (2 bytes)");
-		return 2;
-	}
+	e->prev = -1;
+	e->next = c->head;
 
-	h = ntohs(*((uint16_t *) s));
+	if (-1 != c->head)
+		c->entries[c->head].prev = i;
 
-	lua_pushnumber(L, h);
+	c->head = i;
 
-	return 1;
+	if (-1 == c->tail)
+		c->tail = i;
 }
 
-static int api_htonl(lua_State * L)
+static void addrcache_unchain(addrcache * c, int i)
 {
-	lua_Number n = luaL_checknumber(L, 1);
-	uint32_t   l = (uint32_t) n;
-
-	if (l != n) /* type promotion back to lua_Number */
-	{
-		lua_pushnil(L);
-		lua_pushfstring(L, "number cannot be represented as [network] long (%s)", l > n ? "underflow" : "overflow");
-		return 2;
-	}
+	int * p = &c->buckets[c->entries[i].hash & c->mask];
 
-	l = htonl(l);
-
-	lua_pushlstring(L, (char *) &l, sizeof(uint32_t));
+	while (*p != i)
+		p = &c->entries[*p].chain;
 
-	return 1;
+	*p = c->entries[i].chain;
 }
 
-static int api_ntohl(lua_State * L)
+/* pushes the interned value for sa (nil if sa is not a sockaddr we can unpack) */
+static void addrcache_intern(lua_State * L, int idx, const char * sa, size_t sa_len)
 {
-	uint32_t     h = 0;
-	size_t       l = 0;
-	const char * s = luaL_checklstring(L, 1, &l);
+	int i;
+	unsigned h;
 
-	if (sizeof(uint32_t) != l) /* 4 bytes */
+	addrcache * c = (addrcache *) luaL_checkudata(L, idx, LSOCK_ADDRCACHE);
+
+	idx = lua_absindex(L, idx);
+
+	if (sa_len > sizeof(lsockaddr))
 	{
-		lua_pushnil(L);
-		lua_pushliteral(L, "string length must be sizeof(uint32_t) (4 bytes)");
-		return 2;
+		if (!sockaddr_to_table(L, sa, sa_len))
+			lua_pushnil(L);
+
+		return;
 	}
 
-	h = ntohl(*((uint32_t *) s));
+	h = hash_bytes(sa, sa_len);
 
-	lua_pushnumber(L, h);
+	for (i = c->buckets[h & c->mask]; i != -1; i = c->entries[i].chain)
+	{
+		addrcache_entry * e = &c->entries[i];
 
-	return 1;
-}
+		if (e->hash == h && e->len == sa_len && 0 == memcmp(&e->sa, sa, sa_len))
+		{
+			c->hits++;
 
-static int api_accept(lua_State * L)
-{
-	luaL_Stream * fh;
-	lsocket       new_sock;
-	lsockaddr     info;
+			if (c->head != i)
+			{
+				addrcache_unlink(c, i);
+				addrcache_push_front(c, i);
+			}
 
-	lsocket       serv = LSOCK_CHECKSOCK(L, 1);
-	socklen_t     sz   = sizeof(lsockaddr);
+			lua_getuservalue(L, idx);
+			lua_rawgeti(L, -1, i + 1);
+			lua_remove(L, -2);
+			return;
+		}
+	}
 
-	ZERO_OUT(&info, sizeof(info));
+	c->misses++;
 
-	new_sock = accept(serv, (struct sockaddr *) &info, &sz);
+	if (!sockaddr_to_table(L, sa, sa_len))
+	{
+		lua_pushnil(L);
+		return;
+	}
 
-	if (INVALID_SOCKET == new_sock)
-		return LSOCK_STRERROR(L, NULL);
+	/* claim a fresh slot or recycle the least recently used one */
+	if (c->count < c->cap)
+		i = c->count++;
+	else
+	{
+		i = c->tail;
+		addrcache_unlink(c, i);
+		addrcache_unchain(c, i);
+		c->evictions++;
+	}
 
-	fh = newfile(L);
-	fh->f = sock_to_file(L, new_sock, NULL);
+	c->entries[i].hash  = h;
+	c->entries[i].len   = sa_len;
+	c->entries[i].chain = c->buckets[h & c->mask];
+	c->buckets[h & c->mask] = i;
 
-	lua_pushlstring(L, (char *) &info, sz);
+	memcpy(&c->entries[i].sa, sa, sa_len);
+	addrcache_push_front(c, i);
 
-	return 2;
+	lua_getuservalue(L, idx);
+	lua_pushvalue(L, -2);
+	lua_rawseti(L, -2, i + 1);
+	lua_pop(L, 1);
 }
 
-static int api_listen(lua_State * L)
+static int api_addrcache(lua_State * L)
 {
-	lsocket serv = LSOCK_CHECKSOCK(L, 1);
-	int  backlog = luaL_optinteger(L, 2, 0);
+	int buckets = 1;
+	int cap     = luaL_optint(L, 1, 4096);
+	size_t sz;
+	addrcache * c;
 
-	/* a backlog of zero hints the implementation
-	** to set the ideal connect queue size */
-	if (listen(serv, backlog))
-		return LSOCK_STRERROR(L, NULL);
+	luaL_argcheck(L, cap > 0, 1, "cache size must be positive");
+	luaL_argcheck(L, cap <= ADDRCACHE_MAX, 1, "cache size too large");
 
-	lua_pushboolean(L, 1);
+	/* keep the load factor at or below 1 */
+	while (buckets < cap)
+		buckets <<= 1;
 
-	return 1;
-}
+	sz = sizeof(addrcache) + cap * sizeof(addrcache_entry) + buckets * sizeof(int);
 
-static int api_bind(lua_State * L)
-{
-	size_t       sz   = 0;
-	lsocket      serv = LSOCK_CHECKSOCK(L, 1);
-	const char * addr = luaL_checklstring(L, 2, &sz);
+	c = (addrcache *) LSOCK_NEWUDATA(L, sz);
 
-	if (bind(serv, (struct sockaddr *) addr, sz))
-		return LSOCK_STRERROR(L, NULL);
+	/* entries first: they need the stricter alignment */
+	c->cap     = cap;
+	c->mask    = buckets - 1;
+	c->entries = (addrcache_entry *) (c + 1);
+	c->buckets = (int *) (c->entries + cap);
 
-	lua_pushboolean(L, 1);
+	addrcache_reset(c);
+
+	lua_createtable(L, cap, 0);
+	lua_setuservalue(L, -2);
+
+	luaL_setmetatable(L, LSOCK_ADDRCACHE);
 
 	return 1;
 }
 
-static int api_connect(lua_State * L)
+static int api_addrcache_intern(lua_State * L)
 {
-	size_t       sz     = 0;
-	lsocket      client = LSOCK_CHECKSOCK(L, 1);
-	const char * addr   = luaL_checklstring(L, 2, &sz);
-
-	if (connect(client, (struct sockaddr *) addr, sz))
-		return LSOCK_STRERROR(L, NULL);
+	size_t       l = 0;
+	const char * s = luaL_checklstring(L, 2, &l);
 
-	lua_pushboolean(L, 1);
+	addrcache_intern(L, 1, s, l);
 
 	return 1;
 }
 
-static int api_getsockname(lua_State * L)
+static int api_addrcache_clear(lua_State * L)
 {
-	lsockaddr addr;
-
-	lsocket    s = LSOCK_CHECKSOCK(L, 1);
-	socklen_t sz = sizeof(addr);
+	addrcache * c = (addrcache *) luaL_checkudata(L, 1, LSOCK_ADDRCACHE);
 
-	ZERO_OUT(&addr, sizeof(addr));
-
-	if (getsockname(s, (struct sockaddr *) &addr, &sz))
-		return LSOCK_STRERROR(L, NULL);
+	addrcache_reset(c);
 
-	lua_pushlstring(L, (char *) &addr, sz);
+	lua_createtable(L, c->cap, 0);
+	lua_setuservalue(L, 1);
 
-	return 1;
+	return 0;
 }
 
-static int api_getpeername(lua_State * L)
+static int api_addrcache_stats(lua_State * L)
 {
-	lsockaddr addr;
+	addrcache * c = (addrcache *) luaL_checkudata(L, 1, LSOCK_ADDRCACHE);
 
-	lsocket    s = LSOCK_CHECKSOCK(L, 1);
-	socklen_t sz = sizeof(addr);
+	lua_createtable(L, 0, 5);
 
-	ZERO_OUT(&addr, sizeof(addr));
+	PUSHFIELD(L, -1, integer, "size",      c->count    );
+	PUSHFIELD(L, -1, integer, "max",       c->cap      );
+	PUSHFIELD(L, -1, number,  "hits",      c->hits     );
+	PUSHFIELD(L, -1, number,  "misses",    c->misses   );
+	PUSHFIELD(L, -1, number,  "evictions", c->evictions);
 
-	if (getpeername(s, (struct sockaddr *) &addr, &sz))
-		return LSOCK_STRERROR(L, NULL);
+	return 1;
+}
 
-	lua_pushlstring(L, (char *) &addr, sz);
+static int addrcache_len(lua_State * L)
+{
+	lua_pushinteger(L, ((addrcache *) luaL_checkudata(L, 1, LSOCK_ADDRCACHE))->count);
 
 	return 1;
 }
 
-static int api_sendto(lua_State * L)
+static luaL_Reg addrcache_methods[] =
 {
-	ssize_t sent;
+	{ "intern", api_addrcache_intern },
+	{ "clear",  api_addrcache_clear  },
+	{ "stats",  api_addrcache_stats  },
+	{ NULL,     NULL                 }
+};
 
-	int flags;
+static luaL_Reg addrcache_meta[] =
+{
+	{ "__len", addrcache_len },
+	{ NULL,    NULL          }
+};
 
-	size_t data_len = 0;
-	const char * data = NULL;
+/* textual address forms understood by parse_addrs():
+**   1.2.3.4   1.2.3.4:80   1.2.3.0/24
+**   ::1       [::1]:80     2001:db8::/32   [2001:db8::/32] */
 
-	size_t sa_len;
-	const char * sa;
+#define ADDR_TEXT_MAX (INET6_ADDRSTRLEN + sizeof("[]/128:65535"))
 
-	lsocket s = LSOCK_CHECKSOCK(L, 1);
-	strij(L, 2, &data, &data_len);
-	flags = luaL_checkint(L, 3);
+static int text_to_number(const char * s, const char * e, unsigned long max, unsigned long * n)
+{
+	*n = 0;
 
-	sa = luaL_optlstring(L, 4, "", &sa_len);
+	if (s == e)
+		return 0;
 
-	sent = sendto(s, data, data_len, flags, (struct sockaddr *) &sa, sa_len);
+	for (; s < e; s++)
+	{
+		if (*s < '0' || *s > '9')
+			return 0;
 
-	if (sent < 0)
-		return LSOCK_STRERROR(L, NULL);
+		*n = *n * 10 + (*s - '0');
 
-	lua_pushnumber(L, sent);
+		if (*n > max)
+			return 0;
+	}
 
 	return 1;
 }
 
-static int api_send(lua_State * L)
+/* returns NULL on success, or why the text was rejected */
+static const char * text_to_sockaddr(const char * s, size_t l, lsockaddr * lsa, socklen_t * lsa_sz, int * prefix)
 {
-	int n = lua_gettop(L);
-
-	/* the sock is already associated with a sockaddr (connect())
-	** arg-shave-off anything after arg 3 to avoid confusing sendto() */
-	if (n > 3)
-		lua_pop(L, n - 3);
+	int af;
+	unsigned long n;
 
-	return api_sendto(L);
-}
+	char buf[ADDR_TEXT_MAX];
+	char * addr  = buf;
+	char * end   = NULL;
+	char * slash = NULL;
+	char * port  = NULL;
 
-static int api_recvfrom(lua_State * L)
-{
-	ssize_t gotten;
+	if (l >= sizeof(buf))
+		return "address too long";
 
-	const char * from     = NULL;
-	socklen_t    from_len = 0;
+	memcpy(buf, s, l);
+	buf[l] = '\0';
+	end    = buf + l;
 
-	char * buf;
-	luaL_Buffer B;
+	if ('[' == *addr)
+	{
+		char * close = strchr(addr, ']');
 
-	lsocket s      = LSOCK_CHECKSOCK(L, 1);
-	size_t  buflen = luaL_checkint  (L, 2);
-	int     flags  = luaL_checkint  (L, 3);
+		if (NULL == close)
+			return "missing ']'";
 
-	from = luaL_optlstring(L, 4, "", (size_t *) &from_len);
+		if (close + 1 != end)
+		{
+			if (':' != close[1])
+				return "junk after ']'";
 
-	buf = luaL_buffinitsize(L, &B, buflen);
+			port = close + 2;
+		}
 
-	ZERO_OUT(buf, buflen); /* a must! */
+		*close = '\0';
+		addr++;
+		af = AF_INET6;
+	}
+	else
+	{
+		char * colon = strchr(addr, ':');
 
-	gotten = recvfrom(s, buf, buflen, flags, (struct sockaddr *) from, &from_len);
+		af = AF_INET;
 
-	if (gotten < 0)
-		return LSOCK_STRERROR(L, NULL);
+		if (NULL != colon)
+		{
+			if (NULL == strchr(colon + 1, ':'))
+			{
+				*colon = '\0';
+				port   = colon + 1;
+			}
+			else
+				af = AF_INET6;
+		}
+	}
 
-	luaL_pushresultsize(&B, gotten);
+	slash = strchr(addr, '/');
 
-	return 1; /* success! */
-}
+	if (NULL != slash)
+		*slash++ = '\0';
 
-static int api_recv(lua_State * L)
-{
-	int n = lua_gettop(L);
+	ZERO_OUT(lsa, sizeof(lsockaddr));
 
-	/* the sock is already associated with a sockaddr (connect())
-	** arg-shave-off anything after arg 3 to avoid confusing recvfrom() */
-	if (n > 3)
-		lua_pop(L, n - 3);
+	if (AF_INET == af)
+	{
+		lsa->in.sin_family = AF_INET;
+		*lsa_sz = sizeof(struct sockaddr_in);
+		*prefix = 32;
 
-	return api_recvfrom(L);
+#ifdef _WIN32
+		if (1 != InetPton(AF_INET, (PCWSTR) addr, &lsa->in.sin_addr))
+#else
+		if (1 != inet_pton(AF_INET, addr, &lsa->in.sin_addr))
+#endif
+			return "invalid IPv4 address";
+	}
+	else
+	{
+		lsa->in6.sin6_family = AF_INET6;
+		*lsa_sz = sizeof(struct sockaddr_in6);
+		*prefix = 128;
+
+#ifdef _WIN32
+		if (1 != InetPton(AF_INET6, (PCWSTR) addr, &lsa->in6.sin6_addr))
+#else
+		if (1 != inet_pton(AF_INET6, addr, &lsa->in6.sin6_addr))
+#endif
+			return "invalid IPv6 address";
+	}
+
+	if (NULL != slash)
+	{
+		if (!text_to_number(slash, slash + strlen(slash), *prefix, &n))
+			return "invalid prefix length";
+
+		*prefix = (int) n;
+	}
+
+	if (NULL != port)
+	{
+		if (!text_to_number(port, end, 65535, &n))
+			return "invalid port";
+
+		/* sin_port and sin6_port share an offset */
+		lsa->in.sin_port = htons((u_short) n);
+	}
+
+	return NULL;
 }
 
-static int api_shutdown(lua_State * L)
+/* the inverse; prefix < 0 omits the "/len" */
+static const char * sockaddr_to_text(const lsockaddr * lsa, int prefix, char out[ADDR_TEXT_MAX])
 {
-	lsocket sock = LSOCK_CHECKSOCK(L, 1);
-	int     how  = luaL_checkint  (L, 2);
+	char  addr[INET6_ADDRSTRLEN];
+	int   v6   = AF_INET6 == lsa->sa.sa_family;
+	u_short port = ntohs(lsa->in.sin_port);
 
-	if (shutdown(sock, how))
-		return LSOCK_STRERROR(L, NULL);
+	ZERO_OUT(addr, sizeof(addr));
 
-	lua_pushboolean(L, 1);
+#ifdef _WIN32
+	if (NULL == InetNtop(lsa->sa.sa_family, v6 ? (void *) &lsa->in6.sin6_addr : (void *) &lsa->in.sin_addr, (PWSTR) addr, sizeof(addr)))
+#else
+	if (NULL == inet_ntop(lsa->sa.sa_family, v6 ? (void *) &lsa->in6.sin6_addr : (void *) &lsa->in.sin_addr, addr, sizeof(addr)))
+#endif
+		return NULL;
+
+	/* every field below is bounded, so the whole never outgrows ADDR_TEXT_MAX */
+	if (prefix > (v6 ? 128 : 32))
+		return NULL;
+
+	if (prefix >= 0 && port)
+		sprintf(out, v6 ? "[%.*s/%d]:%u" : "%.*s/%d:%u", (int) sizeof(addr) - 1, addr, prefix, port);
+	else if (prefix >= 0)
+		sprintf(out, "%.*s/%d", (int) sizeof(addr) - 1, addr, prefix);
+	else if (port)
+		sprintf(out, v6 ? "[%.*s]:%u" : "%.*s:%u", (int) sizeof(addr) - 1, addr, port);
+	else
+		sprintf(out, "%.*s", (int) sizeof(addr) - 1, addr);
 
-	return 1;
+	return out;
 }
 
-static int api_socket(lua_State * L)
+/* parse_addrs({ '10.0.0.0/8', '[::1]:53', ... }) or parse_addrs('one\nper\nline')
+** -> { packed sockaddr, ... }, { prefix length, ... } */
+static int api_parse_addrs(lua_State * L)
 {
-	luaL_Stream * stream;
+	int i = 0;
+	int n;
+	int is_text = LUA_TSTRING == lua_type(L, 1);
 
-	int domain   = luaL_checkint(L, 1),
-		type     = luaL_checkint(L, 2),
-		protocol = luaL_optint  (L, 3, 0);
+	size_t       text_len = 0;
+	const char * text     = NULL;
+	const char * cursor   = NULL;
 
-	lsocket new_sock = socket(domain, type, protocol);
+	if (is_text)
+	{
+		text   = lua_tolstring(L, 1, &text_len);
+		cursor = text;
+		n      = 0;
+	}
+	else
+	{
+		luaL_checktype(L, 1, LUA_TTABLE);
+		n = luaL_len(L, 1);
+	}
 
-	if (INVALID_SOCKET == new_sock)
-		return LSOCK_STRERROR(L, NULL);
+	lua_createtable(L, n, 0); /* addresses */
+	lua_createtable(L, n, 0); /* prefixes  */
 
-	stream    = newfile(L);
-	stream->f = sock_to_file(L, new_sock, NULL);
+	for (;;)
+	{
+		lsockaddr    lsa;
+		socklen_t    lsa_sz = 0;
+		int          prefix = 0;
+		size_t       l      = 0;
+		const char * s      = NULL;
+		const char * err    = NULL;
+
+		if (is_text)
+		{
+			const char * stop = text + text_len;
 
-	return 1;
+			while (cursor < stop && strchr(" \t\r\n", *cursor))
+				cursor++;
+
+			if (cursor == stop)
+				break;
+
+			s = cursor;
+
+			while (cursor < stop && !strchr(" \t\r\n", *cursor))
+				cursor++;
+
+			l = cursor - s;
+			i++;
+		}
+		else
+		{
+			if (++i > n)
+				break;
+
+			lua_rawgeti(L, 1, i);
+			s = lua_tolstring(L, -1, &l);
+			lua_pop(L, 1); /* the table still anchors the string */
+
+			if (NULL == s)
+				return luaL_error(L, "parse_addrs(): entry %d is not a string", i);
+		}
+
+		err = text_to_sockaddr(s, l, &lsa, &lsa_sz, &prefix);
+
+		if (NULL != err)
+		{
+			lua_pushnil(L);
+			lua_pushlstring(L, s, l);
+			lua_pushfstring(L, "parse_addrs(): %s at entry %d (\"%s\")", err, i, lua_tostring(L, -1));
+			lua_remove(L, -2);
+			lua_pushinteger(L, i);
+			return 3;
+		}
+
+		lua_pushlstring(L, (char *) &lsa, lsa_sz);
+		lua_rawseti(L, -3, i);
+
+		lua_pushinteger(L, prefix);
+		lua_rawseti(L, -2, i);
+	}
+
+	return 2;
 }
 
-static int api_should_block(lua_State * L)
+/* format_addrs({ packed sockaddr, ... } [, { prefix length, ... }]) -> { text, ... } */
+static int api_format_addrs(lua_State * L)
 {
-	lsocket s = LSOCK_CHECKSOCK(L, 1);
-	int     b = lua_isnone(L, 2) ? 1 : lua_toboolean(L, 2);
+	int i, n;
+	int prefixes;
 
-#ifdef _WIN32
-	if (SOCKET_ERROR == ioctlsocket(s, FIONBIO, (u_long *) &b))
-		return LSOCK_STRERROR(L, "ioctlsocket()");
-#else
-	int flags = fcntl(s, F_GETFL);
+	luaL_checktype(L, 1, LUA_TTABLE);
 
-	if (-1 == flags)
-		return LSOCK_STRERROR(L, "fcntl(F_GETFL)");
+	prefixes = !lua_isnoneornil(L, 2);
 
-	if (b)
-		flags |= O_NONBLOCK;
-	else
-		flags &= ~O_NONBLOCK;
+	if (prefixes)
+		luaL_checktype(L, 2, LUA_TTABLE);
 
-	/* could be redundant (O_NONBLOCK might already be set) */
-	flags = fcntl(s, F_SETFL, flags);
+	n = luaL_len(L, 1);
 
-	if (-1 == flags)
-		return LSOCK_STRERROR(L, "fcntl(F_SETFL)");
+	lua_createtable(L, n, 0);
 
-	flags = b ? 1 : 0;
+	for (i = 1; i <= n; i++)
+	{
+		lsockaddr lsa;
+		char      out[ADDR_TEXT_MAX];
+		int       prefix = -1;
+		size_t    l      = 0;
+		const char * s   = NULL;
+
+		lua_rawgeti(L, 1, i);
+		s = lua_tolstring(L, -1, &l);
+		lua_pop(L, 1);
 
-	flags = ioctl(s, FIONBIO, &flags);
+		ZERO_OUT(&lsa, sizeof(lsa));
 
-	if (-1 == flags)
-		return LSOCK_STRERROR(L, "ioctl()");
+		if (NULL != s)
+			memcpy(&lsa, s, MIN(l, sizeof(lsa)));
+
+		if
+		(
+			NULL == s ||
+			(AF_INET  == lsa.sa.sa_family && l < sizeof(struct sockaddr_in )) ||
+			(AF_INET6 == lsa.sa.sa_family && l < sizeof(struct sockaddr_in6)) ||
+			(AF_INET  != lsa.sa.sa_family && AF_INET6 != lsa.sa.sa_family)
+		)
+			return luaL_error(L, "format_addrs(): entry %d is not a packed AF_INET/AF_INET6 sockaddr", i);
+
+		if (prefixes)
+		{
+			lua_rawgeti(L, 2, i);
+
+			if (!lua_isnil(L, -1))
+			{
+				lua_Integer bits = lua_tointeger(L, -1);
+
+				if (bits < 0 || bits > (AF_INET6 == lsa.sa.sa_family ? 128 : 32))
+					return luaL_error(L, "format_addrs(): prefix of entry %d is out of range", i);
+
+				prefix = (int) bits;
+			}
+
+			lua_pop(L, 1);
+		}
+
+		if (NULL == sockaddr_to_text(&lsa, prefix, out))
+#ifdef _WIN32
+			return LSOCK_STRFATAL(L, "InetNtop()");
+#else
+			return LSOCK_STRFATAL(L, "inet_ntop()");
 #endif
 
-	lua_pushboolean(L, 1); /* success, not the passed/read blocking state */
+		lua_pushstring(L, out);
+		lua_rawseti(L, -2, i);
+	}
 
 	return 1;
 }
 
-/* you can also use io.close()... */
-static int api_close(lua_State * L)
+
+/* longest-prefix match over CIDR blocks: a path-compressed binary trie per family,
+** nodes live in one growable array and link to each other by index */
+
+#define LSOCK_CIDR "lsock.cidr"
+
+typedef struct
 {
-	return close_stream(L);
-}
+	unsigned char key[16]; /* network order, host bits zeroed */
+	int bits;
+	int child[2];
+	int value;             /* uservalue slot, or -1 for a pure branching node */
+} cidr_node;
 
-static int sockopt_boolean(lua_State * L)
+typedef struct
 {
-	lsocket s  = LSOCK_CHECKSOCK(L, 1);
-	int level  =   luaL_checkint(L, 2);
-	int option =   luaL_checkint(L, 3);
-	int get    =      lua_isnone(L, 4);
+	int root[2];           /* [0] AF_INET, [1] AF_INET6 */
+	int count, cap;
+	int prefixes;
+	cidr_node * nodes;
+} cidr_index;
 
-	int value = 0;
-	socklen_t sz = sizeof(value);
+#define KEY_BIT(k, b) (((k)[(b) >> 3] >> (7 - ((b) & 7))) & 1)
 
-	if (get)
-	{
-		if (getsockopt(s, level, option, (char *) &value, &sz))
-			return LSOCK_STRERROR(L, NULL);
+/* how many leading bits a and b share, up to max */
+static int common_bits(const unsigned char * a, const unsigned char * b, int max)
+{
+	int i = 0;
 
-		lua_pushboolean(L, value);
-	}
-	else
-	{
-		value = lua_isnumber(L, 4) ? lua_tointeger(L, 4) : lua_toboolean(L, 4);
+	while (i < max && a[i >> 3] == b[i >> 3])
+		i += 8;
 
-		if (setsockopt(s, level, option, (char *) &value, sz))
-			return LSOCK_STRERROR(L, NULL);
-	}
+	if (i >= max)
+		return max;
 
-	return get;
+	while (i < max && KEY_BIT(a, i) == KEY_BIT(b, i))
+		i++;
+
+	return i;
 }
 
-static int sockopt_integer(lua_State * L)
+static int cidr_newnode(lua_State * L, cidr_index * c, const unsigned char * key, int bits, int value)
 {
-	lsocket s  = LSOCK_CHECKSOCK(L, 1);
-	int level  =   luaL_checkint(L, 2);
-	int option =   luaL_checkint(L, 3);
-	int get    =      lua_isnone(L, 4);
-
-	int value = 0;
-	socklen_t sz = sizeof(value);
+	cidr_node * n;
 
-	if (get)
+	if (c->count == c->cap)
 	{
-		if (getsockopt(s, level, option, (char *) &value, &sz))
-			return LSOCK_STRERROR(L, NULL);
+		int        cap   = c->cap ? c->cap * 2 : 64;
+		cidr_node * grown = (cidr_node *) realloc(c->nodes, cap * sizeof(cidr_node));
 
-		lua_pushnumber(L, value);
-	}
-	else
-	{
-		value = luaL_checkint(L, 4);
+		if (NULL == grown)
+			luaL_error(L, "cidr: out of memory");
 
-		if (setsockopt(s, level, option, (char *) &value, sz))
-			return LSOCK_STRERROR(L, NULL);
+		c->nodes = grown;
+		c->cap   = cap;
 	}
 
-	return get;
+	n = &c->nodes[c->count];
+
+	ZERO_OUT(n->key, sizeof(n->key));
+	memcpy(n->key, key, (bits + 7) >> 3);
+
+	if (bits & 7)
+		n->key[bits >> 3] &= (unsigned char) (0xff << (8 - (bits & 7)));
+
+	n->bits     = bits;
+	n->child[0] = n->child[1] = -1;
+	n->value    = value;
+
+	return c->count++;
 }
 
-static int sockopt_linger(lua_State * L)
+/* returns the value slot of the prefix (a fresh one is next_slot) */
+static int cidr_insert(lua_State * L, cidr_index * c, int v6, const unsigned char * key, int bits, int next_slot)
 {
-	lsocket s  = LSOCK_CHECKSOCK(L, 1);
-	int level  =   luaL_checkint(L, 2);
-	int option =   luaL_checkint(L, 3);
-	int get    =      lua_isnone(L, 4);
+	/* the link we came through, by index: realloc() can move the nodes under a pointer */
+	int parent = -1, dir = 0;
+	int fresh;
 
-	if (get)
+#define CIDR_LINK (-1 == parent ? &c->root[v6] : &c->nodes[parent].child[dir])
+
+	for (;;)
 	{
-		struct linger l;
-		socklen_t sz = sizeof(l);
+		int n = *CIDR_LINK;
+		int common;
 
-		ZERO_OUT(&l, sz);
+		if (-1 == n)
+		{
+			fresh = cidr_newnode(L, c, key, bits, next_slot);
+			break;
+		}
 
-		if (getsockopt(s, level, option, (char *) &l, &sz))
-			return LSOCK_STRERROR(L, NULL);
+		common = common_bits(key, c->nodes[n].key, MIN(bits, c->nodes[n].bits));
 
-		linger_to_table(L, &l);
-	}
-	else
-	{
-		struct linger * l = NULL;
-		socklen_t sz = 0;
+		if (common == c->nodes[n].bits)
+		{
+			if (bits == common)
+			{
+				if (-1 == c->nodes[n].value)
+				{
+					c->nodes[n].value = next_slot;
+					c->prefixes++;
+				}
 
-		luaL_checktype(L, 4, LUA_TTABLE);
+				return c->nodes[n].value;
+			}
 
-		l  = table_to_linger(L, 4);
-		sz = lua_rawlen(L, -1);
+			parent = n;
+			dir    = KEY_BIT(key, common);
+			continue;
+		}
 
-		if (setsockopt(s, level, option, (char *) l, sz))
-			return LSOCK_STRERROR(L, NULL);
+		/* n diverges from key before its own end: splice a node in above it */
+		if (common == bits)
+		{
+			fresh = cidr_newnode(L, c, key, bits, next_slot);
+			c->nodes[fresh].child[KEY_BIT(c->nodes[n].key, bits)] = n;
+		}
+		else
+		{
+			int leaf = cidr_newnode(L, c, key, bits, next_slot);
+
+			fresh = cidr_newnode(L, c, key, common, -1);
+			c->nodes[fresh].child[KEY_BIT(key, common)]            = leaf;
+			c->nodes[fresh].child[KEY_BIT(c->nodes[n].key, common)] = n;
+		}
+
+		break;
 	}
 
-	return get;
-}
+	*CIDR_LINK = fresh;
 
-#ifndef _WIN32
+#undef CIDR_LINK
 
-static int sockopt_ifnam(lua_State * L)
+	c->prefixes++;
+
+	return next_slot;
+}
+
+/* value slot of the longest prefix covering key, or -1 */
+static int cidr_match(const cidr_index * c, int v6, const unsigned char * key, int * matched_bits)
 {
-	lsocket s  = LSOCK_CHECKSOCK(L, 1);
-	int level  =   luaL_checkint(L, 2);
-	int option =   luaL_checkint(L, 3);
-	int get    =      lua_isnone(L, 4);
+	int best  = -1;
+	int max   = v6 ? 128 : 32;
+	int n     = c->root[v6];
 
-	if (get)
+	while (-1 != n)
 	{
-		char buf[IFNAMSIZ + 1]; /* +1 for safety (this is like ~17 bytes anyway) */
-		socklen_t sz = sizeof(buf);
+		const cidr_node * node = &c->nodes[n];
 
-		ZERO_OUT(buf, sizeof(buf));
-
-		if (getsockopt(s, level, option, buf, &sz))
-			return LSOCK_STRERROR(L, NULL);
+		if (common_bits(key, node->key, node->bits) != node->bits)
+			break;
 
-		lua_pushlstring(L, buf, sz);
-	}
-	else
-	{
-		socklen_t sz = 0;
+		if (-1 != node->value)
+		{
+			best          = node->value;
+			*matched_bits = node->bits;
+		}
 
-		const char * value = luaL_checklstring(L, 4, (size_t *) &sz);
+		if (node->bits == max)
+			break;
 
-		if (setsockopt(s, level, option, value, sz))
-			return LSOCK_STRERROR(L, NULL);
+		n = node->child[KEY_BIT(key, node->bits)];
 	}
 
-	return get;
+	return best;
 }
 
-#endif
+/* pulls the lookup key out of a packed sockaddr; v4-mapped v6 addresses search the v4 tree */
+static const unsigned char * sockaddr_to_key(const char * sa, size_t sa_len, int * v6)
+{
+	static const unsigned char v4mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
 
-enum { SOCKOPT_BOOLEAN, SOCKOPT_INTEGER, SOCKOPT_LINGER, SOCKOPT_INADDR, SOCKOPT_IN6ADDR, SOCKOPT_IFNAM };
+	const lsockaddr * lsa = (const lsockaddr *) sa;
 
-static int option_to_handler(const int level, const int option)
-{
-	if (SOL_SOCKET == level)
+	if (sa_len < MEMBER_SIZE(struct sockaddr, sa_family))
+		return NULL;
+
+	if (AF_INET == lsa->sa.sa_family && sa_len >= sizeof(struct sockaddr_in))
 	{
-		switch (option)
-		{
-			case SO_ACCEPTCONN:
-			case SO_BROADCAST:
-			case SO_REUSEADDR:
-			case SO_KEEPALIVE:
-			case SO_OOBINLINE:
-			case SO_DONTROUTE:
-			case SO_DEBUG:
-#ifndef _WIN32
-			case SO_TIMESTAMP:
-#endif
-#ifdef __linux
-			case SO_BSDCOMPAT:
-			case SO_NO_CHECK:
-			case SO_MARK:
-#endif
-				return SOCKOPT_BOOLEAN;
-
-			case SO_RCVLOWAT:
-			case SO_RCVTIMEO:
-			case SO_SNDLOWAT:
-			case SO_SNDTIMEO:
-			case SO_SNDBUF:
-			case SO_RCVBUF:
-			case SO_ERROR:
-			case SO_TYPE:
-#ifdef __linux
-			case SO_PRIORITY:
-			case SO_PROTOCOL:
-			case SO_RCVBUFFORCE:
-			case SO_SNDBUFFORCE:
-			case SO_PEEK_OFF:
-			case SO_DOMAIN:
-#endif
-				return SOCKOPT_INTEGER;
-
-			case SO_LINGER:
-				return SOCKOPT_LINGER;
-
-#ifdef __linux
-			case SO_BINDTODEVICE:
-				return SOCKOPT_IFNAM;
-#endif
-		}
+		*v6 = 0;
+		return (const unsigned char *) &lsa->in.sin_addr;
 	}
-	else if (IPPROTO_TCP == level) /* SOL_TCP */
-	{
-		switch (option)
-		{
-			case TCP_MAXSEG:
-#ifndef _WIN32
-			case TCP_KEEPINTVL:
-			case TCP_KEEPCNT:
-#endif
-#ifdef __linux
-			case TCP_WINDOW_CLAMP:
-			case TCP_DEFER_ACCEPT: /* NOT A BOOLEAN, # of seconds to wait for data before drop */
-			case TCP_LINGER2:
-			case TCP_KEEPIDLE:
-			case TCP_SYNCNT:
-#endif
-				return SOCKOPT_INTEGER;
-
-			case TCP_NODELAY:
-#ifdef __linux
-			case TCP_CORK:
-#endif
-				return SOCKOPT_BOOLEAN;
 
-			/* maybe handle TCP_INFO at some point */
-		}
-	}
-	else if (IPPROTO_UDP == level) /* SOL_UDP */
+	if (AF_INET6 == lsa->sa.sa_family && sa_len >= sizeof(struct sockaddr_in6))
 	{
-		switch (option)
+		const unsigned char * a = (const unsigned char *) &lsa->in6.sin6_addr;
+
+		if (0 == memcmp(a, v4mapped, sizeof(v4mapped)))
 		{
-#ifdef _WIN32
-			case UDP_CHECKSUM_COVERAGE:
-			case UDP_NOCHECKSUM:
-#endif
-#ifdef __linux
-			case UDP_CORK:
-#endif
-				return SOCKOPT_BOOLEAN;
+			*v6 = 0;
+			return a + sizeof(v4mapped);
 		}
+
+		*v6 = 1;
+		return a;
 	}
-	else if (IPPROTO_IP == level) /* SOL_IP */
-	{
-		switch (option)
-		{
-			case IP_TTL:
-			case IP_TOS:
-			case IP_MULTICAST_TTL:
-#ifndef _WIN32
-			case IP_RECVTTL:
-#endif
-#ifdef __linux
-			case IP_MTU_DISCOVER:
-			case IP_RECVTOS:
-#endif
-				return SOCKOPT_INTEGER;
 
-			case IP_HDRINCL:
-			case IP_MULTICAST_LOOP:
-#ifndef _WIN32
-			case IP_RECVOPTS:
-			case IP_RETOPTS:
-#endif
-#ifdef __linux
-			case IP_PKTINFO:
-			case IP_RECVERR:
-			case IP_ROUTER_ALERT:
-#endif
-				return SOCKOPT_BOOLEAN;
+	return NULL;
+}
 
-			case IP_MULTICAST_IF:
-				return SOCKOPT_INADDR;
-		}
-	}
-	else if (IPPROTO_IPV6 == level) /* SOL_IPV6 */
-	{
-		switch (option)
-		{
+static int cidr_gc(lua_State * L)
+{
+	cidr_index * c = (cidr_index *) luaL_checkudata(L, 1, LSOCK_CIDR);
 
-			case IPV6_MULTICAST_LOOP:
-#ifndef _WIN32
-#endif
-#ifdef __linux
-			case IPV6_ROUTER_ALERT:
-			case IPV6_NEXTHOP:
-			case IPV6_HOPLIMIT:
-			case IPV6_DSTOPTS:
-			case IPV6_HOPOPTS:
-#endif
-				return SOCKOPT_BOOLEAN;
+	free(c->nodes);
+	c->nodes = NULL;
 
-			case IPV6_CHECKSUM:
-			case IPV6_MULTICAST_HOPS:
-			case IPV6_UNICAST_HOPS:
-#ifdef __linux
-			case IPV6_AUTHHDR:
-			case IPV6_ADDRFORM:
-			case IPV6_PKTINFO:
-#endif
-				return SOCKOPT_INTEGER;
-		}
-	}
+	return 0;
+}
 
-	/* unknown level+option combo */
-	return -1;
+static int cidr_len(lua_State * L)
+{
+	lua_pushinteger(L, ((cidr_index *) luaL_checkudata(L, 1, LSOCK_CIDR))->prefixes);
+
+	return 1;
 }
 
-static int sockopt(lua_State * L)
+/* adds the CIDR text at text_idx to the index at idx, mapped to the value on top of the stack (popped) */
+static void cidr_add(lua_State * L, int idx, int text_idx)
 {
-	int level, option, get;
+	lsockaddr lsa;
+	socklen_t lsa_sz = 0;
+	int prefix = 0, v6, slot;
 
-	LSOCK_CHECKSOCK(L, 1);
+	size_t       l   = 0;
+	cidr_index * c   = (cidr_index *) luaL_checkudata(L, idx, LSOCK_CIDR);
+	const char * s   = lua_tolstring(L, text_idx, &l);
+	const char * err = NULL;
 
-	level  = luaL_checkint(L, 2);
-	option = luaL_checkint(L, 3);
-	get    =    lua_isnone(L, 4);
+	idx = lua_absindex(L, idx);
 
-	switch (option_to_handler(level, option))
+	if (NULL == s)
+		err = "CIDR string expected";
+	else
+		err = text_to_sockaddr(s, l, &lsa, &lsa_sz, &prefix);
+
+	if (NULL != err)
 	{
-		case SOCKOPT_BOOLEAN: return sockopt_boolean(L);
-		case SOCKOPT_INTEGER: return sockopt_integer(L);
-		case SOCKOPT_LINGER:  return sockopt_linger(L);
-#ifndef _WIN32
-		case SOCKOPT_IFNAM:   return sockopt_ifnam(L);
-#endif
+		luaL_error(L, "cidr: %s (\"%s\")", err, NULL == s ? luaL_typename(L, text_idx) : s);
+		return;
 	}
 
-	/* unkown level+option */
-	lua_pushnil(L);
-	lua_pushfstring
-	(
-		L,
-		"unknown level or option passed to %ssockopt(); you can force it with %ssockopt_boolean/integer()..",
-		get ? "get" : "set",
-		get ? "get" : "set"
-	);
+	v6   = AF_INET6 == lsa.sa.sa_family;
+	slot = cidr_insert(L, c, v6, v6 ? (unsigned char *) &lsa.in6.sin6_addr : (unsigned char *) &lsa.in.sin_addr, prefix, c->prefixes + 1);
 
-	return 2;
+	lua_getuservalue(L, idx);
+	lua_insert(L, -2);
+	lua_rawseti(L, -2, slot);
+	lua_pop(L, 1);
 }
 
-static int api_getsockopt(lua_State * L)
+/* cidr_insert(index, '10.0.0.0/8' [, value]) -- value defaults to true */
+static int api_cidr_insert(lua_State * L)
 {
-	int n = lua_gettop(L);
-
-	if (n > 3)
-		lua_pop(L, n - 3);
+	luaL_checkudata(L, 1, LSOCK_CIDR);
+	luaL_checkstring(L, 2);
 
-	return sockopt(L);
-}
+	if (lua_isnoneornil(L, 3))
+		lua_pushboolean(L, 1);
+	else
+		lua_pushvalue(L, 3);
 
-static int api_setsockopt(lua_State * L)
-{
-	luaL_checkany(L, 4);
+	cidr_add(L, 1, 2);
 
-	return sockopt(L);
+	return 0;
 }
 
-static int api_getaddrinfo(lua_State * L)
+/* cidr_index([{ '10.0.0.0/8', ... } [, { value, ... }]]) -- values default to the list index */
+static int api_cidr_index(lua_State * L)
 {
-	int ret;
-	int i = 1;
-
-	struct addrinfo hints, * info, * p;
+	int i, n = 0;
+	cidr_index * c;
 
-	/* node and service both cannot be NULL, getaddrinfo() will spout EAI_NONAME */
-	const char * nname = lua_isnil(L, 1) ? NULL : luaL_checkstring(L, 1);
-	const char * sname = lua_isnil(L, 2) ? NULL : luaL_checkstring(L, 2);
+	if (!lua_isnoneornil(L, 1))
+	{
+		luaL_checktype(L, 1, LUA_TTABLE);
+		n = luaL_len(L, 1);
+	}
 
-	ZERO_OUT(&hints, sizeof(struct addrinfo));
+	if (!lua_isnoneornil(L, 2))
+		luaL_checktype(L, 2, LUA_TTABLE);
 
-	if (!lua_isnone(L, 3))
-	{
-		luaL_checktype(L, 3, LUA_TTABLE); /* getaddrinfo('www.google.com', 'http', { options }) */
+	c = (cidr_index *) LSOCK_NEWUDATA(L, sizeof(cidr_index));
 
-		lua_getfield(L, 3, "ai_flags");
+	c->root[0] = c->root[1] = -1;
 
-		if (!lua_isnil(L, -1))
-			hints.ai_flags = lua_tointeger(L, -1);
+	luaL_setmetatable(L, LSOCK_CIDR);
 
-		lua_pop(L, 1);
+	lua_createtable(L, n, 0);
+	lua_setuservalue(L, -2);
 
-		lua_getfield(L, 3, "ai_family");
+	for (i = 1; i <= n; i++)
+	{
+		lua_rawgeti(L, 1, i);
 
-		if (!lua_isnil(L, -1))
-			hints.ai_family = lua_tointeger(L, -1);
+		if (lua_isnoneornil(L, 2))
+			lua_pushinteger(L, i);
+		else
+			lua_rawgeti(L, 2, i);
 
+		cidr_add(L, -3, -2);
 		lua_pop(L, 1);
+	}
 
-		lua_getfield(L, 3, "ai_socktype");
+	return 1;
+}
 
-		if (!lua_isnil(L, -1))
-			hints.ai_socktype = lua_tointeger(L, -1);
+/* cidr_lookup(index, packed_sockaddr) -> value, prefix length | nil */
+static int api_cidr_lookup(lua_State * L)
+{
+	int v6 = 0, bits = 0, slot;
 
-		lua_pop(L, 1);
+	size_t                l   = 0;
+	cidr_index          * c   = (cidr_index *) luaL_checkudata(L, 1, LSOCK_CIDR);
+	const char          * sa  = luaL_checklstring(L, 2, &l);
+	const unsigned char * key = sockaddr_to_key(sa, l, &v6);
 
-		lua_getfield(L, 3, "ai_protocol");
+	luaL_argcheck(L, NULL != key, 2, "packed AF_INET/AF_INET6 sockaddr expected");
 
-		if (!lua_isnil(L, -1))
-			hints.ai_protocol = lua_tointeger(L, -1);
+	slot = cidr_match(c, v6, key, &bits);
 
-		lua_pop(L, 1);
+	if (-1 == slot)
+	{
+		lua_pushnil(L);
+		return 1;
 	}
 
-	info = NULL;
+	lua_getuservalue(L, 1);
+	lua_rawgeti(L, -1, slot);
+	lua_pushinteger(L, bits);
 
-	ret = getaddrinfo(nname, sname, &hints, &info);
+	return 2;
+}
 
-	if (0 != ret)
-		return LSOCK_GAIERROR(L, ret);
+/* cidr_lookup_batch(index, { packed_sockaddr, ... }) -> { value or false, ... } */
+static int api_cidr_lookup_batch(lua_State * L)
+{
+	int i, n;
+	cidr_index * c = (cidr_index *) luaL_checkudata(L, 1, LSOCK_CIDR);
 
-	ret = 1; /* to reflect how many returns */
+	luaL_checktype(L, 2, LUA_TTABLE);
 
-	lua_newtable(L);
+	n = luaL_len(L, 2);
 
-	for (p = info; p != NULL; p = (i++, p->ai_next))
+	lua_getuservalue(L, 1);
+	lua_createtable(L, n, 0);
+
+	for (i = 1; i <= n; i++)
 	{
-		/* the sequence index in the outer table */
-		lua_pushnumber(L, i);
+		int v6 = 0, bits = 0, slot = -1;
 
-		/* allocate for 7-at-most members */
-		lua_createtable(L, 0, 7);
+		size_t                l   = 0;
+		const char          * sa  = NULL;
+		const unsigned char * key = NULL;
 
-		PUSHFIELD(L, -1, integer, "ai_flags",    p->ai_flags   );
-		PUSHFIELD(L, -1, integer, "ai_family",   p->ai_family  );
-		PUSHFIELD(L, -1, integer, "ai_socktype", p->ai_socktype);
-		PUSHFIELD(L, -1, integer, "ai_protocol", p->ai_protocol);
-		PUSHFIELD(L, -1, integer, "ai_addrlen",  p->ai_addrlen );
+		lua_rawgeti(L, 2, i);
+		sa = lua_tolstring(L, -1, &l);
+		lua_pop(L, 1);
 
-		lua_pushlstring(L, (char *) p->ai_addr, p->ai_addrlen);
-		lua_setfield(L, -2, "ai_addr");
+		if (NULL != sa && NULL != (key = sockaddr_to_key(sa, l, &v6)))
+			slot = cidr_match(c, v6, key, &bits);
 
-		if (NULL != p->ai_canonname)
-			PUSHFIELD(L, -1, string, "ai_canonname", p->ai_canonname);
+		if (-1 == slot)
+			lua_pushboolean(L, 0);
+		else
+			lua_rawgeti(L, -2, slot);
 
-		lua_settable(L, -3);
+		lua_rawseti(L, -2, i);
 	}
 
-	if (NULL != info->ai_canonname)
-	{
-		lua_pushstring(L, info->ai_canonname);
-		ret++;
-	}
+	return 1;
+}
 
-	freeaddrinfo(info);
+static luaL_Reg cidr_methods[] =
+{
+	{ "insert",       api_cidr_insert       },
+	{ "lookup",       api_cidr_lookup       },
+	{ "lookup_batch", api_cidr_lookup_batch },
+	{ NULL,           NULL                  }
+};
 
-	return ret;
+/* the trie nodes live outside the Lua heap */
+static luaL_Reg cidr_meta[] =
+{
+	{ "__gc",  cidr_gc  },
+	{ "__len", cidr_len },
+	{ NULL,    NULL     }
+};
+static int close_stream(lua_State * L)
+{
+	luaL_Stream * p = LSOCK_CHECKFH(L, 1);
+
+#ifdef _WIN32
+	SOCKET s = file_to_sock(p->f);
+
+	return luaL_fileresult(L, (closesocket(s) && 0 == fclose(p->f)), NULL);
+#else
+	return luaL_fileresult(L, (0 == fclose(p->f)), NULL);
+#endif
 }
 
-static int api_getnameinfo(lua_State * L)
+/* based directly on: newprefile() & newfile() from Lua 5.2 sources */
+static luaL_Stream * newfile(lua_State * L)
+{
+	luaL_Stream * p = (luaL_Stream *) LSOCK_NEWUDATA(L, sizeof(luaL_Stream));
+
+	luaL_setmetatable(L, LUA_FILEHANDLE);
+
+	p->f      = NULL;
+	p->closef = &close_stream;
+
+	return p;
+}
+
+/* closes a handle on the stack the way file:close() would */
+static void close_handle(lua_State * L, int idx)
+{
+	luaL_Stream * p = LSOCK_CHECKFH(L, idx);
+
+	if (NULL == p->closef)
+		return;
+
+#ifdef _WIN32
+	closesocket(file_to_sock(L, p->f));
+#endif
+	fclose(p->f);
+
+	p->closef = NULL; /* how liolib marks a handle closed */
+}
+
+
+static int api_htons(lua_State * L)
+{
+	lua_Number n = luaL_checknumber(L, 1);
+	uint16_t   s = (uint16_t) n;
+
+	if (s != n) /* type promotion back to lua_Number */
+	{
+		lua_pushnil(L);
+		lua_pushfstring(L, "number cannot be represented as [network] short (%s)", s > n ? "underflow" : "overflow");
+		return 2;
+	}
+
+	s = htons(s);
+
+	lua_pushlstring(L, (char *) &s, sizeof(uint16_t));
+
+	return 1;
+}
+
+static int api_ntohs(lua_State * L)
+{
+	uint16_t     h = 0;
+	size_t       l = 0;
+	const char * s = luaL_checklstring(L, 1, &l);
+
+	if (sizeof(uint16_t) != l) /* obviously 2 bytes... */
+	{
+		lua_pushnil(L);
+		lua_pushliteral(L, "string length must be sizeof(uint16_t) (2 bytes)");
+		return 2;
+	}
+
+	h = ntohs(*((uint16_t *) s));
+
+	lua_pushnumber(L, h);
+
+	return 1;
+}
+
+static int api_htonl(lua_State * L)
+{
+	lua_Number n = luaL_checknumber(L, 1);
+	uint32_t   l = (uint32_t) n;
+
+	if (l != n) /* type promotion back to lua_Number */
+	{
+		lua_pushnil(L);
+		lua_pushfstring(L, "number cannot be represented as [network] long (%s)", l > n ? "underflow" : "overflow");
+		return 2;
+	}
+
+	l = htonl(l);
+
+	lua_pushlstring(L, (char *) &l, sizeof(uint32_t));
+
+	return 1;
+}
+
+static int api_ntohl(lua_State * L)
+{
+	uint32_t     h = 0;
+	size_t       l = 0;
+	const char * s = luaL_checklstring(L, 1, &l);
+
+	if (sizeof(uint32_t) != l) /* 4 bytes */
+	{
+		lua_pushnil(L);
+		lua_pushliteral(L, "string length must be sizeof(uint32_t) (4 bytes)");
+		return 2;
+	}
+
+	h = ntohl(*((uint32_t *) s));
+
+	lua_pushnumber(L, h);
+
+	return 1;
+}
+
+/* precompiled setsockopt() batches from sockopt_profile(), see below; accept() and
+** accept_until() take one to configure new connections before handing them out */
+
+#define LSOCK_PROFILE "lsock.sockopt_profile"
+
+typedef union
+{
+	int           i;
+	struct linger l;
+#ifndef _WIN32
+	struct timeval t;
+	char           name[IFNAMSIZ]; /* interface names and TCP_CONGESTION's (TCP_CA_NAME_MAX, also 16) */
+#endif
+#ifdef __linux
+	uint64_t       u64;
+#endif
+} sockopt_value;
+
+typedef struct
+{
+	int       level;
+	int       option;
+	socklen_t len;
+
+	sockopt_value value;
+} profile_entry;
+
+typedef struct
+{
+	int           n;
+	profile_entry entries[1]; /* really n of them */
+} sockopt_profile;
+
+/* 0 when every option took, otherwise the (1-based) entry that failed, errno intact */
+static int profile_apply(const sockopt_profile * p, lsocket s)
+{
+	int i;
+
+	for (i = 0; i < p->n; i++)
+	{
+		const profile_entry * e = &p->entries[i];
+
+		if (setsockopt(s, e->level, e->option, (const char *) &e->value, e->len))
+			return i + 1;
+	}
+
+	return 0;
+}
+
+/* applies the optional profile at idx to the handle on top of the stack, closing it on failure */
+static int profile_accepted(lua_State * L, int idx, const char * fname)
+{
+	int err;
+
+	if (lua_isnoneornil(L, idx))
+		return 0;
+
+	if (!profile_apply((sockopt_profile *) luaL_checkudata(L, idx, LSOCK_PROFILE), LSOCK_CHECKSOCK(L, -1)))
+		return 0;
+
+	err = NET_ERRNO;
+	close_handle(L, -1);
+
+	return lsock_error(L, err, (char * (*)(int)) &strerror, (char *) fname);
+}
+
+/* accept(serv[, profile]) -> sock, addr; the sockopt_profile, if any, is applied first */
+static int api_accept(lua_State * L)
+{
+	luaL_Stream * fh;
+	lsocket       new_sock;
+	lsockaddr     info;
+
+	lsocket       serv = LSOCK_CHECKSOCK(L, 1);
+	socklen_t     sz   = sizeof(lsockaddr);
+
+	lua_settop(L, 2); /* the new socket is pushed above the (maybe absent) profile */
+
+	ZERO_OUT(&info, sizeof(info));
+
+	new_sock = accept(serv, (struct sockaddr *) &info, &sz);
+
+	if (INVALID_SOCKET == new_sock)
+		return LSOCK_STRERROR(L, NULL);
+
+	fh = newfile(L);
+	fh->f = sock_to_file(L, new_sock, NULL);
+
+	if (profile_accepted(L, 2, "accept()"))
+		return 3;
+
+	lua_pushlstring(L, (char *) &info, sz);
+
+	return 2;
+}
+
+static int api_listen(lua_State * L)
+{
+	lsocket serv = LSOCK_CHECKSOCK(L, 1);
+	int  backlog = luaL_optinteger(L, 2, 0);
+
+	/* a backlog of zero hints the implementation
+	** to set the ideal connect queue size */
+	if (listen(serv, backlog))
+		return LSOCK_STRERROR(L, NULL);
+
+	lua_pushboolean(L, 1);
+
+	return 1;
+}
+
+static int api_bind(lua_State * L)
+{
+	size_t       sz   = 0;
+	lsocket      serv = LSOCK_CHECKSOCK(L, 1);
+	const char * addr = luaL_checklstring(L, 2, &sz);
+
+	if (bind(serv, (struct sockaddr *) addr, sz))
+		return LSOCK_STRERROR(L, NULL);
+
+	lua_pushboolean(L, 1);
+
+	return 1;
+}
+
+static int api_connect(lua_State * L)
+{
+	size_t       sz     = 0;
+	lsocket      client = LSOCK_CHECKSOCK(L, 1);
+	const char * addr   = luaL_checklstring(L, 2, &sz);
+
+	if (connect(client, (struct sockaddr *) addr, sz))
+		return LSOCK_STRERROR(L, NULL);
+
+	lua_pushboolean(L, 1);
+
+	return 1;
+}
+
+static int api_getsockname(lua_State * L)
+{
+	lsockaddr addr;
+
+	lsocket    s = LSOCK_CHECKSOCK(L, 1);
+	socklen_t sz = sizeof(addr);
+
+	ZERO_OUT(&addr, sizeof(addr));
+
+	if (getsockname(s, (struct sockaddr *) &addr, &sz))
+		return LSOCK_STRERROR(L, NULL);
+
+	lua_pushlstring(L, (char *) &addr, sz);
+
+	return 1;
+}
+
+static int api_getpeername(lua_State * L)
+{
+	lsockaddr addr;
+
+	lsocket    s = LSOCK_CHECKSOCK(L, 1);
+	socklen_t sz = sizeof(addr);
+
+	ZERO_OUT(&addr, sizeof(addr));
+
+	if (getpeername(s, (struct sockaddr *) &addr, &sz))
+		return LSOCK_STRERROR(L, NULL);
+
+	lua_pushlstring(L, (char *) &addr, sz);
+
+	return 1;
+}
+
+#ifdef __linux
+/* whether the handshake carried data in the SYN and the peer accepted it;
+** only settled once the connection is established */
+static int syn_carried_data(lsocket s)
+{
+	struct tcp_info info;
+	socklen_t       sz = sizeof(info);
+
+	ZERO_OUT(&info, sizeof(info));
+
+	if (getsockopt(s, IPPROTO_TCP, TCP_INFO, &info, &sz))
+		return -1;
+
+	return 0 != (info.tcpi_options & TCPI_OPT_SYN_DATA);
+}
+#endif
+
+#ifdef __linux
+
+/* syn_data(sock) -> whether TCP Fast Open got data through in the SYN, from
+** either end; pair with TCP_FASTOPEN_CONNECT to check a connect() + send() */
+static int api_syn_data(lua_State * L)
+{
+	int carried = syn_carried_data(LSOCK_CHECKSOCK(L, 1));
+
+	if (-1 == carried)
+		return LSOCK_STRERROR(L, "getsockopt(TCP_INFO)");
+
+	lua_pushboolean(L, carried);
+
+	return 1;
+}
+
+#endif
+
+/* per-socket token buckets: rate_limit() hangs one on a socket and from then on
+** send(), sendto() and sendfile() only let through what it holds, answering
+** nil, msg, EAGAIN, ns to wait when it's dry.  Buckets live in a weak-keyed
+** registry table, so they go away with their socket */
+
+#define LSOCK_RATELIMITS "lsock.ratelimits"
+
+typedef struct
+{
+	double rate;   /* bytes per second */
+	double burst;  /* the most it holds */
+	double tokens; /* bytes it would let through right now; negative after an oversized datagram */
+	double last;   /* monotonic ns of the last refill */
+
+	int stream; /* byte streams can be cut short, datagrams go whole or not at all */
+	int paced;  /* the kernel paces it too (SO_MAX_PACING_RATE) */
+
+	lua_Number sent, throttled;
+} token_bucket;
+
+/* the bucket on the socket at idx, or NULL */
+static token_bucket * rate_limit_of(lua_State * L, int idx)
+{
+	token_bucket * b = NULL;
+
+	idx = lua_absindex(L, idx);
+
+	lua_getfield(L, LUA_REGISTRYINDEX, LSOCK_RATELIMITS);
+
+	if (lua_istable(L, -1))
+	{
+		lua_pushvalue(L, idx);
+		lua_rawget(L, -2);
+		b = (token_bucket *) lua_touserdata(L, -1); /* the table keeps it alive */
+		lua_pop(L, 1);
+	}
+
+	lua_pop(L, 1);
+
+	return b;
+}
+
+static void bucket_refill(token_bucket * b)
+{
+	double now = monotonic_ns();
+
+	b->tokens = MIN(b->burst, b->tokens + (now - b->last) * b->rate / 1e9);
+	b->last   = now;
+}
+
+/* how long until want bytes may go; a datagram over the burst size needs a full bucket */
+static double bucket_wait(const token_bucket * b, size_t want)
+{
+	double need = b->stream ? MIN(want, 1) : MIN(want, b->burst);
+
+	return b->tokens >= need ? 0 : ceil((need - b->tokens) / b->rate * 1e9);
+}
+
+/* 1 and how many of want bytes may go now, or 0 and how many ns until some may */
+static int bucket_take(token_bucket * b, size_t want, size_t * allowed, double * retry_ns)
+{
+	bucket_refill(b);
+
+	*retry_ns = bucket_wait(b, want);
+
+	if (*retry_ns > 0)
+	{
+		b->throttled++;
+		return 0;
+	}
+
+	*allowed = b->stream ? (size_t) MIN(want, b->tokens) : want;
+
+	return 1;
+}
+
+static void bucket_charge(token_bucket * b, size_t sent)
+{
+	b->tokens -= sent;
+	b->sent   += sent;
+}
+
+static int rate_limited(lua_State * L, const char * fname, double retry_ns)
+{
+	lua_pushnil(L);
+
+	if (NULL == fname)
+		lua_pushliteral(L, "rate limited");
+	else
+		lua_pushfstring(L, "%s: rate limited", fname);
+
+	lua_pushinteger(L, EAGAIN);
+	lua_pushnumber(L, retry_ns);
+
+	return 4;
+}
+
+/* SO_MAX_PACING_RATE; the kernel spaces out TCP segments (and fq-scheduled packets) itself */
+static int pace_socket(lsocket s, double rate)
+{
+#ifdef SO_MAX_PACING_RATE
+	uint64_t r = rate > 0 ? (uint64_t) rate : ~(uint64_t) 0;
+
+	return 0 == setsockopt(s, SOL_SOCKET, SO_MAX_PACING_RATE, &r, sizeof(r));
+#else
+	(void) s;
+	(void) rate;
+
+	return 0;
+#endif
+}
+
+/* rate_limit(sock, bytes_per_sec[, burst = bytes_per_sec / 10[, pace = true]]) -> true, kernel pacing on
+** rate_limit(sock, nil) takes it off again.  pace also sets SO_MAX_PACING_RATE where there is one */
+static int api_rate_limit(lua_State * L)
+{
+	token_bucket * b;
+	int            type = 0;
+	socklen_t      sz   = sizeof(type);
+
+	lsocket    s     = LSOCK_CHECKSOCK(L, 1);
+	lua_Number rate  = luaL_optnumber(L, 2, 0);
+	lua_Number burst = luaL_optnumber(L, 3, MAX(rate / 10, 1));
+	int        pace  = lua_isnoneornil(L, 4) || lua_toboolean(L, 4);
+
+	luaL_argcheck(L, rate >= 0, 2, "rate can't be negative");
+	luaL_argcheck(L, burst >= 1, 3, "burst must hold at least a byte");
+
+	b = rate_limit_of(L, 1);
+
+	lua_getfield(L, LUA_REGISTRYINDEX, LSOCK_RATELIMITS);
+
+	if (lua_isnil(L, -1))
+	{
+		lua_pop(L, 1);
+
+		/* sockets shouldn't stay open for their buckets' sake */
+		lua_newtable(L);
+		lua_createtable(L, 0, 1);
+		PUSHFIELD(L, -1, literal, "__mode", "k");
+		lua_setmetatable(L, -2);
+
+		lua_pushvalue(L, -1);
+		lua_setfield(L, LUA_REGISTRYINDEX, LSOCK_RATELIMITS);
+	}
+
+	if (0 == rate)
+	{
+		if (NULL != b && b->paced)
+			pace_socket(s, 0);
+
+		lua_pushvalue(L, 1);
+		lua_pushnil(L);
+		lua_rawset(L, -3);
+
+		lua_pushboolean(L, 1);
+		lua_pushboolean(L, 0);
+		return 2;
+	}
+
+	if (getsockopt(s, SOL_SOCKET, SO_TYPE, (char *) &type, &sz))
+		return LSOCK_STRERROR(L, "rate_limit()");
+
+	if (NULL == b)
+	{
+		b = (token_bucket *) LSOCK_NEWUDATA(L, sizeof(token_bucket));
+
+		lua_pushvalue(L, 1);
+		lua_pushvalue(L, -2);
+		lua_rawset(L, -4);
+
+		/* starts full */
+		b->tokens = burst;
+	}
+	else if (b->paced && !pace)
+		pace_socket(s, 0);
+
+	b->rate   = rate;
+	b->burst  = burst;
+	b->tokens = MIN(b->tokens, burst);
+	b->last   = monotonic_ns();
+	b->stream = SOCK_STREAM == type;
+	b->paced  = pace && pace_socket(s, rate);
+
+	lua_pushboolean(L, 1);
+	lua_pushboolean(L, b->paced);
+
+	return 2;
+}
+
+/* rate_limit_wait(sock[, bytes = 1]) -> ns until the bucket lets that much through, 0 for now or no bucket
+** made for timer_add() (in seconds, so / 1e9) or select()'s timeout */
+static int api_rate_limit_wait(lua_State * L)
+{
+	token_bucket * b;
+
+	LSOCK_CHECKSOCK(L, 1);
+
+	b = rate_limit_of(L, 1);
+
+	if (NULL == b)
+	{
+		lua_pushnumber(L, 0);
+		return 1;
+	}
+
+	bucket_refill(b);
+
+	lua_pushnumber(L, bucket_wait(b, (size_t) luaL_optnumber(L, 2, 1)));
+
+	return 1;
+}
+
+/* rate_limit_stats(sock) -> { rate =, burst =, tokens =, sent =, throttled =, paced = }, or nil without a bucket */
+static int api_rate_limit_stats(lua_State * L)
+{
+	token_bucket * b;
+
+	LSOCK_CHECKSOCK(L, 1);
+
+	b = rate_limit_of(L, 1);
+
+	if (NULL == b)
+	{
+		lua_pushnil(L);
+		return 1;
+	}
+
+	bucket_refill(b);
+
+	lua_createtable(L, 0, 6);
+	PUSHFIELD(L, -1, number,  "rate",      b->rate);
+	PUSHFIELD(L, -1, number,  "burst",     b->burst);
+	PUSHFIELD(L, -1, number,  "tokens",    b->tokens);
+	PUSHFIELD(L, -1, number,  "sent",      b->sent);
+	PUSHFIELD(L, -1, number,  "throttled", b->throttled);
+	PUSHFIELD(L, -1, boolean, "paced",     b->paced);
+
+	return 1;
+}
+
+/* with MSG_FASTOPEN (Linux) this connects too, and also returns whether the data rode in the SYN */
+static int api_sendto(lua_State * L)
+{
+	ssize_t sent;
+
+	int flags;
+
+	token_bucket * bucket;
+	double         retry_ns;
+
+	size_t data_len = 0;
+	const char * data = NULL;
+
+	size_t sa_len;
+	const char * sa;
+
+	lsocket s = LSOCK_CHECKSOCK(L, 1);
+	strij(L, 2, &data, &data_len);
+	flags = luaL_checkint(L, 3);
+
+	sa = luaL_optlstring(L, 4, "", &sa_len);
+
+	bucket = rate_limit_of(L, 1);
+
+	if (NULL != bucket && !bucket_take(bucket, data_len, &data_len, &retry_ns))
+		return rate_limited(L, NULL, retry_ns);
+
+	/* no address at all for connected sockets, an empty one upsets UDP */
+	sent = sendto(s, data, data_len, flags, sa_len ? (struct sockaddr *) sa : NULL, sa_len);
+
+	if (sent < 0)
+		return LSOCK_STRERROR(L, NULL);
+
+	if (NULL != bucket)
+		bucket_charge(bucket, sent);
+
+	lua_pushnumber(L, sent);
+
+#ifdef __linux
+	if (flags & MSG_FASTOPEN)
+	{
+		lua_pushboolean(L, 1 == syn_carried_data(s));
+		return 2;
+	}
+#endif
+
+	return 1;
+}
+
+static int api_send(lua_State * L)
+{
+	int n = lua_gettop(L);
+
+	/* the sock is already associated with a sockaddr (connect())
+	** arg-shave-off anything after arg 3 to avoid confusing sendto() */
+	if (n > 3)
+		lua_pop(L, n - 3);
+
+	return api_sendto(L);
+}
+
+static int api_recvfrom(lua_State * L)
+{
+	ssize_t gotten;
+
+	lsockaddr from;
+	socklen_t from_len = sizeof(from);
+
+	char * buf;
+	luaL_Buffer B;
+
+	lsocket s      = LSOCK_CHECKSOCK(L, 1);
+	size_t  buflen = luaL_checkint  (L, 2);
+	int     flags  = luaL_checkint  (L, 3);
+	int     intern = !lua_isnoneornil(L, 4);
+
+	if (intern)
+		luaL_checkudata(L, 4, LSOCK_ADDRCACHE);
+
+	ZERO_OUT(&from, sizeof(from));
+
+	buf = luaL_buffinitsize(L, &B, buflen);
+
+	ZERO_OUT(buf, buflen); /* a must! */
+
+	gotten = recvfrom(s, buf, buflen, flags, (struct sockaddr *) &from, &from_len);
+
+	if (gotten < 0)
+		return LSOCK_STRERROR(L, NULL);
+
+	luaL_pushresultsize(&B, gotten);
+
+	/* connected sockets don't report a source */
+	if (0 == from_len)
+		return 1;
+
+	lua_pushlstring(L, (char *) &from, from_len);
+
+	if (!intern)
+		return 2;
+
+	/* the same table for every datagram from this peer */
+	addrcache_intern(L, 4, (char *) &from, from_len);
+
+	return 3; /* success! */
+}
+
+static int api_recv(lua_State * L)
+{
+	int n = lua_gettop(L);
+
+	/* the sock is already associated with a sockaddr (connect())
+	** arg-shave-off anything after arg 3 to avoid confusing recvfrom() */
+	if (n > 3)
+		lua_pop(L, n - 3);
+
+	return api_recvfrom(L);
+}
+
+static int api_shutdown(lua_State * L)
+{
+	lsocket sock = LSOCK_CHECKSOCK(L, 1);
+	int     how  = luaL_checkint  (L, 2);
+
+	if (shutdown(sock, how))
+		return LSOCK_STRERROR(L, NULL);
+
+	lua_pushboolean(L, 1);
+
+	return 1;
+}
+
+static int api_socket(lua_State * L)
+{
+	luaL_Stream * stream;
+
+	int domain   = luaL_checkint(L, 1),
+		type     = luaL_checkint(L, 2),
+		protocol = luaL_optint  (L, 3, 0);
+
+	lsocket new_sock = socket(domain, type, protocol);
+
+	if (INVALID_SOCKET == new_sock)
+		return LSOCK_STRERROR(L, NULL);
+
+	stream    = newfile(L);
+	stream->f = sock_to_file(L, new_sock, NULL);
+
+	return 1;
+}
+
+static int api_should_block(lua_State * L)
+{
+	lsocket s = LSOCK_CHECKSOCK(L, 1);
+	int     b = lua_isnone(L, 2) ? 1 : lua_toboolean(L, 2);
+
+#ifdef _WIN32
+	if (SOCKET_ERROR == ioctlsocket(s, FIONBIO, (u_long *) &b))
+		return LSOCK_STRERROR(L, "ioctlsocket()");
+#else
+	int flags = fcntl(s, F_GETFL);
+
+	if (-1 == flags)
+		return LSOCK_STRERROR(L, "fcntl(F_GETFL)");
+
+	if (b)
+		flags |= O_NONBLOCK;
+	else
+		flags &= ~O_NONBLOCK;
+
+	/* could be redundant (O_NONBLOCK might already be set) */
+	flags = fcntl(s, F_SETFL, flags);
+
+	if (-1 == flags)
+		return LSOCK_STRERROR(L, "fcntl(F_SETFL)");
+
+	flags = b ? 1 : 0;
+
+	flags = ioctl(s, FIONBIO, &flags);
+
+	if (-1 == flags)
+		return LSOCK_STRERROR(L, "ioctl()");
+#endif
+
+	lua_pushboolean(L, 1); /* success, not the passed/read blocking state */
+
+	return 1;
+}
+
+static int set_nonblocking(lsocket s, int on)
+{
+#ifdef _WIN32
+	u_long b = on;
+
+	return SOCKET_ERROR == ioctlsocket(s, FIONBIO, &b) ? -1 : 0;
+#else
+	int flags = fcntl(s, F_GETFL);
+
+	if (-1 == flags)
+		return -1;
+
+	return fcntl(s, F_SETFL, on ? flags | O_NONBLOCK : flags & ~O_NONBLOCK);
+#endif
+}
+
+static int close_socket(lsocket s)
+{
+#ifdef _WIN32
+	return closesocket(s);
+#else
+	return close(s);
+#endif
+}
+
+static int connect_in_progress(int err)
+{
+#ifdef _WIN32
+	return WSAEWOULDBLOCK == err || WSAEINPROGRESS == err;
+#else
+	return EINPROGRESS == err || EWOULDBLOCK == err || EAGAIN == err;
+#endif
+}
+
+/* Happy Eyeballs (RFC 8305): addresses alternate between families, and a new attempt
+** starts whenever the last one fails or has gone `delay' seconds without finishing */
+
+#define CONNECT_ANY_MAX 64
+
+/* connect_any(getaddrinfo_results [, { delay = 0.25, timeout = seconds }]) -> socket, packed sockaddr */
+static int api_connect_any(lua_State * L)
+{
+	int i, n, a = 0, b = 0;
+	int first_family = AF_UNSPEC;
+	int live = 0, next = 0, err = 0, won = -1;
+
+	int          order[CONNECT_ANY_MAX];
+	int          family[CONNECT_ANY_MAX], socktype[CONNECT_ANY_MAX], protocol[CONNECT_ANY_MAX];
+	const char * addr[CONNECT_ANY_MAX];
+	size_t       addr_len[CONNECT_ANY_MAX];
+	lsocket      attempt[CONNECT_ANY_MAX];
+	int          attempt_of[CONNECT_ANY_MAX]; /* which address each live attempt is for */
+	int          ready[CONNECT_ANY_MAX];      /* live attempts the last wait reported on */
+
+	double delay    = 0.25;
+	double deadline = 0;
+	double start_at = 0;
+
+	luaL_Stream * fh;
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	if (!lua_isnoneornil(L, 2))
+	{
+		luaL_checktype(L, 2, LUA_TTABLE);
+
+		lua_getfield(L, 2, "delay");
+		delay = luaL_optnumber(L, -1, delay);
+		lua_getfield(L, 2, "timeout");
+		deadline = luaL_optnumber(L, -1, 0);
+		lua_pop(L, 2);
+	}
+
+	if (deadline > 0)
+		deadline += monotonic_seconds();
+
+	n = MIN(luaL_len(L, 1), CONNECT_ANY_MAX);
+
+	for (i = 0; i < n; i++)
+	{
+		lua_rawgeti(L, 1, i + 1);
+		luaL_argcheck(L, lua_istable(L, -1), 1, "getaddrinfo() result entries expected");
+
+		lua_getfield(L, -1, "ai_family");
+		lua_getfield(L, -2, "ai_socktype");
+		lua_getfield(L, -3, "ai_protocol");
+		lua_getfield(L, -4, "ai_addr");
+
+		family[i]   = lua_tointeger(L, -4);
+		socktype[i] = lua_isnil(L, -3) ? SOCK_STREAM : (int) lua_tointeger(L, -3);
+		protocol[i] = lua_tointeger(L, -2);
+		addr[i]     = lua_tolstring(L, -1, &addr_len[i]); /* anchored by the results table */
+
+		luaL_argcheck(L, NULL != addr[i], 1, "entry without ai_addr");
+
+		lua_pop(L, 5);
+	}
+
+	/* interleave: the first entry's family leads, the others fill in between */
+	if (n > 0)
+		first_family = family[0];
+
+	for (i = 0; i < n; i++)
+	{
+		while (a < n && family[a] != first_family) a++;
+		while (b < n && family[b] == first_family) b++;
+
+		if (a < n && (i % 2 == 0 || b >= n))
+			order[i] = a++;
+		else
+			order[i] = b++;
+	}
+
+	for (;;)
+	{
+		double now = monotonic_seconds();
+		double wait_until = deadline;
+		int ms = -1;
+		int stat;
+
+		if (next < n && (0 == live || now >= start_at))
+		{
+			int     k = order[next++];
+			lsocket s = socket(family[k], socktype[k], protocol[k]);
+
+			if (INVALID_SOCKET == s)
+			{
+				err = NET_ERRNO;
+				continue;
+			}
+
+			if (set_nonblocking(s, 1))
+			{
+				err = NET_ERRNO;
+				close_socket(s);
+				continue;
+			}
+
+			if (0 == connect(s, (struct sockaddr *) addr[k], addr_len[k]))
+			{
+				attempt[live]    = s;
+				attempt_of[live] = k;
+				won = live++;
+				break;
+			}
+
+			if (!connect_in_progress(NET_ERRNO))
+			{
+				err = NET_ERRNO;
+				close_socket(s);
+				continue; /* straight on to the next address */
+			}
+
+			attempt[live]    = s;
+			attempt_of[live] = k;
+			live++;
+
+			start_at = now + delay;
+		}
+
+		if (0 == live)
+			break; /* nothing left to try */
+
+		if (next < n && (0 == wait_until || start_at < wait_until))
+			wait_until = start_at;
+
+		if (0 != wait_until)
+			ms = (int) MIN(ceil(MAX(0, wait_until - now) * 1e3), 0x7fffffff); /* round up so we don't spin */
+
+#ifdef _WIN32
+		{
+			/* Winsock's fd_set is a counted array, CONNECT_ANY_MAX sockets fit */
+			fd_set wset, eset;
+			struct timeval tv;
+
+			FD_ZERO(&wset);
+			FD_ZERO(&eset);
+
+			for (i = 0; i < live; i++)
+			{
+				FD_SET(attempt[i], &wset);
+				FD_SET(attempt[i], &eset);
+			}
+
+			tv.tv_sec  = ms / 1000;
+			tv.tv_usec = (ms % 1000) * 1000;
+
+			stat = select(0, NULL, &wset, &eset, -1 == ms ? NULL : &tv);
+
+			for (i = 0; i < live; i++)
+				ready[i] = FD_ISSET(attempt[i], &wset) || FD_ISSET(attempt[i], &eset);
+		}
+#else
+		{
+			/* poll() has no FD_SETSIZE ceiling */
+			struct pollfd p[CONNECT_ANY_MAX];
+
+			for (i = 0; i < live; i++)
+			{
+				p[i].fd      = attempt[i];
+				p[i].events  = POLLOUT;
+				p[i].revents = 0;
+			}
+
+			stat = poll(p, live, ms);
+
+			for (i = 0; i < live; i++)
+				ready[i] = 0 != p[i].revents;
+		}
+#endif
+
+		if (-1 == stat)
+		{
+			if (EINTR == NET_ERRNO)
+				continue;
+
+			err = NET_ERRNO;
+			break;
+		}
+
+		for (i = 0; i < live && -1 == won; i++)
+		{
+			int       so_err = 0;
+			socklen_t sz     = sizeof(so_err);
+
+			if (!ready[i])
+				continue;
+
+			if (getsockopt(attempt[i], SOL_SOCKET, SO_ERROR, (char *) &so_err, &sz))
+				so_err = NET_ERRNO;
+
+			if (0 == so_err)
+			{
+				won = i;
+				break;
+			}
+
+			/* this one lost on its own; its slot goes to the last live attempt */
+			err = so_err;
+			close_socket(attempt[i]);
+
+			attempt[i]    = attempt[--live];
+			attempt_of[i] = attempt_of[live];
+			ready[i]      = ready[live];
+			i--;
+
+			start_at = 0; /* the next address needn't wait out the delay */
+		}
+
+		if (-1 != won)
+			break;
+
+		if (0 != deadline && monotonic_seconds() >= deadline)
+		{
+			err = ETIMEDOUT;
+			break;
+		}
+	}
+
+	for (i = 0; i < live; i++)
+		if (i != won)
+			close_socket(attempt[i]);
+
+	/* no error at all means there was nothing to try */
+	if (-1 == won)
+		return lsock_error(L, 0 == err ? EINVAL : err, (char * (*)(int)) &strerror, "connect_any()");
+
+	if (set_nonblocking(attempt[won], 0))
+	{
+		err = NET_ERRNO;
+		close_socket(attempt[won]);
+		return lsock_error(L, err, (char * (*)(int)) &strerror, "connect_any()");
+	}
+
+	fh = newfile(L);
+	fh->f = sock_to_file(L, attempt[won], NULL);
+
+	lua_pushlstring(L, addr[attempt_of[won]], addr_len[attempt_of[won]]);
+
+	return 2;
+}
+
+/* deadline-bound I/O: the *_until() calls take an absolute monotonic_ns() deadline
+** (nil waits forever), try the operation without blocking, and wait in C in between.
+** Running out of time gives nil, "...: timed out", ETIMEDOUT. */
+
+enum { WAIT_READ, WAIT_WRITE };
+
+/* 1 when ready, 0 past the deadline, -1 on error */
+static int wait_ready(lsocket s, int how, double deadline)
+{
+	for (;;)
+	{
+		int stat;
+		int ms = -1;
+
+		if (deadline > 0)
+		{
+			double left = deadline - monotonic_ns();
+
+			if (left <= 0)
+				return 0;
+
+			ms = (int) MIN((left + 999999) / 1e6, 0x7fffffff); /* round up so we don't spin */
+		}
+
+#ifdef _WIN32
+		{
+			fd_set set;
+			struct timeval tv;
+
+			FD_ZERO(&set);
+			FD_SET(s, &set);
+
+			tv.tv_sec  = ms / 1000;
+			tv.tv_usec = (ms % 1000) * 1000;
+
+			stat = select(0, WAIT_READ == how ? &set : NULL, WAIT_WRITE == how ? &set : NULL, NULL, -1 == ms ? NULL : &tv);
+		}
+#else
+		{
+			/* poll() has no FD_SETSIZE ceiling */
+			struct pollfd p;
+
+			p.fd      = s;
+			p.events  = WAIT_READ == how ? POLLIN : POLLOUT;
+			p.revents = 0;
+
+			stat = poll(&p, 1, ms);
+		}
+#endif
+
+		if (stat > 0)
+			return 1;
+
+		if (-1 == stat && EINTR != NET_ERRNO)
+			return -1;
+	}
+}
+
+static int would_block(int err)
+{
+#ifdef _WIN32
+	return WSAEWOULDBLOCK == err;
+#else
+	return EAGAIN == err || EWOULDBLOCK == err;
+#endif
+}
+
+static int timed_out(lua_State * L, const char * fname)
+{
+	return lsock_error(L, ETIMEDOUT, (char * (*)(int)) &strerror, (char *) fname);
+}
+
+/* the deadline argument: nil or an absolute monotonic_ns() value */
+static double check_deadline(lua_State * L, int idx)
+{
+	return lua_isnoneornil(L, idx) ? 0 : luaL_checknumber(L, idx);
+}
+
+/* runs with the socket nonblocking, putting it back the way it was */
+static int nonblocking_begin(lsocket s, int * was_blocking)
+{
+#ifdef _WIN32
+	*was_blocking = 1; /* Windows can't tell us; assume the default */
+
+	return set_nonblocking(s, 1);
+#else
+	int flags = fcntl(s, F_GETFL);
+
+	if (-1 == flags)
+		return -1;
+
+	*was_blocking = !(flags & O_NONBLOCK);
+
+	return *was_blocking ? fcntl(s, F_SETFL, flags | O_NONBLOCK) : 0;
+#endif
+}
+
+static void nonblocking_end(lsocket s, int was_blocking)
+{
+	if (was_blocking)
+		set_nonblocking(s, 0);
+}
+
+/* connect_until(sock, addr, deadline) -> true */
+static int api_connect_until(lua_State * L)
+{
+	int err = 0, was_blocking = 0, ready;
+
+	size_t       sz       = 0;
+	lsocket      client   = LSOCK_CHECKSOCK(L, 1);
+	const char * addr     = luaL_checklstring(L, 2, &sz);
+	double       deadline = check_deadline(L, 3);
+
+	if (nonblocking_begin(client, &was_blocking))
+		return LSOCK_STRERROR(L, "connect_until()");
+
+	if (0 == connect(client, (struct sockaddr *) addr, sz))
+	{
+		nonblocking_end(client, was_blocking);
+		lua_pushboolean(L, 1);
+		return 1;
+	}
+
+	err = NET_ERRNO;
+
+	if (!connect_in_progress(err))
+	{
+		nonblocking_end(client, was_blocking);
+		return lsock_error(L, err, (char * (*)(int)) &strerror, "connect_until()");
+	}
+
+	ready = wait_ready(client, WAIT_WRITE, deadline);
+
+	if (1 == ready)
+	{
+		socklen_t es = sizeof(err);
+
+		if (getsockopt(client, SOL_SOCKET, SO_ERROR, (char *) &err, &es))
+			err = NET_ERRNO;
+	}
+	else
+		err = 0 == ready ? ETIMEDOUT : NET_ERRNO;
+
+	nonblocking_end(client, was_blocking);
+
+	/* a timed-out socket is still mid-handshake; close it rather than reuse it */
+	if (0 != err)
+		return lsock_error(L, err, (char * (*)(int)) &strerror, "connect_until()");
+
+	lua_pushboolean(L, 1);
+
+	return 1;
+}
+
+/* accept_until(sock, deadline[, profile]) -> socket, packed sockaddr */
+static int api_accept_until(lua_State * L)
+{
+	int err = 0, was_blocking = 0;
+
+	luaL_Stream * fh;
+	lsocket       new_sock;
+	lsockaddr     info;
+
+	lsocket   serv     = LSOCK_CHECKSOCK(L, 1);
+	double    deadline = check_deadline(L, 2);
+	socklen_t sz       = sizeof(lsockaddr);
+
+	lua_settop(L, 3); /* the new socket is pushed above the (maybe absent) profile */
+
+	ZERO_OUT(&info, sizeof(info));
+
+	if (nonblocking_begin(serv, &was_blocking))
+		return LSOCK_STRERROR(L, "accept_until()");
+
+	for (;;)
+	{
+		int ready;
+
+		new_sock = accept(serv, (struct sockaddr *) &info, &sz);
+
+		if (INVALID_SOCKET != new_sock)
+			break;
+
+		err = NET_ERRNO;
+
+		if (!would_block(err) && ECONNABORTED != err && EINTR != err)
+			break;
+
+		err   = 0;
+		ready = wait_ready(serv, WAIT_READ, deadline);
+
+		if (1 != ready)
+		{
+			err = 0 == ready ? ETIMEDOUT : NET_ERRNO;
+			break;
+		}
+	}
+
+	nonblocking_end(serv, was_blocking);
+
+	if (INVALID_SOCKET == new_sock)
+		return lsock_error(L, err, (char * (*)(int)) &strerror, "accept_until()");
+
+	/* the new socket may inherit O_NONBLOCK on some platforms; hand it back blocking like accept() */
+	if (was_blocking)
+		set_nonblocking(new_sock, 0);
+
+	fh = newfile(L);
+	fh->f = sock_to_file(L, new_sock, NULL);
+
+	if (profile_accepted(L, 3, "accept_until()"))
+		return 3;
+
+	lua_pushlstring(L, (char *) &info, sz);
+
+	return 2;
+}
+
+#ifdef MSG_DONTWAIT
+#	define UNTIL_FLAGS MSG_DONTWAIT
+#else
+#	define UNTIL_FLAGS 0
+#endif
+
+/* send_until(sock, data, flags, deadline) -> bytes sent, all of them
+** on timeout: nil, msg, ETIMEDOUT, bytes that did go out */
+static int api_send_until(lua_State * L)
+{
+	int was_blocking = 0;
+
+	size_t       data_len = 0;
+	size_t       done     = 0;
+	const char * data     = NULL;
+
+	lsocket s        = LSOCK_CHECKSOCK(L, 1);
+	int     flags;
+	double  deadline;
+
+	strij(L, 2, &data, &data_len);
+	flags    = luaL_optint(L, 3, 0);
+	deadline = check_deadline(L, 4);
+
+#ifndef MSG_DONTWAIT
+	if (nonblocking_begin(s, &was_blocking))
+		return LSOCK_STRERROR(L, "send_until()");
+#endif
+
+	while (done < data_len)
+	{
+		int     ready;
+		ssize_t sent = send(s, data + done, data_len - done, flags | UNTIL_FLAGS);
+
+		if (sent >= 0)
+		{
+			done += sent;
+			continue;
+		}
+
+		if (!would_block(NET_ERRNO) && EINTR != NET_ERRNO)
+		{
+			int err = NET_ERRNO;
+
+			nonblocking_end(s, was_blocking);
+			return lsock_error(L, err, (char * (*)(int)) &strerror, "send_until()");
+		}
+
+		ready = wait_ready(s, WAIT_WRITE, deadline);
+
+		if (1 != ready)
+		{
+			int ret = 0 == ready ? timed_out(L, "send_until()") : LSOCK_STRERROR(L, "send_until()");
+
+			nonblocking_end(s, was_blocking);
+			lua_pushnumber(L, done);
+			return ret + 1;
+		}
+	}
+
+	nonblocking_end(s, was_blocking);
+
+	lua_pushnumber(L, done);
+
+	return 1;
+}
+
+/* recv_until(sock, buflen, flags, deadline) -> data, as soon as there is any */
+static int api_recv_until(lua_State * L)
+{
+	int was_blocking = 0;
+
+	char * buf;
+	luaL_Buffer B;
+
+	lsocket s        = LSOCK_CHECKSOCK(L, 1);
+	size_t  buflen   = luaL_checkint  (L, 2);
+	int     flags    = luaL_optint    (L, 3, 0);
+	double  deadline = check_deadline(L, 4);
+
+#ifndef MSG_DONTWAIT
+	if (nonblocking_begin(s, &was_blocking))
+		return LSOCK_STRERROR(L, "recv_until()");
+#endif
+
+	buf = luaL_buffinitsize(L, &B, buflen);
+
+	for (;;)
+	{
+		int     ready;
+		ssize_t gotten = recv(s, buf, buflen, flags | UNTIL_FLAGS);
+
+		if (gotten >= 0)
+		{
+			nonblocking_end(s, was_blocking);
+			luaL_pushresultsize(&B, gotten);
+			return 1;
+		}
+
+		if (!would_block(NET_ERRNO) && EINTR != NET_ERRNO)
+			break;
+
+		ready = wait_ready(s, WAIT_READ, deadline);
+
+		if (0 == ready)
+		{
+			nonblocking_end(s, was_blocking);
+			return timed_out(L, "recv_until()");
+		}
+
+		if (-1 == ready)
+			break;
+	}
+
+	{
+		int err = NET_ERRNO;
+
+		nonblocking_end(s, was_blocking);
+		return lsock_error(L, err, (char * (*)(int)) &strerror, "recv_until()");
+	}
+}
+
+#ifndef _WIN32
+
+#ifdef __linux
+/* steers each new connection to listener (receiving cpu % n), so with one
+** listener per worker pinned to its cpu the handshake never crosses cores */
+static int attach_cpu_steering(lsocket s, int n)
+{
+	struct sock_filter code[] =
+	{
+		{ BPF_LD  | BPF_W   | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+		{ BPF_ALU | BPF_MOD | BPF_K,   0, 0, 0                       },
+		{ BPF_RET | BPF_A,             0, 0, 0                       }
+	};
+
+	struct sock_fprog prog;
+
+	code[1].k = n;
+
+	prog.len    = sizeof(code) / sizeof(code[0]);
+	prog.filter = code;
+
+	return setsockopt(s, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+}
+#endif
+
+/* reuseport_group(addr, n[, { type = SOCK_STREAM, protocol = 0, backlog = SOMAXCONN, steer = true }])
+** -> { n sockets bound to addr with SO_REUSEPORT, listening if connection-oriented }
+** with steer (Linux-only) socket i gets the connections the kernel received on cpu (i - 1) % n */
+static int api_reuseport_group(lua_State * L)
+{
+	int i, type, protocol, backlog, steer;
+
+	size_t       sz   = 0;
+	const char * addr = luaL_checklstring(L, 1, &sz);
+	int          n    = luaL_checkint(L, 2);
+
+	luaL_argcheck(L, sz >= MEMBER_SIZE(struct sockaddr, sa_family), 1, "not a packed sockaddr");
+	luaL_argcheck(L, n > 0, 2, "need at least one listener");
+
+	lua_settop(L, 3);
+
+	if (lua_isnil(L, 3))
+	{
+		lua_newtable(L);
+		lua_replace(L, 3);
+	}
+	else
+		luaL_checktype(L, 3, LUA_TTABLE);
+
+	lua_getfield(L, 3, "type");
+	lua_getfield(L, 3, "protocol");
+	lua_getfield(L, 3, "backlog");
+	lua_getfield(L, 3, "steer");
+
+	type     = luaL_optint(L, -4, SOCK_STREAM);
+	protocol = luaL_optint(L, -3, 0);
+	backlog  = luaL_optint(L, -2, SOMAXCONN);
+	steer    = lua_isnil(L, -1) || lua_toboolean(L, -1);
+
+	lua_pop(L, 4);
+
+	lua_createtable(L, n, 0);
+
+	for (i = 1; i <= n; i++)
+	{
+		luaL_Stream * stream;
+
+		int     on = 1;
+		lsocket s  = socket(((struct sockaddr *) addr)->sa_family, type, protocol);
+
+		if (INVALID_SOCKET == s)
+			goto fail;
+
+		/* the stream owns it from here, unwinding closes it */
+		stream    = newfile(L);
+		stream->f = sock_to_file(L, s, NULL);
+		lua_rawseti(L, -2, i);
+
+		if
+		(
+			setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) ||
+			bind(s, (struct sockaddr *) addr, sz)                    ||
+			((SOCK_STREAM == type || SOCK_SEQPACKET == type) && listen(s, backlog))
+		)
+			goto fail;
+	}
+
+#ifdef __linux
+	/* the program belongs to the group, any member can install it */
+	lua_rawgeti(L, -1, 1);
+
+	if (steer && n > 1 && attach_cpu_steering(LSOCK_CHECKSOCK(L, -1), n))
+		goto fail;
+
+	lua_pop(L, 1);
+#else
+	(void) steer;
+#endif
+
+	return 1;
+
+fail:
+	{
+		int err = NET_ERRNO;
+
+		/* close what we made rather than leave half a group bound */
+		lua_settop(L, 4);
+
+		for (i = 1; i <= n; i++)
+		{
+			lua_rawgeti(L, 4, i);
+
+			if (!lua_isnil(L, -1))
+				close_handle(L, -1);
+
+			lua_pop(L, 1);
+		}
+
+		return lsock_error(L, err, (char * (*)(int)) &strerror, "reuseport_group()");
+	}
+}
+
+#ifdef __linux
+
+/* classic BPF socket filters: the kernel runs them on each packet before queueing it,
+** so whatever they reject never wakes us.  On UDP and TCP sockets offset 0 is the
+** transport header; SKF_NET_OFF + n reaches back into the IP one */
+
+enum { ASM_LOAD, ASM_LOADX, ASM_STORE, ASM_ALU, ASM_NEG, ASM_JA, ASM_JCOND, ASM_RET, ASM_MISC };
+
+typedef struct
+{
+	const char   * name;
+	unsigned short code;
+	int            kind;
+	int            invert; /* jne, jlt, jle: the opposite test, branches swapped */
+} bpf_mnemonic;
+
+/* sorted by name for bsearch() */
+static const bpf_mnemonic bpf_mnemonics[] =
+{
+	{ "add",  BPF_ALU  | BPF_ADD,  ASM_ALU,   0 },
+	{ "and",  BPF_ALU  | BPF_AND,  ASM_ALU,   0 },
+	{ "div",  BPF_ALU  | BPF_DIV,  ASM_ALU,   0 },
+	{ "ja",   BPF_JMP  | BPF_JA,   ASM_JA,    0 },
+	{ "jeq",  BPF_JMP  | BPF_JEQ,  ASM_JCOND, 0 },
+	{ "jge",  BPF_JMP  | BPF_JGE,  ASM_JCOND, 0 },
+	{ "jgt",  BPF_JMP  | BPF_JGT,  ASM_JCOND, 0 },
+	{ "jle",  BPF_JMP  | BPF_JGT,  ASM_JCOND, 1 },
+	{ "jlt",  BPF_JMP  | BPF_JGE,  ASM_JCOND, 1 },
+	{ "jmp",  BPF_JMP  | BPF_JA,   ASM_JA,    0 },
+	{ "jne",  BPF_JMP  | BPF_JEQ,  ASM_JCOND, 1 },
+	{ "jset", BPF_JMP  | BPF_JSET, ASM_JCOND, 0 },
+	{ "ld",   BPF_LD   | BPF_W,    ASM_LOAD,  0 },
+	{ "ldb",  BPF_LD   | BPF_B,    ASM_LOAD,  0 },
+	{ "ldh",  BPF_LD   | BPF_H,    ASM_LOAD,  0 },
+	{ "ldx",  BPF_LDX  | BPF_W,    ASM_LOADX, 0 },
+	{ "ldxb", BPF_LDX  | BPF_B,    ASM_LOADX, 0 },
+	{ "lsh",  BPF_ALU  | BPF_LSH,  ASM_ALU,   0 },
+	{ "mod",  BPF_ALU  | BPF_MOD,  ASM_ALU,   0 },
+	{ "mul",  BPF_ALU  | BPF_MUL,  ASM_ALU,   0 },
+	{ "neg",  BPF_ALU  | BPF_NEG,  ASM_NEG,   0 },
+	{ "or",   BPF_ALU  | BPF_OR,   ASM_ALU,   0 },
+	{ "ret",  BPF_RET,             ASM_RET,   0 },
+	{ "rsh",  BPF_ALU  | BPF_RSH,  ASM_ALU,   0 },
+	{ "st",   BPF_ST,              ASM_STORE, 0 },
+	{ "stx",  BPF_STX,             ASM_STORE, 0 },
+	{ "sub",  BPF_ALU  | BPF_SUB,  ASM_ALU,   0 },
+	{ "tax",  BPF_MISC | BPF_TAX,  ASM_MISC,  0 },
+	{ "txa",  BPF_MISC | BPF_TXA,  ASM_MISC,  0 },
+	{ "xor",  BPF_ALU  | BPF_XOR,  ASM_ALU,   0 }
+};
+
+static int bpf_mnemonic_cmp(const void * key, const void * m)
+{
+	return strcmp((const char *) key, ((const bpf_mnemonic *) m)->name);
+}
+
+/* the whole of s, in any base strtol() knows */
+static int bpf_number(const char * s, long * n)
+{
+	char * end = NULL;
+
+	if ('\0' == *s)
+		return 0;
+
+	*n = strtol(s, &end, 0);
+
+	return '\0' == *end;
+}
+
+/* pre, a number, post -- and nothing else */
+static int bpf_wrapped(const char * op, const char * pre, const char * post, long * k)
+{
+	char   num[32];
+	size_t l  = strlen(op);
+	size_t lp = strlen(pre);
+	size_t ls = strlen(post);
+
+	if (l <= lp + ls || l - lp - ls >= sizeof(num) || 0 != strncmp(op, pre, lp) || 0 != strcmp(op + l - ls, post))
+		return 0;
+
+	memcpy(num, op + lp, l - lp - ls);
+	num[l - lp - ls] = '\0';
+
+	return bpf_number(num, k);
+}
+
+/* "#k" or the register named reg */
+static int bpf_k_or(const char * op, const char * reg, int regbit, struct sock_filter * f)
+{
+	long k;
+
+	if (0 == strcmp(op, reg))
+		f->code |= regbit;
+	else if (bpf_wrapped(op, "#", "", &k))
+		f->k = (unsigned int) k;
+	else
+		return 0;
+
+	return 1;
+}
+
+/* "len", "#k", "M[k]", "[x+k]", "[k]", "4*([k]&0xf)"; NULL when it fits the load */
+static const char * bpf_operand(const bpf_mnemonic * m, const char * op, struct sock_filter * f)
+{
+	int  mode, ok = 0;
+	long k    = 0;
+	int  word = BPF_W == BPF_SIZE(m->code);
+
+	if (0 == strcmp(op, "len") || 0 == strcmp(op, "#len"))
+		mode = BPF_LEN;
+	else if (bpf_wrapped(op, "#", "", &k))
+		mode = BPF_IMM;
+	else if (bpf_wrapped(op, "M[", "]", &k))
+		mode = BPF_MEM;
+	else if (bpf_wrapped(op, "[x+", "]", &k))
+		mode = BPF_IND;
+	else if (bpf_wrapped(op, "[", "]", &k))
+		mode = BPF_ABS;
+	else if (bpf_wrapped(op, "4*([", "]&0xf)", &k))
+		mode = BPF_MSH;
+	else
+		return "unknown operand";
+
+	/* which addressing modes each load takes */
+	switch (mode)
+	{
+		case BPF_LEN:
+		case BPF_IMM: ok = word;                                    break;
+		case BPF_MEM: ok = word && k >= 0 && k < BPF_MEMWORDS;      break;
+		case BPF_IND:
+		case BPF_ABS: ok = ASM_LOAD == m->kind;                     break;
+		case BPF_MSH: ok = ASM_LOADX == m->kind && !word;           break;
+	}
+
+	if (!ok)
+		return "operand doesn't fit the instruction";
+
+	f->code |= mode;
+	f->k     = (unsigned int) k;
+
+	return NULL;
+}
+
+/* a jump target: a label, or a number of instructions to skip */
+static const char * bpf_target(lua_State * L, int labels, const char * name, int pc, int max, unsigned int * off)
+{
+	long n;
+
+	if (!bpf_number(name, &n))
+	{
+		lua_getfield(L, labels, name);
+
+		if (!lua_isnumber(L, -1))
+		{
+			lua_pop(L, 1);
+			return "unknown label";
+		}
+
+		n = lua_tointeger(L, -1) - (pc + 1);
+		lua_pop(L, 1);
+	}
+
+	if (n < 0 || n > max)
+		return "jump out of reach (only forward, 255 at most for conditionals)";
+
+	*off = (unsigned int) n;
+
+	return NULL;
+}
+
+/* one line, comments and label already gone, spaces squeezed out of the operands */
+static const char * bpf_line(lua_State * L, int labels, char * line, int pc, struct sock_filter * f)
+{
+	char * ops[3];
+	char * p;
+	int    i, n = 0;
+
+	const bpf_mnemonic * m;
+	const char         * why = NULL;
+
+	for (p = line; isalpha((unsigned char) *p); p++)
+		*p = tolower((unsigned char) *p);
+
+	if (isspace((unsigned char) *p))
+		*p++ = '\0';
+	else if ('\0' != *p)
+		return "expected a mnemonic";
+
+	m = (const bpf_mnemonic *) bsearch(line, bpf_mnemonics, LENGTH(bpf_mnemonics), sizeof(bpf_mnemonic), bpf_mnemonic_cmp);
+
+	if (NULL == m)
+		return "unknown mnemonic";
+
+	/* operands, comma-separated */
+	while ('\0' != *p && n < (int) LENGTH(ops))
+	{
+		char * w;
+
+		ops[n++] = p;
+
+		for (w = p; '\0' != *p && ',' != *p; p++)
+			if (!isspace((unsigned char) *p))
+				*w++ = *p;
+
+		if (',' == *p)
+			p++;
+
+		*w = '\0';
+	}
+
+	if ('\0' != *p)
+		return "too many operands";
+
+	for (i = 0; i < n; i++)
+		if ('\0' == ops[i][0])
+			return "empty operand";
+
+	ZERO_OUT(f, sizeof(*f));
+	f->code = m->code;
+
+	switch (m->kind)
+	{
+		case ASM_LOAD:
+		case ASM_LOADX:
+			return 1 != n ? "one operand expected" : bpf_operand(m, ops[0], f);
+
+		case ASM_STORE:
+		{
+			long k;
+
+			if (1 != n || !bpf_wrapped(ops[0], "M[", "]", &k) || k < 0 || k >= BPF_MEMWORDS)
+				return "M[k] expected";
+
+			f->k = (unsigned int) k;
+
+			return NULL;
+		}
+
+		case ASM_ALU:
+			if (1 != n)
+				return "one operand expected";
+
+			return bpf_k_or(ops[0], "x", BPF_X, f) ? NULL : "#k or x expected";
+
+		case ASM_NEG:
+		case ASM_MISC:
+			return 0 != n ? "no operands expected" : NULL;
+
+		case ASM_JA:
+			return 1 != n ? "a target expected" : bpf_target(L, labels, ops[0], pc, INT_MAX, &f->k);
+
+		case ASM_JCOND:
+		{
+			unsigned int t = 0, e = 0;
+
+			if (n < 2)
+				return "a value and at least one target expected";
+
+			if (!bpf_k_or(ops[0], "x", BPF_X, f))
+				return "#k or x expected";
+
+			if (NULL != (why = bpf_target(L, labels, ops[1], pc, 255, &t)))
+				return why;
+
+			if (3 == n && NULL != (why = bpf_target(L, labels, ops[2], pc, 255, &e)))
+				return why;
+
+			f->jt = m->invert ? e : t;
+			f->jf = m->invert ? t : e;
+
+			return NULL;
+		}
+
+		case ASM_RET:
+			if (1 != n)
+				return "one operand expected";
+
+			return bpf_k_or(ops[0], "a", BPF_A, f) ? NULL : "#k or a expected";
+	}
+
+	return "unknown mnemonic";
+}
+
+/* splits off the next line of text into buf: its label (or NULL) and its instruction, minus comment and outer spaces */
+static const char * bpf_next_line(const char ** text, char * buf, size_t bufsz, char ** label, char ** insn)
+{
+	char       * b, * e;
+	const char * s   = *text;
+	const char * eol = strchr(s, '\n');
+	size_t       l   = NULL == eol ? strlen(s) : (size_t) (eol - s);
+
+	*text  = NULL == eol ? s + l : eol + 1;
+	*label = NULL;
+	*insn  = buf;
+
+	if (l >= bufsz)
+		return "line too long";
+
+	memcpy(buf, s, l);
+	buf[l] = '\0';
+
+	if (NULL != (e = strchr(buf, ';')))
+		*e = '\0';
+
+	for (b = buf; isspace((unsigned char) *b); b++);
+
+	for (e = b + strlen(b); e > b && isspace((unsigned char) e[-1]); e--);
+
+	*e = '\0';
+
+	/* "name:" up front */
+	for (e = b; isalnum((unsigned char) *e) || '_' == *e; e++);
+
+	if (e > b && ':' == *e)
+	{
+		*e     = '\0';
+		*label = b;
+
+		for (b = e + 1; isspace((unsigned char) *b); b++);
+	}
+
+	*insn = b;
+
+	return NULL;
+}
+
+/* pushes the packed sock_filter array for the program at idx (assembly text, or
+** { { code, jt, jf, k }, ... }) and returns 1, or pushes nil, why, line and returns 3 */
+static int bpf_compile(lua_State * L, int idx, const char * fname)
+{
+	int                i, pc, line, labels;
+	char               buf[256];
+	char             * label, * insn;
+	const char       * text, * why = NULL;
+	struct sock_filter f;
+	luaL_Buffer        B;
+
+	idx = lua_absindex(L, idx);
+
+	if (lua_istable(L, idx))
+	{
+		int n = lua_rawlen(L, idx);
+
+		luaL_argcheck(L, n > 0 && n <= BPF_MAXINSNS, idx, "1 to BPF_MAXINSNS instructions");
+
+		luaL_buffinit(L, &B);
+
+		for (i = 1; i <= n; i++)
+		{
+			lua_rawgeti(L, idx, i);
+
+			if (!lua_istable(L, -1))
+				return luaL_error(L, "%s: instruction %d is not a { code, jt, jf, k } table", fname, i);
+
+			lua_rawgeti(L, -1, 1);
+			lua_rawgeti(L, -2, 2);
+			lua_rawgeti(L, -3, 3);
+			lua_rawgeti(L, -4, 4);
+
+			f.code = lua_tointeger(L, -4);
+			f.jt   = lua_tointeger(L, -3);
+			f.jf   = lua_tointeger(L, -2);
+			f.k    = (unsigned int) lua_tointeger(L, -1);
+
+			lua_pop(L, 5);
+
+			luaL_addlstring(&B, (char *) &f, sizeof(f));
+		}
+
+		luaL_pushresult(&B);
+
+		return 1;
+	}
+
+	text = luaL_checkstring(L, idx);
+
+	/* first pass: where the labels are */
+	lua_newtable(L);
+	labels = lua_gettop(L);
+
+	for (pc = 0, line = 1; '\0' != *text; line++)
+	{
+		if (NULL != (why = bpf_next_line(&text, buf, sizeof(buf), &label, &insn)))
+			goto fail;
+
+		if (NULL != label)
+		{
+			lua_pushinteger(L, pc);
+			lua_setfield(L, labels, label);
+		}
+
+		if ('\0' != *insn)
+			pc++;
+	}
+
+	if (0 == pc || pc > BPF_MAXINSNS)
+	{
+		why = 0 == pc ? "empty program" : "too many instructions";
+		goto fail;
+	}
+
+	/* second pass: the code */
+	text = lua_tostring(L, idx);
+
+	luaL_buffinit(L, &B);
+
+	for (pc = 0, line = 1; '\0' != *text; line++)
+	{
+		bpf_next_line(&text, buf, sizeof(buf), &label, &insn);
+
+		if ('\0' == *insn)
+			continue;
+
+		if (NULL != (why = bpf_line(L, labels, insn, pc++, &f)))
+			goto fail;
+
+		luaL_addlstring(&B, (char *) &f, sizeof(f));
+	}
+
+	luaL_pushresult(&B);
+	lua_remove(L, labels);
+
+	return 1;
+
+fail:
+	lua_pushnil(L);
+	lua_pushfstring(L, "%s: %s at line %d", fname, why, line);
+	lua_pushinteger(L, line);
+
+	return 3;
+}
+
+/* bpf_assemble(text) -> { { code, jt, jf, k }, ... } for attach_filter(), or nil, why, line
+** one instruction per line, ';' comments, "label:" prefixes, jumps by label or count:
+**     ldh [2]             ; UDP destination port
+**     jne #53, drop
+**     ret #65535
+** drop:
+**     ret #0 */
+static int api_bpf_assemble(lua_State * L)
+{
+	int    i, n;
+	size_t sz;
+	const struct sock_filter * code;
+
+	luaL_checktype(L, 1, LUA_TSTRING);
+
+	if (1 != bpf_compile(L, 1, "bpf_assemble()"))
+		return 3;
+
+	code = (const struct sock_filter *) lua_tolstring(L, -1, &sz);
+	n    = sz / sizeof(struct sock_filter);
+
+	lua_createtable(L, n, 0);
+
+	for (i = 0; i < n; i++)
+	{
+		lua_createtable(L, 4, 0);
+		lua_pushinteger(L, code[i].code); lua_rawseti(L, -2, 1);
+		lua_pushinteger(L, code[i].jt);   lua_rawseti(L, -2, 2);
+		lua_pushinteger(L, code[i].jf);   lua_rawseti(L, -2, 3);
+		lua_pushnumber (L, code[i].k);    lua_rawseti(L, -2, 4);
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	return 1;
+}
+
+/* attach_filter(sock, program) -> true, or nil, why[, line]
+** program is assembly text (see bpf_assemble()) or its { { code, jt, jf, k }, ... } output;
+** it returns how many bytes of each packet to keep, 0 drops it */
+static int api_attach_filter(lua_State * L)
+{
+	size_t sz;
+	struct sock_fprog prog;
+
+	lsocket s = LSOCK_CHECKSOCK(L, 1);
+
+	if (1 != bpf_compile(L, 2, "attach_filter()"))
+		return 3;
+
+	prog.filter = (struct sock_filter *) lua_tolstring(L, -1, &sz);
+	prog.len    = sz / sizeof(struct sock_filter);
+
+	if (setsockopt(s, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)))
+		return LSOCK_STRERROR(L, "setsockopt(SO_ATTACH_FILTER)");
+
+	lua_pushboolean(L, 1);
+
+	return 1;
+}
+
+static int api_detach_filter(lua_State * L)
+{
+	int     dummy = 0;
+	lsocket s     = LSOCK_CHECKSOCK(L, 1);
+
+	if (setsockopt(s, SOL_SOCKET, SO_DETACH_FILTER, &dummy, sizeof(dummy)))
+		return LSOCK_STRERROR(L, "setsockopt(SO_DETACH_FILTER)");
+
+	lua_pushboolean(L, 1);
+
+	return 1;
+}
+
+/* lock_filter(sock): no attaching, detaching or replacing from here on, not even by root */
+static int api_lock_filter(lua_State * L)
+{
+	int     on = 1;
+	lsocket s  = LSOCK_CHECKSOCK(L, 1);
+
+	if (setsockopt(s, SOL_SOCKET, SO_LOCK_FILTER, &on, sizeof(on)))
+		return LSOCK_STRERROR(L, "setsockopt(SO_LOCK_FILTER)");
+
+	lua_pushboolean(L, 1);
+
+	return 1;
+}
+
+#endif
+
+#endif
+
+/* keyed pool of idle outbound connections: pool_checkout() hands back a live
+** connection to the same peer when it has one, pool_checkin() parks it again */
+
+#define LSOCK_POOL "lsock.pool"
+
+/* uservalue slots: peer -> { sock, idle since, sock, idle since, ... } and sock -> created (weak) */
+enum { POOL_IDLE = 1, POOL_BORN };
+
+typedef struct
+{
+	double max_idle; /* seconds, 0 for no limit */
+	double max_age;
+	int    max_per_key;
+	int    idle;
+
+	lua_Number hits, misses, evictions;
+} conn_pool;
+
+/* a parked connection should have nothing to read: readable means the peer
+** hung up or sent something nobody asked for, either way it's no good to us */
+static int peer_alive(lsocket s)
+{
+	int readable;
+
+#ifdef _WIN32
+	fd_set set;
+	struct timeval tv = { 0, 0 };
+
+	FD_ZERO(&set);
+	FD_SET(s, &set);
+
+	readable = select(0, &set, NULL, NULL, &tv);
+#else
+	struct pollfd p;
+
+	p.fd      = s;
+	p.events  = POLLIN;
+	p.revents = 0;
+
+	readable = poll(&p, 1, 0);
+#endif
+
+	return 0 == readable;
+}
+
+/* whether the idle connection on top of the stack can go back out */
+static int pool_usable(lua_State * L, conn_pool * p, int born, double since, double now)
+{
+	double created;
+
+	/* closed behind our back */
+	if (NULL == LSOCK_CHECKFH(L, -1)->closef)
+		return 0;
+
+	if (p->max_idle > 0 && now - since >= p->max_idle)
+		return 0;
+
+	lua_pushvalue(L, -1);
+	lua_rawget(L, born);
+	created = lua_tonumber(L, -1);
+	lua_pop(L, 1);
+
+	if (p->max_age > 0 && now - created >= p->max_age)
+		return 0;
+
+	return peer_alive(LSOCK_CHECKSOCK(L, -1));
+}
+
+/* pool([{ max_idle = 60, max_per_key = 8, max_age = 0 }]) -- 0 means no limit */
+static int api_pool(lua_State * L)
+{
+	conn_pool * p;
+
+	lua_settop(L, 1);
+
+	if (!lua_isnil(L, 1))
+		luaL_checktype(L, 1, LUA_TTABLE);
+
+	p = (conn_pool *) LSOCK_NEWUDATA(L, sizeof(conn_pool));
+
+	p->max_idle    = 60;
+	p->max_per_key = 8;
+
+	if (!lua_isnil(L, 1))
+	{
+		lua_getfield(L, 1, "max_idle");
+		p->max_idle = luaL_optnumber(L, -1, p->max_idle);
+		lua_getfield(L, 1, "max_per_key");
+		p->max_per_key = luaL_optint(L, -1, p->max_per_key);
+		lua_getfield(L, 1, "max_age");
+		p->max_age = luaL_optnumber(L, -1, p->max_age);
+		lua_pop(L, 3);
+	}
+
+	luaL_argcheck(L, p->max_per_key >= 0, 1, "max_per_key must not be negative");
+
+	luaL_setmetatable(L, LSOCK_POOL);
+
+	lua_createtable(L, 2, 0);
+
+	lua_newtable(L);
+	lua_rawseti(L, -2, POOL_IDLE);
+
+	/* creation times shouldn't keep sockets alive */
+	lua_newtable(L);
+	lua_createtable(L, 0, 1);
+	PUSHFIELD(L, -1, literal, "__mode", "k");
+	lua_setmetatable(L, -2);
+	lua_rawseti(L, -2, POOL_BORN);
+
+	lua_setuservalue(L, -2);
+
+	return 1;
+}
+
+/* pool_checkout(pool, addr[, dial = true]) -> sock, reused
+** without dial a miss returns nil instead of connecting */
+static int api_pool_checkout(lua_State * L)
+{
+	lsocket       s;
+	luaL_Stream * stream;
+
+	size_t       sz   = 0;
+	conn_pool *  p    = (conn_pool *) luaL_checkudata(L, 1, LSOCK_POOL);
+	const char * addr = luaL_checklstring(L, 2, &sz);
+	int          dial = lua_isnoneornil(L, 3) || lua_toboolean(L, 3);
+	double       now  = monotonic_seconds();
+
+	luaL_argcheck(L, sz >= MEMBER_SIZE(struct sockaddr, sa_family), 2, "not a packed sockaddr");
+
+	lua_settop(L, 2);
+	lua_getuservalue(L, 1);       /* 3 */
+	lua_rawgeti(L, 3, POOL_IDLE); /* 4 */
+	lua_rawgeti(L, 3, POOL_BORN); /* 5 */
+	lua_pushvalue(L, 2);
+	lua_rawget(L, 4);             /* 6 */
+
+	if (!lua_isnil(L, 6))
+	{
+		int n = lua_rawlen(L, 6);
+
+		/* most recently parked first, it's the least likely to have gone stale */
+		while (n > 0)
+		{
+			double since;
+
+			lua_rawgeti(L, 6, n);
+			since = lua_tonumber(L, -1);
+			lua_pop(L, 1);
+
+			lua_rawgeti(L, 6, n - 1);
+
+			lua_pushnil(L);
+			lua_rawseti(L, 6, n);
+			lua_pushnil(L);
+			lua_rawseti(L, 6, n - 1);
+
+			n -= 2;
+			p->idle--;
+
+			if (pool_usable(L, p, 5, since, now))
+			{
+				p->hits++;
+				lua_pushboolean(L, 1);
+				return 2;
+			}
+
+			close_handle(L, -1);
+			lua_pop(L, 1);
+			p->evictions++;
+		}
+	}
+
+	p->misses++;
+
+	if (!dial)
+	{
+		lua_pushnil(L);
+		return 1;
+	}
+
+	s = socket(((struct sockaddr *) addr)->sa_family, SOCK_STREAM, 0);
+
+	if (INVALID_SOCKET == s)
+		return LSOCK_STRERROR(L, "socket()");
+
+	stream    = newfile(L);
+	stream->f = sock_to_file(L, s, NULL);
+
+	if (connect(s, (struct sockaddr *) addr, sz))
+	{
+		int err = NET_ERRNO;
+
+		close_handle(L, -1);
+
+		return lsock_error(L, err, (char * (*)(int)) &strerror, "connect()");
+	}
+
+	lua_pushvalue(L, -1);
+	lua_pushnumber(L, now);
+	lua_rawset(L, 5);
+
+	lua_pushboolean(L, 0);
+
+	return 2;
+}
+
+/* pool_checkin(pool, sock) -> whether it was kept; otherwise it gets closed */
+static int api_pool_checkin(lua_State * L)
+{
+	lsockaddr addr;
+	socklen_t sz = sizeof(addr);
+	int       n;
+
+	conn_pool * p   = (conn_pool *) luaL_checkudata(L, 1, LSOCK_POOL);
+	double      now = monotonic_seconds();
+
+	lua_settop(L, 2);
+
+	if (NULL == LSOCK_CHECKFH(L, 2)->closef)
+	{
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+
+	lua_getuservalue(L, 1);       /* 3 */
+	lua_rawgeti(L, 3, POOL_IDLE); /* 4 */
+	lua_rawgeti(L, 3, POOL_BORN); /* 5 */
+
+	/* a connection we didn't make starts its clock now */
+	lua_pushvalue(L, 2);
+	lua_rawget(L, 5);
+
+	if (lua_isnil(L, -1))
+	{
+		lua_pushvalue(L, 2);
+		lua_pushnumber(L, now);
+		lua_rawset(L, 5);
+	}
+
+	lua_pop(L, 1);
+
+	ZERO_OUT(&addr, sizeof(addr));
+
+	/* only connected sockets are worth keeping */
+	if (getpeername(LSOCK_CHECKSOCK(L, 2), (struct sockaddr *) &addr, &sz))
+		goto evict;
+
+	lua_pushlstring(L, (char *) &addr, sz);
+	lua_pushvalue(L, -1);
+	lua_rawget(L, 4); /* 7 */
+
+	if (lua_isnil(L, -1))
+	{
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_pushvalue(L, 6);
+		lua_pushvalue(L, -2);
+		lua_rawset(L, 4);
+	}
+
+	n = lua_rawlen(L, 7);
+
+	if (n / 2 >= p->max_per_key)
+		goto evict;
+
+	lua_pushvalue(L, 2);
+	if (!pool_usable(L, p, 5, now, now))
+		goto evict;
+
+	lua_rawseti(L, 7, n + 1);
+	lua_pushnumber(L, now);
+	lua_rawseti(L, 7, n + 2);
+
+	p->idle++;
+
+	lua_pushboolean(L, 1);
+
+	return 1;
+
+evict:
+	close_handle(L, 2);
+	p->evictions++;
+
+	lua_pushboolean(L, 0);
+
+	return 1;
+}
+
+/* pool_prune(pool) -> # of idle connections closed for age, idleness or a dead peer */
+static int api_pool_prune(lua_State * L)
+{
+	int          evicted = 0;
+	conn_pool *  p       = (conn_pool *) luaL_checkudata(L, 1, LSOCK_POOL);
+	double       now     = monotonic_seconds();
+
+	lua_settop(L, 1);
+	lua_getuservalue(L, 1);       /* 2 */
+	lua_rawgeti(L, 2, POOL_IDLE); /* 3 */
+	lua_rawgeti(L, 2, POOL_BORN); /* 4 */
+
+	lua_pushnil(L);
+
+	while (lua_next(L, 3))
+	{
+		int i, kept = 0, n = lua_rawlen(L, -1);
+
+		/* compact in place, order preserved */
+		for (i = 1; i < n; i += 2)
+		{
+			double since;
+
+			lua_rawgeti(L, -1, i + 1);
+			since = lua_tonumber(L, -1);
+			lua_pop(L, 1);
+
+			lua_rawgeti(L, -1, i);
+
+			if (pool_usable(L, p, 4, since, now))
+			{
+				lua_rawseti(L, -2, ++kept);
+				lua_pushnumber(L, since);
+				lua_rawseti(L, -2, ++kept);
+			}
+			else
+			{
+				close_handle(L, -1);
+				lua_pop(L, 1);
+				evicted++;
+			}
+		}
+
+		for (i = kept + 1; i <= n; i++)
+		{
+			lua_pushnil(L);
+			lua_rawseti(L, -2, i);
+		}
+
+		/* assigning an existing field (even to nil) is fine mid-traversal */
+		if (0 == kept)
+		{
+			lua_pushvalue(L, -2);
+			lua_pushnil(L);
+			lua_rawset(L, 3);
+		}
+
+		lua_pop(L, 1);
+	}
+
+	p->idle      -= evicted;
+	p->evictions += evicted;
+
+	lua_pushinteger(L, evicted);
+
+	return 1;
+}
+
+static int api_pool_stats(lua_State * L)
+{
+	conn_pool * p = (conn_pool *) luaL_checkudata(L, 1, LSOCK_POOL);
+
+	lua_createtable(L, 0, 4);
+
+	PUSHFIELD(L, -1, integer, "idle",      p->idle     );
+	PUSHFIELD(L, -1, number,  "hits",      p->hits     );
+	PUSHFIELD(L, -1, number,  "misses",    p->misses   );
+	PUSHFIELD(L, -1, number,  "evictions", p->evictions);
+
+	return 1;
+}
+
+static int pool_len(lua_State * L)
+{
+	lua_pushinteger(L, ((conn_pool *) luaL_checkudata(L, 1, LSOCK_POOL))->idle);
+
+	return 1;
+}
+
+static luaL_Reg pool_methods[] =
+{
+	{ "checkout", api_pool_checkout },
+	{ "checkin",  api_pool_checkin  },
+	{ "prune",    api_pool_prune    },
+	{ "stats",    api_pool_stats    },
+	{ NULL,       NULL              }
+};
+
+/* the sockets are ordinary file handles, their own __gc closes them */
+static luaL_Reg pool_meta[] =
+{
+	{ "__len", pool_len },
+	{ NULL,    NULL     }
+};
+
+/* you can also use io.close()... */
+static int api_close(lua_State * L)
+{
+	luaL_Stream * p = LSOCK_CHECKFH(L, 1);
+
+	if (NULL == p->closef)
+		return luaL_error(L, "attempt to use a closed file");
+
+	p->closef = NULL; /* how liolib marks a handle closed, otherwise __gc closes it again */
+
+	return close_stream(L);
+}
+
+static int sockopt_boolean(lua_State * L)
+{
+	lsocket s  = LSOCK_CHECKSOCK(L, 1);
+	int level  =   luaL_checkint(L, 2);
+	int option =   luaL_checkint(L, 3);
+	int get    =      lua_isnone(L, 4);
+
+	int value = 0;
+	socklen_t sz = sizeof(value);
+
+	if (get)
+	{
+		if (getsockopt(s, level, option, (char *) &value, &sz))
+			return LSOCK_STRERROR(L, NULL);
+
+		lua_pushboolean(L, value);
+	}
+	else
+	{
+		value = lua_isnumber(L, 4) ? lua_tointeger(L, 4) : lua_toboolean(L, 4);
+
+		if (setsockopt(s, level, option, (char *) &value, sz))
+			return LSOCK_STRERROR(L, NULL);
+	}
+
+	return get;
+}
+
+static int sockopt_integer(lua_State * L)
+{
+	lsocket s  = LSOCK_CHECKSOCK(L, 1);
+	int level  =   luaL_checkint(L, 2);
+	int option =   luaL_checkint(L, 3);
+	int get    =      lua_isnone(L, 4);
+
+	int value = 0;
+	socklen_t sz = sizeof(value);
+
+	if (get)
+	{
+		if (getsockopt(s, level, option, (char *) &value, &sz))
+			return LSOCK_STRERROR(L, NULL);
+
+		lua_pushnumber(L, value);
+	}
+	else
+	{
+		value = luaL_checkint(L, 4);
+
+		if (setsockopt(s, level, option, (char *) &value, sz))
+			return LSOCK_STRERROR(L, NULL);
+	}
+
+	return get;
+}
+
+static int sockopt_linger(lua_State * L)
+{
+	lsocket s  = LSOCK_CHECKSOCK(L, 1);
+	int level  =   luaL_checkint(L, 2);
+	int option =   luaL_checkint(L, 3);
+	int get    =      lua_isnone(L, 4);
+
+	if (get)
+	{
+		struct linger l;
+		socklen_t sz = sizeof(l);
+
+		ZERO_OUT(&l, sz);
+
+		if (getsockopt(s, level, option, (char *) &l, &sz))
+			return LSOCK_STRERROR(L, NULL);
+
+		linger_to_table(L, &l);
+	}
+	else
+	{
+		struct linger * l = NULL;
+		socklen_t sz = 0;
+
+		luaL_checktype(L, 4, LUA_TTABLE);
+
+		l  = table_to_linger(L, 4);
+		sz = lua_rawlen(L, -1);
+
+		if (setsockopt(s, level, option, (char *) l, sz))
+			return LSOCK_STRERROR(L, NULL);
+	}
+
+	return get;
+}
+
+#ifndef _WIN32
+
+/* seconds as a number both ways; the kernel wants a struct timeval */
+static int sockopt_timeval(lua_State * L)
+{
+	lsocket s  = LSOCK_CHECKSOCK(L, 1);
+	int level  =   luaL_checkint(L, 2);
+	int option =   luaL_checkint(L, 3);
+	int get    =      lua_isnone(L, 4);
+
+	struct timeval t;
+	socklen_t sz = sizeof(t);
+
+	ZERO_OUT(&t, sz);
+
+	if (get)
+	{
+		if (getsockopt(s, level, option, (char *) &t, &sz))
+			return LSOCK_STRERROR(L, NULL);
+
+		lua_pushnumber(L, t.tv_sec + t.tv_usec / 1e6);
+	}
+	else
+	{
+		table_to_timeval(L, 4, &t);
+
+		if (setsockopt(s, level, option, (char *) &t, sz))
+			return LSOCK_STRERROR(L, NULL);
+	}
+
+	return get;
+}
+
+static int sockopt_ifnam(lua_State * L)
+{
+	lsocket s  = LSOCK_CHECKSOCK(L, 1);
+	int level  =   luaL_checkint(L, 2);
+	int option =   luaL_checkint(L, 3);
+	int get    =      lua_isnone(L, 4);
+
+	if (get)
+	{
+		char buf[IFNAMSIZ + 1]; /* +1 for safety (this is like ~17 bytes anyway) */
+		socklen_t sz = sizeof(buf);
+
+		ZERO_OUT(buf, sizeof(buf));
+
+		if (getsockopt(s, level, option, buf, &sz))
+			return LSOCK_STRERROR(L, NULL);
+
+		lua_pushlstring(L, buf, sz);
+	}
+	else
+	{
+		socklen_t sz = 0;
+
+		const char * value = luaL_checklstring(L, 4, (size_t *) &sz);
+
+		if (setsockopt(s, level, option, value, sz))
+			return LSOCK_STRERROR(L, NULL);
+	}
+
+	return get;
+}
+
+
+/* an interface by index, by name ('eth0'), or nil for whichever the routing table picks */
+static unsigned int interface_index(lua_State * L, int idx)
+{
+	unsigned int index;
+
+	if (lua_isnoneornil(L, idx))
+		return 0;
+
+	if (lua_isnumber(L, idx))
+		return lua_tointeger(L, idx);
+
+	index = if_nametoindex(luaL_checkstring(L, idx));
+
+	if (0 == index)
+		luaL_error(L, "no such interface: %s", lua_tostring(L, idx));
+
+	return index;
+}
+
+/* IPv4 interfaces go by address, except where Linux also takes an index */
+static void interface_inaddr(lua_State * L, int idx, struct in_addr * addr, unsigned int * index)
+{
+	addr->s_addr = htonl(INADDR_ANY);
+	*index       = 0;
+
+	if (lua_isnoneornil(L, idx))
+		return;
+
+	if (LUA_TSTRING == lua_type(L, idx) && 1 == inet_pton(AF_INET, lua_tostring(L, idx), addr))
+		return;
+
+	*index = interface_index(L, idx);
+}
+
+/* IP_MULTICAST_IF: the outgoing interface's address; Linux also takes a name or index when setting */
+static int sockopt_inaddr(lua_State * L)
+{
+	lsocket s  = LSOCK_CHECKSOCK(L, 1);
+	int level  =   luaL_checkint(L, 2);
+	int option =   luaL_checkint(L, 3);
+	int get    =      lua_isnone(L, 4);
+
+	if (get)
+	{
+		struct in_addr addr;
+		char buf[INET_ADDRSTRLEN];
+		socklen_t sz = sizeof(addr);
+
+		ZERO_OUT(&addr, sz);
+
+		if (getsockopt(s, level, option, (char *) &addr, &sz))
+			return LSOCK_STRERROR(L, NULL);
+
+		if (NULL == inet_ntop(AF_INET, &addr, buf, sizeof(buf)))
+			return LSOCK_STRERROR(L, "inet_ntop()");
+
+		lua_pushstring(L, buf);
+	}
+	else
+	{
+#ifdef __linux
+		struct ip_mreqn m;
+		unsigned int index;
+
+		ZERO_OUT(&m, sizeof(m));
+
+		interface_inaddr(L, 4, &m.imr_address, &index);
+		m.imr_ifindex = index;
+#else
+		struct in_addr m;
+		unsigned int index;
+
+		interface_inaddr(L, 4, &m, &index);
+
+		if (index)
+			return luaL_argerror(L, 4, "interface address expected");
+#endif
+
+		if (setsockopt(s, level, option, (char *) &m, sizeof(m)))
+			return LSOCK_STRERROR(L, NULL);
+	}
+
+	return get;
+}
+
+/* a membership field's address text, family checked */
+static void membership_addr(lua_State * L, int idx, const char * field, int af, lsockaddr * lsa)
+{
+	int          prefix;
+	socklen_t    sz;
+	size_t       l    = 0;
+	const char * text = lua_tolstring(L, idx, &l);
+	const char * why  = NULL == text ? "address expected" : text_to_sockaddr(text, l, lsa, &sz, &prefix);
+
+	if (NULL == why && AF_UNSPEC != af && af != lsa->sa.sa_family)
+		why = AF_INET == af ? "IPv4 address expected" : "IPv6 address expected";
+
+	if (NULL != why)
+		luaL_error(L, "multicast %s: %s", field, why);
+}
+
+/* joining and leaving groups, set-only:
+** setsockopt(s, IPPROTO_IP, IP_ADD_MEMBERSHIP, { group = '239.1.2.3'[, interface = '10.0.0.2' | 'eth0' | index] })
+** the source-specific options also want source = '10.9.8.7'; a bare string is just the group.
+** each membership is one setsockopt(), so a socket can sit in as many groups as
+** net.ipv4.igmp_max_memberships allows -- see IP_MULTICAST_ALL to keep other sockets' groups out */
+static int sockopt_membership(lua_State * L)
+{
+	unsigned int index;
+	socklen_t    sz = 0;
+	lsockaddr    group, source;
+
+	union
+	{
+		struct ip_mreq          mreq;
+		struct ip_mreq_source   mreq_source;
+		struct ipv6_mreq        mreq6;
+#ifdef __linux
+		struct ip_mreqn         mreqn;
+		struct group_req        gr;
+		struct group_source_req gsr;
+#endif
+	} m;
+
+	lsocket s  = LSOCK_CHECKSOCK(L, 1);
+	int level  =   luaL_checkint(L, 2);
+	int option =   luaL_checkint(L, 3);
+
+	if (lua_isnone(L, 4))
+	{
+		lua_pushnil(L);
+		lua_pushliteral(L, "multicast membership options can only be set");
+		return 2;
+	}
+
+	lua_settop(L, 4);
+
+	if (lua_istable(L, 4))
+	{
+		lua_getfield(L, 4, "group");     /* 5 */
+		lua_getfield(L, 4, "source");    /* 6 */
+		lua_getfield(L, 4, "interface"); /* 7 */
+	}
+	else
+	{
+		luaL_checktype(L, 4, LUA_TSTRING);
+		lua_pushvalue(L, 4);
+		lua_pushnil(L);
+		lua_pushnil(L);
+	}
+
+	ZERO_OUT(&m,      sizeof(m));
+	ZERO_OUT(&group,  sizeof(group));
+	ZERO_OUT(&source, sizeof(source));
+
+	if (IPPROTO_IPV6 == level)
+	{
+		if (IPV6_JOIN_GROUP == option || IPV6_LEAVE_GROUP == option)
+		{
+			membership_addr(L, 5, "group", AF_INET6, &group);
+			m.mreq6.ipv6mr_multiaddr = group.in6.sin6_addr;
+			m.mreq6.ipv6mr_interface = interface_index(L, 7);
+			sz = sizeof(m.mreq6);
+		}
+	}
+	else switch (option)
+	{
+		case IP_ADD_MEMBERSHIP:
+		case IP_DROP_MEMBERSHIP:
+			membership_addr(L, 5, "group", AF_INET, &group);
+#ifdef __linux
+			m.mreqn.imr_multiaddr = group.in.sin_addr;
+			interface_inaddr(L, 7, &m.mreqn.imr_address, &index);
+			m.mreqn.imr_ifindex = index;
+			sz = sizeof(m.mreqn);
+#else
+			m.mreq.imr_multiaddr = group.in.sin_addr;
+			interface_inaddr(L, 7, &m.mreq.imr_interface, &index);
+
+			if (index)
+				return luaL_error(L, "multicast interface: address expected");
+
+			sz = sizeof(m.mreq);
+#endif
+			break;
+
+		case IP_ADD_SOURCE_MEMBERSHIP:
+		case IP_DROP_SOURCE_MEMBERSHIP:
+		case IP_BLOCK_SOURCE:
+		case IP_UNBLOCK_SOURCE:
+			membership_addr(L, 5, "group",  AF_INET, &group);
+			membership_addr(L, 6, "source", AF_INET, &source);
+			m.mreq_source.imr_multiaddr  = group.in.sin_addr;
+			m.mreq_source.imr_sourceaddr = source.in.sin_addr;
+			interface_inaddr(L, 7, &m.mreq_source.imr_interface, &index);
+
+			if (index)
+				return luaL_error(L, "multicast interface: address expected");
+
+			sz = sizeof(m.mreq_source);
+			break;
+	}
+
+#ifdef __linux
+	/* the protocol-independent ones, at either level */
+	switch (option)
+	{
+		case MCAST_JOIN_GROUP:
+		case MCAST_LEAVE_GROUP:
+			membership_addr(L, 5, "group", IPPROTO_IPV6 == level ? AF_INET6 : AF_INET, &group);
+			m.gr.gr_interface = interface_index(L, 7);
+			memcpy(&m.gr.gr_group, &group.ss, sizeof(m.gr.gr_group));
+			sz = sizeof(m.gr);
+			break;
+
+		case MCAST_JOIN_SOURCE_GROUP:
+		case MCAST_LEAVE_SOURCE_GROUP:
+		case MCAST_BLOCK_SOURCE:
+		case MCAST_UNBLOCK_SOURCE:
+			membership_addr(L, 5, "group",  IPPROTO_IPV6 == level ? AF_INET6 : AF_INET, &group);
+			membership_addr(L, 6, "source", IPPROTO_IPV6 == level ? AF_INET6 : AF_INET, &source);
+			m.gsr.gsr_interface = interface_index(L, 7);
+			memcpy(&m.gsr.gsr_group,  &group.ss,  sizeof(m.gsr.gsr_group));
+			memcpy(&m.gsr.gsr_source, &source.ss, sizeof(m.gsr.gsr_source));
+			sz = sizeof(m.gsr);
+			break;
+	}
+#endif
+
+	if (setsockopt(s, level, option, (char *) &m, sz))
+		return LSOCK_STRERROR(L, NULL);
+
+	return 0;
+}
+
+#endif
+
+#ifdef __linux
+
+/* NUL-terminated names like TCP_CONGESTION's "cubic" */
+static int sockopt_string(lua_State * L)
+{
+	lsocket s  = LSOCK_CHECKSOCK(L, 1);
+	int level  =   luaL_checkint(L, 2);
+	int option =   luaL_checkint(L, 3);
+	int get    =      lua_isnone(L, 4);
+
+	if (get)
+	{
+		char buf[64];
+		socklen_t sz = sizeof(buf) - 1;
+
+		ZERO_OUT(buf, sizeof(buf));
+
+		if (getsockopt(s, level, option, buf, &sz))
+			return LSOCK_STRERROR(L, NULL);
+
+		lua_pushstring(L, buf);
+	}
+	else
+	{
+		size_t sz = 0;
+
+		const char * value = luaL_checklstring(L, 4, &sz);
+
+		if (setsockopt(s, level, option, value, sz))
+			return LSOCK_STRERROR(L, NULL);
+	}
+
+	return get;
+}
+
+/* 64-bit quantities like SO_MAX_PACING_RATE (bytes/s), which a C int would cap at 2 GB/s */
+static int sockopt_uint64(lua_State * L)
+{
+	lsocket s  = LSOCK_CHECKSOCK(L, 1);
+	int level  =   luaL_checkint(L, 2);
+	int option =   luaL_checkint(L, 3);
+	int get    =      lua_isnone(L, 4);
+
+	uint64_t  value = 0;
+	socklen_t sz    = sizeof(value);
+
+	if (get)
+	{
+		union { uint64_t u64; uint32_t u32; } got;
+
+		got.u64 = 0;
+
+		if (getsockopt(s, level, option, &got, &sz))
+			return LSOCK_STRERROR(L, NULL);
+
+		/* older kernels answer with 32 bits */
+		lua_pushnumber(L, (lua_Number) (sizeof(uint32_t) == sz ? got.u32 : got.u64));
+	}
+	else
+	{
+		lua_Number n = luaL_checknumber(L, 4);
+
+		/* ~0 means unlimited */
+		value = n < 0 ? ~(uint64_t) 0 : (uint64_t) n;
+
+		if (setsockopt(s, level, option, &value, sz))
+			return LSOCK_STRERROR(L, NULL);
+	}
+
+	return get;
+}
+
+#endif
+
+#ifdef __linux
+
+/* the kernel's struct tcp_info; glibc's copy stops at tcpi_total_retrans.
+** Newer kernels only ever append, older ones fill less (the rest reads 0) */
+typedef struct
+{
+	uint8_t state;
+	uint8_t ca_state;
+	uint8_t retransmits;
+	uint8_t probes;
+	uint8_t backoff;
+	uint8_t options;
+	unsigned int snd_wscale : 4, rcv_wscale : 4;
+	unsigned int delivery_rate_app_limited : 1, fastopen_client_fail : 2;
+
+	uint32_t rto;
+	uint32_t ato;
+	uint32_t snd_mss;
+	uint32_t rcv_mss;
+
+	uint32_t unacked;
+	uint32_t sacked;
+	uint32_t lost;
+	uint32_t retrans;
+	uint32_t fackets;
+
+	uint32_t last_data_sent;
+	uint32_t last_ack_sent;
+	uint32_t last_data_recv;
+	uint32_t last_ack_recv;
+
+	uint32_t pmtu;
+	uint32_t rcv_ssthresh;
+	uint32_t rtt;
+	uint32_t rttvar;
+	uint32_t snd_ssthresh;
+	uint32_t snd_cwnd;
+	uint32_t advmss;
+	uint32_t reordering;
+
+	uint32_t rcv_rtt;
+	uint32_t rcv_space;
+
+	uint32_t total_retrans;
+
+	uint64_t pacing_rate;
+	uint64_t max_pacing_rate;
+	uint64_t bytes_acked;
+	uint64_t bytes_received;
+	uint32_t segs_out;
+	uint32_t segs_in;
+
+	uint32_t notsent_bytes;
+	uint32_t min_rtt;
+	uint32_t data_segs_in;
+	uint32_t data_segs_out;
+
+	uint64_t delivery_rate;
+
+	uint64_t busy_time;
+	uint64_t rwnd_limited;
+	uint64_t sndbuf_limited;
+
+	uint32_t delivered;
+	uint32_t delivered_ce;
+
+	uint64_t bytes_sent;
+	uint64_t bytes_retrans;
+	uint32_t dsack_dups;
+	uint32_t reord_seen;
+
+	uint32_t rcv_ooopack;
+
+	uint32_t snd_wnd;
+} lsock_tcp_info;
+
+#define LSOCK_TCPINFO "lsock.tcpinfo"
+
+/* bit-fields have no offsetof(), so they get kinds of their own */
+enum { TCPI_U8, TCPI_U32, TCPI_U64, TCPI_SND_WSCALE, TCPI_RCV_WSCALE, TCPI_APP_LIMITED, TCPI_TFO_FAIL };
+
+typedef struct
+{
+	const char * name;
+	size_t       offset;
+	int          kind;
+} tcp_info_field;
+
+#define TCPI(field, kind) { #field, offsetof(lsock_tcp_info, field), kind }
+#define TCPI_BITS(field, kind) { #field, 0, kind }
+
+/* sorted by name for bsearch() */
+static const tcp_info_field tcp_info_fields[] =
+{
+	TCPI(advmss,                    TCPI_U32),
+	TCPI(ato,                       TCPI_U32),
+	TCPI(backoff,                   TCPI_U8 ),
+	TCPI(busy_time,                 TCPI_U64),
+	TCPI(bytes_acked,               TCPI_U64),
+	TCPI(bytes_received,            TCPI_U64),
+	TCPI(bytes_retrans,             TCPI_U64),
+	TCPI(bytes_sent,                TCPI_U64),
+	TCPI(ca_state,                  TCPI_U8 ),
+	TCPI(data_segs_in,              TCPI_U32),
+	TCPI(data_segs_out,             TCPI_U32),
+	TCPI(delivered,                 TCPI_U32),
+	TCPI(delivered_ce,              TCPI_U32),
+	TCPI(delivery_rate,             TCPI_U64),
+	TCPI_BITS(delivery_rate_app_limited, TCPI_APP_LIMITED),
+	TCPI(dsack_dups,                TCPI_U32),
+	TCPI(fackets,                   TCPI_U32),
+	TCPI_BITS(fastopen_client_fail, TCPI_TFO_FAIL),
+	TCPI(last_ack_recv,             TCPI_U32),
+	TCPI(last_ack_sent,             TCPI_U32),
+	TCPI(last_data_recv,            TCPI_U32),
+	TCPI(last_data_sent,            TCPI_U32),
+	TCPI(lost,                      TCPI_U32),
+	TCPI(max_pacing_rate,           TCPI_U64),
+	TCPI(min_rtt,                   TCPI_U32),
+	TCPI(notsent_bytes,             TCPI_U32),
+	TCPI(options,                   TCPI_U8 ),
+	TCPI(pacing_rate,               TCPI_U64),
+	TCPI(pmtu,                      TCPI_U32),
+	TCPI(probes,                    TCPI_U8 ),
+	TCPI(rcv_mss,                   TCPI_U32),
+	TCPI(rcv_ooopack,               TCPI_U32),
+	TCPI(rcv_rtt,                   TCPI_U32),
+	TCPI(rcv_space,                 TCPI_U32),
+	TCPI(rcv_ssthresh,              TCPI_U32),
+	TCPI_BITS(rcv_wscale,           TCPI_RCV_WSCALE),
+	TCPI(reord_seen,                TCPI_U32),
+	TCPI(reordering,                TCPI_U32),
+	TCPI(retrans,                   TCPI_U32),
+	TCPI(retransmits,               TCPI_U8 ),
+	TCPI(rto,                       TCPI_U32),
+	TCPI(rtt,                       TCPI_U32),
+	TCPI(rttvar,                    TCPI_U32),
+	TCPI(rwnd_limited,              TCPI_U64),
+	TCPI(sacked,                    TCPI_U32),
+	TCPI(segs_in,                   TCPI_U32),
+	TCPI(segs_out,                  TCPI_U32),
+	TCPI(snd_cwnd,                  TCPI_U32),
+	TCPI(snd_mss,                   TCPI_U32),
+	TCPI(snd_ssthresh,              TCPI_U32),
+	TCPI(snd_wnd,                   TCPI_U32),
+	TCPI_BITS(snd_wscale,           TCPI_SND_WSCALE),
+	TCPI(sndbuf_limited,            TCPI_U64),
+	TCPI(state,                     TCPI_U8 ),
+	TCPI(total_retrans,             TCPI_U32),
+	TCPI(unacked,                   TCPI_U32)
+};
+
+#undef TCPI
+#undef TCPI_BITS
+
+static int tcp_info_field_cmp(const void * key, const void * field)
+{
+	return strcmp((const char *) key, ((const tcp_info_field *) field)->name);
+}
+
+static const tcp_info_field * tcp_info_lookup(const char * name)
+{
+	return (const tcp_info_field *) bsearch(name, tcp_info_fields, LENGTH(tcp_info_fields), sizeof(tcp_info_field), tcp_info_field_cmp);
+}
+
+static lua_Number tcp_info_value(const lsock_tcp_info * info, const tcp_info_field * f)
+{
+	const char * at = (const char *) info + f->offset;
+
+	switch (f->kind)
+	{
+		case TCPI_U8:          return *(const uint8_t  *) at;
+		case TCPI_U32:         return *(const uint32_t *) at;
+		case TCPI_U64:         return (lua_Number) *(const uint64_t *) at;
+		case TCPI_SND_WSCALE:  return info->snd_wscale;
+		case TCPI_RCV_WSCALE:  return info->rcv_wscale;
+		case TCPI_APP_LIMITED: return info->delivery_rate_app_limited;
+		case TCPI_TFO_FAIL:    return info->fastopen_client_fail;
+	}
+
+	return 0;
+}
+
+static int tcp_info_fetch(lsocket s, lsock_tcp_info * info)
+{
+	socklen_t sz = sizeof(lsock_tcp_info);
+
+	ZERO_OUT(info, sizeof(lsock_tcp_info));
+
+	return getsockopt(s, IPPROTO_TCP, TCP_INFO, info, &sz);
+}
+
+static void tcp_info_to_table(lua_State * L, const lsock_tcp_info * info)
+{
+	size_t i;
+
+	lua_createtable(L, 0, LENGTH(tcp_info_fields));
+
+	for (i = 0; i < LENGTH(tcp_info_fields); i++)
+	{
+		lua_pushnumber(L, tcp_info_value(info, &tcp_info_fields[i]));
+		lua_setfield(L, -2, tcp_info_fields[i].name);
+	}
+}
+
+/* getsockopt(sock, IPPROTO_TCP, TCP_INFO) -> { rtt =, rttvar =, snd_cwnd =, ... } (tcpi_ prefix dropped) */
+static int sockopt_tcp_info(lua_State * L)
+{
+	lsock_tcp_info info;
+
+	lsocket s = LSOCK_CHECKSOCK(L, 1);
+
+	if (!lua_isnone(L, 4))
+		return lsock_error(L, EINVAL, (char * (*)(int)) &strerror, "setsockopt(TCP_INFO)");
+
+	if (tcp_info_fetch(s, &info))
+		return LSOCK_STRERROR(L, NULL);
+
+	tcp_info_to_table(L, &info);
+
+	return 1;
+}
+
+/* tcp_info([sock]) -> reusable snapshot; info.rtt etc. read fields without building a table */
+static int api_tcp_info(lua_State * L)
+{
+	lsock_tcp_info * info = (lsock_tcp_info *) LSOCK_NEWUDATA(L, sizeof(lsock_tcp_info));
+
+	luaL_setmetatable(L, LSOCK_TCPINFO);
+
+	if (!lua_isnoneornil(L, 1) && tcp_info_fetch(LSOCK_CHECKSOCK(L, 1), info))
+		return LSOCK_STRERROR(L, "getsockopt(TCP_INFO)");
+
+	return 1;
+}
+
+/* tcp_info_update(info, sock) -> info, refreshed in place */
+static int api_tcp_info_update(lua_State * L)
+{
+	lsock_tcp_info * info = (lsock_tcp_info *) luaL_checkudata(L, 1, LSOCK_TCPINFO);
+
+	if (tcp_info_fetch(LSOCK_CHECKSOCK(L, 2), info))
+		return LSOCK_STRERROR(L, "getsockopt(TCP_INFO)");
+
+	lua_settop(L, 1);
+
+	return 1;
+}
+
+static int api_tcp_info_totable(lua_State * L)
+{
+	tcp_info_to_table(L, (lsock_tcp_info *) luaL_checkudata(L, 1, LSOCK_TCPINFO));
+
+	return 1;
+}
+
+/* tcp_info_batch(socks[, { field names }]) -> { table per sock }, or with fields
+** { field = { value per sock }, ... }; a sock that fails gets false either way */
+static int api_tcp_info_batch(lua_State * L)
+{
+	int i, k, n, nfields = 0;
+
+	lsock_tcp_info          info;
+	const tcp_info_field *  picked[LENGTH(tcp_info_fields)];
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	n = lua_rawlen(L, 1);
+
+	lua_settop(L, 2);
+
+	if (!lua_isnil(L, 2))
+	{
+		luaL_checktype(L, 2, LUA_TTABLE);
+
+		nfields = lua_rawlen(L, 2);
+
+		luaL_argcheck(L, nfields <= (int) LENGTH(tcp_info_fields), 2, "too many fields");
+
+		for (k = 0; k < nfields; k++)
+		{
+			lua_rawgeti(L, 2, k + 1);
+			picked[k] = tcp_info_lookup(luaL_checkstring(L, -1));
+
+			if (NULL == picked[k])
+				return luaL_argerror(L, 2, lua_pushfstring(L, "no TCP_INFO field '%s'", lua_tostring(L, -1)));
+
+			lua_pop(L, 1);
+		}
+	}
+
+	/* 3: result; columns go at 4 .. 3 + nfields */
+	lua_createtable(L, nfields ? 0 : n, nfields);
+
+	for (k = 0; k < nfields; k++)
+	{
+		lua_createtable(L, n, 0);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, 3, picked[k]->name);
+	}
+
+	for (i = 1; i <= n; i++)
+	{
+		int failed;
+
+		lua_rawgeti(L, 1, i);
+		failed = tcp_info_fetch(LSOCK_CHECKSOCK(L, -1), &info);
+		lua_pop(L, 1);
+
+		if (nfields)
+		{
+			for (k = 0; k < nfields; k++)
+			{
+				if (failed)
+					lua_pushboolean(L, 0);
+				else
+					lua_pushnumber(L, tcp_info_value(&info, picked[k]));
+
+				lua_rawseti(L, 4 + k, i);
+			}
+
+			continue;
+		}
+
+		if (failed)
+			lua_pushboolean(L, 0);
+		else
+			tcp_info_to_table(L, &info);
+
+		lua_rawseti(L, 3, i);
+	}
+
+	lua_settop(L, 3);
+
+	return 1;
+}
+
+/* fields first, then methods */
+static int tcp_info_index(lua_State * L)
+{
+	lsock_tcp_info       * info = (lsock_tcp_info *) luaL_checkudata(L, 1, LSOCK_TCPINFO);
+	const char           * key  = luaL_checkstring(L, 2);
+	const tcp_info_field * f    = tcp_info_lookup(key);
+
+	if (NULL != f)
+	{
+		lua_pushnumber(L, tcp_info_value(info, f));
+		return 1;
+	}
+
+	if (0 == strcmp(key, "update"))
+		lua_pushcfunction(L, api_tcp_info_update);
+	else if (0 == strcmp(key, "totable"))
+		lua_pushcfunction(L, api_tcp_info_totable);
+	else
+		lua_pushnil(L);
+
+	return 1;
+}
+
+/* no methods table: __index does fields and methods both */
+static luaL_Reg tcp_info_meta[] =
+{
+	{ "__index", tcp_info_index },
+	{ NULL,      NULL           }
+};
+
+#endif
+
+enum { SOCKOPT_BOOLEAN, SOCKOPT_INTEGER, SOCKOPT_LINGER, SOCKOPT_INADDR, SOCKOPT_IN6ADDR, SOCKOPT_IFNAM, SOCKOPT_TIMEVAL, SOCKOPT_TCP_INFO, SOCKOPT_STRING, SOCKOPT_UINT64, SOCKOPT_MEMBERSHIP };
+
+static int option_to_handler(const int level, const int option)
+{
+	if (SOL_SOCKET == level)
+	{
+		switch (option)
+		{
+			case SO_ACCEPTCONN:
+			case SO_BROADCAST:
+			case SO_REUSEADDR:
+			case SO_KEEPALIVE:
+			case SO_OOBINLINE:
+			case SO_DONTROUTE:
+			case SO_DEBUG:
+#ifndef _WIN32
+			case SO_TIMESTAMP:
+#endif
+#ifdef __linux
+			case SO_BSDCOMPAT:
+			case SO_NO_CHECK:
+			case SO_MARK:
+			case SO_LOCK_FILTER: /* one way: it can't be turned back off */
+#endif
+#ifndef _WIN32
+			case SO_REUSEPORT:
+#endif
+#ifdef SO_PREFER_BUSY_POLL
+			case SO_PREFER_BUSY_POLL:
+#endif
+				return SOCKOPT_BOOLEAN;
+
+			case SO_RCVLOWAT:
+			case SO_SNDLOWAT:
+			case SO_SNDBUF:
+#ifdef _WIN32
+			case SO_RCVTIMEO: /* a DWORD of milliseconds on Windows */
+			case SO_SNDTIMEO:
+#endif
+			case SO_RCVBUF:
+			case SO_ERROR:
+			case SO_TYPE:
+#ifdef __linux
+			case SO_PRIORITY:
+			case SO_PROTOCOL:
+			case SO_RCVBUFFORCE:
+			case SO_SNDBUFFORCE:
+			case SO_PEEK_OFF:
+			case SO_DOMAIN:
+			case SO_INCOMING_CPU:
+			case SO_TIMESTAMPING:     /* SOF_TIMESTAMPING_* flags */
+#	ifdef SO_BUSY_POLL
+			case SO_BUSY_POLL:        /* microseconds to spin on the device queue */
+#	endif
+#	ifdef SO_INCOMING_NAPI_ID
+			case SO_INCOMING_NAPI_ID: /* read-only */
+#	endif
+#	ifdef SO_BUSY_POLL_BUDGET
+			case SO_BUSY_POLL_BUDGET:
+#	endif
+#endif
+				return SOCKOPT_INTEGER;
+
+			case SO_LINGER:
+				return SOCKOPT_LINGER;
+
+#ifndef _WIN32
+			case SO_RCVTIMEO:
+			case SO_SNDTIMEO:
+				return SOCKOPT_TIMEVAL;
+#endif
+
+#ifdef __linux
+			case SO_BINDTODEVICE:
+				return SOCKOPT_IFNAM;
+
+#	ifdef SO_MAX_PACING_RATE
+			case SO_MAX_PACING_RATE:
+				return SOCKOPT_UINT64;
+#	endif
+#endif
+		}
+	}
+	else if (IPPROTO_TCP == level) /* SOL_TCP */
+	{
+		switch (option)
+		{
+			case TCP_MAXSEG:
+#ifndef _WIN32
+			case TCP_KEEPINTVL:
+			case TCP_KEEPCNT:
+#endif
+#ifdef __linux
+			case TCP_WINDOW_CLAMP:
+			case TCP_DEFER_ACCEPT: /* NOT A BOOLEAN, # of seconds to wait for data before drop */
+			case TCP_LINGER2:
+			case TCP_KEEPIDLE:
+			case TCP_SYNCNT:
+			case TCP_FASTOPEN: /* the server's queue of pending fast-open requests */
+#	ifdef TCP_NOTSENT_LOWAT
+			case TCP_NOTSENT_LOWAT:
+#	endif
+#	ifdef TCP_USER_TIMEOUT
+			case TCP_USER_TIMEOUT: /* milliseconds unacknowledged before the connection drops */
+#	endif
+#endif
+				return SOCKOPT_INTEGER;
+
+			case TCP_NODELAY:
+#ifdef __linux
+			case TCP_CORK:
+#	ifdef TCP_FASTOPEN_CONNECT
+			case TCP_FASTOPEN_CONNECT: /* connect() returns at once, the first send() carries the SYN */
+#	endif
+			case TCP_QUICKACK: /* not sticky, the kernel drops back out of quickack mode on its own */
+#endif
+				return SOCKOPT_BOOLEAN;
+
+#ifdef __linux
+			case TCP_INFO:
+				return SOCKOPT_TCP_INFO;
+
+			case TCP_CONGESTION:
+				return SOCKOPT_STRING;
+#endif
+		}
+	}
+	else if (IPPROTO_UDP == level) /* SOL_UDP */
+	{
+		switch (option)
+		{
+#ifdef _WIN32
+			case UDP_CHECKSUM_COVERAGE:
+			case UDP_NOCHECKSUM:
+#endif
+#ifdef __linux
+			case UDP_CORK:
+#endif
+				return SOCKOPT_BOOLEAN;
+		}
+	}
+	else if (IPPROTO_IP == level) /* SOL_IP */
+	{
+		switch (option)
+		{
+			case IP_TTL:
+			case IP_TOS:
+			case IP_MULTICAST_TTL:
+#ifndef _WIN32
+			case IP_RECVTTL:
+#endif
+#ifdef __linux
+			case IP_MTU_DISCOVER:
+			case IP_RECVTOS:
+#endif
+				return SOCKOPT_INTEGER;
+
+			case IP_HDRINCL:
+			case IP_MULTICAST_LOOP:
+#ifndef _WIN32
+			case IP_RECVOPTS:
+			case IP_RETOPTS:
+#endif
+#ifdef __linux
+			case IP_PKTINFO:
+			case IP_RECVERR:
+			case IP_ROUTER_ALERT:
+			case IP_MULTICAST_ALL: /* off: only the groups this socket joined, not every one on the host */
+#endif
+				return SOCKOPT_BOOLEAN;
+
+			case IP_MULTICAST_IF:
+				return SOCKOPT_INADDR;
+
+#ifndef _WIN32
+			case IP_ADD_MEMBERSHIP:
+			case IP_DROP_MEMBERSHIP:
+			case IP_ADD_SOURCE_MEMBERSHIP:
+			case IP_DROP_SOURCE_MEMBERSHIP:
+			case IP_BLOCK_SOURCE:
+			case IP_UNBLOCK_SOURCE:
+#endif
+#ifdef __linux
+			case MCAST_JOIN_GROUP:
+			case MCAST_LEAVE_GROUP:
+			case MCAST_JOIN_SOURCE_GROUP:
+			case MCAST_LEAVE_SOURCE_GROUP:
+			case MCAST_BLOCK_SOURCE:
+			case MCAST_UNBLOCK_SOURCE:
+#endif
+				return SOCKOPT_MEMBERSHIP;
+		}
+	}
+	else if (IPPROTO_IPV6 == level) /* SOL_IPV6 */
+	{
+		switch (option)
+		{
+
+			case IPV6_MULTICAST_LOOP:
+#ifndef _WIN32
+			case IPV6_RECVPKTINFO:
+#endif
+#ifdef __linux
+#	ifdef IPV6_MULTICAST_ALL
+			case IPV6_MULTICAST_ALL:
+#	endif
+			case IPV6_ROUTER_ALERT:
+			case IPV6_NEXTHOP:
+			case IPV6_HOPLIMIT:
+			case IPV6_DSTOPTS:
+			case IPV6_HOPOPTS:
+#endif
+				return SOCKOPT_BOOLEAN;
+
+			case IPV6_CHECKSUM:
+			case IPV6_MULTICAST_HOPS:
+			case IPV6_MULTICAST_IF: /* an interface index */
+			case IPV6_UNICAST_HOPS:
+#ifdef __linux
+			case IPV6_AUTHHDR:
+			case IPV6_ADDRFORM:
+			case IPV6_PKTINFO:
+#endif
+				return SOCKOPT_INTEGER;
+
+#ifndef _WIN32
+			case IPV6_JOIN_GROUP:
+			case IPV6_LEAVE_GROUP:
+#endif
+#ifdef __linux
+			case MCAST_JOIN_GROUP:
+			case MCAST_LEAVE_GROUP:
+			case MCAST_JOIN_SOURCE_GROUP:
+			case MCAST_LEAVE_SOURCE_GROUP:
+			case MCAST_BLOCK_SOURCE:
+			case MCAST_UNBLOCK_SOURCE:
+#endif
+				return SOCKOPT_MEMBERSHIP;
+		}
+	}
+
+	/* unknown level+option combo */
+	return -1;
+}
+
+static int sockopt(lua_State * L)
+{
+	int level, option, get;
+
+	LSOCK_CHECKSOCK(L, 1);
+
+	level  = luaL_checkint(L, 2);
+	option = luaL_checkint(L, 3);
+	get    =    lua_isnone(L, 4);
+
+	switch (option_to_handler(level, option))
+	{
+		case SOCKOPT_BOOLEAN: return sockopt_boolean(L);
+		case SOCKOPT_INTEGER: return sockopt_integer(L);
+		case SOCKOPT_LINGER:  return sockopt_linger(L);
+#ifndef _WIN32
+		case SOCKOPT_IFNAM:   return sockopt_ifnam(L);
+		case SOCKOPT_TIMEVAL: return sockopt_timeval(L);
+		case SOCKOPT_INADDR:  return sockopt_inaddr(L);
+		case SOCKOPT_MEMBERSHIP: return sockopt_membership(L);
+#endif
+#ifdef __linux
+		case SOCKOPT_TCP_INFO: return sockopt_tcp_info(L);
+		case SOCKOPT_STRING:  return sockopt_string(L);
+		case SOCKOPT_UINT64:  return sockopt_uint64(L);
+#endif
+	}
+
+	/* unkown level+option */
+	lua_pushnil(L);
+	lua_pushfstring
+	(
+		L,
+		"unknown level or option passed to %ssockopt(); you can force it with %ssockopt_boolean/integer()..",
+		get ? "get" : "set",
+		get ? "get" : "set"
+	);
+
+	return 2;
+}
+
+static int api_getsockopt(lua_State * L)
+{
+	int n = lua_gettop(L);
+
+	if (n > 3)
+		lua_pop(L, n - 3);
+
+	return sockopt(L);
+}
+
+static int api_setsockopt(lua_State * L)
+{
+	luaL_checkany(L, 4);
+
+	return sockopt(L);
+}
+
+/* sockopt_profile({ { level, option, value }, ... }) -> profile
+** values are checked and encoded here, once, the way setsockopt() would take them */
+static int api_sockopt_profile(lua_State * L)
+{
+	int i, n;
+	sockopt_profile * p;
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	n = lua_rawlen(L, 1);
+
+	p = (sockopt_profile *) LSOCK_NEWUDATA(L, sizeof(sockopt_profile) + MAX(n - 1, 0) * sizeof(profile_entry));
+	p->n = n;
+
+	luaL_setmetatable(L, LSOCK_PROFILE);
+
+	for (i = 0; i < n; i++)
+	{
+		profile_entry * e = &p->entries[i];
+
+		lua_rawgeti(L, 1, i + 1);
+
+		if (!lua_istable(L, -1))
+			return luaL_error(L, "sockopt_profile(): entry %d is not a { level, option, value } table", i + 1);
+
+		lua_rawgeti(L, -1, 1);
+		lua_rawgeti(L, -2, 2);
+		lua_rawgeti(L, -3, 3); /* value at -1, the entry at -4 */
+
+		if (!lua_isnumber(L, -3) || !lua_isnumber(L, -2))
+			return luaL_error(L, "sockopt_profile(): entry %d needs a numeric level and option", i + 1);
+
+		e->level  = lua_tointeger(L, -3);
+		e->option = lua_tointeger(L, -2);
+
+		switch (option_to_handler(e->level, e->option))
+		{
+			case SOCKOPT_BOOLEAN:
+				e->value.i = lua_isnumber(L, -1) ? lua_tointeger(L, -1) : lua_toboolean(L, -1);
+				e->len     = sizeof(int);
+				break;
+
+			case SOCKOPT_INTEGER:
+				if (!lua_isnumber(L, -1))
+					return luaL_error(L, "sockopt_profile(): entry %d wants an integer", i + 1);
+
+				e->value.i = lua_tointeger(L, -1);
+				e->len     = sizeof(int);
+				break;
+
+			case SOCKOPT_LINGER:
+				if (!lua_istable(L, -1))
+					return luaL_error(L, "sockopt_profile(): entry %d wants a linger table", i + 1);
+
+				e->value.l = *table_to_linger(L, -1);
+				e->len     = sizeof(struct linger);
+				lua_pop(L, 1);
+				break;
+
+#ifndef _WIN32
+			case SOCKOPT_TIMEVAL:
+				table_to_timeval(L, lua_absindex(L, -1), &e->value.t);
+				e->len = sizeof(struct timeval);
+				break;
+
+			case SOCKOPT_IFNAM:
+#	ifdef __linux
+			case SOCKOPT_STRING:
+#	endif
+			{
+				size_t       len  = 0;
+				const char * name = lua_tolstring(L, -1, &len);
+
+				if (NULL == name || len >= IFNAMSIZ)
+					return luaL_error(L, "sockopt_profile(): entry %d wants a name under %d bytes", i + 1, IFNAMSIZ);
+
+				memcpy(e->value.name, name, len);
+				e->len = len;
+				break;
+			}
+#endif
+
+#ifdef __linux
+			case SOCKOPT_UINT64:
+				if (!lua_isnumber(L, -1))
+					return luaL_error(L, "sockopt_profile(): entry %d wants a number", i + 1);
+
+				e->value.u64 = lua_tonumber(L, -1) < 0 ? ~(uint64_t) 0 : (uint64_t) lua_tonumber(L, -1);
+				e->len       = sizeof(uint64_t);
+				break;
+#endif
+
+			default:
+				return luaL_error(L, "sockopt_profile(): entry %d: unknown (or read-only) level and option", i + 1);
+		}
+
+		lua_pop(L, 4);
+	}
+
+	return 1;
+}
+
+/* sockopt_apply(profile, sock) -> true, or nil, msg, errno, index of the entry that failed */
+static int api_sockopt_apply(lua_State * L)
+{
+	int failed;
+
+	sockopt_profile * p = (sockopt_profile *) luaL_checkudata(L, 1, LSOCK_PROFILE);
+
+	failed = profile_apply(p, LSOCK_CHECKSOCK(L, 2));
+
+	if (failed)
+	{
+		LSOCK_STRERROR(L, "sockopt_apply()");
+		lua_pushinteger(L, failed);
+		return 4;
+	}
+
+	lua_pushboolean(L, 1);
+
+	return 1;
+}
+
+static int profile_len(lua_State * L)
+{
+	lua_pushinteger(L, ((sockopt_profile *) luaL_checkudata(L, 1, LSOCK_PROFILE))->n);
+
+	return 1;
+}
+
+static luaL_Reg profile_methods[] =
+{
+	{ "apply", api_sockopt_apply },
+	{ NULL,    NULL              }
+};
+
+static luaL_Reg profile_meta[] =
+{
+	{ "__len", profile_len },
+	{ NULL,    NULL        }
+};
+
+static void table_to_hints(lua_State * L, int idx, struct addrinfo * hints)
+{
+	ZERO_OUT(hints, sizeof(struct addrinfo));
+
+	if (lua_isnoneornil(L, idx))
+		return;
+
+	luaL_checktype(L, idx, LUA_TTABLE); /* getaddrinfo('www.google.com', 'http', { options }) */
+
+	lua_getfield(L, idx, "ai_flags");
+
+	if (!lua_isnil(L, -1))
+		hints->ai_flags = lua_tointeger(L, -1);
+
+	lua_pop(L, 1);
+
+	lua_getfield(L, idx, "ai_family");
+
+	if (!lua_isnil(L, -1))
+		hints->ai_family = lua_tointeger(L, -1);
+
+	lua_pop(L, 1);
+
+	lua_getfield(L, idx, "ai_socktype");
+
+	if (!lua_isnil(L, -1))
+		hints->ai_socktype = lua_tointeger(L, -1);
+
+	lua_pop(L, 1);
+
+	lua_getfield(L, idx, "ai_protocol");
+
+	if (!lua_isnil(L, -1))
+		hints->ai_protocol = lua_tointeger(L, -1);
+
+	lua_pop(L, 1);
+}
+
+/* pushes the result table (and the canonical name, if any); returns how many */
+static int addrinfo_to_table(lua_State * L, struct addrinfo * info)
+{
+	int ret = 1; /* to reflect how many returns */
+	int i   = 1;
+
+	struct addrinfo * p;
+
+	lua_newtable(L);
+
+	for (p = info; p != NULL; p = (i++, p->ai_next))
+	{
+		/* the sequence index in the outer table */
+		lua_pushnumber(L, i);
+
+		/* allocate for 7-at-most members */
+		lua_createtable(L, 0, 7);
+
+		PUSHFIELD(L, -1, integer, "ai_flags",    p->ai_flags   );
+		PUSHFIELD(L, -1, integer, "ai_family",   p->ai_family  );
+		PUSHFIELD(L, -1, integer, "ai_socktype", p->ai_socktype);
+		PUSHFIELD(L, -1, integer, "ai_protocol", p->ai_protocol);
+		PUSHFIELD(L, -1, integer, "ai_addrlen",  p->ai_addrlen );
+
+		lua_pushlstring(L, (char *) p->ai_addr, p->ai_addrlen);
+		lua_setfield(L, -2, "ai_addr");
+
+		if (NULL != p->ai_canonname)
+			PUSHFIELD(L, -1, string, "ai_canonname", p->ai_canonname);
+
+		lua_settable(L, -3);
+	}
+
+	if (NULL != info && NULL != info->ai_canonname)
+	{
+		lua_pushstring(L, info->ai_canonname);
+		ret++;
+	}
+
+	return ret;
+}
+
+/* optional getaddrinfo() result cache, one per lua_State: the registry holds a
+** userdata whose uservalue is { key -> entry, insertion queue of keys }.
+** getaddrinfo() reports no TTLs, so lifetimes are fixed by configuration. */
+
+#define LSOCK_GAICACHE "lsock.gaicache"
+
+enum { GAI_ENTRY_RESULT = 1, GAI_ENTRY_EXTRA, GAI_ENTRY_CODE, GAI_ENTRY_EXPIRES, GAI_ENTRY_SEQ };
+
+typedef struct
+{
+	int    max;
+	double ttl, negative_ttl;
+
+	int size;
+	int head, tail; /* the live span of the insertion queue */
+
+	unsigned long hits, negative_hits, misses, expired, evictions;
+} gaicache;
+
+/* pushes the cache's map and queue tables and returns the cache, or returns NULL (pushing nothing) */
+static gaicache * gaicache_get(lua_State * L)
+{
+	gaicache * c;
+
+	lua_getfield(L, LUA_REGISTRYINDEX, LSOCK_GAICACHE);
+
+	c = (gaicache *) lua_touserdata(L, -1);
+
+	if (NULL == c)
+	{
+		lua_pop(L, 1);
+		return NULL;
+	}
+
+	lua_getuservalue(L, -1);
+	lua_rawgeti(L, -1, 1);
+	lua_rawgeti(L, -2, 2);
+	lua_remove(L, -3);
+	lua_remove(L, -3);
+
+	return c;
+}
+
+static void gaicache_key(lua_State * L, const char * nname, const char * sname, const struct addrinfo * hints)
+{
+	/* \1 keeps NULL apart from "" -- and '\n' can't be in a host or service name */
+	lua_pushfstring
+	(
+		L, "%s\n%s\n%d %d %d %d",
+		NULL == nname ? "\1" : nname,
+		NULL == sname ? "\1" : sname,
+		hints->ai_flags, hints->ai_family, hints->ai_socktype, hints->ai_protocol
+	);
+}
+
+enum { RETIRE_NONE, RETIRE_SLOT, RETIRE_ENTRY };
+
+/* pops the oldest queue slot if it is stale, expired, or force is set (map and queue at -2/-1 stay put) */
+static int gaicache_retire(lua_State * L, gaicache * c, double now, int force)
+{
+	int h = c->head;
+	int live;
+
+	if (h >= c->tail)
+		return RETIRE_NONE;
+
+	lua_rawgeti(L, -1, h);      /* key   */
+	lua_pushvalue(L, -1);
+	lua_rawget(L, -4);          /* entry */
+
+	/* the key may have been refreshed (or invalidated) since it was queued here */
+	live = 0;
+
+	if (!lua_isnil(L, -1))
+	{
+		lua_rawgeti(L, -1, GAI_ENTRY_SEQ);
+		live = lua_tointeger(L, -1) == h;
+		lua_pop(L, 1);
+	}
+
+	if (live && !force)
+	{
+		lua_rawgeti(L, -1, GAI_ENTRY_EXPIRES);
+
+		if (lua_tonumber(L, -1) > now)
+		{
+			lua_pop(L, 3);
+			return RETIRE_NONE;
+		}
+
+		lua_pop(L, 1);
+	}
+
+	lua_pop(L, 1);
+
+	if (live)
+	{
+		lua_pushnil(L);
+		lua_rawset(L, -4);
+		c->size--;
+	}
+	else
+		lua_pop(L, 1);
+
+	lua_pushnil(L);
+	lua_rawseti(L, -2, h);
+	c->head++;
+
+	return live ? RETIRE_ENTRY : RETIRE_SLOT;
+}
+
+static void gaicache_drop_oldest(lua_State * L, gaicache * c)
+{
+	int retired;
+
+	while (RETIRE_SLOT == (retired = gaicache_retire(L, c, 0, 1)))
+		;
+
+	if (RETIRE_ENTRY == retired)
+		c->evictions++;
+}
+
+/* pushes a copy of the result table at idx, down to the entries: the tables in the
+** cache never reach a caller, so nobody can edit what the next lookup gets */
+static void gaicache_copy(lua_State * L, int idx)
+{
+	idx = lua_absindex(L, idx);
+
+	lua_createtable(L, lua_rawlen(L, idx), 0);
+	lua_pushnil(L);
+
+	while (lua_next(L, idx))
+	{
+		if (lua_istable(L, -1))
+		{
+			int entry = lua_gettop(L);
+
+			lua_createtable(L, 0, 7);
+			lua_pushnil(L);
+
+			while (lua_next(L, entry))
+			{
+				lua_pushvalue(L, -2);
+				lua_insert(L, -2);
+				lua_rawset(L, -4);
+			}
+
+			lua_replace(L, entry);
+		}
+
+		lua_pushvalue(L, -2);
+		lua_insert(L, -2);
+		lua_rawset(L, -4);
+	}
+}
+
+/* pushes the cached returns of getaddrinfo() and returns how many, or 0 on a miss */
+static int gaicache_lookup(lua_State * L, const char * nname, const char * sname, const struct addrinfo * hints)
+{
+	int top = lua_gettop(L);
+	int code;
+	gaicache * c = gaicache_get(L);
+
+	if (NULL == c)
+		return 0;
+
+	gaicache_key(L, nname, sname, hints);
+	lua_rawget(L, -3);
+
+	if (lua_isnil(L, -1))
+	{
+		c->misses++;
+		lua_settop(L, top);
+		return 0;
+	}
+
+	lua_rawgeti(L, -1, GAI_ENTRY_EXPIRES);
+
+	if (lua_tonumber(L, -1) <= monotonic_seconds())
+	{
+		c->expired++;
+		c->misses++;
+		lua_settop(L, top);
+		return 0;
+	}
+
+	lua_pop(L, 1);
+
+	lua_rawgeti(L, -1, GAI_ENTRY_CODE);
+	code = lua_tointeger(L, -1);
+	lua_pop(L, 1);
+
+	lua_rawgeti(L, -1, GAI_ENTRY_RESULT);
+	lua_rawgeti(L, -2, GAI_ENTRY_EXTRA);
+
+	/* leave just the returns */
+	lua_replace(L, top + 1);
+	lua_replace(L, top + 2);
+	lua_settop(L, top + 2);
+	lua_insert(L, top + 1);
+
+	if (0 != code)
+	{
+		c->negative_hits++;
+		lua_pushinteger(L, code);
+		return 3;
+	}
+
+	c->hits++;
+
+	gaicache_copy(L, top + 1);
+	lua_replace(L, top + 1);
+
+	if (lua_isnil(L, -1))
+	{
+		lua_pop(L, 1);
+		return 1;
+	}
+
+	return 2;
+}
+
+/* stores the nret getaddrinfo() returns on top of the stack (left in place) */
+static void gaicache_store(lua_State * L, const char * nname, const char * sname, const struct addrinfo * hints, int nret, int code)
+{
+	int top = lua_gettop(L);
+	int seq;
+	double ttl;
+	gaicache * c = gaicache_get(L);
+
+	if (NULL == c)
+		return;
+
+	ttl = 0 == code ? c->ttl : c->negative_ttl;
+
+	if (ttl <= 0)
+	{
+		lua_settop(L, top);
+		return;
+	}
+
+	/* expired and superseded entries leave the front of the queue first */
+	while (RETIRE_NONE != gaicache_retire(L, c, monotonic_seconds(), 0))
+		;
+
+	gaicache_key(L, nname, sname, hints);
+	lua_pushvalue(L, -1);
+	lua_rawget(L, -4);
+
+	if (lua_isnil(L, -1))
+	{
+		if (c->size >= c->max)
+		{
+			lua_pop(L, 2);
+			gaicache_drop_oldest(L, c);
+			gaicache_key(L, nname, sname, hints);
+			lua_pushnil(L);
+		}
+
+		c->size++;
+	}
+
+	lua_pop(L, 1);
+
+	seq = c->tail++;
+
+	lua_pushvalue(L, -1);
+	lua_rawseti(L, -3, seq);
+
+	lua_createtable(L, 5, 0);
+
+	if (0 == code)
+	{
+		gaicache_copy(L, top - nret + 1);
+		lua_rawseti(L, -2, GAI_ENTRY_RESULT);
+
+		if (nret > 1)
+		{
+			lua_pushvalue(L, top);
+			lua_rawseti(L, -2, GAI_ENTRY_EXTRA);
+		}
+	}
+	else
+	{
+		lua_pushvalue(L, top - nret + 2); /* the message */
+		lua_rawseti(L, -2, GAI_ENTRY_EXTRA);
+	}
+
+	lua_pushinteger(L, code);
+	lua_rawseti(L, -2, GAI_ENTRY_CODE);
+
+	lua_pushnumber(L, monotonic_seconds() + ttl);
+	lua_rawseti(L, -2, GAI_ENTRY_EXPIRES);
+
+	lua_pushinteger(L, seq);
+	lua_rawseti(L, -2, GAI_ENTRY_SEQ);
+
+	lua_rawset(L, -4);
+	lua_settop(L, top);
+}
+
+/* transient failures are worth retrying straight away */
+static int gai_is_negative(int code)
+{
+	switch (code)
+	{
+		case EAI_NONAME:
+#if defined(EAI_NODATA) && EAI_NODATA != EAI_NONAME
+		case EAI_NODATA:
+#endif
+			return 1;
+	}
+
+	return 0;
+}
+
+static void gaicache_reset(lua_State * L, int idx, gaicache * c)
+{
+	idx = lua_absindex(L, idx);
+
+	c->size = 0;
+	c->head = c->tail = 1;
+
+	lua_createtable(L, 2, 0);
+	lua_newtable(L);
+	lua_rawseti(L, -2, 1);
+	lua_newtable(L);
+	lua_rawseti(L, -2, 2);
+	lua_setuservalue(L, idx);
+}
+
+/* getaddrinfo_cache({ max = 1024, ttl = 30, negative_ttl = 5 }) to enable or reconfigure, false to disable */
+static int api_getaddrinfo_cache(lua_State * L)
+{
+	gaicache * c;
+
+	if (!lua_toboolean(L, 1))
+	{
+		lua_pushnil(L);
+		lua_setfield(L, LUA_REGISTRYINDEX, LSOCK_GAICACHE);
+		lua_pushboolean(L, 1);
+		return 1;
+	}
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	lua_getfield(L, LUA_REGISTRYINDEX, LSOCK_GAICACHE);
+	c = (gaicache *) lua_touserdata(L, -1);
+
+	if (NULL == c)
+	{
+		lua_pop(L, 1);
+
+		c = (gaicache *) LSOCK_NEWUDATA(L, sizeof(gaicache));
+
+		c->max          = 1024;
+		c->ttl          = 30;
+		c->negative_ttl = 5;
+
+		gaicache_reset(L, -1, c);
+
+		lua_pushvalue(L, -1);
+		lua_setfield(L, LUA_REGISTRYINDEX, LSOCK_GAICACHE);
+	}
+
+	lua_getfield(L, 1, "max");
+	c->max = luaL_optint(L, -1, c->max);
+	lua_getfield(L, 1, "ttl");
+	c->ttl = luaL_optnumber(L, -1, c->ttl);
+	lua_getfield(L, 1, "negative_ttl");
+	c->negative_ttl = luaL_optnumber(L, -1, c->negative_ttl);
+
+	luaL_argcheck(L, c->max > 0, 1, "max must be positive");
+
+	/* shrinking takes effect right away */
+	lua_settop(L, 2);
+	lua_getuservalue(L, 2);
+	lua_rawgeti(L, -1, 1);
+	lua_rawgeti(L, -2, 2);
+
+	while (c->size > c->max)
+		gaicache_drop_oldest(L, c);
+
+	lua_pushboolean(L, 1);
+
+	return 1;
+}
+
+static int api_getaddrinfo_cache_stats(lua_State * L)
+{
+	gaicache * c;
+
+	lua_getfield(L, LUA_REGISTRYINDEX, LSOCK_GAICACHE);
+	c = (gaicache *) lua_touserdata(L, -1);
+
+	if (NULL == c)
+	{
+		lua_pushnil(L);
+		return 1;
+	}
+
+	lua_createtable(L, 0, 9);
+
+	PUSHFIELD(L, -1, integer, "size",          c->size         );
+	PUSHFIELD(L, -1, integer, "max",           c->max          );
+	PUSHFIELD(L, -1, number,  "ttl",           c->ttl          );
+	PUSHFIELD(L, -1, number,  "negative_ttl",  c->negative_ttl );
+	PUSHFIELD(L, -1, number,  "hits",          c->hits         );
+	PUSHFIELD(L, -1, number,  "negative_hits", c->negative_hits);
+	PUSHFIELD(L, -1, number,  "misses",        c->misses       );
+	PUSHFIELD(L, -1, number,  "expired",       c->expired      );
+	PUSHFIELD(L, -1, number,  "evictions",     c->evictions    );
+
+	return 1;
+}
+
+/* getaddrinfo_invalidate() drops everything, getaddrinfo_invalidate(node [, service [, hints]]) just the matches */
+static int api_getaddrinfo_invalidate(lua_State * L)
+{
+	int dropped = 0;
+	int nargs   = lua_gettop(L);
+	gaicache * c;
+
+	lua_settop(L, 3);
+	lua_getfield(L, LUA_REGISTRYINDEX, LSOCK_GAICACHE);
+	c = (gaicache *) lua_touserdata(L, -1);
+
+	if (NULL == c)
+	{
+		lua_pushinteger(L, 0);
+		return 1;
+	}
+
+	if (0 == nargs)
+	{
+		lua_pushinteger(L, c->size);
+		gaicache_reset(L, -2, c);
+		return 1;
+	}
+	else if (nargs > 1)
+	{
+		struct addrinfo hints;
+
+		const char * nname = lua_isnil(L, 1) ? NULL : luaL_checkstring(L, 1);
+		const char * sname = lua_isnil(L, 2) ? NULL : luaL_checkstring(L, 2);
+
+		table_to_hints(L, 3, &hints);
+
+		lua_getuservalue(L, -1);
+		lua_rawgeti(L, -1, 1);
+
+		gaicache_key(L, nname, sname, &hints);
+		lua_rawget(L, -2);
+		dropped = !lua_isnil(L, -1);
+		lua_pop(L, 1);
+
+		gaicache_key(L, nname, sname, &hints);
+		lua_pushnil(L);
+		lua_rawset(L, -3);
+	}
+	else
+	{
+		/* every service and hint combination for this node */
+		size_t       l      = 0;
+		const char * prefix = NULL;
+
+		lua_pushfstring(L, "%s\n", lua_isnil(L, 1) ? "\1" : luaL_checkstring(L, 1));
+		prefix = lua_tolstring(L, -1, &l);
+
+		lua_getuservalue(L, -2);
+		lua_rawgeti(L, -1, 1);
+		lua_pushnil(L);
+
+		while (lua_next(L, -2))
+		{
+			size_t       kl = 0;
+			const char * k  = lua_tolstring(L, -2, &kl);
+
+			lua_pop(L, 1);
+
+			if (kl > l && 0 == memcmp(k, prefix, l))
+			{
+				/* clearing the current key is fine mid-traversal */
+				lua_pushvalue(L, -1);
+				lua_pushnil(L);
+				lua_rawset(L, -4);
+				dropped++;
+			}
+		}
+	}
+
+	/* the stale queue slots are skipped when they come up */
+	c->size -= dropped;
+
+	lua_pushinteger(L, dropped);
+
+	return 1;
+}
+
+static int api_getaddrinfo(lua_State * L)
+{
+	int ret;
+
+	struct addrinfo hints, * info;
+
+	/* node and service both cannot be NULL, getaddrinfo() will spout EAI_NONAME */
+	const char * nname = lua_isnil(L, 1) ? NULL : luaL_checkstring(L, 1);
+	const char * sname = lua_isnil(L, 2) ? NULL : luaL_checkstring(L, 2);
+
+	table_to_hints(L, 3, &hints);
+
+	/* a hit hands back a fresh copy of what the first lookup built */
+	ret = gaicache_lookup(L, nname, sname, &hints);
+
+	if (0 != ret)
+		return ret;
+
+	info = NULL;
+
+	ret = getaddrinfo(nname, sname, &hints, &info);
+
+	if (0 != ret)
+	{
+		int code = ret;
+
+		ret = LSOCK_GAIERROR(L, code);
+
+		if (gai_is_negative(code))
+			gaicache_store(L, nname, sname, &hints, ret, code);
+
+		return ret;
+	}
+
+	ret = addrinfo_to_table(L, info);
+
+	freeaddrinfo(info);
+
+	gaicache_store(L, nname, sname, &hints, ret, 0);
+
+	return ret;
+}
+
+static int api_getnameinfo(lua_State * L)
+{
+	int stat;
+
+	char hbuf[NI_MAXHOST], sbuf[NI_MAXSERV];
+
+	size_t       sz    = 0;
+	const char * sa    = luaL_checklstring(L, 1, &sz);
+	int          flags = luaL_checkint(L, 2);
+
+	ZERO_OUT(hbuf, NI_MAXHOST);
+	ZERO_OUT(sbuf, NI_MAXSERV);
+
+	stat = getnameinfo((struct sockaddr *) sa, sz, hbuf, sizeof(hbuf), sbuf, sizeof(sbuf), flags);
+
+	if (0 != stat)
+		return LSOCK_GAIERROR(L, stat);
+
+	lua_pushstring(L, hbuf);
+	lua_pushstring(L, sbuf);
+
+	return 2;
+}
+
+#ifndef _WIN32
+
+/* asynchronous getaddrinfo(): a few worker threads take requests off a
+** shared list, and every completion writes a byte to a pipe the caller can select() on */
+
+#define LSOCK_RESOLVER "lsock.resolver"
+#define RESOLVER_MAX_THREADS 64
+
+enum { REQ_QUEUED, REQ_RUNNING, REQ_DONE, REQ_CANCELLED };
+
+typedef struct resolve_req
+{
+	struct resolve_req * next;
+
+	lua_Integer id;
+	int         state;
+	double      deadline; /* 0 for none */
+
+	char * node;
+	char * service;
+	struct addrinfo hints;
+
+	int               err;
+	struct addrinfo * info;
+} resolve_req;
+
+/* lives in the userdata; __gc joins the workers before it goes away */
+typedef struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t  wake;
+
+	int closed;
+	int stopping;
+	int notify; /* write end of the completion pipe */
+
+	int       nthreads;
+	pthread_t threads[RESOLVER_MAX_THREADS];
+
+	lua_Integer   last_id;
+	resolve_req * reqs; /* oldest first */
+} resolver;
+
+static char * copy_string(const char * s)
+{
+	char * c;
+
+	if (NULL == s)
+		return NULL;
+
+	c = (char *) malloc(strlen(s) + 1);
+
+	if (NULL != c)
+		strcpy(c, s);
+
+	return c;
+}
+
+static void resolve_req_free(resolve_req * q)
+{
+	if (NULL != q->info)
+		freeaddrinfo(q->info);
+
+	free(q->node);
+	free(q->service);
+	free(q);
+}
+
+static void resolver_unlink(resolver * r, resolve_req * q)
+{
+	resolve_req ** p = &r->reqs;
+
+	while (*p != q)
+		p = &(*p)->next;
+
+	*p = q->next;
+}
+
+static void * resolver_worker(void * arg)
+{
+	resolver * r = (resolver *) arg;
+
+	pthread_mutex_lock(&r->lock);
+
+	for (;;)
+	{
+		int err;
+		resolve_req     * q    = NULL;
+		struct addrinfo * info = NULL;
+
+		while (!r->stopping)
+		{
+			for (q = r->reqs; NULL != q && REQ_QUEUED != q->state; q = q->next)
+				;
+
+			if (NULL != q)
+				break;
+
+			pthread_cond_wait(&r->wake, &r->lock);
+		}
+
+		if (r->stopping)
+			break;
+
+		q->state = REQ_RUNNING;
+
+		pthread_mutex_unlock(&r->lock);
+
+		err = getaddrinfo(q->node, q->service, &q->hints, &info);
+
+		pthread_mutex_lock(&r->lock);
+
+		if (REQ_CANCELLED == q->state)
+		{
+			if (NULL != info)
+				freeaddrinfo(info);
+
+			resolver_unlink(r, q);
+			resolve_req_free(q);
+			continue;
+		}
+
+		q->err   = err;
+		q->info  = info;
+		q->state = REQ_DONE;
+
+		/* nonblocking: a full pipe is already readable, that's all we want */
+		if (-1 == write(r->notify, "", 1))
+			(void) 0;
+	}
+
+	pthread_mutex_unlock(&r->lock);
+
+	return NULL;
+}
+
+static resolver * resolver_check(lua_State * L, int idx)
+{
+	resolver * r = (resolver *) luaL_checkudata(L, idx, LSOCK_RESOLVER);
+
+	if (r->closed)
+		luaL_argerror(L, idx, "resolver is closed");
+
+	return r;
+}
+
+static void resolver_close(resolver * r)
+{
+	int i;
+
+	if (r->closed)
+		return;
+
+	r->closed = 1;
+
+	pthread_mutex_lock(&r->lock);
+	r->stopping = 1;
+	pthread_cond_broadcast(&r->wake);
+	pthread_mutex_unlock(&r->lock);
+
+	/* a lookup in flight can't be interrupted, so this may wait on it;
+	** detaching instead would leave threads running in an unloaded module */
+	for (i = 0; i < r->nthreads; i++)
+		pthread_join(r->threads[i], NULL);
+
+	while (NULL != r->reqs)
+	{
+		resolve_req * q = r->reqs;
+
+		r->reqs = q->next;
+		resolve_req_free(q);
+	}
+
+	close(r->notify);
+	pthread_cond_destroy(&r->wake);
+	pthread_mutex_destroy(&r->lock);
+}
+
+static int resolver_gc(lua_State * L)
+{
+	resolver_close((resolver *) luaL_checkudata(L, 1, LSOCK_RESOLVER));
+
+	return 0;
+}
+
+static int resolver_len(lua_State * L)
+{
+	int n = 0;
+
+	resolve_req    * q;
+	resolver * r = resolver_check(L, 1);
+
+	pthread_mutex_lock(&r->lock);
+
+	for (q = r->reqs; NULL != q; q = q->next)
+		n += REQ_CANCELLED != q->state;
+
+	pthread_mutex_unlock(&r->lock);
+
+	lua_pushinteger(L, n);
+
+	return 1;
+}
+
+/* resolver([threads]) */
+static int api_resolver(lua_State * L)
+{
+	int fds[2] = { -1, -1 };
+
+	luaL_Stream * stream;
+	resolver    * r;
+
+	int threads = luaL_optint(L, 1, 4);
+
+	luaL_argcheck(L, threads > 0 && threads <= RESOLVER_MAX_THREADS, 1, "thread count out of range");
+
+	if (pipe(fds))
+		return LSOCK_STRERROR(L, "pipe()");
+
+	if (-1 == fcntl(fds[0], F_SETFL, O_NONBLOCK) || -1 == fcntl(fds[1], F_SETFL, O_NONBLOCK))
+	{
+		close(fds[0]);
+		close(fds[1]);
+		return LSOCK_STRERROR(L, "fcntl(F_SETFL)");
+	}
+
+	r = (resolver *) LSOCK_NEWUDATA(L, sizeof(resolver));
+
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->wake, NULL);
+
+	r->notify = fds[1];
+
+	luaL_setmetatable(L, LSOCK_RESOLVER);
+
+	/* the read end is a regular lsock handle so it can go into select() */
+	lua_createtable(L, 1, 0);
+
+	stream    = newfile(L);
+	stream->f = fd_to_file(L, fds[0], "rb");
+
+	lua_rawseti(L, -2, 1);
+	lua_setuservalue(L, -2);
+
+	for (r->nthreads = 0; r->nthreads < threads; r->nthreads++)
+		if (pthread_create(&r->threads[r->nthreads], NULL, &resolver_worker, r))
+			break;
+
+	if (0 == r->nthreads)
+	{
+		resolver_close(r);
+		return luaL_error(L, "resolver(): could not start any threads");
+	}
+
+	return 1;
+}
+
+/* resolve(resolver, node, service [, hints [, timeout]]) -> request id */
+static int api_resolve(lua_State * L)
+{
+	struct addrinfo hints;
+
+	resolver       * r     = resolver_check(L, 1);
+	const char     * nname = lua_isnil(L, 2) ? NULL : luaL_checkstring(L, 2);
+	const char     * sname = lua_isnil(L, 3) ? NULL : luaL_checkstring(L, 3);
+	lua_Number      timeout = luaL_optnumber(L, 5, 0);
+
+	resolve_req * q, ** tail;
+
+	table_to_hints(L, 4, &hints);
+
+	q = (resolve_req *) calloc(1, sizeof(resolve_req));
+
+	if (NULL == q)
+		return luaL_error(L, "resolve(): out of memory");
+
+	q->node    = copy_string(nname);
+	q->service = copy_string(sname);
+
+	if ((NULL != nname && NULL == q->node) || (NULL != sname && NULL == q->service))
+	{
+		resolve_req_free(q);
+		return luaL_error(L, "resolve(): out of memory");
+	}
+
+	q->hints.ai_flags    = hints.ai_flags;
+	q->hints.ai_family   = hints.ai_family;
+	q->hints.ai_socktype = hints.ai_socktype;
+	q->hints.ai_protocol = hints.ai_protocol;
+
+	if (timeout > 0)
+		q->deadline = monotonic_seconds() + timeout;
+
+	pthread_mutex_lock(&r->lock);
+
+	q->id = ++r->last_id;
+
+	for (tail = &r->reqs; NULL != *tail; tail = &(*tail)->next)
+		;
+
+	*tail = q;
+
+	pthread_cond_signal(&r->wake);
+	pthread_mutex_unlock(&r->lock);
+
+	lua_pushinteger(L, q->id);
+
+	return 1;
+}
+
+/* resolver_next(resolver) -> id, <what getaddrinfo() would return> | nil when nothing is ready
+** keep calling it until nil: the fd only signals new completions */
+static int api_resolver_next(lua_State * L)
+{
+	char drain[64];
+	double now = 0;
+
+	resolve_req    * q;
+	resolver * r = resolver_check(L, 1);
+
+	lua_getuservalue(L, 1);
+	lua_rawgeti(L, -1, 1);
+
+	while (read(LSOCK_CHECKFD(L, -1), drain, sizeof(drain)) > 0)
+		;
+
+	lua_pop(L, 2);
+
+	pthread_mutex_lock(&r->lock);
+
+	for (q = r->reqs; NULL != q; q = q->next)
+	{
+		if (REQ_DONE == q->state)
+			break;
+
+		if (REQ_CANCELLED == q->state || 0 == q->deadline)
+			continue;
+
+		if (0 == now)
+			now = monotonic_seconds();
+
+		if (now >= q->deadline)
+		{
+			q->err = EAI_AGAIN;
+			break;
+		}
+	}
+
+	if (NULL == q)
+	{
+		pthread_mutex_unlock(&r->lock);
+		lua_pushnil(L);
+		return 1;
+	}
+
+	if (REQ_RUNNING == q->state)
+	{
+		/* timed out mid-lookup: the worker will discard it */
+		q->state = REQ_CANCELLED;
+		pthread_mutex_unlock(&r->lock);
+
+		lua_pushinteger(L, q->id);
+		lua_pushnil(L);
+		lua_pushliteral(L, "resolve(): timed out");
+		lua_pushinteger(L, EAI_AGAIN);
+		return 4;
+	}
+
+	resolver_unlink(r, q);
+	pthread_mutex_unlock(&r->lock);
+
+	lua_pushinteger(L, q->id);
+
+	if (REQ_DONE != q->state)
+	{
+		lua_pushnil(L);
+		lua_pushliteral(L, "resolve(): timed out");
+		lua_pushinteger(L, EAI_AGAIN);
+		resolve_req_free(q);
+		return 4;
+	}
+
+	if (0 != q->err)
+	{
+		int ret = LSOCK_GAIERROR(L, q->err);
+
+		resolve_req_free(q);
+		return 1 + ret;
+	}
+
+	{
+		int ret = addrinfo_to_table(L, q->info);
+
+		resolve_req_free(q);
+		return 1 + ret;
+	}
+}
+
+/* resolver_cancel(resolver, id) -> whether it was still outstanding */
+static int api_resolver_cancel(lua_State * L)
+{
+	resolve_req    * q;
+	resolver       * r  = resolver_check(L, 1);
+	lua_Integer      id = luaL_checkinteger(L, 2);
+
+	pthread_mutex_lock(&r->lock);
+
+	for (q = r->reqs; NULL != q && q->id != id; q = q->next)
+		;
+
+	if (NULL != q && REQ_CANCELLED != q->state)
+	{
+		if (REQ_RUNNING == q->state)
+			q->state = REQ_CANCELLED;
+		else
+		{
+			resolver_unlink(r, q);
+			resolve_req_free(q);
+		}
+
+		lua_pushboolean(L, 1);
+	}
+	else
+		lua_pushboolean(L, 0);
+
+	pthread_mutex_unlock(&r->lock);
+
+	return 1;
+}
+
+/* resolver_fd(resolver) -> file handle that turns readable as lookups complete */
+static int api_resolver_fd(lua_State * L)
+{
+	resolver_check(L, 1);
+	lua_getuservalue(L, 1);
+	lua_rawgeti(L, -1, 1);
+
+	return 1;
+}
+
+/* resolver_deadline(resolver) -> seconds until the nearest request timeout, or nil */
+static int api_resolver_deadline(lua_State * L)
+{
+	double nearest = 0;
+
+	resolve_req    * q;
+	resolver * r = resolver_check(L, 1);
+
+	pthread_mutex_lock(&r->lock);
+
+	for (q = r->reqs; NULL != q; q = q->next)
+		if (REQ_CANCELLED != q->state && 0 != q->deadline && (0 == nearest || q->deadline < nearest))
+			nearest = q->deadline;
+
+	pthread_mutex_unlock(&r->lock);
+
+	if (0 == nearest)
+		lua_pushnil(L);
+	else
+		lua_pushnumber(L, MAX(0, nearest - monotonic_seconds()));
+
+	return 1;
+}
+
+static luaL_Reg resolver_methods[] =
+{
+	{ "resolve",  api_resolve           },
+	{ "next",     api_resolver_next     },
+	{ "cancel",   api_resolver_cancel   },
+	{ "fd",       api_resolver_fd       },
+	{ "deadline", api_resolver_deadline },
+	{ "close",    resolver_gc           },
+	{ NULL,       NULL                  }
+};
+
+static luaL_Reg resolver_meta[] =
+{
+	{ "__gc",  resolver_gc  },
+	{ "__len", resolver_len },
+	{ NULL,    NULL         }
+};
+
+#endif
+
+#ifdef __linux
+
+/* multi-core runtime: N threads, each running its own lua_State with lsock
+** loaded, fed connections by the owning state through single-producer
+** single-consumer fd rings.  An eventfd per worker says "the ring has something" */
+
+#define LSOCK_WORKERS "lsock.workers"
+#define LSOCK_WORKER  "lsock.worker"
+#define WORKERS_MAX   256
+
+EXPOSE_SYMBOL int luaopen_lsock(lua_State * L);
+
+typedef struct
+{
+	int *    slots;
+	unsigned mask;
+
+	volatile unsigned head; /* only the worker moves this */
+	volatile unsigned tail; /* only the dispatching state moves this */
+} fd_ring;
+
+typedef struct
+{
+	pthread_t thread;
+	int       started;
+	int       index;
+	int       cpu;     /* -1 for unpinned */
+	int       wakeup;  /* eventfd */
+
+	fd_ring ring;
+
+	volatile int active; /* handed over and not yet reported done() */
+	lua_Number   handed;
+
+	const char *     chunk;
+	size_t           chunk_len;
+	volatile int *   stopping;
+	char *           error; /* malloc'd message if the chunk failed */
+} lsock_worker;
+
+/* lives in the userdata; __gc stops and joins the threads before it goes away */
+typedef struct
+{
+	int closed;
+	int n;
+
+	volatile int stopping;
+
+	char * chunk;
+	size_t chunk_len;
+
+	lsock_worker workers[WORKERS_MAX];
+} workers;
+
+static int fd_ring_push(fd_ring * r, int fd)
+{
+	unsigned t = r->tail;
+
+	if (t - r->head > r->mask)
+		return 0;
+
+	r->slots[t & r->mask] = fd;
+
+	/* the slot has to be visible before the new tail is */
+	__sync_synchronize();
+	r->tail = t + 1;
+
+	return 1;
+}
+
+static int fd_ring_pop(fd_ring * r)
+{
+	int      fd;
+	unsigned h = r->head;
+
+	if (h == r->tail)
+		return -1;
+
+	__sync_synchronize();
+	fd = r->slots[h & r->mask];
+	__sync_synchronize();
+
+	r->head = h + 1;
+
+	return fd;
+}
+
+static void * worker_main(void * arg)
+{
+	lsock_worker ** ctx;
+
+	lsock_worker * w = (lsock_worker *) arg;
+	lua_State    * L = luaL_newstate();
+
+	if (NULL == L)
+	{
+		w->error = copy_string("worker: cannot create a lua_State");
+		return NULL;
+	}
+
+	if (-1 != w->cpu)
+	{
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(w->cpu, &set);
+
+		/* best effort: a restricted cpuset just leaves it floating */
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+
+	luaL_openlibs(L);
+	luaL_requiref(L, "lsock", luaopen_lsock, 1);
+	lua_pop(L, 1);
+
+	if (LUA_OK == luaL_loadbuffer(L, w->chunk, w->chunk_len, "=worker"))
+	{
+		ctx  = (lsock_worker **) lua_newuserdata(L, sizeof(lsock_worker *));
+		*ctx = w;
+		luaL_setmetatable(L, LSOCK_WORKER);
+
+		lua_newtable(L);
+		lua_setuservalue(L, -2);
+
+		lua_pushinteger(L, w->index + 1);
+
+		if (LUA_OK == lua_pcall(L, 2, 0, 0))
+			lua_pushnil(L);
+	}
+
+	if (!lua_isnil(L, -1))
+		w->error = copy_string(lua_isstring(L, -1) ? lua_tostring(L, -1) : "worker: error object is not a string");
+
+	lua_close(L);
+
+	return NULL;
+}
+
+static void workers_close(workers * rt)
+{
+	int i, fd;
+
+	if (rt->closed)
+		return;
+
+	rt->closed   = 1;
+	rt->stopping = 1;
+
+	__sync_synchronize();
+
+	for (i = 0; i < rt->n; i++)
+	{
+		uint64_t one = 1;
+
+		/* take() reports the stop whether or not this lands */
+		if (-1 != rt->workers[i].wakeup && -1 == write(rt->workers[i].wakeup, &one, sizeof(one)))
+			(void) 0;
+	}
+
+	/* a worker that never looks at take() keeps us here; there is no safe way to kill one */
+	for (i = 0; i < rt->n; i++)
+	{
+		lsock_worker * w = &rt->workers[i];
+
+		if (w->started)
+			pthread_join(w->thread, NULL);
+
+		/* connections nobody took */
+		if (NULL != w->ring.slots)
+			while (-1 != (fd = fd_ring_pop(&w->ring)))
+				close(fd);
+
+		if (-1 != w->wakeup)
+			close(w->wakeup);
+
+		free(w->ring.slots);
+	}
+
+	free(rt->chunk);
+}
+
+static workers * workers_check(lua_State * L, int idx)
+{
+	workers * rt = (workers *) luaL_checkudata(L, idx, LSOCK_WORKERS);
+
+	if (rt->closed)
+		luaL_argerror(L, idx, "workers have been stopped");
+
+	return rt;
+}
+
+static lsock_worker * worker_check(lua_State * L, int idx)
+{
+	return *(lsock_worker **) luaL_checkudata(L, idx, LSOCK_WORKER);
+}
+
+/* workers(n, chunk[, { pin = false | true | { cpu, ... }, queue = 1024 }]) -> runtime
+** each thread runs chunk(worker, index) in a fresh lua_State with lsock loaded;
+** the chunk should return once worker:take() reports the runtime stopping */
+static int api_workers(lua_State * L)
+{
+	int i, ncpu, queue;
+
+	size_t       len   = 0;
+	int          n     = luaL_checkint(L, 1);
+	const char * chunk = luaL_checklstring(L, 2, &len);
+	workers    * rt;
+
+	luaL_argcheck(L, n > 0 && n <= WORKERS_MAX, 1, "between 1 and 256 workers");
+
+	lua_settop(L, 3);
+
+	if (!lua_isnil(L, 3))
+		luaL_checktype(L, 3, LUA_TTABLE);
+	else
+	{
+		lua_newtable(L);
+		lua_replace(L, 3);
+	}
+
+	lua_getfield(L, 3, "queue");
+	queue = luaL_optint(L, -1, 1024);
+	lua_pop(L, 1);
+
+	luaL_argcheck(L, queue > 0 && 0 == (queue & (queue - 1)), 3, "queue must be a power of 2");
+
+	rt = (workers *) LSOCK_NEWUDATA(L, sizeof(workers)); /* 4 */
+
+	for (i = 0; i < WORKERS_MAX; i++)
+		rt->workers[i].wakeup = -1;
+
+	luaL_setmetatable(L, LSOCK_WORKERS);
+
+	rt->chunk = (char *) malloc(len);
+
+	if (NULL == rt->chunk)
+		return luaL_error(L, "workers(): out of memory");
+
+	memcpy(rt->chunk, chunk, len);
+	rt->chunk_len = len;
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+	lua_getfield(L, 3, "pin");
+
+	for (i = 0; i < n; i++)
+	{
+		lsock_worker * w = &rt->workers[i];
+
+		w->index     = i;
+		w->chunk     = rt->chunk;
+		w->chunk_len = rt->chunk_len;
+		w->stopping  = &rt->stopping;
+		w->cpu       = -1;
+
+		if (lua_istable(L, -1))
+		{
+			lua_rawgeti(L, -1, i + 1);
+			w->cpu = luaL_optint(L, -1, -1);
+			lua_pop(L, 1);
+		}
+		else if (lua_toboolean(L, -1) && ncpu > 0)
+			w->cpu = i % ncpu;
+
+		/* count the worker as part of the runtime now so a failure below still cleans it up */
+		rt->n = i + 1;
+
+		w->ring.slots = (int *) malloc(queue * sizeof(int));
+		w->ring.mask  = queue - 1;
+
+		if (NULL == w->ring.slots)
+			return luaL_error(L, "workers(): out of memory");
+
+		w->wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+		if (-1 == w->wakeup)
+			return LSOCK_STRFATAL(L, "eventfd()");
+
+		errno = pthread_create(&w->thread, NULL, worker_main, w);
+
+		if (errno)
+			return LSOCK_STRFATAL(L, "pthread_create()");
+
+		w->started = 1;
+	}
+
+	lua_pop(L, 1);
+
+	return 1;
+}
+
+/* workers_dispatch(runtime, sock) -> index of the worker that now owns it
+** the least-loaded worker (queued + active) with room gets it; the handle
+** here is closed because the descriptor belongs to that worker from now on */
+static int api_workers_dispatch(lua_State * L)
+{
+	int i, fd, best = -1, best_load = 0;
+
+	workers  * rt   = workers_check(L, 1);
+	uint64_t   one  = 1;
+
+	fd = dup(LSOCK_CHECKFD(L, 2));
+
+	if (-1 == fd)
+		return LSOCK_STRERROR(L, "dup()");
+
+	for (i = 0; i < rt->n; i++)
+	{
+		fd_ring * r    = &rt->workers[i].ring;
+		int       load = (int) (r->tail - r->head) + rt->workers[i].active;
+
+		if (r->tail - r->head > r->mask)
+			continue;
+
+		if (-1 == best || load < best_load)
+		{
+			best      = i;
+			best_load = load;
+		}
+	}
+
+	if (-1 == best)
+	{
+		close(fd);
+		return lsock_error(L, EAGAIN, (char * (*)(int)) &strerror, "workers_dispatch()");
+	}
+
+	__sync_fetch_and_add(&rt->workers[best].active, 1);
+	rt->workers[best].handed++;
+
+	fd_ring_push(&rt->workers[best].ring, fd);
+
+	/* the counter can't realistically overflow, a failed wakeup only delays the next take() */
+	if (-1 == write(rt->workers[best].wakeup, &one, sizeof(one)))
+		(void) 0;
+
+	close_handle(L, 2);
+
+	lua_pushinteger(L, best + 1);
+
+	return 1;
+}
+
+/* workers_stats(runtime) -> { { queued =, active =, handed = }, ... } */
+static int api_workers_stats(lua_State * L)
+{
+	int i;
+
+	workers * rt = workers_check(L, 1);
+
+	lua_createtable(L, rt->n, 0);
+
+	for (i = 0; i < rt->n; i++)
+	{
+		lsock_worker * w = &rt->workers[i];
+
+		lua_createtable(L, 0, 3);
+		PUSHFIELD(L, -1, integer, "queued", (lua_Integer) (w->ring.tail - w->ring.head));
+		PUSHFIELD(L, -1, integer, "active", w->active);
+		PUSHFIELD(L, -1, number,  "handed", w->handed);
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	return 1;
+}
+
+/* workers_stop(runtime) -> { true or error message, ... } once every thread has returned */
+static int api_workers_stop(lua_State * L)
+{
+	int i;
+
+	workers * rt = workers_check(L, 1);
+
+	workers_close(rt);
+
+	lua_createtable(L, rt->n, 0);
+
+	for (i = 0; i < rt->n; i++)
+	{
+		lsock_worker * w = &rt->workers[i];
+
+		if (NULL == w->error)
+			lua_pushboolean(L, 1);
+		else
+		{
+			lua_pushstring(L, w->error);
+			free(w->error);
+			w->error = NULL;
+		}
+
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	return 1;
+}
+
+static int workers_gc(lua_State * L)
+{
+	int i;
+
+	workers * rt = (workers *) luaL_checkudata(L, 1, LSOCK_WORKERS);
+
+	workers_close(rt);
+
+	for (i = 0; i < rt->n; i++)
+		free(rt->workers[i].error);
+
+	return 0;
+}
+
+static int workers_len(lua_State * L)
+{
+	lua_pushinteger(L, workers_check(L, 1)->n);
+
+	return 1;
+}
+
+/* worker:take() -> the next connection handed to this worker,
+** or nil when there is none (and true as well once the runtime is stopping) */
+static int api_worker_take(lua_State * L)
+{
+	int           fd;
+	uint64_t      count;
+	luaL_Stream * stream;
+	lsock_worker * w = worker_check(L, 1);
+
+	/* reset the wakeup before looking, so a push racing with us re-arms it */
+	if (-1 == read(w->wakeup, &count, sizeof(count)) && EAGAIN != errno)
+		return LSOCK_STRERROR(L, "read()");
+
+	fd = fd_ring_pop(&w->ring);
+
+	if (-1 == fd)
+	{
+		lua_pushnil(L);
+		lua_pushboolean(L, *w->stopping);
+		return 2;
+	}
+
+	stream    = newfile(L);
+	stream->f = sock_to_file(L, fd, NULL);
+
+	return 1;
+}
+
+/* worker:done() -- one of the connections it took is finished, for load balancing */
+static int api_worker_done(lua_State * L)
+{
+	lsock_worker * w = worker_check(L, 1);
+
+	if (w->active > 0)
+		__sync_fetch_and_sub(&w->active, 1);
+
+	return 0;
+}
+
+/* worker:fd() -> file handle that turns readable when take() has something */
+static int api_worker_fd(lua_State * L)
+{
+	int           fd;
+	luaL_Stream * stream;
+	lsock_worker * w = worker_check(L, 1);
+
+	lua_getuservalue(L, 1);
+	lua_rawgeti(L, -1, 1);
+
+	if (!lua_isnil(L, -1))
+		return 1;
+
+	/* its own descriptor: this state's __gc shouldn't close the runtime's */
+	fd = dup(w->wakeup);
+
+	if (-1 == fd)
+		return LSOCK_STRERROR(L, "dup()");
+
+	stream    = newfile(L);
+	stream->f = fd_to_file(L, fd, "rb");
+
+	lua_pushvalue(L, -1);
+	lua_rawseti(L, -4, 1);
+
+	return 1;
+}
+
+static int api_worker_id(lua_State * L)
+{
+	lua_pushinteger(L, worker_check(L, 1)->index + 1);
+
+	return 1;
+}
+
+static luaL_Reg workers_methods[] =
+{
+	{ "dispatch", api_workers_dispatch },
+	{ "stats",    api_workers_stats    },
+	{ "stop",     api_workers_stop     },
+	{ NULL,       NULL                 }
+};
+
+static luaL_Reg workers_meta[] =
+{
+	{ "__gc",  workers_gc  },
+	{ "__len", workers_len },
+	{ NULL,    NULL        }
+};
+
+static luaL_Reg worker_methods[] =
+{
+	{ "take", api_worker_take },
+	{ "done", api_worker_done },
+	{ "fd",   api_worker_fd   },
+	{ "id",   api_worker_id   },
+	{ NULL,   NULL            }
+};
+
+static luaL_Reg worker_meta[] =
+{
+	{ NULL, NULL }
+};
+
+#endif
+
+#ifdef __linux
+
+/* same-host byte stream over a memfd-backed ring: one producer, one consumer,
+** no syscalls per message.  The consumer only pays for an eventfd wakeup once
+** it has found the ring empty and gone idle, and the producer only signals then */
+
+#define LSOCK_SHMRING "lsock.shmring"
+#define SHMRING_MAGIC 0x6c73726eu /* "lsrn" */
+
+/* a peer that could shrink the memfd would SIGBUS us on the next access */
+#define SHMRING_SEALS (F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW)
+
+/* shared between the processes; head, tail and idle each get a cache line */
+typedef struct
+{
+	uint32_t magic;
+	uint32_t size; /* data bytes, a power of 2 */
+	char     pad0[56];
+
+	volatile uint32_t head; /* bytes consumed, only the consumer moves it */
+	char              pad1[60];
+
+	volatile uint32_t tail; /* bytes produced, only the producer moves it */
+	char              pad2[60];
+
+	volatile uint32_t idle; /* the consumer is (about to be) waiting on the eventfd */
+	char              pad3[60];
+} shmring_hdr;
+
+typedef struct
+{
+	shmring_hdr * hdr;
+	char        * data;
+	size_t        mapped;
+	uint32_t      size; /* hdr->size as checked at map time; the peer can rewrite the header */
+
+	int memfd;
+	int eventfd;
+} shmring;
+
+static shmring * shmring_check(lua_State * L, int idx)
+{
+	shmring * r = (shmring *) luaL_checkudata(L, idx, LSOCK_SHMRING);
+
+	if (NULL == r->hdr)
+		luaL_argerror(L, idx, "ring is closed");
+
+	return r;
+}
+
+static void shmring_close(shmring * r)
+{
+	if (NULL != r->hdr)
+		munmap(r->hdr, r->mapped);
+
+	if (-1 != r->memfd)   close(r->memfd);
+	if (-1 != r->eventfd) close(r->eventfd);
+
+	r->hdr     = NULL;
+	r->memfd   = -1;
+	r->eventfd = -1;
+}
+
+/* pushes a ring mapping memfd; it owns both descriptors from here on, even on failure
+** size is nonzero only for a brand new ring, whose header it fills in */
+static int shmring_map(lua_State * L, int memfd, int efd, uint32_t size)
+{
+	struct stat st;
+	void      * base;
+	int         seals;
+	shmring   * r = (shmring *) LSOCK_NEWUDATA(L, sizeof(shmring));
+
+	r->memfd   = memfd;
+	r->eventfd = efd;
+
+	luaL_setmetatable(L, LSOCK_SHMRING);
+
+	lua_newtable(L);
+	lua_setuservalue(L, -2);
+
+	seals = fcntl(memfd, F_GET_SEALS);
+
+	if (-1 == seals)
+		return LSOCK_STRERROR(L, "fcntl(F_GET_SEALS)");
+
+	if ((seals & SHMRING_SEALS) != SHMRING_SEALS)
+		return lsock_error(L, EPERM, (char * (*)(int)) &strerror, "ring not sealed");
+
+	if (fstat(memfd, &st))
+		return LSOCK_STRERROR(L, "fstat()");
+
+	if ((size_t) st.st_size <= sizeof(shmring_hdr))
+		return lsock_error(L, EINVAL, (char * (*)(int)) &strerror, "mmap()");
+
+	base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+
+	if (MAP_FAILED == base)
+		return LSOCK_STRERROR(L, "mmap()");
+
+	r->hdr    = (shmring_hdr *) base;
+	r->data   = (char *) base + sizeof(shmring_hdr);
+	r->mapped = st.st_size;
+
+	if (size)
+	{
+		r->hdr->size  = size;
+		r->hdr->magic = SHMRING_MAGIC;
+	}
+
+	/* never trust the other side's header further than the mapping; read size just once */
+	size = *(volatile uint32_t *) &r->hdr->size;
+
+	if (SHMRING_MAGIC != r->hdr->magic || 0 == size || size & (size - 1) || size > r->mapped - sizeof(shmring_hdr))
+	{
+		shmring_close(r);
+		return lsock_error(L, EINVAL, (char * (*)(int)) &strerror, "mmap()");
+	}
+
+	r->size = size;
+
+	return 1;
+}
+
+/* shmring([size = 65536]) -> ring; size is rounded up to a power of 2
+** hand shmring_fds() to the peer (see send_fds()), which calls shmring_attach() */
+static int api_shmring(lua_State * L)
+{
+	int        memfd, efd;
+	uint32_t   size = 64;
+	lua_Number want = luaL_optnumber(L, 1, 65536);
+
+	luaL_argcheck(L, want > 0 && want <= 1 << 30, 1, "size must be between 1 byte and 1 GiB");
+
+	while (size < want)
+		size <<= 1;
+
+	memfd = memfd_create("lsock.shmring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+	if (-1 == memfd)
+		return LSOCK_STRERROR(L, "memfd_create()");
+
+	efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (-1 == efd || ftruncate(memfd, sizeof(shmring_hdr) + size) || fcntl(memfd, F_ADD_SEALS, SHMRING_SEALS))
+	{
+		int err = NET_ERRNO;
+
+		close(memfd);
+
+		if (-1 != efd)
+			close(efd);
+
+		return lsock_error(L, err, (char * (*)(int)) &strerror, "shmring()");
+	}
+
+	return shmring_map(L, memfd, efd, size);
+}
+
+/* shmring_attach(memfd, eventfd) -> ring, the other end of what shmring_fds() gave out */
+static int api_shmring_attach(lua_State * L)
+{
+	int memfd = dup(LSOCK_CHECKFD(L, 1));
+	int efd;
+
+	if (-1 == memfd)
+		return LSOCK_STRERROR(L, "dup()");
+
+	efd = dup(LSOCK_CHECKFD(L, 2));
+
+	if (-1 == efd)
+	{
+		int err = NET_ERRNO;
+
+		close(memfd);
+		return lsock_error(L, err, (char * (*)(int)) &strerror, "dup()");
+	}
+
+	return shmring_map(L, memfd, efd, 0);
+}
+
+/* shmring_fds(ring) -> memfd, eventfd; fresh handles, ready for send_fds() */
+static int api_shmring_fds(lua_State * L)
+{
+	int i;
+
+	shmring * r      = shmring_check(L, 1);
+	int       fds[2];
+
+	fds[0] = r->memfd;
+	fds[1] = r->eventfd;
+
+	for (i = 0; i < 2; i++)
+	{
+		luaL_Stream * stream;
+		int           fd = dup(fds[i]);
+
+		if (-1 == fd)
+			return LSOCK_STRERROR(L, "dup()");
+
+		stream    = newfile(L);
+		stream->f = fd_to_file(L, fd, "r+b");
+	}
+
+	return 2;
+}
+
+/* shmring_send(ring, data) -> bytes queued, possibly fewer than #data (nil, msg, EAGAIN when full)
+** producer side only */
+static int api_shmring_send(lua_State * L)
+{
+	uint32_t head, tail, room, n, at, first;
+
+	size_t       len  = 0;
+	shmring    * r    = shmring_check(L, 1);
+	const char * data = luaL_checklstring(L, 2, &len);
+
+	head = r->hdr->head;
+	tail = r->hdr->tail;
+
+	/* more queued than fits: the peer scribbled on the header */
+	if (tail - head > r->size)
+		return lsock_error(L, EPROTO, (char * (*)(int)) &strerror, "shmring_send()");
+
+	room = r->size - (tail - head);
+
+	if (0 == room && len > 0)
+		return lsock_error(L, EAGAIN, (char * (*)(int)) &strerror, "shmring_send()");
+
+	n     = (uint32_t) MIN(len, room);
+	at    = tail & (r->size - 1);
+	first = MIN(n, r->size - at);
+
+	/* copy out before the consumer can see the bytes */
+	__sync_synchronize();
+
+	memcpy(r->data + at, data,         first);
+	memcpy(r->data,      data + first, n - first);
+
+	__sync_synchronize();
+	r->hdr->tail = tail + n;
+	__sync_synchronize();
+
+	/* only a consumer that went to sleep needs the syscall */
+	if (n > 0 && r->hdr->idle && __sync_bool_compare_and_swap(&r->hdr->idle, 1, 0))
+	{
+		uint64_t one = 1;
+
+		if (-1 == write(r->eventfd, &one, sizeof(one)))
+			(void) 0;
+	}
+
+	lua_pushnumber(L, n);
+
+	return 1;
+}
+
+/* shmring_recv(ring, buflen) -> up to buflen bytes (nil, msg, EAGAIN when empty)
+** consumer side only; an empty ring arms the wakeup, so select() on shmring_fd() next */
+static int api_shmring_recv(lua_State * L)
+{
+	uint32_t head, tail, n, at, first;
+	char   * buf;
+	luaL_Buffer B;
+
+	shmring * r      = shmring_check(L, 1);
+	size_t    buflen = luaL_checkint(L, 2);
+
+	head = r->hdr->head;
+	tail = r->hdr->tail;
+
+	if (head == tail)
+	{
+		uint64_t count;
+
+		/* swallow a stale wakeup, then announce we're idle and look once more:
+		** a producer that published before seeing idle is caught by the recheck */
+		if (-1 == read(r->eventfd, &count, sizeof(count)))
+			(void) 0;
+
+		r->hdr->idle = 1;
+		__sync_synchronize();
+
+		tail = r->hdr->tail;
+
+		if (head == tail)
+			return lsock_error(L, EAGAIN, (char * (*)(int)) &strerror, "shmring_recv()");
+
+		r->hdr->idle = 0;
+	}
+
+	if (tail - head > r->size)
+		return lsock_error(L, EPROTO, (char * (*)(int)) &strerror, "shmring_recv()");
+
+	__sync_synchronize();
+
+	n     = (uint32_t) MIN(buflen, tail - head);
+	at    = head & (r->size - 1);
+	first = MIN(n, r->size - at);
+
+	buf = luaL_buffinitsize(L, &B, n);
+
+	memcpy(buf,         r->data + at, first);
+	memcpy(buf + first, r->data,      n - first);
+
+	__sync_synchronize();
+	r->hdr->head = head + n;
+
+	luaL_pushresultsize(&B, n);
+
+	return 1;
+}
+
+/* shmring_fd(ring) -> handle that turns readable once an idle consumer has data */
+static int api_shmring_fd(lua_State * L)
+{
+	int           fd;
+	luaL_Stream * stream;
+	shmring     * r = shmring_check(L, 1);
+
+	lua_getuservalue(L, 1);
+	lua_rawgeti(L, -1, 1);
+
+	if (!lua_isnil(L, -1))
+		return 1;
+
+	fd = dup(r->eventfd);
+
+	if (-1 == fd)
+		return LSOCK_STRERROR(L, "dup()");
+
+	stream    = newfile(L);
+	stream->f = fd_to_file(L, fd, "rb");
+
+	lua_pushvalue(L, -1);
+	lua_rawseti(L, -4, 1);
+
+	return 1;
+}
+
+static int shmring_gc(lua_State * L)
+{
+	shmring_close((shmring *) luaL_checkudata(L, 1, LSOCK_SHMRING));
+
+	return 0;
+}
+
+/* bytes waiting in the ring */
+static int shmring_len(lua_State * L)
+{
+	shmring * r = shmring_check(L, 1);
+
+	lua_pushnumber(L, r->hdr->tail - r->hdr->head);
+
+	return 1;
+}
+
+static luaL_Reg shmring_methods[] =
+{
+	{ "send", api_shmring_send },
+	{ "recv", api_shmring_recv },
+	{ "fd",   api_shmring_fd   },
+	{ "fds",  api_shmring_fds  },
+	{ NULL,   NULL             }
+};
+
+static luaL_Reg shmring_meta[] =
+{
+	{ "__gc",  shmring_gc  },
+	{ "__len", shmring_len },
+	{ NULL,    NULL        }
+};
+
+#endif
+
+/* hierarchical timer wheel: WHEEL_LEVELS rings of WHEEL_SIZE slots, each level
+** WHEEL_SIZE times coarser than the one below.  Timers sit in doubly-linked slot
+** lists (O(1) add and cancel) and cascade down a level whenever the ring below wraps. */
+
+#define LSOCK_TIMERWHEEL "lsock.timerwheel"
+
+#define WHEEL_BITS     6
+#define WHEEL_SIZE     (1 << WHEEL_BITS)
+#define WHEEL_MASK     (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS   4
+#define WHEEL_OVERFLOW (WHEEL_LEVELS * WHEEL_SIZE) /* list for timers past the top level */
+#define WHEEL_LISTS    (WHEEL_OVERFLOW + 1)
+
+/* a timer id packs its slot in the timer array with a generation count, so stale ids miss */
+#define TIMER_ID_SPAN 16777216.0 /* 2^24 timers */
+
+typedef struct
+{
+	int prev, next;
+	int list;          /* which slot list, -1 when free */
+	unsigned long gen;
+	unsigned long due; /* in ticks */
+} wheel_timer;
+
+typedef struct
+{
+	double start;      /* monotonic ns at tick 0 */
+	double tick;       /* ns per tick */
+
+	unsigned long now; /* the last tick processed */
+
+	int count;
+	int cap;
+	int free;          /* free list through next */
+
+	int heads[WHEEL_LISTS];
+
+	int    timerfd;    /* -1 until timer_fd() asks for one */
+	double armed;      /* the tick it is armed for, 0 if disarmed */
+
+	wheel_timer * timers;
+} timer_wheel;
+
+static void wheel_link(timer_wheel * w, int i, int list)
+{
+	wheel_timer * t = &w->timers[i];
+
+	t->list = list;
+	t->prev = -1;
+	t->next = w->heads[list];
+
+	if (-1 != t->next)
+		w->timers[t->next].prev = i;
+
+	w->heads[list] = i;
+}
+
+static void wheel_unlink(timer_wheel * w, int i)
+{
+	wheel_timer * t = &w->timers[i];
+
+	if (-1 == t->prev) w->heads[t->list] = t->next; else w->timers[t->prev].next = t->next;
+	if (-1 != t->next) w->timers[t->next].prev = t->prev;
+
+	t->list = -1;
+}
+
+/* files timer i under the level its distance from now calls for */
+static void wheel_place(timer_wheel * w, int i)
+{
+	int level;
+	unsigned long due  = w->timers[i].due;
+	unsigned long diff = due - w->now;
+
+	for (level = 0; level < WHEEL_LEVELS; level++)
+		if (diff < 1ul << (WHEEL_BITS * (level + 1)))
+			break;
+
+	if (WHEEL_LEVELS == level)
+		wheel_link(w, i, WHEEL_OVERFLOW);
+	else
+		wheel_link(w, i, level * WHEEL_SIZE + (int) ((due >> (WHEEL_BITS * level)) & WHEEL_MASK));
+}
+
+/* ticks from now until the wheel next has something to do (a lower bound above level 0);
+** every level gets a say, a cascade up top can come due before the first level 0 slot */
+static int wheel_next(const timer_wheel * w, unsigned long * ticks)
+{
+	int level, i, found = 0;
+
+	if (0 == w->count)
+		return 0;
+
+	for (level = 0; level < WHEEL_LEVELS; level++)
+	{
+		int           shift = WHEEL_BITS * level;
+		unsigned long pos   = w->now >> shift;
+
+		for (i = 1; i <= WHEEL_SIZE; i++)
+			if (-1 != w->heads[level * WHEEL_SIZE + (int) ((pos + i) & WHEEL_MASK)])
+			{
+				/* level 0 slots expire; higher ones cascade at the start of their span */
+				unsigned long at = ((pos + i) << shift) - w->now;
+
+				if (!found || at < *ticks)
+					*ticks = at;
+
+				found = 1;
+				break;
+			}
+	}
+
+	/* overflow timers get another look when the top level wraps */
+	if (-1 != w->heads[WHEEL_OVERFLOW])
+	{
+		unsigned long at = (((w->now >> (WHEEL_BITS * WHEEL_LEVELS)) + 1) << (WHEEL_BITS * WHEEL_LEVELS)) - w->now;
+
+		if (!found || at < *ticks)
+			*ticks = at;
+
+		found = 1;
+	}
+
+	return found;
+}
+
+static void wheel_cascade(timer_wheel * w, int list)
+{
+	int i = w->heads[list];
+
+	w->heads[list] = -1;
+
+	while (-1 != i)
+	{
+		int next = w->timers[i].next;
+
+		wheel_place(w, i);
+		i = next;
+	}
+}
+
+#ifdef __linux
+static void wheel_arm(timer_wheel * w)
+{
+	unsigned long     ticks = 0;
+	struct itimerspec its;
+
+	if (-1 == w->timerfd)
+		return;
+
+	ZERO_OUT(&its, sizeof(its));
+
+	if (wheel_next(w, &ticks))
+	{
+		double at = w->start + (w->now + ticks) * w->tick;
+
+		its.it_value.tv_sec  = (time_t) (at / 1e9);
+		its.it_value.tv_nsec = (long) (at - its.it_value.tv_sec * 1e9);
+
+		/* zero would disarm it */
+		if (0 == its.it_value.tv_sec && 0 == its.it_value.tv_nsec)
+			its.it_value.tv_nsec = 1;
+
+		w->armed = w->now + ticks;
+	}
+	else
+		w->armed = 0;
+
+	timerfd_settime(w->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* timer_fd() hands the descriptor out as a file; once that gets closed the number
+** may already belong to someone else, so the wheel forgets it instead of touching it */
+static void wheel_checkfd(lua_State * L, int idx, timer_wheel * w)
+{
+	luaL_Stream * stream;
+
+	if (-1 == w->timerfd)
+		return;
+
+	lua_getuservalue(L, idx);
+	lua_getfield(L, -1, "fd");
+
+	stream = (luaL_Stream *) lua_touserdata(L, -1);
+
+	if (NULL == stream || NULL == stream->closef)
+	{
+		w->timerfd = -1;
+		w->armed   = 0;
+
+		lua_pushnil(L);
+		lua_setfield(L, -3, "fd");
+	}
+
+	lua_pop(L, 2);
+}
+#else
+#	define wheel_arm(w) ((void) (w))
+#	define wheel_checkfd(L, idx, w) ((void) (w))
+#endif
+
+static timer_wheel * wheel_check(lua_State * L, int idx)
+{
+	timer_wheel * w = (timer_wheel *) luaL_checkudata(L, idx, LSOCK_TIMERWHEEL);
+
+	if (NULL == w->timers && w->cap > 0)
+		luaL_argerror(L, idx, "timer wheel is gone");
+
+	return w;
+}
+
+/* runs the wheel up to the present, appending expired values to the table on top of the stack */
+static int wheel_advance(lua_State * L, int idx, timer_wheel * w)
+{
+	int expired = 0;
+	unsigned long target = (unsigned long) ((monotonic_ns() - w->start) / w->tick);
+
+	idx = lua_absindex(L, idx);
+
+	wheel_checkfd(L, idx, w);
+
+	lua_getuservalue(L, idx);
+
+	/* nothing pending: no need to walk the empty slots */
+	if (0 == w->count && target > w->now)
+		w->now = target;
+
+	while (w->now < target)
+	{
+		int level, i;
+
+		w->now++;
+
+		for (level = 1; level <= WHEEL_LEVELS; level++)
+		{
+			int shift = WHEEL_BITS * (level - 1);
+
+			if (0 != ((w->now >> shift) & WHEEL_MASK))
+				break;
+
+			wheel_cascade(w, WHEEL_LEVELS == level ? WHEEL_OVERFLOW : level * WHEEL_SIZE + (int) ((w->now >> (shift + WHEEL_BITS)) & WHEEL_MASK));
+		}
+
+		i = w->heads[w->now & WHEEL_MASK];
+		w->heads[w->now & WHEEL_MASK] = -1;
+
+		while (-1 != i)
+		{
+			int next = w->timers[i].next;
+
+			w->timers[i].list = -1;
+			w->timers[i].gen++;
+			w->timers[i].next = w->free;
+			w->free = i;
+			w->count--;
+
+			lua_rawgeti(L, -1, i + 1);
+			lua_rawseti(L, -3, ++expired);
+
+			lua_pushnil(L);
+			lua_rawseti(L, -2, i + 1);
+
+			i = next;
+		}
+
+		if (0 == w->count && target > w->now)
+			w->now = target;
+	}
+
+	lua_pop(L, 1);
+
+#ifdef __linux
+	if (-1 != w->timerfd)
+	{
+		char drain[8];
+
+		while (read(w->timerfd, drain, sizeof(drain)) > 0)
+			;
+	}
+#endif
+
+	wheel_arm(w);
+
+	return expired;
+}
+
+static int wheel_gc(lua_State * L)
+{
+	timer_wheel * w = (timer_wheel *) luaL_checkudata(L, 1, LSOCK_TIMERWHEEL);
+
+	free(w->timers);
+	w->timers = NULL;
+
+	return 0;
+}
+
+static int wheel_len(lua_State * L)
+{
+	lua_pushinteger(L, wheel_check(L, 1)->count);
+
+	return 1;
+}
+
+/* timer_wheel([resolution in seconds, default 1ms]) */
+static int api_timer_wheel(lua_State * L)
+{
+	int i;
+	lua_Number    resolution = luaL_optnumber(L, 1, 0.001);
+	timer_wheel * w;
+
+	luaL_argcheck(L, resolution > 0, 1, "resolution must be positive");
+
+	w = (timer_wheel *) LSOCK_NEWUDATA(L, sizeof(timer_wheel));
+
+	w->start   = monotonic_ns();
+	w->tick    = resolution * 1e9;
+	w->free    = -1;
+	w->timerfd = -1;
+
+	for (i = 0; i < WHEEL_LISTS; i++)
+		w->heads[i] = -1;
+
+	luaL_setmetatable(L, LSOCK_TIMERWHEEL);
+
+	lua_newtable(L);
+	lua_setuservalue(L, -2);
+
+	return 1;
+}
+
+/* timer_add(wheel, seconds, value) -> id; value comes back from timer_advance() */
+static int api_timer_add(lua_State * L)
+{
+	int i;
+	double ticks;
+
+	timer_wheel * w     = wheel_check(L, 1);
+	lua_Number    delay = luaL_checknumber(L, 2);
+
+	luaL_checkany(L, 3);
+
+	if (-1 == w->free)
+	{
+		int           cap   = w->cap ? w->cap * 2 : 64;
+		wheel_timer * grown;
+
+		if (cap > TIMER_ID_SPAN)
+			return luaL_error(L, "timer_add(): too many timers");
+
+		grown = (wheel_timer *) realloc(w->timers, cap * sizeof(wheel_timer));
+
+		if (NULL == grown)
+			return luaL_error(L, "timer_add(): out of memory");
+
+		for (i = cap - 1; i >= w->cap; i--)
+		{
+			grown[i].list = -1;
+			grown[i].gen  = 0;
+			grown[i].next = w->free;
+			w->free = i;
+		}
+
+		w->timers = grown;
+		w->cap    = cap;
+	}
+
+	i = w->free;
+	w->free = w->timers[i].next;
+
+	/* due on a later tick than the one already processed, never sooner */
+	ticks = (monotonic_ns() + delay * 1e9 - w->start) / w->tick;
+	w->timers[i].due = MAX((unsigned long) (ticks > 0 ? ticks + 0.999999 : 0), w->now + 1);
+
+	wheel_place(w, i);
+	w->count++;
+
+	lua_getuservalue(L, 1);
+	lua_pushvalue(L, 3);
+	lua_rawseti(L, -2, i + 1);
+
+#ifdef __linux
+	wheel_checkfd(L, 1, w);
+
+	if (-1 != w->timerfd && (0 == w->armed || w->timers[i].due < w->armed))
+		wheel_arm(w);
+#endif
+
+	lua_pushnumber(L, w->timers[i].gen * TIMER_ID_SPAN + i);
+
+	return 1;
+}
+
+/* timer_cancel(wheel, id) -> whether it was still pending */
+static int api_timer_cancel(lua_State * L)
+{
+	timer_wheel * w  = wheel_check(L, 1);
+	lua_Number    id = luaL_checknumber(L, 2);
+
+	unsigned long gen = (unsigned long) (id / TIMER_ID_SPAN);
+	lua_Number    i   = id - gen * TIMER_ID_SPAN;
+
+	if (i < 0 || i >= w->cap || -1 == w->timers[(int) i].list || w->timers[(int) i].gen != gen)
+	{
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+
+	wheel_unlink(w, (int) i);
+
+	w->timers[(int) i].gen++;
+	w->timers[(int) i].next = w->free;
+	w->free = (int) i;
+	w->count--;
+
+	lua_getuservalue(L, 1);
+	lua_pushnil(L);
+	lua_rawseti(L, -2, (int) i + 1);
+
+	lua_pushboolean(L, 1);
+
+	return 1;
+}
+
+/* timer_advance(wheel) -> { values of every timer that came due } */
+static int api_timer_advance(lua_State * L)
+{
+	timer_wheel * w = wheel_check(L, 1);
+
+	lua_newtable(L);
+	wheel_advance(L, 1, w);
+
+	return 1;
+}
+
+/* timer_next(wheel) -> seconds until the wheel wants timer_advance() again, or nil when idle */
+static int api_timer_next(lua_State * L)
+{
+	unsigned long ticks = 0;
+	timer_wheel * w     = wheel_check(L, 1);
+
+	if (!wheel_next(w, &ticks))
+	{
+		lua_pushnil(L);
+		return 1;
+	}
+
+	lua_pushnumber(L, MAX(0, w->start + (w->now + ticks) * w->tick - monotonic_ns()) / 1e9);
+
+	return 1;
+}
+
+#ifdef __linux
+
+/* timer_fd(wheel) -> file handle readable whenever timer_advance() has work */
+static int api_timer_fd(lua_State * L)
+{
+	luaL_Stream * stream;
+	timer_wheel * w = wheel_check(L, 1);
+
+	wheel_checkfd(L, 1, w);
+
+	lua_getuservalue(L, 1);
+	lua_getfield(L, -1, "fd");
+
+	if (!lua_isnil(L, -1))
+		return 1;
+
+	w->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+	if (-1 == w->timerfd)
+		return LSOCK_STRERROR(L, "timerfd_create()");
+
+	stream    = newfile(L);
+	stream->f = fd_to_file(L, w->timerfd, "rb");
+
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -4, "fd");
+
+	wheel_arm(w);
+
+	return 1;
+}
+
+#endif
+
+static luaL_Reg timer_wheel_methods[] =
+{
+	{ "add",     api_timer_add     },
+	{ "cancel",  api_timer_cancel  },
+	{ "advance", api_timer_advance },
+	{ "next",    api_timer_next    },
+#ifdef __linux
+	{ "fd",      api_timer_fd      },
+#endif
+	{ NULL,      NULL              }
+};
+
+static luaL_Reg timer_wheel_meta[] =
+{
+	{ "__gc",  wheel_gc  },
+	{ "__len", wheel_len },
+	{ NULL,    NULL      }
+};
+
+/* log-scale latency histogram: per_decade buckets for every power of 10 between
+** lowest and highest, plus one bucket on each end for everything outside */
+
+#define LSOCK_HISTOGRAM "lsock.histogram"
+
+typedef struct
+{
+	double lowest;
+	double per_decade;
+	int    nbuckets;
+
+	lua_Number count;
+	double     sum, min, max;
+
+	lua_Number buckets[1]; /* really nbuckets of them */
+} histogram;
+
+static int histogram_bucket(const histogram * h, double v)
+{
+	double at;
+
+	if (v < h->lowest)
+		return 0;
+
+	at = log10(v / h->lowest) * h->per_decade;
+
+	return (int) MIN(at + 1, h->nbuckets - 1);
+}
+
+/* where a bucket's values lie, geometrically halfway */
+static double histogram_value(const histogram * h, int bucket)
+{
+	if (0 == bucket)
+		return h->min;
+
+	if (h->nbuckets - 1 == bucket)
+		return h->max;
+
+	return h->lowest * pow(10, (bucket - 0.5) / h->per_decade);
+}
+
+static double histogram_percentile(const histogram * h, double p)
+{
+	int        i;
+	lua_Number seen = 0;
+	lua_Number want = p / 100 * h->count;
+
+	for (i = 0; i < h->nbuckets; i++)
+	{
+		seen += h->buckets[i];
+
+		if (seen >= want && seen > 0)
+			return MAX(h->min, MIN(h->max, histogram_value(h, i)));
+	}
+
+	return h->max;
+}
+
+static void histogram_add(histogram * h, double v)
+{
+	h->buckets[histogram_bucket(h, v)]++;
+
+	h->min = 0 == h->count ? v : MIN(h->min, v);
+	h->max = 0 == h->count ? v : MAX(h->max, v);
+
+	h->count++;
+	h->sum += v;
+}
+
+/* histogram([lowest = 1e-6[, highest = 100[, per_decade = 20]]]) -- seconds, about 12% resolution by default */
+static int api_histogram(lua_State * L)
+{
+	double      nbuckets;
+	histogram * h;
+
+	lua_Number lowest     = luaL_optnumber(L, 1, 1e-6);
+	lua_Number highest    = luaL_optnumber(L, 2, 100);
+	lua_Number per_decade = luaL_optnumber(L, 3, 20);
+
+	/* NaN fails these comparisons too */
+	luaL_argcheck(L, lowest > 0,                               1, "must be positive");
+	luaL_argcheck(L, highest > lowest && highest < HUGE_VAL,   2, "must be finite and above lowest");
+	luaL_argcheck(L, per_decade >= 1 && per_decade < HUGE_VAL, 3, "at least 1 bucket per decade");
+
+	/* sized as a double first: highest / lowest and the product can both leave int range */
+	nbuckets = ceil(log10(highest / lowest) * per_decade) + 2;
+
+	luaL_argcheck(L, nbuckets <= 65536, 3, "too many buckets");
+
+	h = (histogram *) LSOCK_NEWUDATA(L, sizeof(histogram) + ((int) nbuckets - 1) * sizeof(lua_Number));
+
+	h->lowest     = lowest;
+	h->per_decade = per_decade;
+	h->nbuckets   = (int) nbuckets;
+
+	luaL_setmetatable(L, LSOCK_HISTOGRAM);
+
+	return 1;
+}
+
+/* histogram_add(h, seconds, ...) -> h */
+static int api_histogram_add(lua_State * L)
+{
+	int i, n = lua_gettop(L);
+
+	histogram * h = (histogram *) luaL_checkudata(L, 1, LSOCK_HISTOGRAM);
+
+	for (i = 2; i <= n; i++)
+		histogram_add(h, luaL_checknumber(L, i));
+
+	lua_settop(L, 1);
+
+	return 1;
+}
+
+/* histogram_add_deltas(h, records, from, to, pending[, field]) -> # of deltas added
+** pairs stamps of the same id, e.g. recv_tx_timestamps() records from 'sent' to 'ack'
+** (wire + peer time) or 'sched' to 'sent' (qdisc time); pending carries unmatched
+** from-stamps between calls.  field picks the clock: 'software' (default) or 'hardware' */
+static int api_histogram_add_deltas(lua_State * L)
+{
+	int i, n, added = 0;
+
+	histogram  * h     = (histogram *) luaL_checkudata(L, 1, LSOCK_HISTOGRAM);
+	const char * from  = luaL_checkstring(L, 3);
+	const char * to    = luaL_checkstring(L, 4);
+	const char * field = luaL_optstring(L, 6, "software");
+
+	luaL_checktype(L, 2, LUA_TTABLE);
+	luaL_checktype(L, 5, LUA_TTABLE);
+
+	n = lua_rawlen(L, 2);
+
+	for (i = 1; i <= n; i++)
+	{
+		const char * type;
+
+		lua_rawgeti(L, 2, i);   /* record */
+		lua_getfield(L, -1, "type");
+		lua_getfield(L, -2, "id");
+		lua_getfield(L, -3, field);
+
+		type = lua_tostring(L, -3);
+
+		if (NULL != type && lua_isnumber(L, -1))
+		{
+			if (0 == strcmp(type, from))
+			{
+				lua_pushvalue(L, -2);
+				lua_pushvalue(L, -2);
+				lua_rawset(L, 5);
+			}
+			else if (0 == strcmp(type, to))
+			{
+				lua_pushvalue(L, -2);
+				lua_rawget(L, 5);
+
+				if (lua_isnumber(L, -1))
+				{
+					histogram_add(h, lua_tonumber(L, -2) - lua_tonumber(L, -1));
+					added++;
+
+					lua_pushvalue(L, -3);
+					lua_pushnil(L);
+					lua_rawset(L, 5);
+				}
+
+				lua_pop(L, 1);
+			}
+		}
+
+		lua_pop(L, 4);
+	}
+
+	lua_pushinteger(L, added);
+
+	return 1;
+}
+
+/* histogram_stats(h[, { percentiles... } = { 50, 90, 99, 99.9 }]) -> { count, min, max, mean, p50 =, ... } */
+static int api_histogram_stats(lua_State * L)
+{
+	int i, n;
+
+	histogram * h = (histogram *) luaL_checkudata(L, 1, LSOCK_HISTOGRAM);
+
+	static const double defaults[] = { 50, 90, 99, 99.9 };
+
+	lua_settop(L, 2);
+
+	lua_createtable(L, 0, 8);
+
+	PUSHFIELD(L, -1, number, "count", h->count);
+
+	if (0 == h->count)
+		return 1;
+
+	PUSHFIELD(L, -1, number, "min",  h->min);
+	PUSHFIELD(L, -1, number, "max",  h->max);
+	PUSHFIELD(L, -1, number, "mean", h->sum / h->count);
+
+	n = lua_isnil(L, 2) ? (int) LENGTH(defaults) : (int) lua_rawlen(L, 2);
+
+	for (i = 0; i < n; i++)
+	{
+		double p;
+
+		if (lua_isnil(L, 2))
+			p = defaults[i];
+		else
+		{
+			lua_rawgeti(L, 2, i + 1);
+			p = luaL_checknumber(L, -1);
+			lua_pop(L, 1);
+		}
+
+		/* 99.9 -> "p99.9" */
+		lua_pushnumber(L, p);
+		lua_pushfstring(L, "p%s", lua_tostring(L, -1));
+		lua_remove(L, -2);
+		lua_pushnumber(L, histogram_percentile(h, p));
+		lua_rawset(L, -3);
+	}
+
+	return 1;
+}
+
+static int api_histogram_reset(lua_State * L)
+{
+	histogram * h = (histogram *) luaL_checkudata(L, 1, LSOCK_HISTOGRAM);
+
+	h->count = 0;
+	h->sum   = h->min = h->max = 0;
+
+	ZERO_OUT(h->buckets, h->nbuckets * sizeof(lua_Number));
+
+	lua_settop(L, 1);
+
+	return 1;
+}
+
+static int histogram_len(lua_State * L)
+{
+	lua_pushnumber(L, ((histogram *) luaL_checkudata(L, 1, LSOCK_HISTOGRAM))->count);
+
+	return 1;
+}
+
+static luaL_Reg histogram_methods[] =
+{
+	{ "add",        api_histogram_add        },
+	{ "add_deltas", api_histogram_add_deltas },
+	{ "stats",      api_histogram_stats      },
+	{ "reset",      api_histogram_reset      },
+	{ NULL,         NULL                     }
+};
+
+static luaL_Reg histogram_meta[] =
+{
+	{ "__len", histogram_len },
+	{ NULL,    NULL          }
+};
+
+enum { R, W, E };
+
+/* select(r, w, e [, timeout [, timer_wheel]]) -> r, w, e [, expired timer values]
+** with a wheel, its next expiry caps the timeout */
+static int api_select(lua_State * L)
+{
+	int x, y, stat;
+
+	fd_set set[3];
+	int highsock = 0;
+	struct timeval tv, * t = NULL;
+	timer_wheel * wheel = NULL;
+
+	luaL_checktype(L, 1, LUA_TTABLE); /*  readfds */
+	luaL_checktype(L, 2, LUA_TTABLE); /* writefds */
+	luaL_checktype(L, 3, LUA_TTABLE); /* errorfds */
+
+	/* { tv_sec = s, tv_usec = us } or just seconds */
+	if (!lua_isnoneornil(L, 4))
+	{
+		table_to_timeval(L, 4, &tv);
+		t = &tv;
+	}
+
+	if (!lua_isnoneornil(L, 5))
+	{
+		unsigned long ticks = 0;
+
+		wheel = wheel_check(L, 5);
+
+		if (wheel_next(wheel, &ticks))
+		{
+			double left = MAX(0, wheel->start + (wheel->now + ticks) * wheel->tick - monotonic_ns()) / 1e9;
+
+			if (NULL == t || left < tv.tv_sec + tv.tv_usec / 1e6)
+			{
+				tv.tv_sec  = (long) left;
+				tv.tv_usec = (long) ((left - tv.tv_sec) * 1e6 + 1); /* never short of the tick */
+
+				/* the +1 can round a .999999 fraction up to a whole second, which select() rejects */
+				if (tv.tv_usec >= 1000000)
+				{
+					tv.tv_sec  += tv.tv_usec / 1000000;
+					tv.tv_usec %= 1000000;
+				}
+
+				t = &tv;
+			}
+		}
+	}
+
+	ZERO_OUT(&set, sizeof(set));
+
+	/* parse tables into fd_sets */
+	for (x = 1; x <= 3; x++)
+	{
+		int how_many = luaL_len(L, x);
+
+		for (y = 1; y <= how_many; y++)
+		{
+			int fd = -1;
+
+			lua_pushnumber(L, y);
+			lua_gettable(L, x);
+
+			fd = LSOCK_CHECKFD(L, -1);
+			lua_pop(L, 1);
+
+			highsock = MAX(highsock, fd);
+
+			FD_SET(fd, &set[x - 1]);
+		}
+	}
+
+	stat = select(highsock + 1, &set[R], &set[W], &set[E], t);
+
+	if (-1 == stat)
+		return LSOCK_STRERROR(L, NULL);
+
+	/* parse fd_sets back into tables */
+	for (x = 1; x <= 3; x++)
+	{
+		int ready    = 0;
+		int how_many = luaL_len(L, x);
+
+		/* reuse stat for how many array elems we might have */
+		lua_createtable(L, stat, 0);
+
+		for (y = 1; y <= how_many; y++)
+		{
+			int fd;
+
+			/* push the file handle (socket) userdata */
+			lua_pushnumber(L, y);
+			lua_gettable(L, x);
+
+			fd = LSOCK_CHECKFD(L, -1);
+
+			if (FD_ISSET(fd, &set[x - 1]))
+			{
+				lua_pushnumber(L, ++ready); /* the numeric index */
+				lua_pushvalue(L, -2);       /* the file handle */
+				lua_settable(L, -4);        /* the new outgoing table */
+			}
+
+			/* remove the file handle userdata */
+			lua_pop(L, 1);
+		}
+	}
+
+	if (NULL == wheel)
+		return 3;
+
+	lua_newtable(L);
+	wheel_advance(L, 5, wheel);
+
+	/* returns the read, write, and exception tables (and the expired timers) */
+	return 4;
+}
+
+static int api_unread_bytes(lua_State * L)
+{
+	lsocket s = LSOCK_CHECKSOCK(L, 1);
+
+	size_t available = 0;
+
+#ifdef _WIN32
+	if (ioctlsocket(s, FIONREAD, (u_long *) &available))
+		return LSOCK_STRERROR(L, "ioctlsocket()");
+#else
+	if (ioctl(s, FIONREAD, &available))
+		return LSOCK_STRERROR(L, "ioctl()");
+#endif
+
+	lua_pushnumber(L, available);
+	return 1;
+}
+
+static int api_pipe(lua_State * L)
+{
+	lsocket pair[2] = { -1, -1 };
+
+	luaL_Stream * r = NULL;
+	luaL_Stream * w = NULL;
+
+#ifdef _WIN32
+	if (0 == CreatePipe((PHANDLE) &pair[0], (PHANDLE) &pair[1], NULL, (DWORD) luaL_optnumber(L, 1, 0)))
+		return lsock_error(L, GetLastError(), (char * (*)(int)) &strerror, "CreatePipe()");
+#else
+	if (pipe(pair))
+		return LSOCK_STRERROR(L, NULL);
+#endif
+
+	r = newfile(L);
+	r->f = fd_to_file(L, pair[0], "rb");
+
+	w = newfile(L);
+	w->f = fd_to_file(L, pair[1], "wb");
+
+	return 2;
+}
+
+
+#ifndef _WIN32
+
+/* FIXME: Windows -> connect 2 TCP sockets on random (local) port */
+
+static int api_socketpair(lua_State * L)
+{
+	int pair[2] = { -1, -1 };
+
+	luaL_Stream * one = NULL;
+	luaL_Stream * two = NULL;
+
+	int domain   = luaL_checknumber(L, 1),
+		type     = luaL_checknumber(L, 2),
+		protocol = luaL_checknumber(L, 3);
+
+	if (socketpair(domain, type, protocol, pair))
+		return LSOCK_STRERROR(L, NULL);
+
+	one = newfile(L);
+	one->f = fd_to_file(L, pair[0], NULL);
+
+	two = newfile(L);
+	two->f = fd_to_file(L, pair[1], NULL);
+
+	return 2;
+}
+
+/* the kernel's per-message cap on passed descriptors (SCM_MAX_FD on Linux) */
+#define FDS_PER_MSG 253
+
+typedef union
+{
+	struct cmsghdr hdr;
+	char           buf[CMSG_SPACE(FDS_PER_MSG * sizeof(int))];
+} rights_control;
+
+/* one sendmsg() carrying data and n (<= FDS_PER_MSG) descriptors in SCM_RIGHTS */
+static ssize_t send_rights(lsocket s, const char * data, size_t len, const int * fds, int n, int flags)
+{
+	struct msghdr    msg;
+	struct iovec     iov;
+	struct cmsghdr * cmsg;
+	rights_control   control;
+
+	ZERO_OUT(&msg,     sizeof(msg));
+	ZERO_OUT(&control, sizeof(control));
+
+	iov.iov_base = (void *) data;
+	iov.iov_len  = len;
+
+	msg.msg_iov        = &iov;
+	msg.msg_iovlen     = 1;
+	msg.msg_control    = control.buf;
+	msg.msg_controllen = CMSG_SPACE(n * sizeof(int));
+
+	cmsg             = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type  = SCM_RIGHTS;
+	cmsg->cmsg_len   = CMSG_LEN(n * sizeof(int));
+
+	/* CMSG_DATA() needn't be int-aligned */
+	memcpy(CMSG_DATA(cmsg), fds, n * sizeof(int));
+
+#ifdef __linux
+	flags |= MSG_NOSIGNAL;
+#endif
+
+	return sendmsg(s, &msg, flags);
+}
+
+/* one recvmsg() into buf, collecting up to maxfds passed descriptors into fds
+** *n gets how many arrived; *truncated whether the kernel had to drop (close) some */
+static ssize_t recv_rights(lsocket s, char * buf, size_t len, int * fds, int maxfds, int * n, int * truncated, int flags)
+{
+	ssize_t gotten;
+
+	struct msghdr    msg;
+	struct iovec     iov;
+	struct cmsghdr * cmsg;
+	rights_control   control;
+
+	ZERO_OUT(&msg,     sizeof(msg));
+	ZERO_OUT(&control, sizeof(control));
+
+	*n = 0;
+
+	iov.iov_base = buf;
+	iov.iov_len  = len;
+
+	msg.msg_iov        = &iov;
+	msg.msg_iovlen     = 1;
+	msg.msg_control    = control.buf;
+	msg.msg_controllen = CMSG_SPACE(maxfds * sizeof(int));
+
+#ifdef __linux
+	flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+	gotten = recvmsg(s, &msg, flags);
+
+	if (-1 == gotten)
+		return -1;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); NULL != cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		if (SOL_SOCKET == cmsg->cmsg_level && SCM_RIGHTS == cmsg->cmsg_type)
+		{
+			int i;
+			int got  = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			int keep = MIN(got, maxfds - *n);
+
+			memcpy(fds + *n, CMSG_DATA(cmsg), keep * sizeof(int));
+			*n += keep;
+
+			/* only a lying cmsg_len gets here, but don't leak them */
+			for (i = keep; i < got; i++)
+			{
+				int extra;
+
+				memcpy(&extra, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+				close(extra);
+			}
+		}
+
+	*truncated = 0 != (msg.msg_flags & MSG_CTRUNC);
+
+	return gotten;
+}
+
+/* send_fds(sock, data, { handles or raw fds... }[, flags]) -> bytes of data sent
+** up to FDS_PER_MSG descriptors ride along with data in one SCM_RIGHTS message;
+** a stream socket needs at least one byte of data to carry them */
+static int api_send_fds(lua_State * L)
+{
+	int i, n;
+	ssize_t sent;
+
+	int fds[FDS_PER_MSG];
+
+	size_t       data_len = 0;
+	lsocket      s        = LSOCK_CHECKSOCK(L, 1);
+	const char * data     = luaL_checklstring(L, 2, &data_len);
+	int          flags    = luaL_optint(L, 4, 0);
+
+	luaL_checktype(L, 3, LUA_TTABLE);
+
+	n = lua_rawlen(L, 3);
+
+	luaL_argcheck(L, n > 0 && n <= FDS_PER_MSG, 3, "between 1 and 253 descriptors per message");
+
+	for (i = 0; i < n; i++)
+	{
+		lua_rawgeti(L, 3, i + 1);
+		fds[i] = lua_type(L, -1) == LUA_TNUMBER ? lua_tointeger(L, -1) : LSOCK_CHECKFD(L, -1);
+		lua_pop(L, 1);
+	}
+
+	sent = send_rights(s, data, data_len, fds, n, flags);
+
+	if (-1 == sent)
+		return LSOCK_STRERROR(L, "sendmsg()");
+
+	lua_pushnumber(L, sent);
+
+	return 1;
+}
+
+/* recv_fds(sock[, maxfds = 253[, buflen = 4096[, flags]]]) -> data, { handles... }, truncated
+** descriptors arrive wrapped like accept()'s sockets (other files get a mode matching how they were opened);
+** truncated means the sender passed more than maxfds and the kernel closed the rest */
+static int api_recv_fds(lua_State * L)
+{
+	int i, n = 0, truncated = 0;
+	ssize_t gotten;
+	char  * buf;
+	luaL_Buffer B;
+
+	int    fds[FDS_PER_MSG];
+	FILE * files[FDS_PER_MSG];
+
+	lsocket s      = LSOCK_CHECKSOCK(L, 1);
+	int     maxfds = luaL_optint(L, 2, FDS_PER_MSG);
+	size_t  buflen = luaL_optint(L, 3, 4096);
+	int     flags  = luaL_optint(L, 4, 0);
+
+	luaL_argcheck(L, maxfds > 0 && maxfds <= FDS_PER_MSG, 2, "between 1 and 253 descriptors per message");
+
+	buf = luaL_buffinitsize(L, &B, buflen);
+
+	gotten = recv_rights(s, buf, buflen, fds, maxfds, &n, &truncated, flags);
+
+	if (-1 == gotten)
+		return LSOCK_STRERROR(L, "recvmsg()");
+
+	/* wrap every descriptor before anything can raise: bailing out halfway would leak the rest */
+	for (i = 0; i < n; i++)
+	{
+		int  type = 0;
+		int  mode = fcntl(fds[i], F_GETFL) & O_ACCMODE;
+		socklen_t sz = sizeof(type);
+
+		if (0 == getsockopt(fds[i], SOL_SOCKET, SO_TYPE, &type, &sz))
+			files[i] = fdopen(fds[i], "r+b");
+		else
+			files[i] = fdopen(fds[i], O_RDONLY == mode ? "rb" : O_WRONLY == mode ? "wb" : "r+b");
+
+		if (NULL == files[i])
+		{
+			int j, err = errno;
+
+			for (j = 0; j < i; j++)
+				fclose(files[j]);
+
+			for (j = i; j < n; j++)
+				close(fds[j]);
+
+			return lsock_error(L, err, (char * (*)(int)) &strerror, "fdopen()");
+		}
+	}
+
+	luaL_pushresultsize(&B, gotten);
+
+	lua_createtable(L, n, 0);
+
+	for (i = 0; i < n; i++)
+	{
+		luaL_Stream * stream = newfile(L);
+
+		stream->f = files[i];
+
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	lua_pushboolean(L, truncated);
+
+	return 3;
+}
+
+#ifdef __linux
+
+/* large local messages as sealed memfds: the bytes are written once, only the
+** descriptor crosses the socket, and the receiver maps it read-only.  The seals
+** promise the mapping can't change or shrink under the receiver (no SIGBUS) */
+
+#define PAYLOAD_SEALS (F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE)
+
+/* returns a sealed memfd holding data, or -1 with errno set */
+static int payload_create(const char * data, size_t len)
+{
+	int    err;
+	size_t done = 0;
+	int    fd   = memfd_create("lsock.payload", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+	if (-1 == fd)
+		return -1;
+
+	if (ftruncate(fd, len))
+		goto fail;
+
+	while (done < len)
+	{
+		ssize_t wrote = pwrite(fd, data + done, len - done, done);
+
+		if (-1 == wrote)
+		{
+			if (EINTR == errno)
+				continue;
+
+			goto fail;
+		}
+
+		done += wrote;
+	}
+
+	if (fcntl(fd, F_ADD_SEALS, PAYLOAD_SEALS))
+		goto fail;
+
+	return fd;
+
+fail:
+	err = errno;
+	close(fd);
+	errno = err;
+
+	return -1;
+}
+
+/* pushes a payload mapping the sealed memfd fd (which stays the caller's to close) */
+static int payload_map(lua_State * L, int fd)
+{
+	struct stat     st;
+	void          * base  = NULL;
+	int             seals = fcntl(fd, F_GET_SEALS);
+	lsock_payload * p;
+
+	if (-1 == seals)
+		return LSOCK_STRERROR(L, "fcntl(F_GET_SEALS)");
+
+	/* unsealed, the sender could still truncate it while we read */
+	if ((seals & (F_SEAL_SHRINK | F_SEAL_WRITE)) != (F_SEAL_SHRINK | F_SEAL_WRITE))
+		return lsock_error(L, EPERM, (char * (*)(int)) &strerror, "payload not sealed");
+
+	if (fstat(fd, &st))
+		return LSOCK_STRERROR(L, "fstat()");
+
+	/* mmap() refuses empty mappings */
+	if (st.st_size > 0)
+	{
+		base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+		if (MAP_FAILED == base)
+			return LSOCK_STRERROR(L, "mmap()");
+	}
+
+	p = (lsock_payload *) LSOCK_NEWUDATA(L, sizeof(lsock_payload));
+
+	p->data = NULL == base ? "" : (const char *) base;
+	p->len  = st.st_size;
+
+	luaL_setmetatable(L, LSOCK_PAYLOAD);
+
+	return 1;
+}
+
+/* payload_memfd(data) -> sealed memfd handle with a copy of data (string, payload or { s, i, j }) */
+static int api_payload_memfd(lua_State * L)
+{
+	int           fd;
+	size_t        len  = 0;
+	const char  * data = NULL;
+	luaL_Stream * stream;
+
+	strij(L, 1, &data, &len);
+
+	fd = payload_create(data, len);
+
+	if (-1 == fd)
+		return LSOCK_STRERROR(L, "payload_memfd()");
+
+	stream    = newfile(L);
+	stream->f = fd_to_file(L, fd, "rb");
+
+	return 1;
+}
+
+/* payload_map(memfd handle) -> payload; the handle may be closed afterwards */
+static int api_payload_map(lua_State * L)
+{
+	return payload_map(L, LSOCK_CHECKFD(L, 1));
+}
+
+/* send_payload(sock, data[, flags]) -> bytes of payload handed over
+** the message itself is one byte plus the descriptor, whatever the size of data */
+static int api_send_payload(lua_State * L)
+{
+	int         fd;
+	ssize_t     sent;
+	size_t      len   = 0;
+	const char * data = NULL;
+
+	lsocket s     = LSOCK_CHECKSOCK(L, 1);
+	int     flags = luaL_optint(L, 3, 0);
+
+	strij(L, 2, &data, &len);
+
+	fd = payload_create(data, len);
+
+	if (-1 == fd)
+		return LSOCK_STRERROR(L, "send_payload()");
+
+	sent = send_rights(s, "P", 1, &fd, 1, flags);
+
+	/* the peer holds its own reference once it's queued */
+	if (-1 == sent)
+	{
+		int err = NET_ERRNO;
+
+		close(fd);
+		return lsock_error(L, err, (char * (*)(int)) &strerror, "sendmsg()");
+	}
+
+	close(fd);
+
+	lua_pushnumber(L, len);
+
+	return 1;
+}
+
+/* recv_payload(sock[, flags]) -> payload, read-only and mapped straight from the sender's memfd */
+static int api_recv_payload(lua_State * L)
+{
+	int     fd = -1, n = 0, truncated = 0, ret;
+	char    marker;
+	ssize_t gotten;
+
+	lsocket s     = LSOCK_CHECKSOCK(L, 1);
+	int     flags = luaL_optint(L, 2, 0);
+
+	gotten = recv_rights(s, &marker, 1, &fd, 1, &n, &truncated, flags);
+
+	if (-1 == gotten)
+		return LSOCK_STRERROR(L, "recvmsg()");
+
+	if (0 == gotten && 0 == n)
+		return lsock_error(L, ECONNRESET, (char * (*)(int)) &strerror, "recv_payload()");
+
+	if (0 == n)
+		return lsock_error(L, EPROTO, (char * (*)(int)) &strerror, "recv_payload(): no descriptor");
+
+	/* the mapping keeps the memory alive on its own */
+	ret = payload_map(L, fd);
+	close(fd);
+
+	return ret;
+}
+
+/* payload:sub([i[, j]]) -> a copy of that slice, string.sub() style; frames too */
+static int api_payload_sub(lua_State * L)
+{
+	lsock_payload * p = payload_check(L, 1);
+
+	size_t i = posrelat(luaL_optinteger(L, 2,  1), p->len);
+	size_t j = posrelat(luaL_optinteger(L, 3, -1), p->len);
+
+	i = MAX(i, 1);
+	j = MIN(j, p->len);
+
+	if (i > j)
+		lua_pushliteral(L, "");
+	else
+		lua_pushlstring(L, p->data + i - 1, j - i + 1);
+
+	return 1;
+}
+
+static int payload_gc(lua_State * L)
+{
+	lsock_payload * p = (lsock_payload *) luaL_checkudata(L, 1, LSOCK_PAYLOAD);
+
+	if (p->len > 0)
+		munmap((void *) p->data, p->len);
+
+	p->data = "";
+	p->len  = 0;
+
+	return 0;
+}
+
+static int payload_len(lua_State * L)
+{
+	lua_pushnumber(L, payload_check(L, 1)->len);
+
+	return 1;
+}
+
+static luaL_Reg payload_methods[] =
+{
+	{ "sub", api_payload_sub },
+	{ NULL,  NULL            }
+};
+
+static luaL_Reg payload_meta[] =
+{
+	{ "__gc",  payload_gc  },
+	{ "__len", payload_len },
+	{ NULL,    NULL        }
+};
+
+#endif
+
+#ifdef __linux
+
+/* AF_PACKET capture through a TPACKET_V3 ring: the kernel fills whole blocks of
+** frames in memory shared with us, so walking them costs no syscall at all.
+** frames come out as views (see LSOCK_FRAME) that point straight into the ring */
+
+#define LSOCK_PACKETRING "lsock.packetring"
+
+typedef struct
+{
+	char       * map;
+	size_t       mapped;
+	unsigned int block_size;
+	unsigned int blocks;
+
+	unsigned int          block; /* the one we're on */
+	unsigned int          left;  /* its frames not handed out yet */
+	int                   held;  /* it's ours until we give it back */
+	struct tpacket3_hdr * frame; /* the next one of them */
+} packet_ring;
+
+static packet_ring * packet_ring_check(lua_State * L, int idx)
+{
+	packet_ring * r = (packet_ring *) luaL_checkudata(L, idx, LSOCK_PACKETRING);
+
+	if (NULL == r->map)
+		luaL_argerror(L, idx, "ring is not mapped");
+
+	return r;
+}
+
+static struct tpacket_block_desc * packet_ring_block(const packet_ring * r, unsigned int i)
+{
+	return (struct tpacket_block_desc *) (r->map + (size_t) i * r->block_size);
+}
+
+static int packet_ring_opt(lua_State * L, int idx, const char * field, int def)
+{
+	int n;
+
+	if (lua_isnoneornil(L, idx))
+		return def;
+
+	luaL_checktype(L, idx, LUA_TTABLE);
+	lua_getfield(L, idx, field);
+	n = luaL_optint(L, -1, def);
+	lua_pop(L, 1);
+
+	return n;
+}
+
+/* packet_ring([interface[, { protocol = ETH_P_ALL, blocks = 16, block_size = 256 KiB, frame_size = 2048, timeout = 10, fanout = group[, fanout_mode = PACKET_FANOUT_HASH] }]])
+** -> ring; every interface without one.  timeout (ms) retires a block that isn't full yet.
+** rings on the same fanout group id split the traffic between them, one per worker */
+static int api_packet_ring(lua_State * L)
+{
+	int                version = TPACKET_V3;
+	void             * base;
+	lsocket            s;
+	luaL_Stream      * stream;
+	packet_ring      * r;
+	struct tpacket_req3 req;
+	struct sockaddr_ll  sll;
+
+	int protocol   = packet_ring_opt(L, 2, "protocol",   ETH_P_ALL);
+	int blocks     = packet_ring_opt(L, 2, "blocks",     16);
+	int block_size = packet_ring_opt(L, 2, "block_size", 1 << 18);
+	int frame_size = packet_ring_opt(L, 2, "frame_size", 2048);
+	int timeout    = packet_ring_opt(L, 2, "timeout",    10);
+	int fanout     = packet_ring_opt(L, 2, "fanout",     -1);
+	int mode       = packet_ring_opt(L, 2, "fanout_mode", PACKET_FANOUT_HASH);
+
+	luaL_argcheck(L, blocks > 0 && block_size > 0 && 0 == block_size % getpagesize(), 2, "block_size must be a multiple of the page size");
+	luaL_argcheck(L, frame_size >= (int) TPACKET3_HDRLEN && 0 == frame_size % TPACKET_ALIGNMENT && 0 == block_size % frame_size, 2, "frame_size must be aligned and divide block_size");
+
+	ZERO_OUT(&sll, sizeof(sll));
+
+	sll.sll_family   = AF_PACKET;
+	sll.sll_protocol = htons(protocol);
+	sll.sll_ifindex  = interface_index(L, 1);
+
+	r = (packet_ring *) LSOCK_NEWUDATA(L, sizeof(packet_ring));
+
+	luaL_setmetatable(L, LSOCK_PACKETRING);
+
+	s = socket(AF_PACKET, SOCK_RAW, htons(protocol));
+
+	if (INVALID_SOCKET == s)
+		return LSOCK_STRERROR(L, "socket()");
+
+	/* the ring keeps its socket as an ordinary handle, which closes itself */
+	lua_createtable(L, 1, 0);
+	stream    = newfile(L);
+	stream->f = sock_to_file(L, s, NULL);
+	lua_rawseti(L, -2, 1);
+	lua_setuservalue(L, -2);
+
+	if (setsockopt(s, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)))
+		return LSOCK_STRERROR(L, "setsockopt(PACKET_VERSION)");
+
+	ZERO_OUT(&req, sizeof(req));
+
+	req.tp_block_size       = block_size;
+	req.tp_block_nr         = blocks;
+	req.tp_frame_size       = frame_size;
+	req.tp_frame_nr         = (block_size / frame_size) * blocks;
+	req.tp_retire_blk_tov   = timeout;
+	req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+
+	if (setsockopt(s, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)))
+		return LSOCK_STRERROR(L, "setsockopt(PACKET_RX_RING)");
+
+	base = mmap(NULL, (size_t) block_size * blocks, PROT_READ | PROT_WRITE, MAP_SHARED, s, 0);
+
+	if (MAP_FAILED == base)
+		return LSOCK_STRERROR(L, "mmap()");
+
+	r->map        = (char *) base;
+	r->mapped     = (size_t) block_size * blocks;
+	r->block_size = block_size;
+	r->blocks     = blocks;
+
+	if (bind(s, (struct sockaddr *) &sll, sizeof(sll)))
+		return LSOCK_STRERROR(L, "bind()");
+
+	if (fanout >= 0)
+	{
+		int arg = (fanout & 0xffff) | (mode << 16);
+
+		if (setsockopt(s, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)))
+			return LSOCK_STRERROR(L, "setsockopt(PACKET_FANOUT)");
+	}
+
+	return 1;
+}
+
+/* gives a finished block back to the kernel and moves on to the next */
+static void packet_ring_release(packet_ring * r)
+{
+	__sync_synchronize();
+
+	packet_ring_block(r, r->block)->hdr.bh1.block_status = TP_STATUS_KERNEL;
+
+	r->held  = 0;
+	r->left  = 0;
+	r->block = (r->block + 1) % r->blocks;
+}
+
+/* the iterator behind packet_ring_frames(): upvalues are the ring and the view it re-points */
+static int packet_ring_next(lua_State * L)
+{
+	struct tpacket3_hdr * f;
+
+	packet_ring   * r    = packet_ring_check(L, lua_upvalueindex(1));
+	lsock_payload * view = (lsock_payload *) lua_touserdata(L, lua_upvalueindex(2));
+
+	/* the frame handed out last time was only good until now */
+	view->data = "";
+	view->len  = 0;
+
+	while (!r->held || 0 == r->left)
+	{
+		struct tpacket_block_desc * b;
+
+		if (r->held)
+			packet_ring_release(r);
+
+		b = packet_ring_block(r, r->block);
+
+		if (!(b->hdr.bh1.block_status & TP_STATUS_USER))
+			return 0;
+
+		__sync_synchronize();
+
+		r->held  = 1;
+		r->left  = b->hdr.bh1.num_pkts;
+		r->frame = (struct tpacket3_hdr *) ((char *) b + b->hdr.bh1.offset_to_first_pkt);
+	}
+
+	f = r->frame;
+
+	r->left--;
+	r->frame = (struct tpacket3_hdr *) ((char *) f + f->tp_next_offset);
+
+	view->data = (char *) f + f->tp_mac;
+	view->len  = f->tp_snaplen;
+
+	lua_pushvalue(L, lua_upvalueindex(2));
+	lua_pushnumber(L, f->tp_len);
+	lua_pushnumber(L, f->tp_sec + f->tp_nsec / 1e9);
+
+	return 3;
+}
+
+/* for frame, wire_len, timestamp in packet_ring_frames(ring) do ... end
+** walks every frame the kernel has handed over so far, without blocking; wait on
+** packet_ring_socket() for more.  frame is one view, re-pointed at each step and
+** only valid until the next -- frame:sub() copies what you want to keep.
+** the view keeps the ring (and so its mapping) alive for as long as it is around */
+static int api_packet_ring_frames(lua_State * L)
+{
+	lsock_payload * view;
+
+	packet_ring_check(L, 1);
+
+	lua_settop(L, 1);
+
+	view = (lsock_payload *) LSOCK_NEWUDATA(L, sizeof(lsock_payload));
+	view->data = "";
+
+	luaL_setmetatable(L, LSOCK_FRAME);
+
+	lua_createtable(L, 1, 0);
+	lua_pushvalue(L, 1);
+	lua_rawseti(L, -2, 1);
+	lua_setuservalue(L, -2);
+
+	lua_pushcclosure(L, &packet_ring_next, 2);
+
+	return 1;
+}
+
+/* packet_ring_socket(ring) -> the AF_PACKET socket underneath, for select() and friends */
+static int api_packet_ring_socket(lua_State * L)
+{
+	packet_ring_check(L, 1);
+
+	lua_getuservalue(L, 1);
+	lua_rawgeti(L, -1, 1);
+
+	return 1;
+}
+
+/* packet_ring_stats(ring) -> { packets =, drops =, freezes = } since the last call */
+static int api_packet_ring_stats(lua_State * L)
+{
+	struct tpacket_stats_v3 st;
+	socklen_t sz = sizeof(st);
+
+	packet_ring_check(L, 1);
+
+	lua_getuservalue(L, 1);
+	lua_rawgeti(L, -1, 1);
+
+	ZERO_OUT(&st, sz);
+
+	if (getsockopt(LSOCK_CHECKSOCK(L, -1), SOL_PACKET, PACKET_STATISTICS, &st, &sz))
+		return LSOCK_STRERROR(L, "getsockopt(PACKET_STATISTICS)");
+
+	lua_createtable(L, 0, 3);
+	PUSHFIELD(L, -1, number, "packets", st.tp_packets);
+	PUSHFIELD(L, -1, number, "drops",   st.tp_drops);
+	PUSHFIELD(L, -1, number, "freezes", st.tp_freeze_q_cnt);
+
+	return 1;
+}
+
+static int packet_ring_gc(lua_State * L)
+{
+	packet_ring * r = (packet_ring *) luaL_checkudata(L, 1, LSOCK_PACKETRING);
+
+	if (NULL != r->map)
+		munmap(r->map, r->mapped);
+
+	r->map = NULL;
+
+	return 0;
+}
+
+static luaL_Reg packet_ring_methods[] =
+{
+	{ "frames", api_packet_ring_frames },
+	{ "socket", api_packet_ring_socket },
+	{ "stats",  api_packet_ring_stats  },
+	{ NULL,     NULL                   }
+};
+
+static luaL_Reg packet_ring_meta[] =
+{
+	{ "__gc", packet_ring_gc },
+	{ NULL,   NULL           }
+};
+
+static luaL_Reg frame_methods[] =
+{
+	{ "sub", api_payload_sub },
+	{ NULL,  NULL            }
+};
+
+static luaL_Reg frame_meta[] =
+{
+	{ "__len", payload_len },
+	{ NULL,    NULL        }
+};
+
+#endif
+
+#ifdef __linux
+
+/* SO_TIMESTAMPING: the kernel stamps packets as they arrive (RX) and as they
+** leave (TX, reported back on the error queue); the stamps are CLOCK_REALTIME */
+
+static double timespec_seconds(const struct timespec * t)
+{
+	return t->tv_sec + t->tv_nsec / 1e9;
+}
+
+static double realtime_seconds(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_REALTIME, &t);
+
+	return timespec_seconds(&t);
+}
+
+/* { software =, hardware = } from an SCM_TIMESTAMPING cmsg, leaving out the zeroes */
+static void stamps_to_table(lua_State * L, const struct scm_timestamping * ts)
+{
+	lua_createtable(L, 0, 3);
+
+	if (ts->ts[0].tv_sec || ts->ts[0].tv_nsec)
+		PUSHFIELD(L, -1, number, "software", timespec_seconds(&ts->ts[0]));
+
+	/* ts[1] is deprecated and always zero */
+	if (ts->ts[2].tv_sec || ts->ts[2].tv_nsec)
+		PUSHFIELD(L, -1, number, "hardware", timespec_seconds(&ts->ts[2]));
+}
+
+/* recv_timestamped(sock, buflen[, flags]) -> data, packed source address, stamps
+** stamps = { software =, hardware =, queued = } when SO_TIMESTAMPING asked for RX stamps;
+** queued is how long it sat in the kernel before this call read it */
+static int api_recv_timestamped(lua_State * L)
+{
+	ssize_t gotten;
+	char  * buf;
+
+	struct msghdr    msg;
+	struct iovec     iov;
+	struct cmsghdr * cmsg;
+	lsockaddr        from;
+	luaL_Buffer      B;
+
+	union
+	{
+		struct cmsghdr hdr;
+		char           buf[CMSG_SPACE(sizeof(struct scm_timestamping)) + 256];
+	} control;
+
+	lsocket s      = LSOCK_CHECKSOCK(L, 1);
+	size_t  buflen = luaL_checkint(L, 2);
+	int     flags  = luaL_optint(L, 3, 0);
+
+	ZERO_OUT(&msg,     sizeof(msg));
+	ZERO_OUT(&from,    sizeof(from));
+	ZERO_OUT(&control, sizeof(control));
+
+	buf = luaL_buffinitsize(L, &B, buflen);
+
+	iov.iov_base = buf;
+	iov.iov_len  = buflen;
+
+	msg.msg_name       = &from;
+	msg.msg_namelen    = sizeof(from);
+	msg.msg_iov        = &iov;
+	msg.msg_iovlen     = 1;
+	msg.msg_control    = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	gotten = recvmsg(s, &msg, flags);
+
+	if (-1 == gotten)
+		return LSOCK_STRERROR(L, "recvmsg()");
+
+	luaL_pushresultsize(&B, gotten);
+
+	lua_pushlstring(L, (char *) &from, msg.msg_namelen);
+
+	lua_createtable(L, 0, 3);
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); NULL != cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		if (SOL_SOCKET == cmsg->cmsg_level && SCM_TIMESTAMPING == cmsg->cmsg_type)
+		{
+			struct scm_timestamping ts;
+
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+
+			lua_pop(L, 1);
+			stamps_to_table(L, &ts);
+
+			if (ts.ts[0].tv_sec || ts.ts[0].tv_nsec)
+				PUSHFIELD(L, -1, number, "queued", realtime_seconds() - timespec_seconds(&ts.ts[0]));
+		}
+
+	return 3;
+}
+
+/* recv_tx_timestamps(sock[, max = 64]) -> { { id =, type = 'sched' | 'sent' | 'ack', software =, hardware = }, ... }
+** drains TX completion stamps from the error queue without blocking; with
+** SOF_TIMESTAMPING_OPT_ID, id is the byte offset (TCP) or datagram count (UDP) of the send */
+static int api_recv_tx_timestamps(lua_State * L)
+{
+	int n = 0;
+
+	lsocket s   = LSOCK_CHECKSOCK(L, 1);
+	int     max = luaL_optint(L, 2, 64);
+
+	lua_createtable(L, max > 0 ? MIN(max, 64) : 0, 0);
+
+	while (n < max)
+	{
+		char byte;
+		int  stamped = 0, errd = 0;
+
+		struct msghdr             msg;
+		struct iovec              iov;
+		struct cmsghdr          * cmsg;
+		struct scm_timestamping   ts;
+		struct sock_extended_err  ee;
+
+		union
+		{
+			struct cmsghdr hdr;
+			char           buf[CMSG_SPACE(sizeof(struct scm_timestamping)) + CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(lsockaddr))];
+		} control;
+
+		ZERO_OUT(&msg,     sizeof(msg));
+		ZERO_OUT(&control, sizeof(control));
+
+		/* OPT_TSONLY queues no payload, otherwise we don't want it back anyway */
+		iov.iov_base = &byte;
+		iov.iov_len  = 1;
+
+		msg.msg_iov        = &iov;
+		msg.msg_iovlen     = 1;
+		msg.msg_control    = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+
+		if (-1 == recvmsg(s, &msg, MSG_ERRQUEUE | MSG_DONTWAIT))
+		{
+			if (would_block(NET_ERRNO))
+				break;
+
+			return LSOCK_STRERROR(L, "recvmsg(MSG_ERRQUEUE)");
+		}
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); NULL != cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+			if (SOL_SOCKET == cmsg->cmsg_level && SCM_TIMESTAMPING == cmsg->cmsg_type)
+			{
+				memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+				stamped = 1;
+			}
+			else if ((SOL_IP == cmsg->cmsg_level && IP_RECVERR == cmsg->cmsg_type) || (SOL_IPV6 == cmsg->cmsg_level && IPV6_RECVERR == cmsg->cmsg_type))
+			{
+				memcpy(&ee, CMSG_DATA(cmsg), sizeof(ee));
+				errd = SO_EE_ORIGIN_TIMESTAMPING == ee.ee_origin;
+			}
+
+		/* some other error queued, nothing for us */
+		if (!stamped || !errd)
+			continue;
+
+		stamps_to_table(L, &ts);
+		PUSHFIELD(L, -1, number, "id", ee.ee_data);
+		PUSHFIELD(L, -1, string, "type", SCM_TSTAMP_SCHED == ee.ee_info ? "sched" : SCM_TSTAMP_ACK == ee.ee_info ? "ack" : "sent");
+
+		lua_rawseti(L, -2, ++n);
+	}
+
+	return 1;
+}
+
+
+/* per-datagram bookkeeping for recv_groups() */
+typedef struct
+{
+	lsockaddr    from;
+	struct iovec iov;
+
+	union
+	{
+		size_t align; /* cmsghdr's own alignment; it can't nest here, it ends in a flexible array */
+		char   buf[CMSG_SPACE(sizeof(struct in6_pktinfo)) + 64];
+	} control;
+} group_slot;
+
+/* recv_groups(sock, buflen[, max = 1[, flags]]) -> { { data =, from =, group =, ifindex = }, ... }
+** up to max datagrams in one recvmmsg(), waiting only for the first; group is the
+** address each was sent to and ifindex where it came in, so one socket can serve
+** many groups -- turn IP_PKTINFO (IPV6_RECVPKTINFO) on first.  from is packed */
+static int api_recv_groups(lua_State * L)
+{
+	int   i, got;
+	char * data;
+
+	struct mmsghdr * msgs;
+	group_slot     * slots;
+
+	lsocket s      = LSOCK_CHECKSOCK(L, 1);
+	int     len    = luaL_checkint(L, 2);
+	int     max    = luaL_optint(L, 3, 1);
+	int     flags  = luaL_optint(L, 4, 0);
+	size_t  buflen = (size_t) len;
+
+	luaL_argcheck(L, len > 0,                 2, "buffer length must be positive");
+	luaL_argcheck(L, max >= 1 && max <= 1024, 3, "between 1 and 1024 datagrams");
+
+	/* max slots of header + control + buffer must not wrap size_t */
+	if (buflen > ((size_t) -1) / max - sizeof(struct mmsghdr) - sizeof(group_slot))
+		return luaL_argerror(L, 2, "buffer length too large");
+
+	msgs  = (struct mmsghdr *) lua_newuserdata(L, max * (sizeof(struct mmsghdr) + sizeof(group_slot) + buflen));
+	slots = (group_slot *) (msgs + max);
+	data  = (char *) (slots + max);
+
+	ZERO_OUT(msgs, max * (sizeof(struct mmsghdr) + sizeof(group_slot)));
+
+	for (i = 0; i < max; i++)
+	{
+		slots[i].iov.iov_base = data + i * buflen;
+		slots[i].iov.iov_len  = buflen;
+
+		msgs[i].msg_hdr.msg_name       = &slots[i].from;
+		msgs[i].msg_hdr.msg_namelen    = sizeof(slots[i].from);
+		msgs[i].msg_hdr.msg_iov        = &slots[i].iov;
+		msgs[i].msg_hdr.msg_iovlen     = 1;
+		msgs[i].msg_hdr.msg_control    = slots[i].control.buf;
+		msgs[i].msg_hdr.msg_controllen = sizeof(slots[i].control.buf);
+	}
+
+	got = recvmmsg(s, msgs, max, flags | (max > 1 ? MSG_WAITFORONE : 0), NULL);
+
+	if (-1 == got)
+		return LSOCK_STRERROR(L, "recvmmsg()");
+
+	lua_createtable(L, got, 0);
+
+	for (i = 0; i < got; i++)
+	{
+		struct cmsghdr * cmsg;
+		struct msghdr  * msg = &msgs[i].msg_hdr;
+
+		lua_createtable(L, 0, 4);
+
+		lua_pushlstring(L, (char *) slots[i].iov.iov_base, msgs[i].msg_len);
+		lua_setfield(L, -2, "data");
+
+		lua_pushlstring(L, (char *) &slots[i].from, msg->msg_namelen);
+		lua_setfield(L, -2, "from");
+
+		for (cmsg = CMSG_FIRSTHDR(msg); NULL != cmsg; cmsg = CMSG_NXTHDR(msg, cmsg))
+		{
+			char dst[INET6_ADDRSTRLEN];
+
+			if (SOL_IP == cmsg->cmsg_level && IP_PKTINFO == cmsg->cmsg_type)
+			{
+				struct in_pktinfo pi;
+
+				memcpy(&pi, CMSG_DATA(cmsg), sizeof(pi));
+
+				PUSHFIELD(L, -1, string,  "group",   inet_ntop(AF_INET, &pi.ipi_addr, dst, sizeof(dst)));
+				PUSHFIELD(L, -1, integer, "ifindex", pi.ipi_ifindex);
+			}
+			else if (SOL_IPV6 == cmsg->cmsg_level && IPV6_PKTINFO == cmsg->cmsg_type)
+			{
+				struct in6_pktinfo pi;
+
+				memcpy(&pi, CMSG_DATA(cmsg), sizeof(pi));
+
+				PUSHFIELD(L, -1, string,  "group",   inet_ntop(AF_INET6, &pi.ipi6_addr, dst, sizeof(dst)));
+				PUSHFIELD(L, -1, integer, "ifindex", pi.ipi6_ifindex);
+			}
+		}
+
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	return 1;
+}
+
+#endif
+
+/* FIXME: Windows -> TransmitFile() */
+
+static int api_sendfile(lua_State * L)
+{
+	ssize_t sent;
+	double  retry_ns;
+	size_t  allowed;
+
+	token_bucket * bucket;
+
+	int    out    =    LSOCK_CHECKFD(L, 1);
+	int    in     =    LSOCK_CHECKFD(L, 2);
+	off_t  offset =   luaL_optnumber(L, 3, 0);
+#ifdef __linux
+	size_t count  = luaL_checknumber(L, 4);
+#endif
+#ifdef __APPLE__
+	off_t count = luaL_checknumber(L, 4);
+#endif
+
+	bucket = rate_limit_of(L, 1);
+
+	if (NULL != bucket)
+	{
+		if (!bucket_take(bucket, count, &allowed, &retry_ns))
+			return rate_limited(L, "sendfile()", retry_ns);
+
+		count = allowed;
+	}
+
+#ifdef __linux
+	sent = sendfile(out, in, lua_isnil(L, 3) ? NULL : &offset, count);
+#endif
+#ifdef __APPLE__
+	/* Differences:
+	** 1) out<->in reversed from Linux sendfile()
+	** 2) NULL for the header/trailer structure (Mac OS X sendfile rocks!)
+	** 3) 0 for flags (future expansion); otherwise EINVAL will be returned */
+	sent = sendfile(in, out, offset, &count, NULL, 0);
+#endif
+
+	if (-1 == sent)
+		return LSOCK_STRERROR(L, NULL);
+
+#ifdef __APPLE__
+	sent = count;
+#endif
+
+	if (NULL != bucket)
+		bucket_charge(bucket, sent);
+
+	lua_pushnumber(L, sent);
+
+	return 1;
+}
+
+#endif
+
+static int api_getfd(lua_State * L)
+{
+	lua_pushnumber(L, LSOCK_CHECKFD(L, 1));
+
+	return 1;
+}
+
+#ifdef _WIN32
+
+static int lsock_cleanup(lua_State * L)
+{
+	((void) L);
+
+	WSACleanup();
+
+	return 0;
+}
+
+static void lsock_startup(lua_State * L)
+{
+	WSADATA wsaData;
+
+	int stat = WSAStartup(MAKEWORD(2, 2), &wsaData);
+
+	if (stat != 0)
+	{
+		lsock_cleanup(L);
+		luaL_error(L, "WSAStartup() failed [%d]: %s\n", stat, strerror(stat));
+	}
+
+	if (2 != LOBYTE(wsaData.wVersion) || 2 != HIBYTE(wsaData.wVersion))
+	{
+		lsock_cleanup(L);
+		luaL_error(L, "Could not find a usable version of Winsock.dll");
+	}
+}
+
+#endif
+
+/* metatable for one of our userdata types; methods are the api_* functions taking it first */
+static void lsock_newclass(lua_State * L, const char * name, const luaL_Reg * methods, const luaL_Reg * meta)
+{
+	luaL_newmetatable(L, name);
+	luaL_setfuncs(L, meta, 0);
+
+	/* no methods when meta brings its own __index */
+	if (NULL != methods)
+	{
+		lua_newtable(L);
+		luaL_setfuncs(L, methods, 0);
+		lua_setfield(L, -2, "__index");
+	}
+
+	lua_pop(L, 1);
+}
+
+/*
+ * constants are kept in sorted static tables (one per platform section)
+ * and only pushed into lsock.constants when a name is first looked up,
+ * so luaopen_lsock() does not pay for hundreds of table inserts up front
+ */
+typedef struct
+{
+	const char * name;
+	lua_Integer  value;
+} lsock_constant;
+
+#define CONSTANT(C) { #C, C }
+
+/* portable constants */
+static const lsock_constant portable_constants[] =
+{
+	CONSTANT(AF_APPLETALK),
+	CONSTANT(AF_INET),
+	CONSTANT(AF_INET6),
+	CONSTANT(AF_IPX),
+	CONSTANT(AF_UNSPEC),
+	CONSTANT(AI_ADDRCONFIG),
+	CONSTANT(AI_ALL),
+	CONSTANT(AI_CANONNAME),
+	CONSTANT(AI_NUMERICHOST),
+	CONSTANT(AI_NUMERICSERV),
+	CONSTANT(AI_PASSIVE),
+	CONSTANT(AI_V4MAPPED),
+	CONSTANT(EACCES),
+	CONSTANT(EADDRINUSE),
+	CONSTANT(EADDRNOTAVAIL),
+	CONSTANT(EAFNOSUPPORT),
+	CONSTANT(EAGAIN),
+	CONSTANT(EAI_AGAIN),
+	CONSTANT(EAI_BADFLAGS),
+	CONSTANT(EAI_FAIL),
+	CONSTANT(EAI_FAMILY),
+	CONSTANT(EAI_MEMORY),
+	CONSTANT(EAI_NODATA),
+	CONSTANT(EAI_NONAME),
+	CONSTANT(EAI_SERVICE),
+	CONSTANT(EAI_SOCKTYPE),
+	CONSTANT(EBADF),
+	CONSTANT(ECONNABORTED),
+	CONSTANT(ECONNREFUSED),
+	CONSTANT(EDESTADDRREQ),
+	CONSTANT(EINPROGRESS),
+	CONSTANT(EINTR),
+	CONSTANT(EINVAL),
+	CONSTANT(EIO),
+	CONSTANT(EISDIR),
+	CONSTANT(ELOOP),
+	CONSTANT(EMFILE),
+	CONSTANT(ENAMETOOLONG),
+	CONSTANT(ENFILE),
+	CONSTANT(ENOBUFS),
+	CONSTANT(ENOENT),
+	CONSTANT(ENOMEM),
+	CONSTANT(ENOTCONN),
+	CONSTANT(ENOTDIR),
+	CONSTANT(ENOTSOCK),
+	CONSTANT(EOPNOTSUPP),
+	CONSTANT(EPROTO),
+	CONSTANT(EPROTONOSUPPORT),
+	CONSTANT(EPROTOTYPE),
+	CONSTANT(EROFS),
+	CONSTANT(ETIMEDOUT),
+	CONSTANT(EWOULDBLOCK),
+	CONSTANT(IPPROTO_AH),
+	CONSTANT(IPPROTO_EGP),
+	CONSTANT(IPPROTO_ESP),
+	CONSTANT(IPPROTO_FRAGMENT),
+	CONSTANT(IPPROTO_ICMP),
+	CONSTANT(IPPROTO_ICMPV6),
+	CONSTANT(IPPROTO_IDP),
+	CONSTANT(IPPROTO_IGMP),
+	CONSTANT(IPPROTO_IP),
+	CONSTANT(IPPROTO_IPV6),
+	CONSTANT(IPPROTO_MAX),
+	CONSTANT(IPPROTO_NONE),
+	CONSTANT(IPPROTO_PIM),
+	CONSTANT(IPPROTO_PUP),
+	CONSTANT(IPPROTO_RAW),
+	CONSTANT(IPPROTO_ROUTING),
+	CONSTANT(IPPROTO_SCTP),
+	CONSTANT(IPPROTO_TCP),
+	CONSTANT(IPPROTO_UDP),
+	CONSTANT(IPV6_CHECKSUM),
+	CONSTANT(IPV6_HOPLIMIT),
+	CONSTANT(IPV6_JOIN_GROUP),
+	CONSTANT(IPV6_LEAVE_GROUP),
+	CONSTANT(IPV6_MULTICAST_HOPS),
+	CONSTANT(IPV6_MULTICAST_IF),
+	CONSTANT(IPV6_MULTICAST_LOOP),
+	CONSTANT(IPV6_PKTINFO),
+	CONSTANT(IPV6_UNICAST_HOPS),
+	CONSTANT(IPV6_V6ONLY),
+	CONSTANT(IP_ADD_MEMBERSHIP),
+	CONSTANT(IP_ADD_SOURCE_MEMBERSHIP),
+	CONSTANT(IP_BLOCK_SOURCE),
+	CONSTANT(IP_DROP_MEMBERSHIP),
+	CONSTANT(IP_DROP_SOURCE_MEMBERSHIP),
+	CONSTANT(IP_HDRINCL),
+	CONSTANT(IP_MULTICAST_IF),
+	CONSTANT(IP_MULTICAST_LOOP),
+	CONSTANT(IP_MULTICAST_TTL),
+	CONSTANT(IP_OPTIONS),
+	CONSTANT(IP_PKTINFO),
+	CONSTANT(IP_TOS),
+	CONSTANT(IP_TTL),
+	CONSTANT(IP_UNBLOCK_SOURCE),
+	CONSTANT(MSG_CTRUNC),
+	CONSTANT(MSG_DONTROUTE),
+	CONSTANT(MSG_OOB),
+	CONSTANT(MSG_PEEK),
+	CONSTANT(MSG_TRUNC),
+	CONSTANT(MSG_WAITALL),
+	CONSTANT(NI_DGRAM),
+	CONSTANT(NI_NAMEREQD),
+	CONSTANT(NI_NOFQDN),
+	CONSTANT(NI_NUMERICHOST),
+	CONSTANT(NI_NUMERICSERV),
+	CONSTANT(PF_APPLETALK),
+	CONSTANT(PF_INET),
+	CONSTANT(PF_INET6),
+	CONSTANT(PF_IPX),
+	CONSTANT(PF_UNSPEC),
+	CONSTANT(SOCK_DGRAM),
+	CONSTANT(SOCK_RAW),
+	CONSTANT(SOCK_RDM),
+	CONSTANT(SOCK_SEQPACKET),
+	CONSTANT(SOCK_STREAM),
+	CONSTANT(SOL_SOCKET),
+	CONSTANT(SOMAXCONN),
+	CONSTANT(SO_ACCEPTCONN),
+	CONSTANT(SO_BROADCAST),
+	CONSTANT(SO_DEBUG),
+	CONSTANT(SO_DONTROUTE),
+	CONSTANT(SO_ERROR),
+	CONSTANT(SO_KEEPALIVE),
+	CONSTANT(SO_LINGER),
+	CONSTANT(SO_OOBINLINE),
+	CONSTANT(SO_RCVBUF),
+	CONSTANT(SO_RCVLOWAT),
+	CONSTANT(SO_RCVTIMEO),
+	CONSTANT(SO_REUSEADDR),
+	CONSTANT(SO_SNDBUF),
+	CONSTANT(SO_SNDLOWAT),
+	CONSTANT(SO_SNDTIMEO),
+	CONSTANT(SO_TYPE),
+	CONSTANT(TCP_MAXSEG),
+	CONSTANT(TCP_NODELAY),
+};
+
+/* Windows-only */
+#ifdef _WIN32
+static const lsock_constant windows_constants[] =
+{
+#	ifdef AF_BTH
+	CONSTANT(AF_BTH),
+#	endif
+#	ifdef AF_NETBIOS
+	CONSTANT(AF_NETBIOS),
+#	endif
+#	ifdef AI_FILESERVER
+	CONSTANT(AI_FILESERVER),
+#	endif
+#	ifdef AI_FQDN
+	CONSTANT(AI_FQDN),
+#	endif
+#	ifdef AI_NON_AUTHORITATIVE
+	CONSTANT(AI_NON_AUTHORITATIVE),
+#	endif
+#	ifdef AI_RETURN_PREFERRED_NAMES
+	CONSTANT(AI_RETURN_PREFERRED_NAMES),
+#	endif
+#	ifdef AI_SECURE
+	CONSTANT(AI_SECURE),
+#	endif
+#	ifdef BTHPROTO_RFCOMM
+	CONSTANT(BTHPROTO_RFCOMM),
+#	endif
+#	ifdef E2BIG
+	CONSTANT(E2BIG),
+#	endif
+#	ifdef EALREADY
+	CONSTANT(EALREADY),
+#	endif
+#	ifdef EBADMSG
+	CONSTANT(EBADMSG),
+#	endif
+#	ifdef EBUSY
+	CONSTANT(EBUSY),
+#	endif
+#	ifdef ECANCELED
+	CONSTANT(ECANCELED),
+#	endif
+#	ifdef ECHILD
+	CONSTANT(ECHILD),
+#	endif
+#	ifdef ECONNRESET
+	CONSTANT(ECONNRESET),
+#	endif
+#	ifdef EDEADLK
+	CONSTANT(EDEADLK),
+#	endif
+#	ifdef EDOM
+	CONSTANT(EDOM),
+#	endif
+#	ifdef EEXIST
+	CONSTANT(EEXIST),
+#	endif
+#	ifdef EFAULT
+	CONSTANT(EFAULT),
+#	endif
+#	ifdef EFBIG
+	CONSTANT(EFBIG),
+#	endif
+#	ifdef EHOSTUNREACH
+	CONSTANT(EHOSTUNREACH),
+#	endif
+#	ifdef EIDRM
+	CONSTANT(EIDRM),
+#	endif
+#	ifdef EILSEQ
+	CONSTANT(EILSEQ),
+#	endif
+#	ifdef EISCONN
+	CONSTANT(EISCONN),
+#	endif
+#	ifdef EMLINK
+	CONSTANT(EMLINK),
+#	endif
+#	ifdef EMSGSIZE
+	CONSTANT(EMSGSIZE),
+#	endif
+#	ifdef ENETDOWN
+	CONSTANT(ENETDOWN),
+#	endif
+#	ifdef ENETRESET
+	CONSTANT(ENETRESET),
+#	endif
+#	ifdef ENETUNREACH
+	CONSTANT(ENETUNREACH),
+#	endif
+#	ifdef ENODATA
+	CONSTANT(ENODATA),
+#	endif
+#	ifdef ENODEV
+	CONSTANT(ENODEV),
+#	endif
+#	ifdef ENOEXEC
+	CONSTANT(ENOEXEC),
+#	endif
+#	ifdef ENOLCK
+	CONSTANT(ENOLCK),
+#	endif
+#	ifdef ENOLINK
+	CONSTANT(ENOLINK),
+#	endif
+#	ifdef ENOMSG
+	CONSTANT(ENOMSG),
+#	endif
+#	ifdef ENOPROTOOPT
+	CONSTANT(ENOPROTOOPT),
+#	endif
+#	ifdef ENOSPC
+	CONSTANT(ENOSPC),
+#	endif
+#	ifdef ENOSR
+	CONSTANT(ENOSR),
+#	endif
+#	ifdef ENOSTR
+	CONSTANT(ENOSTR),
+#	endif
+#	ifdef ENOSYS
+	CONSTANT(ENOSYS),
+#	endif
+#	ifdef ENOTEMPTY
+	CONSTANT(ENOTEMPTY),
+#	endif
+#	ifdef ENOTRECOVERABLE
+	CONSTANT(ENOTRECOVERABLE),
+#	endif
+#	ifdef ENOTSUP
+	CONSTANT(ENOTSUP),
+#	endif
+#	ifdef ENOTTY
+	CONSTANT(ENOTTY),
+#	endif
+#	ifdef ENXIO
+	CONSTANT(ENXIO),
+#	endif
+#	ifdef EOTHER
+	CONSTANT(EOTHER),
+#	endif
+#	ifdef EOVERFLOW
+	CONSTANT(EOVERFLOW),
+#	endif
+#	ifdef EOWNERDEAD
+	CONSTANT(EOWNERDEAD),
+#	endif
+#	ifdef EPERM
+	CONSTANT(EPERM),
+#	endif
+#	ifdef EPIPE
+	CONSTANT(EPIPE),
+#	endif
+#	ifdef ERANGE
+	CONSTANT(ERANGE),
+#	endif
+#	ifdef ESPIPE
+	CONSTANT(ESPIPE),
+#	endif
+#	ifdef ESRCH
+	CONSTANT(ESRCH),
+#	endif
+#	ifdef ETIME
+	CONSTANT(ETIME),
+#	endif
+#	ifdef ETXTBSY
+	CONSTANT(ETXTBSY),
+#	endif
+#	ifdef EXDEV
+	CONSTANT(EXDEV),
+#	endif
+#	ifdef IPPROTO_RM
+	CONSTANT(IPPROTO_RM),
+#	endif
+#	ifdef IPV6_ADD_MEMBERSHIP
+	CONSTANT(IPV6_ADD_MEMBERSHIP),
+#	endif
+#	ifdef IPV6_DROP_MEMBERSHIP
+	CONSTANT(IPV6_DROP_MEMBERSHIP),
+#	endif
+#	ifdef IPV6_HDRINCL
+	CONSTANT(IPV6_HDRINCL),
+#	endif
+#	ifdef IPV6_PROTECTION_LEVEL
+	CONSTANT(IPV6_PROTECTION_LEVEL),
+#	endif
+#	ifdef IPV6_RECVIF
+	CONSTANT(IPV6_RECVIF),
+#	endif
+#	ifdef IPV6_UNICAST_IF
+	CONSTANT(IPV6_UNICAST_IF),
+#	endif
+#	ifdef IPX_ADDRESS
+	CONSTANT(IPX_ADDRESS),
+#	endif
+#	ifdef IPX_ADDRESS_NOTIFY
+	CONSTANT(IPX_ADDRESS_NOTIFY),
+#	endif
+#	ifdef IPX_CHECKSUM
+	CONSTANT(IPX_CHECKSUM),
+#	endif
+#	ifdef IPX_DSTYPE
+	CONSTANT(IPX_DSTYPE),
+#	endif
+#	ifdef IPX_EXTENDED_ADDRESS
+	CONSTANT(IPX_EXTENDED_ADDRESS),
+#	endif
+#	ifdef IPX_FILTERPTYPE
+	CONSTANT(IPX_FILTERPTYPE),
+#	endif
+#	ifdef IPX_GETNETINFO
+	CONSTANT(IPX_GETNETINFO),
+#	endif
+#	ifdef IPX_GETNETINFO_NORIP
+	CONSTANT(IPX_GETNETINFO_NORIP),
+#	endif
+#	ifdef IPX_IMMEDIATESPXACK
+	CONSTANT(IPX_IMMEDIATESPXACK),
+#	endif
+#	ifdef IPX_MAXSIZE
+	CONSTANT(IPX_MAXSIZE),
+#	endif
+#	ifdef IPX_MAX_ADAPTER_NUM
+	CONSTANT(IPX_MAX_ADAPTER_NUM),
+#	endif
+#	ifdef IPX_PRIMARY
+	CONSTANT(IPX_PRIMARY),
+#	endif
+#	ifdef IPX_PTYPE
+	CONSTANT(IPX_PTYPE),
+#	endif
+#	ifdef IPX_RECEIVE_BROADCAST
+	CONSTANT(IPX_RECEIVE_BROADCAST),
+#	endif
+#	ifdef IPX_RECVHDR
+	CONSTANT(IPX_RECVHDR),
+#	endif
+#	ifdef IPX_RERIPNETNUMBER
+	CONSTANT(IPX_RERIPNETNUMBER),
+#	endif
+#	ifdef IPX_RXMEDIASIZE
+	CONSTANT(IPX_RXMEDIASIZE),
+#	endif
+#	ifdef IPX_RXPKTSIZE
+	CONSTANT(IPX_RXPKTSIZE),
+#	endif
+#	ifdef IPX_SPXGETCONNECTIONSTATUS
+	CONSTANT(IPX_SPXGETCONNECTIONSTATUS),
+#	endif
+#	ifdef IPX_STOPFILTERPTYPE
+	CONSTANT(IPX_STOPFILTERPTYPE),
+#	endif
+#	ifdef IPX_TXMEDIASIZE
+	CONSTANT(IPX_TXMEDIASIZE),
+#	endif
+#	ifdef IPX_TXPKTSIZE
+	CONSTANT(IPX_TXPKTSIZE),
+#	endif
+#	ifdef IP_DONTFRAGMENT
+	CONSTANT(IP_DONTFRAGMENT),
+#	endif
+#	ifdef IP_ORIGINAL_ARRIVAL_IF
+	CONSTANT(IP_ORIGINAL_ARRIVAL_IF),
+#	endif
+#	ifdef IP_RECEIVE_BROADCAST
+	CONSTANT(IP_RECEIVE_BROADCAST),
+#	endif
+#	ifdef IP_RECVIF
+	CONSTANT(IP_RECVIF),
+#	endif
+#	ifdef IP_UNICAST_IF
+	CONSTANT(IP_UNICAST_IF),
+#	endif
+#	ifdef IP_WFP_REDIRECT_CONTEXT
+	CONSTANT(IP_WFP_REDIRECT_CONTEXT),
+#	endif
+#	ifdef IP_WFP_REDIRECT_RECORDS
+	CONSTANT(IP_WFP_REDIRECT_RECORDS),
+#	endif
+#	ifdef IRLMP_9WIRE_MODE
+	CONSTANT(IRLMP_9WIRE_MODE),
+#	endif
+#	ifdef IRLMP_DISCOVERY_MODE
+	CONSTANT(IRLMP_DISCOVERY_MODE),
+#	endif
+#	ifdef IRLMP_ENUMDEVICES
+	CONSTANT(IRLMP_ENUMDEVICES),
+#	endif
+#	ifdef IRLMP_EXCLUSIVE_MODE
+	CONSTANT(IRLMP_EXCLUSIVE_MODE),
+#	endif
+#	ifdef IRLMP_IAS_QUERY
+	CONSTANT(IRLMP_IAS_QUERY),
+#	endif
+#	ifdef IRLMP_IAS_SET
+	CONSTANT(IRLMP_IAS_SET),
+#	endif
+#	ifdef IRLMP_IRLPT_MODE
+	CONSTANT(IRLMP_IRLPT_MODE),
+#	endif
+#	ifdef IRLMP_PARAMETERS
+	CONSTANT(IRLMP_PARAMETERS),
+#	endif
+#	ifdef IRLMP_SEND_PDU_LEN
+	CONSTANT(IRLMP_SEND_PDU_LEN),
+#	endif
+#	ifdef IRLMP_SHARP_MODE
+	CONSTANT(IRLMP_SHARP_MODE),
+#	endif
+#	ifdef IRLMP_TINYTP_MODE
+	CONSTANT(IRLMP_TINYTP_MODE),
+#	endif
+#	ifdef MSG_BCAST
+	CONSTANT(MSG_BCAST),
+#	endif
+#	ifdef MSG_MCAST
+	CONSTANT(MSG_MCAST),
+#	endif
+#	ifdef NSPROTO_IPX
+	CONSTANT(NSPROTO_IPX),
+#	endif
+#	ifdef PF_BTH
+	CONSTANT(PF_BTH),
+#	endif
+#	ifdef PF_NETBIOS
+	CONSTANT(PF_NETBIOS),
+#	endif
+#	ifdef PVD_CONFIG
+	CONSTANT(PVD_CONFIG),
+#	endif
+#	ifdef RM_ADD_RECEIVE_IF
+	CONSTANT(RM_ADD_RECEIVE_IF),
+#	endif
+#	ifdef RM_DEL_RECEIVE_IF
+	CONSTANT(RM_DEL_RECEIVE_IF),
+#	endif
+#	ifdef RM_FLUSHCACHE
+	CONSTANT(RM_FLUSHCACHE),
+#	endif
+#	ifdef RM_HIGH_SPEED_INTRANET_OPT
+	CONSTANT(RM_HIGH_SPEED_INTRANET_OPT),
+#	endif
+#	ifdef RM_LATEJOIN
+	CONSTANT(RM_LATEJOIN),
+#	endif
+#	ifdef RM_RATE_WINDOW_SIZE
+	CONSTANT(RM_RATE_WINDOW_SIZE),
+#	endif
+#	ifdef RM_RECEIVER_STATISTICS
+	CONSTANT(RM_RECEIVER_STATISTICS),
+#	endif
+#	ifdef RM_SENDER_STATISTICS
+	CONSTANT(RM_SENDER_STATISTICS),
+#	endif
+#	ifdef RM_SENDER_WINDOW_ADVANCE_METHOD
+	CONSTANT(RM_SENDER_WINDOW_ADVANCE_METHOD),
+#	endif
+#	ifdef RM_SEND_WINDOW_ADV_RATE
+	CONSTANT(RM_SEND_WINDOW_ADV_RATE),
+#	endif
+#	ifdef RM_SET_MCAST_TTL
+	CONSTANT(RM_SET_MCAST_TTL),
+#	endif
+#	ifdef RM_SET_MESSAGE_BOUNDARY
+	CONSTANT(RM_SET_MESSAGE_BOUNDARY),
+#	endif
+#	ifdef RM_SET_SEND_IF
+	CONSTANT(RM_SET_SEND_IF),
+#	endif
+#	ifdef RM_USE_FEC
+	CONSTANT(RM_USE_FEC),
+#	endif
+	CONSTANT(SD_BOTH),
+	CONSTANT(SD_RECEIVE),
+	CONSTANT(SD_SEND),
+#	ifdef SOL_APPLETALK
+	CONSTANT(SOL_APPLETALK),
+#	endif
+#	ifdef SOL_IRLMP
+	CONSTANT(SOL_IRLMP),
+#	endif
+#	ifdef SO_BSP_STATE
+	CONSTANT(SO_BSP_STATE),
+#	endif
+#	ifdef SO_CONDITIONAL_ACCEPT
+	CONSTANT(SO_CONDITIONAL_ACCEPT),
+#	endif
+#	ifdef SO_CONFIRM_NAME
+	CONSTANT(SO_CONFIRM_NAME),
+#	endif
+#	ifdef SO_CONNDATA
+	CONSTANT(SO_CONNDATA),
+#	endif
+#	ifdef SO_CONNDATALEN
+	CONSTANT(SO_CONNDATALEN),
+#	endif
+#	ifdef SO_CONNECT_TIME
+	CONSTANT(SO_CONNECT_TIME),
+#	endif
+#	ifdef SO_CONNOPT
+	CONSTANT(SO_CONNOPT),
+#	endif
+#	ifdef SO_CONNOPTLEN
+	CONSTANT(SO_CONNOPTLEN),
+#	endif
+#	ifdef SO_DEREGISTER_NAME
+	CONSTANT(SO_DEREGISTER_NAME),
+#	endif
+#	ifdef SO_DISCDATA
+	CONSTANT(SO_DISCDATA),
+#	endif
+#	ifdef SO_DISCDATALEN
+	CONSTANT(SO_DISCDATALEN),
+#	endif
+#	ifdef SO_DISCOPT
+	CONSTANT(SO_DISCOPT),
+#	endif
+#	ifdef SO_DISCOPTLEN
+	CONSTANT(SO_DISCOPTLEN),
+#	endif
+#	ifdef SO_DONTLINGER
+	CONSTANT(SO_DONTLINGER),
+#	endif
+#	ifdef SO_EXCLUSIVEADDRUSE
+	CONSTANT(SO_EXCLUSIVEADDRUSE),
+#	endif
+#	ifdef SO_GETLOCALZONES
+	CONSTANT(SO_GETLOCALZONES),
+#	endif
+#	ifdef SO_GETMYZONE
+	CONSTANT(SO_GETMYZONE),
+#	endif
+#	ifdef SO_GETNETINFO
+	CONSTANT(SO_GETNETINFO),
+#	endif
+#	ifdef SO_GETZONELIST
+	CONSTANT(SO_GETZONELIST),
+#	endif
+#	ifdef SO_GROUP_ID
+	CONSTANT(SO_GROUP_ID),
+#	endif
+#	ifdef SO_GROUP_PRIORITY
+	CONSTANT(SO_GROUP_PRIORITY),
+#	endif
+#	ifdef SO_LOOKUP_MYZONE
+	CONSTANT(SO_LOOKUP_MYZONE),
+#	endif
+#	ifdef SO_LOOKUP_NAME
+	CONSTANT(SO_LOOKUP_NAME),
+#	endif
+#	ifdef SO_LOOKUP_NETDEF_ON_ADAPTER
+	CONSTANT(SO_LOOKUP_NETDEF_ON_ADAPTER),
+#	endif
+#	ifdef SO_LOOKUP_ZONES
+	CONSTANT(SO_LOOKUP_ZONES),
+#	endif
+#	ifdef SO_LOOKUP_ZONES_ON_ADAPTER
+	CONSTANT(SO_LOOKUP_ZONES_ON_ADAPTER),
+#	endif
+#	ifdef SO_MAXDG
+	CONSTANT(SO_MAXDG),
+#	endif
+#	ifdef SO_MAXPATHDG
+	CONSTANT(SO_MAXPATHDG),
+#	endif
+#	ifdef SO_MAX_MSG_SIZE
+	CONSTANT(SO_MAX_MSG_SIZE),
+#	endif
+#	ifdef SO_OPENTYPE
+	CONSTANT(SO_OPENTYPE),
+#	endif
+#	ifdef SO_PAP_GET_SERVER_STATUS
+	CONSTANT(SO_PAP_GET_SERVER_STATUS),
+#	endif
+#	ifdef SO_PAP_PRIME_READ
+	CONSTANT(SO_PAP_PRIME_READ),
+#	endif
+#	ifdef SO_PAP_SET_SERVER_STATUS
+	CONSTANT(SO_PAP_SET_SERVER_STATUS),
+#	endif
+#	ifdef SO_PORT_SCALABILITY
+	CONSTANT(SO_PORT_SCALABILITY),
+#	endif
+#	ifdef SO_PROTECT
+	CONSTANT(SO_PROTECT),
+#	endif
+#	ifdef SO_PROTOCOL_INFO
+	CONSTANT(SO_PROTOCOL_INFO),
+#	endif
+#	ifdef SO_PROTOCOL_INFOA
+	CONSTANT(SO_PROTOCOL_INFOA),
+#	endif
+#	ifdef SO_PROTOCOL_INFOW
+	CONSTANT(SO_PROTOCOL_INFOW),
+#	endif
+#	ifdef SO_REGISTER_NAME
+	CONSTANT(SO_REGISTER_NAME),
+#	endif
+#	ifdef SO_REMOVE_NAME
+	CONSTANT(SO_REMOVE_NAME),
+#	endif
+#	ifdef SO_UPDATE_ACCEPT_CONTEXT
+	CONSTANT(SO_UPDATE_ACCEPT_CONTEXT),
+#	endif
+#	ifdef SO_UPDATE_CONNECT_CONTEXT
+	CONSTANT(SO_UPDATE_CONNECT_CONTEXT),
+#	endif
+#	ifdef SO_USELOOPBACK
+	CONSTANT(SO_USELOOPBACK),
+#	endif
+#	ifdef SPX_CHECKSUM
+	CONSTANT(SPX_CHECKSUM),
+#	endif
+#	ifdef SPX_RAWSPX
+	CONSTANT(SPX_RAWSPX),
+#	endif
+#	ifdef SPX_RXMEDIASIZE
+	CONSTANT(SPX_RXMEDIASIZE),
+#	endif
+#	ifdef SPX_RXPKTSIZE
+	CONSTANT(SPX_RXPKTSIZE),
+#	endif
+#	ifdef SPX_TXMEDIASIZE
+	CONSTANT(SPX_TXMEDIASIZE),
+#	endif
+#	ifdef SPX_TXPKTSIZE
+	CONSTANT(SPX_TXPKTSIZE),
+#	endif
+#	ifdef TCP_BSDURGENT
+	CONSTANT(TCP_BSDURGENT),
+#	endif
+#	ifdef TCP_EXPEDITED_1122
+	CONSTANT(TCP_EXPEDITED_1122),
+#	endif
+	CONSTANT(UDP_CHECKSUM_COVERAGE),
+	CONSTANT(UDP_NOCHECKSUM),
+#	ifdef WSAEACCES
+	CONSTANT(WSAEACCES),
+#	endif
+#	ifdef WSAEADDRINUSE
+	CONSTANT(WSAEADDRINUSE),
+#	endif
+#	ifdef WSAEADDRNOTAVAIL
+	CONSTANT(WSAEADDRNOTAVAIL),
+#	endif
+#	ifdef WSAEAFNOSUPPORT
+	CONSTANT(WSAEAFNOSUPPORT),
+#	endif
+#	ifdef WSAEALREADY
+	CONSTANT(WSAEALREADY),
+#	endif
+#	ifdef WSAEBADF
+	CONSTANT(WSAEBADF),
+#	endif
+#	ifdef WSAECANCELLED
+	CONSTANT(WSAECANCELLED),
+#	endif
+#	ifdef WSAECONNABORTED
+	CONSTANT(WSAECONNABORTED),
+#	endif
+#	ifdef WSAECONNREFUSED
+	CONSTANT(WSAECONNREFUSED),
+#	endif
+#	ifdef WSAECONNRESET
+	CONSTANT(WSAECONNRESET),
+#	endif
+#	ifdef WSAEDESTADDRREQ
+	CONSTANT(WSAEDESTADDRREQ),
+#	endif
+#	ifdef WSAEDISCON
+	CONSTANT(WSAEDISCON),
+#	endif
+#	ifdef WSAEDQUOT
+	CONSTANT(WSAEDQUOT),
+#	endif
+#	ifdef WSAEFAULT
+	CONSTANT(WSAEFAULT),
+#	endif
+#	ifdef WSAEHOSTDOWN
+	CONSTANT(WSAEHOSTDOWN),
+#	endif
+#	ifdef WSAEHOSTUNREACH
+	CONSTANT(WSAEHOSTUNREACH),
+#	endif
+#	ifdef WSAEINPROGRESS
+	CONSTANT(WSAEINPROGRESS),
+#	endif
+#	ifdef WSAEINTR
+	CONSTANT(WSAEINTR),
+#	endif
+#	ifdef WSAEINVAL
+	CONSTANT(WSAEINVAL),
+#	endif
+#	ifdef WSAEINVALIDPROCTABLE
+	CONSTANT(WSAEINVALIDPROCTABLE),
+#	endif
+#	ifdef WSAEINVALIDPROVIDER
+	CONSTANT(WSAEINVALIDPROVIDER),
+#	endif
+#	ifdef WSAEISCONN
+	CONSTANT(WSAEISCONN),
+#	endif
+#	ifdef WSAELOOP
+	CONSTANT(WSAELOOP),
+#	endif
+#	ifdef WSAEMFILE
+	CONSTANT(WSAEMFILE),
+#	endif
+#	ifdef WSAEMSGSIZE
+	CONSTANT(WSAEMSGSIZE),
+#	endif
+#	ifdef WSAENAMETOOLONG
+	CONSTANT(WSAENAMETOOLONG),
+#	endif
+#	ifdef WSAENETDOWN
+	CONSTANT(WSAENETDOWN),
+#	endif
+#	ifdef WSAENETRESET
+	CONSTANT(WSAENETRESET),
+#	endif
+#	ifdef WSAENETUNREACH
+	CONSTANT(WSAENETUNREACH),
+#	endif
+#	ifdef WSAENOBUFS
+	CONSTANT(WSAENOBUFS),
+#	endif
+#	ifdef WSAENOMORE
+	CONSTANT(WSAENOMORE),
+#	endif
+#	ifdef WSAENOPROTOOPT
+	CONSTANT(WSAENOPROTOOPT),
+#	endif
+#	ifdef WSAENOTCONN
+	CONSTANT(WSAENOTCONN),
+#	endif
+#	ifdef WSAENOTEMPTY
+	CONSTANT(WSAENOTEMPTY),
+#	endif
+#	ifdef WSAENOTSOCK
+	CONSTANT(WSAENOTSOCK),
+#	endif
+#	ifdef WSAEOPNOTSUPP
+	CONSTANT(WSAEOPNOTSUPP),
+#	endif
+#	ifdef WSAEPFNOSUPPORT
+	CONSTANT(WSAEPFNOSUPPORT),
+#	endif
+#	ifdef WSAEPROCLIM
+	CONSTANT(WSAEPROCLIM),
+#	endif
+#	ifdef WSAEPROTONOSUPPORT
+	CONSTANT(WSAEPROTONOSUPPORT),
+#	endif
+#	ifdef WSAEPROTOTYPE
+	CONSTANT(WSAEPROTOTYPE),
+#	endif
+#	ifdef WSAEPROVIDERFAILEDINIT
+	CONSTANT(WSAEPROVIDERFAILEDINIT),
+#	endif
+#	ifdef WSAEREFUSED
+	CONSTANT(WSAEREFUSED),
+#	endif
+#	ifdef WSAEREMOTE
+	CONSTANT(WSAEREMOTE),
+#	endif
+#	ifdef WSAESHUTDOWN
+	CONSTANT(WSAESHUTDOWN),
+#	endif
+#	ifdef WSAESOCKTNOSUPPORT
+	CONSTANT(WSAESOCKTNOSUPPORT),
+#	endif
+#	ifdef WSAESTALE
+	CONSTANT(WSAESTALE),
+#	endif
+#	ifdef WSAETIMEDOUT
+	CONSTANT(WSAETIMEDOUT),
+#	endif
+#	ifdef WSAETOOMANYREFS
+	CONSTANT(WSAETOOMANYREFS),
+#	endif
+#	ifdef WSAEUSERS
+	CONSTANT(WSAEUSERS),
+#	endif
+#	ifdef WSAEWOULDBLOCK
+	CONSTANT(WSAEWOULDBLOCK),
+#	endif
+#	ifdef WSAHOST_NOT_FOUND
+	CONSTANT(WSAHOST_NOT_FOUND),
+#	endif
+#	ifdef WSANOTINITIALISED
+	CONSTANT(WSANOTINITIALISED),
+#	endif
+#	ifdef WSANO_DATA
+	CONSTANT(WSANO_DATA),
+#	endif
+#	ifdef WSANO_RECOVERY
+	CONSTANT(WSANO_RECOVERY),
+#	endif
+#	ifdef WSASERVICE_NOT_FOUND
+	CONSTANT(WSASERVICE_NOT_FOUND),
+#	endif
+#	ifdef WSASYSCALLFAILURE
+	CONSTANT(WSASYSCALLFAILURE),
+#	endif
+#	ifdef WSASYSNOTREADY
+	CONSTANT(WSASYSNOTREADY),
+#	endif
+#	ifdef WSATRY_AGAIN
+	CONSTANT(WSATRY_AGAIN),
+#	endif
+#	ifdef WSATYPE_NOT_FOUND
+	CONSTANT(WSATYPE_NOT_FOUND),
+#	endif
+#	ifdef WSAVERNOTSUPPORTED
+	CONSTANT(WSAVERNOTSUPPORTED),
+#	endif
+#	ifdef WSA_E_CANCELLED
+	CONSTANT(WSA_E_CANCELLED),
+#	endif
+#	ifdef WSA_E_NO_MORE
+	CONSTANT(WSA_E_NO_MORE),
+#	endif
+#	ifdef WSA_INVALID_HANDLE
+	CONSTANT(WSA_INVALID_HANDLE),
+#	endif
+#	ifdef WSA_INVALID_PARAMETER
+	CONSTANT(WSA_INVALID_PARAMETER),
+#	endif
+#	ifdef WSA_IO_INCOMPLETE
+	CONSTANT(WSA_IO_INCOMPLETE),
+#	endif
+#	ifdef WSA_IO_PENDING
+	CONSTANT(WSA_IO_PENDING),
+#	endif
+#	ifdef WSA_NOT_ENOUGH_MEMORY
+	CONSTANT(WSA_NOT_ENOUGH_MEMORY),
+#	endif
+#	ifdef WSA_OPERATION_ABORTED
+	CONSTANT(WSA_OPERATION_ABORTED),
+#	endif
+#	ifdef WSA_QOS_ADMISSION_FAILURE
+	CONSTANT(WSA_QOS_ADMISSION_FAILURE),
+#	endif
+#	ifdef WSA_QOS_BAD_OBJECT
+	CONSTANT(WSA_QOS_BAD_OBJECT),
+#	endif
+#	ifdef WSA_QOS_BAD_STYLE
+	CONSTANT(WSA_QOS_BAD_STYLE),
+#	endif
+#	ifdef WSA_QOS_EFILTERCOUNT
+	CONSTANT(WSA_QOS_EFILTERCOUNT),
+#	endif
+#	ifdef WSA_QOS_EFILTERSTYLE
+	CONSTANT(WSA_QOS_EFILTERSTYLE),
+#	endif
+#	ifdef WSA_QOS_EFILTERTYPE
+	CONSTANT(WSA_QOS_EFILTERTYPE),
+#	endif
+#	ifdef WSA_QOS_EFLOWCOUNT
+	CONSTANT(WSA_QOS_EFLOWCOUNT),
+#	endif
+#	ifdef WSA_QOS_EFLOWDESC
+	CONSTANT(WSA_QOS_EFLOWDESC),
+#	endif
+#	ifdef WSA_QOS_EFLOWSPEC
+	CONSTANT(WSA_QOS_EFLOWSPEC),
+#	endif
+#	ifdef WSA_QOS_EOBJLENGTH
+	CONSTANT(WSA_QOS_EOBJLENGTH),
+#	endif
+#	ifdef WSA_QOS_EPOLICYOBJ
+	CONSTANT(WSA_QOS_EPOLICYOBJ),
+#	endif
+#	ifdef WSA_QOS_EPROVSPECBUF
+	CONSTANT(WSA_QOS_EPROVSPECBUF),
+#	endif
+#	ifdef WSA_QOS_EPSFILTERSPEC
+	CONSTANT(WSA_QOS_EPSFILTERSPEC),
+#	endif
+#	ifdef WSA_QOS_EPSFLOWSPEC
+	CONSTANT(WSA_QOS_EPSFLOWSPEC),
+#	endif
+#	ifdef WSA_QOS_ESDMODEOBJ
+	CONSTANT(WSA_QOS_ESDMODEOBJ),
+#	endif
+#	ifdef WSA_QOS_ESERVICETYPE
+	CONSTANT(WSA_QOS_ESERVICETYPE),
+#	endif
+#	ifdef WSA_QOS_ESHAPERATEOBJ
+	CONSTANT(WSA_QOS_ESHAPERATEOBJ),
+#	endif
+#	ifdef WSA_QOS_EUNKOWNPSOBJ
+	CONSTANT(WSA_QOS_EUNKOWNPSOBJ),
+#	endif
+#	ifdef WSA_QOS_GENERIC_ERROR
+	CONSTANT(WSA_QOS_GENERIC_ERROR),
+#	endif
+#	ifdef WSA_QOS_NO_RECEIVERS
+	CONSTANT(WSA_QOS_NO_RECEIVERS),
+#	endif
+#	ifdef WSA_QOS_NO_SENDERS
+	CONSTANT(WSA_QOS_NO_SENDERS),
+#	endif
+#	ifdef WSA_QOS_POLICY_FAILURE
+	CONSTANT(WSA_QOS_POLICY_FAILURE),
+#	endif
+#	ifdef WSA_QOS_RECEIVERS
+	CONSTANT(WSA_QOS_RECEIVERS),
+#	endif
+#	ifdef WSA_QOS_REQUEST_CONFIRMED
+	CONSTANT(WSA_QOS_REQUEST_CONFIRMED),
+#	endif
+#	ifdef WSA_QOS_RESERVED_PETYPE
+	CONSTANT(WSA_QOS_RESERVED_PETYPE),
+#	endif
+#	ifdef WSA_QOS_SENDERS
+	CONSTANT(WSA_QOS_SENDERS),
+#	endif
+#	ifdef WSA_QOS_TRAFFIC_CTRL_ERROR
+	CONSTANT(WSA_QOS_TRAFFIC_CTRL_ERROR),
+#	endif
+};
+#endif
+
+/* Linux-only */
+#ifdef __linux
+static const lsock_constant linux_constants[] =
+{
+#	ifdef AF_ALG
+	CONSTANT(AF_ALG),
+#	endif
+#	ifdef AF_ASH
+	CONSTANT(AF_ASH),
+#	endif
+#	ifdef AF_ATMPVC
+	CONSTANT(AF_ATMPVC),
+#	endif
+#	ifdef AF_ATMSVC
+	CONSTANT(AF_ATMSVC),
+#	endif
+#	ifdef AF_AX25
+	CONSTANT(AF_AX25),
+#	endif
+#	ifdef AF_BLUETOOTH
+	CONSTANT(AF_BLUETOOTH),
+#	endif
+#	ifdef AF_BRIDGE
+	CONSTANT(AF_BRIDGE),
+#	endif
+#	ifdef AF_CAIF
+	CONSTANT(AF_CAIF),
+#	endif
+#	ifdef AF_CAN
+	CONSTANT(AF_CAN),
+#	endif
+#	ifdef AF_DECnet
+	CONSTANT(AF_DECnet),
+#	endif
+#	ifdef AF_ECONET
+	CONSTANT(AF_ECONET),
+#	endif
+#	ifdef AF_FILE
+	CONSTANT(AF_FILE),
+#	endif
+#	ifdef AF_IEEE802154
+	CONSTANT(AF_IEEE802154),
+#	endif
+	CONSTANT(AF_IRDA),
+#	ifdef AF_ISDN
+	CONSTANT(AF_ISDN),
+#	endif
+#	ifdef AF_IUCV
+	CONSTANT(AF_IUCV),
+#	endif
+#	ifdef AF_KEY
+	CONSTANT(AF_KEY),
+#	endif
+#	ifdef AF_LLC
+	CONSTANT(AF_LLC),
+#	endif
+#	ifdef AF_LOCAL
+	CONSTANT(AF_LOCAL),
+#	endif
+#	ifdef AF_MAX
+	CONSTANT(AF_MAX),
+#	endif
+#	ifdef AF_NETBEUI
+	CONSTANT(AF_NETBEUI),
+#	endif
+#	ifdef AF_NETLINK
+	CONSTANT(AF_NETLINK),
+#	endif
+#	ifdef AF_NETROM
+	CONSTANT(AF_NETROM),
+#	endif
+#	ifdef AF_NFC
+	CONSTANT(AF_NFC),
+#	endif
+	CONSTANT(AF_PACKET),
+#	ifdef AF_PHONET
+	CONSTANT(AF_PHONET),
+#	endif
+#	ifdef AF_PPPOX
+	CONSTANT(AF_PPPOX),
+#	endif
+#	ifdef AF_RDS
+	CONSTANT(AF_RDS),
+#	endif
+#	ifdef AF_ROSE
+	CONSTANT(AF_ROSE),
+#	endif
+#	ifdef AF_ROUTE
+	CONSTANT(AF_ROUTE),
+#	endif
+#	ifdef AF_RXRPC
+	CONSTANT(AF_RXRPC),
+#	endif
+#	ifdef AF_SECURITY
+	CONSTANT(AF_SECURITY),
+#	endif
+#	ifdef AF_SNA
+	CONSTANT(AF_SNA),
+#	endif
+#	ifdef AF_TIPC
+	CONSTANT(AF_TIPC),
+#	endif
+#	ifdef AF_UNIX
+	CONSTANT(AF_UNIX),
+#	endif
+#	ifdef AF_VSOCK
+	CONSTANT(AF_VSOCK),
+#	endif
+#	ifdef AF_WANPIPE
+	CONSTANT(AF_WANPIPE),
+#	endif
+#	ifdef AF_X25
+	CONSTANT(AF_X25),
+#	endif
+	CONSTANT(AI_CANONIDN),
+	CONSTANT(AI_IDN),
+	CONSTANT(AI_IDN_ALLOW_UNASSIGNED),
+	CONSTANT(AI_IDN_USE_STD3_ASCII_RULES),
+	CONSTANT(BPF_A),
+	CONSTANT(BPF_ABS),
+	CONSTANT(BPF_ADD),
+	CONSTANT(BPF_ALU),
+	CONSTANT(BPF_AND),
+	CONSTANT(BPF_B),
+	CONSTANT(BPF_DIV),
+	CONSTANT(BPF_H),
+	CONSTANT(BPF_IMM),
+	CONSTANT(BPF_IND),
+	CONSTANT(BPF_JA),
+	CONSTANT(BPF_JEQ),
+	CONSTANT(BPF_JGE),
+	CONSTANT(BPF_JGT),
+	CONSTANT(BPF_JMP),
+	CONSTANT(BPF_JSET),
+	CONSTANT(BPF_K),
+	CONSTANT(BPF_LD),
+	CONSTANT(BPF_LDX),
+	CONSTANT(BPF_LEN),
+	CONSTANT(BPF_LSH),
+	CONSTANT(BPF_MAXINSNS),
+	CONSTANT(BPF_MEM),
+	CONSTANT(BPF_MEMWORDS),
+	CONSTANT(BPF_MISC),
+	CONSTANT(BPF_MOD),
+	CONSTANT(BPF_MSH),
+	CONSTANT(BPF_MUL),
+	CONSTANT(BPF_NEG),
+	CONSTANT(BPF_OR),
+	CONSTANT(BPF_RET),
+	CONSTANT(BPF_RSH),
+	CONSTANT(BPF_ST),
+	CONSTANT(BPF_STX),
+	CONSTANT(BPF_SUB),
+	CONSTANT(BPF_TAX),
+	CONSTANT(BPF_TXA),
+	CONSTANT(BPF_W),
+	CONSTANT(BPF_X),
+	CONSTANT(BPF_XOR),
+#	ifdef EAI_ALLDONE
+	CONSTANT(EAI_ALLDONE),
+#	endif
+#	ifdef EAI_CANCELED
+	CONSTANT(EAI_CANCELED),
+#	endif
+#	ifdef EAI_IDN_ENCODE
+	CONSTANT(EAI_IDN_ENCODE),
+#	endif
+#	ifdef EAI_INPROGRESS
+	CONSTANT(EAI_INPROGRESS),
+#	endif
+#	ifdef EAI_INTR
+	CONSTANT(EAI_INTR),
+#	endif
+#	ifdef EAI_NOTCANCELED
+	CONSTANT(EAI_NOTCANCELED),
+#	endif
+	CONSTANT(ETH_P_ALL),
+	CONSTANT(ETH_P_IP),
+	CONSTANT(ETH_P_IPV6),
+	CONSTANT(IPPROTO_COMP),
+	CONSTANT(IPPROTO_DCCP),
+	CONSTANT(IPPROTO_DSTOPTS),
+	CONSTANT(IPPROTO_HOPOPTS),
+#	ifdef IPPROTO_MH
+	CONSTANT(IPPROTO_MH),
+#	endif
+	CONSTANT(IPPROTO_UDPLITE),
+#	ifdef IPV6_2292DSTOPTS
+	CONSTANT(IPV6_2292DSTOPTS),
+#	endif
+#	ifdef IPV6_2292HOPLIMIT
+	CONSTANT(IPV6_2292HOPLIMIT),
+#	endif
+#	ifdef IPV6_2292HOPOPTS
+	CONSTANT(IPV6_2292HOPOPTS),
+#	endif
+#	ifdef IPV6_2292PKTINFO
+	CONSTANT(IPV6_2292PKTINFO),
+#	endif
+#	ifdef IPV6_2292PKTOPTIONS
+	CONSTANT(IPV6_2292PKTOPTIONS),
+#	endif
+#	ifdef IPV6_2292RTHDR
+	CONSTANT(IPV6_2292RTHDR),
+#	endif
+	CONSTANT(IPV6_ADDRFORM),
+#	ifdef IPV6_ADDR_PREFERENCES
+	CONSTANT(IPV6_ADDR_PREFERENCES),
+#	endif
+#	ifdef IPV6_ADD_MEMBERSHIP
+	CONSTANT(IPV6_ADD_MEMBERSHIP),
+#	endif
+	CONSTANT(IPV6_AUTHHDR),
+#	ifdef IPV6_DEFAULT_TNL_ENCAP_LIMIT
+	CONSTANT(IPV6_DEFAULT_TNL_ENCAP_LIMIT),
+#	endif
+#	ifdef IPV6_DONTFRAG
+	CONSTANT(IPV6_DONTFRAG),
+#	endif
+#	ifdef IPV6_DROP_MEMBERSHIP
+	CONSTANT(IPV6_DROP_MEMBERSHIP),
+#	endif
+	CONSTANT(IPV6_DSTOPTS),
+#	ifdef IPV6_FLOW
+	CONSTANT(IPV6_FLOW),
+#	endif
+#	ifdef IPV6_FLOWINFO
+	CONSTANT(IPV6_FLOWINFO),
+#	endif
+#	ifdef IPV6_FLOWINFO_FLOWLABEL
+	CONSTANT(IPV6_FLOWINFO_FLOWLABEL),
+#	endif
+#	ifdef IPV6_FLOWINFO_PRIORITY
+	CONSTANT(IPV6_FLOWINFO_PRIORITY),
+#	endif
+#	ifdef IPV6_FLOWINFO_SEND
+	CONSTANT(IPV6_FLOWINFO_SEND),
+#	endif
+#	ifdef IPV6_FLOWLABEL_MGR
+	CONSTANT(IPV6_FLOWLABEL_MGR),
+#	endif
+#	ifdef IPV6_FL_A_GET
+	CONSTANT(IPV6_FL_A_GET),
+#	endif
+#	ifdef IPV6_FL_A_PUT
+	CONSTANT(IPV6_FL_A_PUT),
+#	endif
+#	ifdef IPV6_FL_A_RENEW
+	CONSTANT(IPV6_FL_A_RENEW),
+#	endif
+#	ifdef IPV6_FL_F_CREATE
+	CONSTANT(IPV6_FL_F_CREATE),
+#	endif
+#	ifdef IPV6_FL_F_EXCL
+	CONSTANT(IPV6_FL_F_EXCL),
+#	endif
+#	ifdef IPV6_FL_S_ANY
+	CONSTANT(IPV6_FL_S_ANY),
+#	endif
+#	ifdef IPV6_FL_S_EXCL
+	CONSTANT(IPV6_FL_S_EXCL),
+#	endif
+#	ifdef IPV6_FL_S_NONE
+	CONSTANT(IPV6_FL_S_NONE),
+#	endif
+#	ifdef IPV6_FL_S_PROCESS
+	CONSTANT(IPV6_FL_S_PROCESS),
+#	endif
+#	ifdef IPV6_FL_S_USER
+	CONSTANT(IPV6_FL_S_USER),
+#	endif
+	CONSTANT(IPV6_HOPOPTS),
+#	ifdef IPV6_IPSEC_POLICY
+	CONSTANT(IPV6_IPSEC_POLICY),
+#	endif
+#	ifdef IPV6_JOIN_ANYCAST
+	CONSTANT(IPV6_JOIN_ANYCAST),
+#	endif
+#	ifdef IPV6_LEAVE_ANYCAST
+	CONSTANT(IPV6_LEAVE_ANYCAST),
+#	endif
+#	ifdef IPV6_MINHOPCOUNT
+	CONSTANT(IPV6_MINHOPCOUNT),
+#	endif
+#	ifdef IPV6_MIN_MTU
+	CONSTANT(IPV6_MIN_MTU),
+#	endif
+#	ifdef IPV6_MTU
+	CONSTANT(IPV6_MTU),
+#	endif
+#	ifdef IPV6_MTU_DISCOVER
+	CONSTANT(IPV6_MTU_DISCOVER),
+#	endif
+#	ifdef IPV6_MULTICAST_ALL
+	CONSTANT(IPV6_MULTICAST_ALL),
+#	endif
+	CONSTANT(IPV6_NEXTHOP),
+#	ifdef IPV6_OPT_ROUTERALERT_MLD
+	CONSTANT(IPV6_OPT_ROUTERALERT_MLD),
+#	endif
+#	ifdef IPV6_ORIGDSTADDR
+	CONSTANT(IPV6_ORIGDSTADDR),
+#	endif
+#	ifdef IPV6_PATHMTU
+	CONSTANT(IPV6_PATHMTU),
+#	endif
+#	ifdef IPV6_PMTUDISC_DO
+	CONSTANT(IPV6_PMTUDISC_DO),
+#	endif
+#	ifdef IPV6_PMTUDISC_DONT
+	CONSTANT(IPV6_PMTUDISC_DONT),
+#	endif
+#	ifdef IPV6_PMTUDISC_PROBE
+	CONSTANT(IPV6_PMTUDISC_PROBE),
+#	endif
+#	ifdef IPV6_PMTUDISC_WANT
+	CONSTANT(IPV6_PMTUDISC_WANT),
+#	endif
+#	ifdef IPV6_PREFER_SRC_CGA
+	CONSTANT(IPV6_PREFER_SRC_CGA),
+#	endif
+#	ifdef IPV6_PREFER_SRC_COA
+	CONSTANT(IPV6_PREFER_SRC_COA),
+#	endif
+#	ifdef IPV6_PREFER_SRC_HOME
+	CONSTANT(IPV6_PREFER_SRC_HOME),
+#	endif
+#	ifdef IPV6_PREFER_SRC_NONCGA
+	CONSTANT(IPV6_PREFER_SRC_NONCGA),
+#	endif
+#	ifdef IPV6_PREFER_SRC_PUBLIC
+	CONSTANT(IPV6_PREFER_SRC_PUBLIC),
+#	endif
+#	ifdef IPV6_PREFER_SRC_PUBTMP_DEFAULT
+	CONSTANT(IPV6_PREFER_SRC_PUBTMP_DEFAULT),
+#	endif
+#	ifdef IPV6_PREFER_SRC_TMP
+	CONSTANT(IPV6_PREFER_SRC_TMP),
+#	endif
+#	ifdef IPV6_PRIORITY_10
+	CONSTANT(IPV6_PRIORITY_10),
+#	endif
+#	ifdef IPV6_PRIORITY_11
+	CONSTANT(IPV6_PRIORITY_11),
+#	endif
+#	ifdef IPV6_PRIORITY_12
+	CONSTANT(IPV6_PRIORITY_12),
+#	endif
+#	ifdef IPV6_PRIORITY_13
+	CONSTANT(IPV6_PRIORITY_13),
+#	endif
+#	ifdef IPV6_PRIORITY_14
+	CONSTANT(IPV6_PRIORITY_14),
+#	endif
+#	ifdef IPV6_PRIORITY_15
+	CONSTANT(IPV6_PRIORITY_15),
+#	endif
+#	ifdef IPV6_PRIORITY_8
+	CONSTANT(IPV6_PRIORITY_8),
+#	endif
+#	ifdef IPV6_PRIORITY_9
+	CONSTANT(IPV6_PRIORITY_9),
+#	endif
+#	ifdef IPV6_PRIORITY_BULK
+	CONSTANT(IPV6_PRIORITY_BULK),
+#	endif
+#	ifdef IPV6_PRIORITY_CONTROL
+	CONSTANT(IPV6_PRIORITY_CONTROL),
+#	endif
+#	ifdef IPV6_PRIORITY_FILLER
+	CONSTANT(IPV6_PRIORITY_FILLER),
+#	endif
+#	ifdef IPV6_PRIORITY_INTERACTIVE
+	CONSTANT(IPV6_PRIORITY_INTERACTIVE),
+#	endif
+#	ifdef IPV6_PRIORITY_RESERVED1
+	CONSTANT(IPV6_PRIORITY_RESERVED1),
+#	endif
+#	ifdef IPV6_PRIORITY_RESERVED2
+	CONSTANT(IPV6_PRIORITY_RESERVED2),
+#	endif
+#	ifdef IPV6_PRIORITY_UNATTENDED
+	CONSTANT(IPV6_PRIORITY_UNATTENDED),
+#	endif
+#	ifdef IPV6_PRIORITY_UNCHARACTERIZED
+	CONSTANT(IPV6_PRIORITY_UNCHARACTERIZED),
+#	endif
+#	ifdef IPV6_RECVDSTOPTS
+	CONSTANT(IPV6_RECVDSTOPTS),
+#	endif
+#	ifdef IPV6_RECVERR
+	CONSTANT(IPV6_RECVERR),
+#	endif
+#	ifdef IPV6_RECVHOPLIMIT
+	CONSTANT(IPV6_RECVHOPLIMIT),
+#	endif
+#	ifdef IPV6_RECVHOPOPTS
+	CONSTANT(IPV6_RECVHOPOPTS),
+#	endif
+#	ifdef IPV6_RECVORIGDSTADDR
+	CONSTANT(IPV6_RECVORIGDSTADDR),
+#	endif
+#	ifdef IPV6_RECVPATHMTU
+	CONSTANT(IPV6_RECVPATHMTU),
+#	endif
+#	ifdef IPV6_RECVRTHDR
+	CONSTANT(IPV6_RECVRTHDR),
+#	endif
+#	ifdef IPV6_RECVTCLASS
+	CONSTANT(IPV6_RECVTCLASS),
+#	endif
+	CONSTANT(IPV6_ROUTER_ALERT),
+#	ifdef IPV6_RTHDR
+	CONSTANT(IPV6_RTHDR),
+#	endif
+#	ifdef IPV6_RTHDRDSTOPTS
+	CONSTANT(IPV6_RTHDRDSTOPTS),
+#	endif
+#	ifdef IPV6_RTHDR_LOOSE
+	CONSTANT(IPV6_RTHDR_LOOSE),
+#	endif
+#	ifdef IPV6_RTHDR_STRICT
+	CONSTANT(IPV6_RTHDR_STRICT),
+#	endif
+#	ifdef IPV6_RTHDR_TYPE_0
+	CONSTANT(IPV6_RTHDR_TYPE_0),
+#	endif
+#	ifdef IPV6_RXDSTOPTS
+	CONSTANT(IPV6_RXDSTOPTS),
+#	endif
+#	ifdef IPV6_RXHOPOPTS
+	CONSTANT(IPV6_RXHOPOPTS),
+#	endif
+#	ifdef IPV6_SRCRT_STRICT
+	CONSTANT(IPV6_SRCRT_STRICT),
+#	endif
+#	ifdef IPV6_SRCRT_TYPE_0
+	CONSTANT(IPV6_SRCRT_TYPE_0),
+#	endif
+#	ifdef IPV6_SRCRT_TYPE_2
+	CONSTANT(IPV6_SRCRT_TYPE_2),
+#	endif
+#	ifdef IPV6_TCLASS
+	CONSTANT(IPV6_TCLASS),
+#	endif
+#	ifdef IPV6_TLV_HAO
+	CONSTANT(IPV6_TLV_HAO),
+#	endif
+#	ifdef IPV6_TLV_JUMBO
+	CONSTANT(IPV6_TLV_JUMBO),
+#	endif
+#	ifdef IPV6_TLV_PAD1
+	CONSTANT(IPV6_TLV_PAD1),
+#	endif
+#	ifdef IPV6_TLV_PADN
+	CONSTANT(IPV6_TLV_PADN),
+#	endif
+#	ifdef IPV6_TLV_ROUTERALERT
+	CONSTANT(IPV6_TLV_ROUTERALERT),
+#	endif
+#	ifdef IPV6_TLV_TNL_ENCAP_LIMIT
+	CONSTANT(IPV6_TLV_TNL_ENCAP_LIMIT),
+#	endif
+#	ifdef IPV6_TRANSPARENT
+	CONSTANT(IPV6_TRANSPARENT),
+#	endif
+#	ifdef IPV6_UNICAST_IF
+	CONSTANT(IPV6_UNICAST_IF),
+#	endif
+#	ifdef IPV6_USE_MIN_MTU
+	CONSTANT(IPV6_USE_MIN_MTU),
+#	endif
+#	ifdef IPV6_XFRM_POLICY
+	CONSTANT(IPV6_XFRM_POLICY),
+#	endif
+#	ifdef IP_DEFAULT_MULTICAST_LOOP
+	CONSTANT(IP_DEFAULT_MULTICAST_LOOP),
+#	endif
+#	ifdef IP_DEFAULT_MULTICAST_TTL
+	CONSTANT(IP_DEFAULT_MULTICAST_TTL),
+#	endif
+#	ifdef IP_DF
+	CONSTANT(IP_DF),
+#	endif
+#	ifdef IP_FREEBIND
+	CONSTANT(IP_FREEBIND),
+#	endif
+#	ifdef IP_IPSEC_POLICY
+	CONSTANT(IP_IPSEC_POLICY),
+#	endif
+#	ifdef IP_MAXPACKET
+	CONSTANT(IP_MAXPACKET),
+#	endif
+#	ifdef IP_MAX_MEMBERSHIPS
+	CONSTANT(IP_MAX_MEMBERSHIPS),
+#	endif
+#	ifdef IP_MF
+	CONSTANT(IP_MF),
+#	endif
+#	ifdef IP_MINTTL
+	CONSTANT(IP_MINTTL),
+#	endif
+#	ifdef IP_MSFILTER
+	CONSTANT(IP_MSFILTER),
+#	endif
+#	ifdef IP_MSS
+	CONSTANT(IP_MSS),
+#	endif
+#	ifdef IP_MTU
+	CONSTANT(IP_MTU),
+#	endif
+	CONSTANT(IP_MTU_DISCOVER),
+	CONSTANT(IP_MULTICAST_ALL),
+#	ifdef IP_NODEFRAG
+	CONSTANT(IP_NODEFRAG),
+#	endif
+#	ifdef IP_OFFMASK
+	CONSTANT(IP_OFFMASK),
+#	endif
+#	ifdef IP_ORIGDSTADDR
+	CONSTANT(IP_ORIGDSTADDR),
+#	endif
+#	ifdef IP_PASSSEC
+	CONSTANT(IP_PASSSEC),
+#	endif
+#	ifdef IP_PKTOPTIONS
+	CONSTANT(IP_PKTOPTIONS),
+#	endif
+#	ifdef IP_PMTUDISC
+	CONSTANT(IP_PMTUDISC),
+#	endif
+#	ifdef IP_PMTUDISC_DO
+	CONSTANT(IP_PMTUDISC_DO),
+#	endif
+#	ifdef IP_PMTUDISC_DONT
+	CONSTANT(IP_PMTUDISC_DONT),
+#	endif
+#	ifdef IP_PMTUDISC_PROBE
+	CONSTANT(IP_PMTUDISC_PROBE),
+#	endif
+#	ifdef IP_PMTUDISC_WANT
+	CONSTANT(IP_PMTUDISC_WANT),
+#	endif
+	CONSTANT(IP_RECVERR),
+#	ifdef IP_RECVORIGDSTADDR
+	CONSTANT(IP_RECVORIGDSTADDR),
+#	endif
+#	ifdef IP_RECVRETOPTS
+	CONSTANT(IP_RECVRETOPTS),
+#	endif
+	CONSTANT(IP_RECVTOS),
+#	ifdef IP_RECVTTL
+	CONSTANT(IP_RECVTTL),
+#	endif
+#	ifdef IP_RF
+	CONSTANT(IP_RF),
+#	endif
+	CONSTANT(IP_ROUTER_ALERT),
+#	ifdef IP_TRANSPARENT
+	CONSTANT(IP_TRANSPARENT),
+#	endif
+#	ifdef IP_UNICAST_IF
+	CONSTANT(IP_UNICAST_IF),
+#	endif
+#	ifdef IP_XFRM_POLICY
+	CONSTANT(IP_XFRM_POLICY),
+#	endif
+	CONSTANT(MCAST_BLOCK_SOURCE),
+	CONSTANT(MCAST_JOIN_GROUP),
+	CONSTANT(MCAST_JOIN_SOURCE_GROUP),
+	CONSTANT(MCAST_LEAVE_GROUP),
+	CONSTANT(MCAST_LEAVE_SOURCE_GROUP),
+	CONSTANT(MCAST_UNBLOCK_SOURCE),
+#	ifdef MSG_ANY
+	CONSTANT(MSG_ANY),
+#	endif
+#	ifdef MSG_BAND
+	CONSTANT(MSG_BAND),
+#	endif
+#	ifdef MSG_CMSG_CLOEXEC
+	CONSTANT(MSG_CMSG_CLOEXEC),
+#	endif
+	CONSTANT(MSG_CONFIRM),
+#	ifdef MSG_COPY
+	CONSTANT(MSG_COPY),
+#	endif
+	CONSTANT(MSG_ERRQUEUE),
+#	ifdef MSG_EXCEPT
+	CONSTANT(MSG_EXCEPT),
+#	endif
+	CONSTANT(MSG_FASTOPEN),
+	CONSTANT(MSG_FIN),
+#	ifdef MSG_HIPRI
+	CONSTANT(MSG_HIPRI),
+#	endif
+#	ifdef MSG_INFO
+	CONSTANT(MSG_INFO),
+#	endif
+#	ifdef MSG_MEM_SCALE
+	CONSTANT(MSG_MEM_SCALE),
+#	endif
+	CONSTANT(MSG_MORE),
+#	ifdef MSG_NOERROR
+	CONSTANT(MSG_NOERROR),
+#	endif
+	CONSTANT(MSG_NOSIGNAL),
+	CONSTANT(MSG_PROXY),
+	CONSTANT(MSG_RST),
+#	ifdef MSG_STAT
+	CONSTANT(MSG_STAT),
+#	endif
+	CONSTANT(MSG_SYN),
+	CONSTANT(MSG_TRYHARD),
+	CONSTANT(MSG_WAITFORONE),
+	CONSTANT(NI_IDN),
+	CONSTANT(NI_IDN_ALLOW_UNASSIGNED),
+	CONSTANT(NI_IDN_USE_STD3_ASCII_RULES),
+#	ifdef NI_MAXHOST
+	CONSTANT(NI_MAXHOST),
+#	endif
+#	ifdef NI_MAXSERV
+	CONSTANT(NI_MAXSERV),
+#	endif
+	CONSTANT(PACKET_FANOUT_CPU),
+	CONSTANT(PACKET_FANOUT_FLAG_DEFRAG),
+	CONSTANT(PACKET_FANOUT_FLAG_ROLLOVER),
+	CONSTANT(PACKET_FANOUT_HASH),
+	CONSTANT(PACKET_FANOUT_LB),
+	CONSTANT(PACKET_FANOUT_QM),
+	CONSTANT(PACKET_FANOUT_RND),
+	CONSTANT(PACKET_FANOUT_ROLLOVER),
+#	ifdef PF_ALG
+	CONSTANT(PF_ALG),
+#	endif
+#	ifdef PF_ASH
+	CONSTANT(PF_ASH),
+#	endif
+#	ifdef PF_ATMPVC
+	CONSTANT(PF_ATMPVC),
+#	endif
+#	ifdef PF_ATMSVC
+	CONSTANT(PF_ATMSVC),
+#	endif
+#	ifdef PF_AX25
+	CONSTANT(PF_AX25),
+#	endif
+#	ifdef PF_BLUETOOTH
+	CONSTANT(PF_BLUETOOTH),
+#	endif
+#	ifdef PF_BRIDGE
+	CONSTANT(PF_BRIDGE),
+#	endif
+#	ifdef PF_CAIF
+	CONSTANT(PF_CAIF),
+#	endif
+#	ifdef PF_CAN
+	CONSTANT(PF_CAN),
+#	endif
+#	ifdef PF_DECnet
+	CONSTANT(PF_DECnet),
+#	endif
+#	ifdef PF_ECONET
+	CONSTANT(PF_ECONET),
+#	endif
+#	ifdef PF_FILE
+	CONSTANT(PF_FILE),
+#	endif
+#	ifdef PF_IEEE802154
+	CONSTANT(PF_IEEE802154),
+#	endif
+	CONSTANT(PF_IRDA),
+#	ifdef PF_ISDN
+	CONSTANT(PF_ISDN),
+#	endif
+#	ifdef PF_IUCV
+	CONSTANT(PF_IUCV),
+#	endif
+#	ifdef PF_KEY
+	CONSTANT(PF_KEY),
+#	endif
+#	ifdef PF_LLC
+	CONSTANT(PF_LLC),
+#	endif
+#	ifdef PF_MAX
+	CONSTANT(PF_MAX),
+#	endif
+#	ifdef PF_NETBEUI
+	CONSTANT(PF_NETBEUI),
+#	endif
+#	ifdef PF_NETLINK
+	CONSTANT(PF_NETLINK),
+#	endif
+#	ifdef PF_NETROM
+	CONSTANT(PF_NETROM),
+#	endif
+#	ifdef PF_NFC
+	CONSTANT(PF_NFC),
+#	endif
+	CONSTANT(PF_PACKET),
+#	ifdef PF_PHONET
+	CONSTANT(PF_PHONET),
+#	endif
+#	ifdef PF_PPPOX
+	CONSTANT(PF_PPPOX),
+#	endif
+#	ifdef PF_RDS
+	CONSTANT(PF_RDS),
+#	endif
+#	ifdef PF_ROSE
+	CONSTANT(PF_ROSE),
+#	endif
+#	ifdef PF_ROUTE
+	CONSTANT(PF_ROUTE),
+#	endif
+#	ifdef PF_RXRPC
+	CONSTANT(PF_RXRPC),
+#	endif
+#	ifdef PF_SECURITY
+	CONSTANT(PF_SECURITY),
+#	endif
+#	ifdef PF_SNA
+	CONSTANT(PF_SNA),
+#	endif
+#	ifdef PF_TIPC
+	CONSTANT(PF_TIPC),
+#	endif
+#	ifdef PF_UNIX
+	CONSTANT(PF_UNIX),
+#	endif
+#	ifdef PF_VSOCK
+	CONSTANT(PF_VSOCK),
+#	endif
+#	ifdef PF_WANPIPE
+	CONSTANT(PF_WANPIPE),
+#	endif
+#	ifdef PF_X25
+	CONSTANT(PF_X25),
+#	endif
+	CONSTANT(SCM_TSTAMP_ACK),
+	CONSTANT(SCM_TSTAMP_SCHED),
+	CONSTANT(SCM_TSTAMP_SND),
+	CONSTANT(SKF_AD_CPU),
+	CONSTANT(SKF_AD_HATYPE),
+	CONSTANT(SKF_AD_IFINDEX),
+	CONSTANT(SKF_AD_MARK),
+	CONSTANT(SKF_AD_OFF),
+	CONSTANT(SKF_AD_PAY_OFFSET),
+	CONSTANT(SKF_AD_PKTTYPE),
+	CONSTANT(SKF_AD_PROTOCOL),
+	CONSTANT(SKF_AD_QUEUE),
+	CONSTANT(SKF_AD_RANDOM),
+	CONSTANT(SKF_AD_RXHASH),
+	CONSTANT(SKF_AD_VLAN_TAG),
+	CONSTANT(SKF_AD_VLAN_TAG_PRESENT),
+	CONSTANT(SKF_LL_OFF),
+	CONSTANT(SKF_NET_OFF),
+#	ifdef SOCK_CLOEXEC
+	CONSTANT(SOCK_CLOEXEC),
+#	endif
+#	ifdef SOCK_DCCP
+	CONSTANT(SOCK_DCCP),
+#	endif
+#	ifdef SOCK_NONBLOCK
+	CONSTANT(SOCK_NONBLOCK),
+#	endif
+#	ifdef SOCK_PACKET
+	CONSTANT(SOCK_PACKET),
+#	endif
+	CONSTANT(SOF_TIMESTAMPING_OPT_CMSG),
+	CONSTANT(SOF_TIMESTAMPING_OPT_ID),
+	CONSTANT(SOF_TIMESTAMPING_OPT_TSONLY),
+	CONSTANT(SOF_TIMESTAMPING_RAW_HARDWARE),
+	CONSTANT(SOF_TIMESTAMPING_RX_HARDWARE),
+	CONSTANT(SOF_TIMESTAMPING_RX_SOFTWARE),
+	CONSTANT(SOF_TIMESTAMPING_SOFTWARE),
+	CONSTANT(SOF_TIMESTAMPING_TX_ACK),
+	CONSTANT(SOF_TIMESTAMPING_TX_HARDWARE),
+	CONSTANT(SOF_TIMESTAMPING_TX_SCHED),
+	CONSTANT(SOF_TIMESTAMPING_TX_SOFTWARE),
+#	ifdef SOL_AAL
+	CONSTANT(SOL_AAL),
+#	endif
+#	ifdef SOL_ATALK
+	CONSTANT(SOL_ATALK),
+#	endif
+#	ifdef SOL_ATM
+	CONSTANT(SOL_ATM),
+#	endif
+#	ifdef SOL_AX25
+	CONSTANT(SOL_AX25),
+#	endif
+#	ifdef SOL_CAN_BASE
+	CONSTANT(SOL_CAN_BASE),
+#	endif
+#	ifdef SOL_CAN_RAW
+	CONSTANT(SOL_CAN_RAW),
+#	endif
+#	ifdef SOL_DECNET
+	CONSTANT(SOL_DECNET),
+#	endif
+#	ifdef SOL_ICMPV6
+	CONSTANT(SOL_ICMPV6),
+#	endif
+	CONSTANT(SOL_IP),
+	CONSTANT(SOL_IPV6),
+#	ifdef SOL_IPX
+	CONSTANT(SOL_IPX),
+#	endif
+#	ifdef SOL_IRDA
+	CONSTANT(SOL_IRDA),
+#	endif
+#	ifdef SOL_IRLMP
+	CONSTANT(SOL_IRLMP),
+#	endif
+#	ifdef SOL_IRTTP
+	CONSTANT(SOL_IRTTP),
+#	endif
+#	ifdef SOL_NETROM
+	CONSTANT(SOL_NETROM),
+#	endif
+	CONSTANT(SOL_PACKET),
+#	ifdef SOL_RAW
+	CONSTANT(SOL_RAW),
+#	endif
+#	ifdef SOL_ROSE
+	CONSTANT(SOL_ROSE),
+#	endif
+	CONSTANT(SOL_TCP),
+#	ifdef SOL_TIPC
+	CONSTANT(SOL_TIPC),
+#	endif
+	CONSTANT(SOL_UDP),
+#	ifdef SOL_X25
+	CONSTANT(SOL_X25),
+#	endif
+	CONSTANT(SO_ATTACH_FILTER),
+	CONSTANT(SO_ATTACH_REUSEPORT_CBPF),
+	CONSTANT(SO_BINDTODEVICE),
+	CONSTANT(SO_BSDCOMPAT),
+#	ifdef SO_BUSY_POLL
+	CONSTANT(SO_BUSY_POLL),
+#	endif
+#	ifdef SO_BUSY_POLL_BUDGET
+	CONSTANT(SO_BUSY_POLL_BUDGET),
+#	endif
+	CONSTANT(SO_DETACH_FILTER),
+	CONSTANT(SO_DOMAIN),
+#	ifdef SO_GET_FILTER
+	CONSTANT(SO_GET_FILTER),
+#	endif
+	CONSTANT(SO_INCOMING_CPU),
+#	ifdef SO_INCOMING_NAPI_ID
+	CONSTANT(SO_INCOMING_NAPI_ID),
+#	endif
+	CONSTANT(SO_LOCK_FILTER),
+	CONSTANT(SO_MARK),
+#	ifdef SO_MAX_PACING_RATE
+	CONSTANT(SO_MAX_PACING_RATE),
+#	endif
+#	ifdef SO_NOFCS
+	CONSTANT(SO_NOFCS),
+#	endif
+	CONSTANT(SO_NO_CHECK),
+#	ifdef SO_PASSCRED
+	CONSTANT(SO_PASSCRED),
+#	endif
+#	ifdef SO_PASSSEC
+	CONSTANT(SO_PASSSEC),
+#	endif
+	CONSTANT(SO_PEEK_OFF),
+#	ifdef SO_PEERCRED
+	CONSTANT(SO_PEERCRED),
+#	endif
+#	ifdef SO_PEERNAME
+	CONSTANT(SO_PEERNAME),
+#	endif
+#	ifdef SO_PEERSEC
+	CONSTANT(SO_PEERSEC),
+#	endif
+#	ifdef SO_PREFER_BUSY_POLL
+	CONSTANT(SO_PREFER_BUSY_POLL),
+#	endif
+	CONSTANT(SO_PRIORITY),
+	CONSTANT(SO_PROTOCOL),
+	CONSTANT(SO_RCVBUFFORCE),
+#	ifdef SO_RXQ_OVFL
+	CONSTANT(SO_RXQ_OVFL),
+#	endif
+#	ifdef SO_SECURITY_AUTHENTICATION
+	CONSTANT(SO_SECURITY_AUTHENTICATION),
+#	endif
+#	ifdef SO_SECURITY_ENCRYPTION_NETWORK
+	CONSTANT(SO_SECURITY_ENCRYPTION_NETWORK),
+#	endif
+#	ifdef SO_SECURITY_ENCRYPTION_TRANSPORT
+	CONSTANT(SO_SECURITY_ENCRYPTION_TRANSPORT),
+#	endif
+#	ifdef SO_SELECT_ERR_QUEUE
+	CONSTANT(SO_SELECT_ERR_QUEUE),
+#	endif
+	CONSTANT(SO_SNDBUFFORCE),
+	CONSTANT(SO_TIMESTAMPING),
+#	ifdef SO_TIMESTAMPNS
+	CONSTANT(SO_TIMESTAMPNS),
+#	endif
+#	ifdef SO_WIFI_STATUS
+	CONSTANT(SO_WIFI_STATUS),
+#	endif
+	CONSTANT(TCP_CONGESTION),
+#	ifdef TCP_COOKIE_IN_ALWAYS
+	CONSTANT(TCP_COOKIE_IN_ALWAYS),
+#	endif
+#	ifdef TCP_COOKIE_MAX
+	CONSTANT(TCP_COOKIE_MAX),
+#	endif
+#	ifdef TCP_COOKIE_MIN
+	CONSTANT(TCP_COOKIE_MIN),
+#	endif
+#	ifdef TCP_COOKIE_OUT_NEVER
+	CONSTANT(TCP_COOKIE_OUT_NEVER),
+#	endif
+#	ifdef TCP_COOKIE_PAIR_SIZE
+	CONSTANT(TCP_COOKIE_PAIR_SIZE),
+#	endif
+#	ifdef TCP_COOKIE_TRANSACTIONS
+	CONSTANT(TCP_COOKIE_TRANSACTIONS),
+#	endif
+	CONSTANT(TCP_CORK),
+	CONSTANT(TCP_DEFER_ACCEPT),
+	CONSTANT(TCP_FASTOPEN),
+#	ifdef TCP_FASTOPEN_CONNECT
+	CONSTANT(TCP_FASTOPEN_CONNECT),
+#	endif
+	CONSTANT(TCP_INFO),
+	CONSTANT(TCP_KEEPIDLE),
+	CONSTANT(TCP_LINGER2),
+#	ifdef TCP_MAXWIN
+	CONSTANT(TCP_MAXWIN),
+#	endif
+#	ifdef TCP_MAX_WINSHIFT
+	CONSTANT(TCP_MAX_WINSHIFT),
+#	endif
+#	ifdef TCP_MD5SIG
+	CONSTANT(TCP_MD5SIG),
+#	endif
+#	ifdef TCP_MD5SIG_MAXKEYLEN
+	CONSTANT(TCP_MD5SIG_MAXKEYLEN),
+#	endif
+#	ifdef TCP_MSS
+	CONSTANT(TCP_MSS),
+#	endif
+#	ifdef TCP_MSS_DEFAULT
+	CONSTANT(TCP_MSS_DEFAULT),
+#	endif
+#	ifdef TCP_MSS_DESIRED
+	CONSTANT(TCP_MSS_DESIRED),
+#	endif
+#	ifdef TCP_NOTSENT_LOWAT
+	CONSTANT(TCP_NOTSENT_LOWAT),
+#	endif
+#	ifdef TCP_QUEUE_SEQ
+	CONSTANT(TCP_QUEUE_SEQ),
+#	endif
+	CONSTANT(TCP_QUICKACK),
+#	ifdef TCP_REPAIR
+	CONSTANT(TCP_REPAIR),
+#	endif
+#	ifdef TCP_REPAIR_OPTIONS
+	CONSTANT(TCP_REPAIR_OPTIONS),
+#	endif
+#	ifdef TCP_REPAIR_QUEUE
+	CONSTANT(TCP_REPAIR_QUEUE),
+#	endif
+	CONSTANT(TCP_SYNCNT),
+#	ifdef TCP_S_DATA_IN
+	CONSTANT(TCP_S_DATA_IN),
+#	endif
+#	ifdef TCP_S_DATA_OUT
+	CONSTANT(TCP_S_DATA_OUT),
+#	endif
+#	ifdef TCP_THIN_DUPACK
+	CONSTANT(TCP_THIN_DUPACK),
+#	endif
+#	ifdef TCP_THIN_LINEAR_TIMEOUTS
+	CONSTANT(TCP_THIN_LINEAR_TIMEOUTS),
+#	endif
+#	ifdef TCP_TIMESTAMP
+	CONSTANT(TCP_TIMESTAMP),
+#	endif
+#	ifdef TCP_USER_TIMEOUT
+	CONSTANT(TCP_USER_TIMEOUT),
+#	endif
+	CONSTANT(TCP_WINDOW_CLAMP),
+	CONSTANT(UDP_CORK),
+};
+#endif
+
+/* Mac-only */
+#ifdef __APPLE__
+static const lsock_constant mac_constants[] =
+{
+#	ifdef AF_CCITT
+	CONSTANT(AF_CCITT),
+#	endif
+#	ifdef AF_CHAOS
+	CONSTANT(AF_CHAOS),
+#	endif
+#	ifdef AF_CNT
+	CONSTANT(AF_CNT),
+#	endif
+#	ifdef AF_COIP
+	CONSTANT(AF_COIP),
+#	endif
+#	ifdef AF_DATAKIT
+	CONSTANT(AF_DATAKIT),
+#	endif
+#	ifdef AF_DLI
+	CONSTANT(AF_DLI),
+#	endif
+#	ifdef AF_E164
+	CONSTANT(AF_E164),
+#	endif
+#	ifdef AF_ECMA
+	CONSTANT(AF_ECMA),
+#	endif
+#	ifdef AF_HYLINK
+	CONSTANT(AF_HYLINK),
+#	endif
+#	ifdef AF_IEEE80211
+	CONSTANT(AF_IEEE80211),
+#	endif
+#	ifdef AF_IMPLINK
+	CONSTANT(AF_IMPLINK),
+#	endif
+#	ifdef AF_ISO
+	CONSTANT(AF_ISO),
+#	endif
+#	ifdef AF_LAT
+	CONSTANT(AF_LAT),
+#	endif
+#	ifdef AF_LINK
+	CONSTANT(AF_LINK),
+#	endif
+#	ifdef AF_NATM
+	CONSTANT(AF_NATM),
+#	endif
+#	ifdef AF_NDRV
+	CONSTANT(AF_NDRV),
+#	endif
+#	ifdef AF_NETBIOS
+	CONSTANT(AF_NETBIOS),
+#	endif
+#	ifdef AF_NS
+	CONSTANT(AF_NS),
+#	endif
+#	ifdef AF_OSI
+	CONSTANT(AF_OSI),
+#	endif
+#	ifdef AF_PPP
+	CONSTANT(AF_PPP),
+#	endif
+#	ifdef AF_PUP
+	CONSTANT(AF_PUP),
+#	endif
+#	ifdef AF_RESERVED_36
+	CONSTANT(AF_RESERVED_36),
+#	endif
+#	ifdef AF_SIP
+	CONSTANT(AF_SIP),
+#	endif
+#	ifdef AF_SYSTEM
+	CONSTANT(AF_SYSTEM),
+#	endif
+#	ifdef AF_SYS_CONTROL
+	CONSTANT(AF_SYS_CONTROL),
+#	endif
+#	ifdef AF_UTUN
+	CONSTANT(AF_UTUN),
+#	endif
+#	ifdef AI_DEFAULT
+	CONSTANT(AI_DEFAULT),
+#	endif
+#	ifdef AI_MASK
+	CONSTANT(AI_MASK),
+#	endif
+#	ifdef AI_V4MAPPED_CFG
+	CONSTANT(AI_V4MAPPED_CFG),
+#	endif
+#	ifdef EAI_BADHINTS
+	CONSTANT(EAI_BADHINTS),
+#	endif
+#	ifdef EAI_MAX
+	CONSTANT(EAI_MAX),
+#	endif
+#	ifdef EAI_PROTOCOL
+	CONSTANT(EAI_PROTOCOL),
+#	endif
+#	ifdef IPPROTO_3PC
+	CONSTANT(IPPROTO_3PC),
+#	endif
+#	ifdef IPPROTO_ADFS
+	CONSTANT(IPPROTO_ADFS),
+#	endif
+#	ifdef IPPROTO_AHIP
+	CONSTANT(IPPROTO_AHIP),
+#	endif
+#	ifdef IPPROTO_APES
+	CONSTANT(IPPROTO_APES),
+#	endif
+#	ifdef IPPROTO_ARGUS
+	CONSTANT(IPPROTO_ARGUS),
+#	endif
+#	ifdef IPPROTO_AX25
+	CONSTANT(IPPROTO_AX25),
+#	endif
+#	ifdef IPPROTO_BHA
+	CONSTANT(IPPROTO_BHA),
+#	endif
+#	ifdef IPPROTO_BLT
+	CONSTANT(IPPROTO_BLT),
+#	endif
+#	ifdef IPPROTO_BRSATMON
+	CONSTANT(IPPROTO_BRSATMON),
+#	endif
+#	ifdef IPPROTO_CFTP
+	CONSTANT(IPPROTO_CFTP),
+#	endif
+#	ifdef IPPROTO_CHAOS
+	CONSTANT(IPPROTO_CHAOS),
+#	endif
+#	ifdef IPPROTO_CMTP
+	CONSTANT(IPPROTO_CMTP),
+#	endif
+#	ifdef IPPROTO_CPHB
+	CONSTANT(IPPROTO_CPHB),
+#	endif
+#	ifdef IPPROTO_CPNX
+	CONSTANT(IPPROTO_CPNX),
+#	endif
+#	ifdef IPPROTO_DDP
+	CONSTANT(IPPROTO_DDP),
+#	endif
+#	ifdef IPPROTO_DGP
+	CONSTANT(IPPROTO_DGP),
+#	endif
+#	ifdef IPPROTO_DIVERT
+	CONSTANT(IPPROTO_DIVERT),
+#	endif
+#	ifdef IPPROTO_DONE
+	CONSTANT(IPPROTO_DONE),
+#	endif
+#	ifdef IPPROTO_EMCON
+	CONSTANT(IPPROTO_EMCON),
+#	endif
+#	ifdef IPPROTO_EON
+	CONSTANT(IPPROTO_EON),
+#	endif
+#	ifdef IPPROTO_ETHERIP
+	CONSTANT(IPPROTO_ETHERIP),
+#	endif
+#	ifdef IPPROTO_GGP
+	CONSTANT(IPPROTO_GGP),
+#	endif
+#	ifdef IPPROTO_GMTP
+	CONSTANT(IPPROTO_GMTP),
+#	endif
+#	ifdef IPPROTO_HELLO
+	CONSTANT(IPPROTO_HELLO),
+#	endif
+#	ifdef IPPROTO_HMP
+	CONSTANT(IPPROTO_HMP),
+#	endif
+#	ifdef IPPROTO_IDPR
+	CONSTANT(IPPROTO_IDPR),
+#	endif
+#	ifdef IPPROTO_IDRP
+	CONSTANT(IPPROTO_IDRP),
+#	endif
+#	ifdef IPPROTO_IGP
+	CONSTANT(IPPROTO_IGP),
+#	endif
+#	ifdef IPPROTO_IGRP
+	CONSTANT(IPPROTO_IGRP),
+#	endif
+#	ifdef IPPROTO_IL
+	CONSTANT(IPPROTO_IL),
+#	endif
+#	ifdef IPPROTO_INLSP
+	CONSTANT(IPPROTO_INLSP),
+#	endif
+#	ifdef IPPROTO_INP
+	CONSTANT(IPPROTO_INP),
+#	endif
+#	ifdef IPPROTO_IPCOMP
+	CONSTANT(IPPROTO_IPCOMP),
+#	endif
+#	ifdef IPPROTO_IPCV
+	CONSTANT(IPPROTO_IPCV),
+#	endif
+#	ifdef IPPROTO_IPEIP
+	CONSTANT(IPPROTO_IPEIP),
+#	endif
+#	ifdef IPPROTO_IPPC
+	CONSTANT(IPPROTO_IPPC),
+#	endif
+#	ifdef IPPROTO_IPV4
+	CONSTANT(IPPROTO_IPV4),
+#	endif
+#	ifdef IPPROTO_IRTP
+	CONSTANT(IPPROTO_IRTP),
+#	endif
+#	ifdef IPPROTO_KRYPTOLAN
+	CONSTANT(IPPROTO_KRYPTOLAN),
+#	endif
+#	ifdef IPPROTO_LARP
+	CONSTANT(IPPROTO_LARP),
+#	endif
+#	ifdef IPPROTO_LEAF1
+	CONSTANT(IPPROTO_LEAF1),
+#	endif
+#	ifdef IPPROTO_LEAF2
+	CONSTANT(IPPROTO_LEAF2),
+#	endif
+#	ifdef IPPROTO_MAXID
+	CONSTANT(IPPROTO_MAXID),
+#	endif
+#	ifdef IPPROTO_MEAS
+	CONSTANT(IPPROTO_MEAS),
+#	endif
+#	ifdef IPPROTO_MHRP
+	CONSTANT(IPPROTO_MHRP),
+#	endif
+#	ifdef IPPROTO_MICP
+	CONSTANT(IPPROTO_MICP),
+#	endif
+#	ifdef IPPROTO_MUX
+	CONSTANT(IPPROTO_MUX),
+#	endif
+#	ifdef IPPROTO_ND
+	CONSTANT(IPPROTO_ND),
+#	endif
+#	ifdef IPPROTO_NHRP
+	CONSTANT(IPPROTO_NHRP),
+#	endif
+#	ifdef IPPROTO_NSP
+	CONSTANT(IPPROTO_NSP),
+#	endif
+#	ifdef IPPROTO_NVPII
+	CONSTANT(IPPROTO_NVPII),
+#	endif
+#	ifdef IPPROTO_OSPFIGP
+	CONSTANT(IPPROTO_OSPFIGP),
+#	endif
+#	ifdef IPPROTO_PGM
+	CONSTANT(IPPROTO_PGM),
+#	endif
+#	ifdef IPPROTO_PIGP
+	CONSTANT(IPPROTO_PIGP),
+#	endif
+#	ifdef IPPROTO_PRM
+	CONSTANT(IPPROTO_PRM),
+#	endif
+#	ifdef IPPROTO_PVP
+	CONSTANT(IPPROTO_PVP),
+#	endif
+#	ifdef IPPROTO_RCCMON
+	CONSTANT(IPPROTO_RCCMON),
+#	endif
+#	ifdef IPPROTO_RDP
+	CONSTANT(IPPROTO_RDP),
+#	endif
+#	ifdef IPPROTO_RVD
+	CONSTANT(IPPROTO_RVD),
+#	endif
+#	ifdef IPPROTO_SATEXPAK
+	CONSTANT(IPPROTO_SATEXPAK),
+#	endif
+#	ifdef IPPROTO_SATMON
+	CONSTANT(IPPROTO_SATMON),
+#	endif
+#	ifdef IPPROTO_SCCSP
+	CONSTANT(IPPROTO_SCCSP),
+#	endif
+#	ifdef IPPROTO_SDRP
+	CONSTANT(IPPROTO_SDRP),
+#	endif
+#	ifdef IPPROTO_SEP
+	CONSTANT(IPPROTO_SEP),
+#	endif
+#	ifdef IPPROTO_SRPC
+	CONSTANT(IPPROTO_SRPC),
+#	endif
+#	ifdef IPPROTO_ST
+	CONSTANT(IPPROTO_ST),
+#	endif
+#	ifdef IPPROTO_SVMTP
+	CONSTANT(IPPROTO_SVMTP),
+#	endif
+#	ifdef IPPROTO_SWIPE
+	CONSTANT(IPPROTO_SWIPE),
+#	endif
+#	ifdef IPPROTO_TCF
+	CONSTANT(IPPROTO_TCF),
+#	endif
+#	ifdef IPPROTO_TPXX
+	CONSTANT(IPPROTO_TPXX),
+#	endif
+#	ifdef IPPROTO_TRUNK1
+	CONSTANT(IPPROTO_TRUNK1),
+#	endif
+#	ifdef IPPROTO_TRUNK2
+	CONSTANT(IPPROTO_TRUNK2),
+#	endif
+#	ifdef IPPROTO_TTP
+	CONSTANT(IPPROTO_TTP),
+#	endif
+#	ifdef IPPROTO_VINES
+	CONSTANT(IPPROTO_VINES),
+#	endif
+#	ifdef IPPROTO_VISA
+	CONSTANT(IPPROTO_VISA),
+#	endif
+#	ifdef IPPROTO_VMTP
+	CONSTANT(IPPROTO_VMTP),
+#	endif
+#	ifdef IPPROTO_WBEXPAK
+	CONSTANT(IPPROTO_WBEXPAK),
+#	endif
+#	ifdef IPPROTO_WBMON
+	CONSTANT(IPPROTO_WBMON),
+#	endif
+#	ifdef IPPROTO_WSN
+	CONSTANT(IPPROTO_WSN),
+#	endif
+#	ifdef IPPROTO_XNET
+	CONSTANT(IPPROTO_XNET),
+#	endif
+#	ifdef IPPROTO_XTP
+	CONSTANT(IPPROTO_XTP),
+#	endif
+#	ifdef IPV6PROTO_MAXID
+	CONSTANT(IPV6PROTO_MAXID),
+#	endif
+#	ifdef IPV6_2292NEXTHOP
+	CONSTANT(IPV6_2292NEXTHOP),
+#	endif
+#	ifdef IPV6_3542DSTOPTS
+	CONSTANT(IPV6_3542DSTOPTS),
+#	endif
+#	ifdef IPV6_3542HOPLIMIT
+	CONSTANT(IPV6_3542HOPLIMIT),
+#	endif
+#	ifdef IPV6_3542HOPOPTS
+	CONSTANT(IPV6_3542HOPOPTS),
+#	endif
+#	ifdef IPV6_3542NEXTHOP
+	CONSTANT(IPV6_3542NEXTHOP),
+#	endif
+#	ifdef IPV6_3542PKTINFO
+	CONSTANT(IPV6_3542PKTINFO),
+#	endif
+#	ifdef IPV6_3542RTHDR
+	CONSTANT(IPV6_3542RTHDR),
+#	endif
+#	ifdef IPV6_AUTOFLOWLABEL
+	CONSTANT(IPV6_AUTOFLOWLABEL),
+#	endif
+#	ifdef IPV6_BINDV6ONLY
+	CONSTANT(IPV6_BINDV6ONLY),
+#	endif
+#	ifdef IPV6_BOUND_IF
+	CONSTANT(IPV6_BOUND_IF),
+#	endif
+#	ifdef IPV6_DEFAULT_MULTICAST_HOPS
+	CONSTANT(IPV6_DEFAULT_MULTICAST_HOPS),
+#	endif
+#	ifdef IPV6_DEFAULT_MULTICAST_LOOP
+	CONSTANT(IPV6_DEFAULT_MULTICAST_LOOP),
+#	endif
+#	ifdef IPV6_DEFHLIM
+	CONSTANT(IPV6_DEFHLIM),
+#	endif
+#	ifdef IPV6_FAITH
+	CONSTANT(IPV6_FAITH),
+#	endif
+#	ifdef IPV6_FLOWINFO_MASK
+	CONSTANT(IPV6_FLOWINFO_MASK),
+#	endif
+#	ifdef IPV6_FLOWLABEL_MASK
+	CONSTANT(IPV6_FLOWLABEL_MASK),
+#	endif
+#	ifdef IPV6_FRAGTTL
+	CONSTANT(IPV6_FRAGTTL),
+#	endif
+#	ifdef IPV6_FW_ADD
+	CONSTANT(IPV6_FW_ADD),
+#	endif
+#	ifdef IPV6_FW_DEL
+	CONSTANT(IPV6_FW_DEL),
+#	endif
+#	ifdef IPV6_FW_FLUSH
+	CONSTANT(IPV6_FW_FLUSH),
+#	endif
+#	ifdef IPV6_FW_GET
+	CONSTANT(IPV6_FW_GET),
+#	endif
+#	ifdef IPV6_FW_ZERO
+	CONSTANT(IPV6_FW_ZERO),
+#	endif
+#	ifdef IPV6_HLIMDEC
+	CONSTANT(IPV6_HLIMDEC),
+#	endif
+#	ifdef IPV6_MAXHLIM
+	CONSTANT(IPV6_MAXHLIM),
+#	endif
+#	ifdef IPV6_MAXOPTHDR
+	CONSTANT(IPV6_MAXOPTHDR),
+#	endif
+#	ifdef IPV6_MAXPACKET
+	CONSTANT(IPV6_MAXPACKET),
+#	endif
+#	ifdef IPV6_MAX_GROUP_SRC_FILTER
+	CONSTANT(IPV6_MAX_GROUP_SRC_FILTER),
+#	endif
+#	ifdef IPV6_MAX_MEMBERSHIPS
+	CONSTANT(IPV6_MAX_MEMBERSHIPS),
+#	endif
+#	ifdef IPV6_MAX_SOCK_SRC_FILTER
+	CONSTANT(IPV6_MAX_SOCK_SRC_FILTER),
+#	endif
+#	ifdef IPV6_MIN_MEMBERSHIPS
+	CONSTANT(IPV6_MIN_MEMBERSHIPS),
+#	endif
+#	ifdef IPV6_MMTU
+	CONSTANT(IPV6_MMTU),
+#	endif
+#	ifdef IPV6_MSFILTER
+	CONSTANT(IPV6_MSFILTER),
+#	endif
+#	ifdef IPV6_OPTIONS
+	CONSTANT(IPV6_OPTIONS),
+#	endif
+#	ifdef IPV6_PKTOPTIONS
+	CONSTANT(IPV6_PKTOPTIONS),
+#	endif
+#	ifdef IPV6_PORTRANGE
+	CONSTANT(IPV6_PORTRANGE),
+#	endif
+#	ifdef IPV6_PORTRANGE_DEFAULT
+	CONSTANT(IPV6_PORTRANGE_DEFAULT),
+#	endif
+#	ifdef IPV6_PORTRANGE_HIGH
+	CONSTANT(IPV6_PORTRANGE_HIGH),
+#	endif
+#	ifdef IPV6_PORTRANGE_LOW
+	CONSTANT(IPV6_PORTRANGE_LOW),
+#	endif
+#	ifdef IPV6_PREFER_TEMPADDR
+	CONSTANT(IPV6_PREFER_TEMPADDR),
+#	endif
+#	ifdef IPV6_REACHCONF
+	CONSTANT(IPV6_REACHCONF),
+#	endif
+#	ifdef IPV6_RECVDSTADDR
+	CONSTANT(IPV6_RECVDSTADDR),
+#	endif
+#	ifdef IPV6_RECVOPTS
+	CONSTANT(IPV6_RECVOPTS),
+#	endif
+#	ifdef IPV6_RECVRETOPTS
+	CONSTANT(IPV6_RECVRETOPTS),
+#	endif
+#	ifdef IPV6_RETOPTS
+	CONSTANT(IPV6_RETOPTS),
+#	endif
+#	ifdef IPV6_SOCKOPT_RESERVED1
+	CONSTANT(IPV6_SOCKOPT_RESERVED1),
+#	endif
+#	ifdef IPV6_VERSION
+	CONSTANT(IPV6_VERSION),
+#	endif
+#	ifdef IPV6_VERSION_MASK
+	CONSTANT(IPV6_VERSION_MASK),
+#	endif
+#	ifdef IP_BOUND_IF
+	CONSTANT(IP_BOUND_IF),
+#	endif
+#	ifdef IP_DUMMYNET_CONFIGURE
+	CONSTANT(IP_DUMMYNET_CONFIGURE),
+#	endif
+#	ifdef IP_DUMMYNET_DEL
+	CONSTANT(IP_DUMMYNET_DEL),
+#	endif
+#	ifdef IP_DUMMYNET_FLUSH
+	CONSTANT(IP_DUMMYNET_FLUSH),
+#	endif
+#	ifdef IP_DUMMYNET_GET
+	CONSTANT(IP_DUMMYNET_GET),
+#	endif
+#	ifdef IP_FAITH
+	CONSTANT(IP_FAITH),
+#	endif
+#	ifdef IP_FW_ADD
+	CONSTANT(IP_FW_ADD),
+#	endif
+#	ifdef IP_FW_DEL
+	CONSTANT(IP_FW_DEL),
+#	endif
+#	ifdef IP_FW_FLUSH
+	CONSTANT(IP_FW_FLUSH),
+#	endif
+#	ifdef IP_FW_GET
+	CONSTANT(IP_FW_GET),
+#	endif
+#	ifdef IP_FW_RESETLOG
+	CONSTANT(IP_FW_RESETLOG),
+#	endif
+#	ifdef IP_FW_ZERO
+	CONSTANT(IP_FW_ZERO),
+#	endif
+#	ifdef IP_MAX_GROUP_SRC_FILTER
+	CONSTANT(IP_MAX_GROUP_SRC_FILTER),
+#	endif
+#	ifdef IP_MAX_SOCK_MUTE_FILTER
+	CONSTANT(IP_MAX_SOCK_MUTE_FILTER),
+#	endif
+#	ifdef IP_MAX_SOCK_SRC_FILTER
+	CONSTANT(IP_MAX_SOCK_SRC_FILTER),
+#	endif
+#	ifdef IP_MIN_MEMBERSHIPS
+	CONSTANT(IP_MIN_MEMBERSHIPS),
+#	endif
+#	ifdef IP_MULTICAST_IFINDEX
+	CONSTANT(IP_MULTICAST_IFINDEX),
+#	endif
+#	ifdef IP_MULTICAST_VIF
+	CONSTANT(IP_MULTICAST_VIF),
+#	endif
+#	ifdef IP_NAT__XXX
+	CONSTANT(IP_NAT__XXX),
+#	endif
+#	ifdef IP_OLD_FW_ADD
+	CONSTANT(IP_OLD_FW_ADD),
+#	endif
+#	ifdef IP_OLD_FW_DEL
+	CONSTANT(IP_OLD_FW_DEL),
+#	endif
+#	ifdef IP_OLD_FW_FLUSH
+	CONSTANT(IP_OLD_FW_FLUSH),
+#	endif
+#	ifdef IP_OLD_FW_GET
+	CONSTANT(IP_OLD_FW_GET),
+#	endif
+#	ifdef IP_OLD_FW_RESETLOG
+	CONSTANT(IP_OLD_FW_RESETLOG),
+#	endif
+#	ifdef IP_OLD_FW_ZERO
+	CONSTANT(IP_OLD_FW_ZERO),
+#	endif
+#	ifdef IP_PORTRANGE
+	CONSTANT(IP_PORTRANGE),
+#	endif
+#	ifdef IP_PORTRANGE_DEFAULT
+	CONSTANT(IP_PORTRANGE_DEFAULT),
+#	endif
+#	ifdef IP_PORTRANGE_HIGH
+	CONSTANT(IP_PORTRANGE_HIGH),
+#	endif
+#	ifdef IP_PORTRANGE_LOW
+	CONSTANT(IP_PORTRANGE_LOW),
+#	endif
+#	ifdef IP_RECVDSTADDR
+	CONSTANT(IP_RECVDSTADDR),
+#	endif
+#	ifdef IP_RECVIF
+	CONSTANT(IP_RECVIF),
+#	endif
+#	ifdef IP_RECVPKTINFO
+	CONSTANT(IP_RECVPKTINFO),
+#	endif
+#	ifdef IP_RSVP_OFF
+	CONSTANT(IP_RSVP_OFF),
+#	endif
+#	ifdef IP_RSVP_ON
+	CONSTANT(IP_RSVP_ON),
+#	endif
+#	ifdef IP_RSVP_VIF_OFF
+	CONSTANT(IP_RSVP_VIF_OFF),
+#	endif
+#	ifdef IP_RSVP_VIF_ON
+	CONSTANT(IP_RSVP_VIF_ON),
+#	endif
+#	ifdef IP_STRIPHDR
+	CONSTANT(IP_STRIPHDR),
+#	endif
+#	ifdef IP_TRAFFIC_MGT_BACKGROUND
+	CONSTANT(IP_TRAFFIC_MGT_BACKGROUND),
+#	endif
+#	ifdef MSG_EOF
+	CONSTANT(MSG_EOF),
+#	endif
+#	ifdef MSG_FLUSH
+	CONSTANT(MSG_FLUSH),
+#	endif
+#	ifdef MSG_HAVEMORE
+	CONSTANT(MSG_HAVEMORE),
+#	endif
+#	ifdef MSG_HOLD
+	CONSTANT(MSG_HOLD),
+#	endif
+#	ifdef MSG_NEEDSA
+	CONSTANT(MSG_NEEDSA),
+#	endif
+#	ifdef MSG_RCVMORE
+	CONSTANT(MSG_RCVMORE),
+#	endif
+#	ifdef MSG_SEND
+	CONSTANT(MSG_SEND),
+#	endif
+#	ifdef MSG_WAITSTREAM
+	CONSTANT(MSG_WAITSTREAM),
+#	endif
+#	ifdef NI_FQDN_FLAG_VALIDTTL
+	CONSTANT(NI_FQDN_FLAG_VALIDTTL),
+#	endif
+#	ifdef NI_NODEADDR_FLAG_ALL
+	CONSTANT(NI_NODEADDR_FLAG_ALL),
+#	endif
+#	ifdef NI_NODEADDR_FLAG_ANYCAST
+	CONSTANT(NI_NODEADDR_FLAG_ANYCAST),
+#	endif
+#	ifdef NI_NODEADDR_FLAG_COMPAT
+	CONSTANT(NI_NODEADDR_FLAG_COMPAT),
+#	endif
+#	ifdef NI_NODEADDR_FLAG_GLOBAL
+	CONSTANT(NI_NODEADDR_FLAG_GLOBAL),
+#	endif
+#	ifdef NI_NODEADDR_FLAG_LINKLOCAL
+	CONSTANT(NI_NODEADDR_FLAG_LINKLOCAL),
+#	endif
+#	ifdef NI_NODEADDR_FLAG_SITELOCAL
+	CONSTANT(NI_NODEADDR_FLAG_SITELOCAL),
+#	endif
+#	ifdef NI_NODEADDR_FLAG_TRUNCATE
+	CONSTANT(NI_NODEADDR_FLAG_TRUNCATE),
+#	endif
+#	ifdef NI_QTYPE_DNSNAME
+	CONSTANT(NI_QTYPE_DNSNAME),
+#	endif
+#	ifdef NI_QTYPE_FQDN
+	CONSTANT(NI_QTYPE_FQDN),
+#	endif
+#	ifdef NI_QTYPE_IPV4ADDR
+	CONSTANT(NI_QTYPE_IPV4ADDR),
+#	endif
+#	ifdef NI_QTYPE_NODEADDR
+	CONSTANT(NI_QTYPE_NODEADDR),
+#	endif
+#	ifdef NI_QTYPE_NOOP
+	CONSTANT(NI_QTYPE_NOOP),
+#	endif
+#	ifdef NI_QTYPE_SUPTYPES
+	CONSTANT(NI_QTYPE_SUPTYPES),
+#	endif
+#	ifdef NI_SUPTYPE_FLAG_COMPRESS
+	CONSTANT(NI_SUPTYPE_FLAG_COMPRESS),
+#	endif
+#	ifdef NI_WITHSCOPEID
+	CONSTANT(NI_WITHSCOPEID),
+#	endif
+#	ifdef PF_BOND
+	CONSTANT(PF_BOND),
+#	endif
+#	ifdef PF_CCITT
+	CONSTANT(PF_CCITT),
+#	endif
+#	ifdef PF_CHAOS
+	CONSTANT(PF_CHAOS),
+#	endif
+#	ifdef PF_CNT
+	CONSTANT(PF_CNT),
+#	endif
+#	ifdef PF_COIP
+	CONSTANT(PF_COIP),
+#	endif
+#	ifdef PF_DATAKIT
+	CONSTANT(PF_DATAKIT),
+#	endif
+#	ifdef PF_DLI
+	CONSTANT(PF_DLI),
+#	endif
+#	ifdef PF_ECMA
+	CONSTANT(PF_ECMA),
+#	endif
+#	ifdef PF_HYLINK
+	CONSTANT(PF_HYLINK),
+#	endif
+#	ifdef PF_IMPLINK
+	CONSTANT(PF_IMPLINK),
+#	endif
+#	ifdef PF_ISO
+	CONSTANT(PF_ISO),
+#	endif
+#	ifdef PF_LAT
+	CONSTANT(PF_LAT),
+#	endif
+#	ifdef PF_LINK
+	CONSTANT(PF_LINK),
+#	endif
+#	ifdef PF_NATM
+	CONSTANT(PF_NATM),
+#	endif
+#	ifdef PF_NDRV
+	CONSTANT(PF_NDRV),
+#	endif
+#	ifdef PF_NETBIOS
+	CONSTANT(PF_NETBIOS),
+#	endif
+#	ifdef PF_NS
+	CONSTANT(PF_NS),
+#	endif
+#	ifdef PF_OSI
+	CONSTANT(PF_OSI),
+#	endif
+#	ifdef PF_PIP
+	CONSTANT(PF_PIP),
+#	endif
+#	ifdef PF_PPP
+	CONSTANT(PF_PPP),
+#	endif
+#	ifdef PF_PUP
+	CONSTANT(PF_PUP),
+#	endif
+#	ifdef PF_RESERVED_36
+	CONSTANT(PF_RESERVED_36),
+#	endif
+#	ifdef PF_RTIP
+	CONSTANT(PF_RTIP),
+#	endif
+#	ifdef PF_SIP
+	CONSTANT(PF_SIP),
+#	endif
+#	ifdef PF_SYSTEM
+	CONSTANT(PF_SYSTEM),
+#	endif
+#	ifdef PF_UTUN
+	CONSTANT(PF_UTUN),
+#	endif
+#	ifdef PF_VLAN
+	CONSTANT(PF_VLAN),
+#	endif
+#	ifdef PF_XTP
+	CONSTANT(PF_XTP),
+#	endif
+#	ifdef SOCK_MAXADDRLEN
+	CONSTANT(SOCK_MAXADDRLEN),
+#	endif
+#	ifdef SOL_LOCAL
+	CONSTANT(SOL_LOCAL),
+#	endif
+#	ifdef SO_ACCEPTFILTER
+	CONSTANT(SO_ACCEPTFILTER),
+#	endif
+#	ifdef SO_DONTTRUNC
+	CONSTANT(SO_DONTTRUNC),
+#	endif
+#	ifdef SO_LABEL
+	CONSTANT(SO_LABEL),
+#	endif
+#	ifdef SO_LINGER_SEC
+	CONSTANT(SO_LINGER_SEC),
+#	endif
+#	ifdef SO_NKE
+	CONSTANT(SO_NKE),
+#	endif
+#	ifdef SO_NOADDRERR
+	CONSTANT(SO_NOADDRERR),
+#	endif
+#	ifdef SO_NOSIGPIPE
+	CONSTANT(SO_NOSIGPIPE),
+#	endif
+#	ifdef SO_NOTIFYCONFLICT
+	CONSTANT(SO_NOTIFYCONFLICT),
+#	endif
+#	ifdef SO_NP_EXTENSIONS
+	CONSTANT(SO_NP_EXTENSIONS),
+#	endif
+#	ifdef SO_NREAD
+	CONSTANT(SO_NREAD),
+#	endif
+#	ifdef SO_NWRITE
+	CONSTANT(SO_NWRITE),
+#	endif
+#	ifdef SO_PEERLABEL
+	CONSTANT(SO_PEERLABEL),
+#	endif
+#	ifdef SO_RANDOMPORT
+	CONSTANT(SO_RANDOMPORT),
+#	endif
+#	ifdef SO_REUSESHAREUID
+	CONSTANT(SO_REUSESHAREUID),
+#	endif
+#	ifdef SO_TIMESTAMP_MONOTONIC
+	CONSTANT(SO_TIMESTAMP_MONOTONIC),
+#	endif
+#	ifdef SO_UPCALLCLOSEWAIT
+	CONSTANT(SO_UPCALLCLOSEWAIT),
+#	endif
+#	ifdef SO_USELOOPBACK
+	CONSTANT(SO_USELOOPBACK),
+#	endif
+#	ifdef SO_WANTMORE
+	CONSTANT(SO_WANTMORE),
+#	endif
+#	ifdef SO_WANTOOBFLAG
+	CONSTANT(SO_WANTOOBFLAG),
+#	endif
+#	ifdef TCP_CONNECTIONTIMEOUT
+	CONSTANT(TCP_CONNECTIONTIMEOUT),
+#	endif
+#	ifdef TCP_KEEPALIVE
+	CONSTANT(TCP_KEEPALIVE),
+#	endif
+#	ifdef TCP_MAXHLEN
+	CONSTANT(TCP_MAXHLEN),
+#	endif
+#	ifdef TCP_MAXOLEN
+	CONSTANT(TCP_MAXOLEN),
+#	endif
+#	ifdef TCP_MAX_SACK
+	CONSTANT(TCP_MAX_SACK),
+#	endif
+#	ifdef TCP_MINMSS
+	CONSTANT(TCP_MINMSS),
+#	endif
+#	ifdef TCP_NOOPT
+	CONSTANT(TCP_NOOPT),
+#	endif
+#	ifdef TCP_NOPUSH
+	CONSTANT(TCP_NOPUSH),
+#	endif
+#	ifdef TCP_RXT_CONNDROPTIME
+	CONSTANT(TCP_RXT_CONNDROPTIME),
+#	endif
+#	ifdef TCP_RXT_FINDROP
+	CONSTANT(TCP_RXT_FINDROP),
+#	endif
+#	ifdef TCP_SENDMOREACKS
+	CONSTANT(TCP_SENDMOREACKS),
+#	endif
+};
+#endif
+
+/* Linux + Mac shared */
+#ifndef _WIN32
+static const lsock_constant unix_constants[] =
 {
-	int stat;
-
-	char hbuf[NI_MAXHOST], sbuf[NI_MAXSERV];
-
-	size_t       sz    = 0;
-	const char * sa    = luaL_checklstring(L, 1, &sz);
-	int          flags = luaL_checkint(L, 2);
-
-	ZERO_OUT(hbuf, NI_MAXHOST);
-	ZERO_OUT(sbuf, NI_MAXSERV);
-
-	stat = getnameinfo((struct sockaddr *) sa, sz, hbuf, sizeof(hbuf), sbuf, sizeof(sbuf), flags);
-
-	if (0 != stat)
-		return LSOCK_GAIERROR(L, stat);
-
-	lua_pushstring(L, hbuf);
-	lua_pushstring(L, sbuf);
-
-	return 2;
-}
+	CONSTANT(EAI_ADDRFAMILY),
+	CONSTANT(EAI_OVERFLOW),
+	CONSTANT(EAI_SYSTEM),
+	CONSTANT(IPPROTO_ENCAP),
+	CONSTANT(IPPROTO_GRE),
+	CONSTANT(IPPROTO_IPIP),
+	CONSTANT(IPPROTO_MTP),
+	CONSTANT(IPPROTO_RSVP),
+	CONSTANT(IPPROTO_TP),
+	CONSTANT(IPV6_RECVPKTINFO),
+	CONSTANT(IP_RECVOPTS),
+	CONSTANT(IP_RETOPTS),
+	CONSTANT(MSG_DONTWAIT),
+	CONSTANT(MSG_EOR),
+	CONSTANT(PF_LOCAL),
+	CONSTANT(SHUT_RD),
+	CONSTANT(SHUT_RDWR),
+	CONSTANT(SHUT_WR),
+	CONSTANT(SO_REUSEPORT),
+	CONSTANT(SO_TIMESTAMP),
+	CONSTANT(TCP_KEEPCNT),
+	CONSTANT(TCP_KEEPINTVL),
+};
+#endif
 
-enum { R, W, E };
+#undef CONSTANT
 
-static int api_select(lua_State * L)
+static const struct
 {
-	int x, y, stat;
-
-	fd_set set[3];
-	int highsock = 0;
-	struct timeval * t = NULL;
-
-	luaL_checktype(L, 1, LUA_TTABLE); /*  readfds */
-	luaL_checktype(L, 2, LUA_TTABLE); /* writefds */
-	luaL_checktype(L, 3, LUA_TTABLE); /* errorfds */
-
-	if (!lua_isnoneornil(L, 4))
-	{
-		luaL_checktype(L, 4, LUA_TTABLE);
-		t = table_to_timeval(L, 4);
-	}
-
-	ZERO_OUT(&set, sizeof(set));
-
-	/* parse tables into fd_sets */
-	for (x = 1; x <= 3; x++)
-	{
-		int how_many = luaL_len(L, x);
-
-		for (y = 1; y <= how_many; y++)
-		{
-			int fd = -1;
-
-			lua_pushnumber(L, y);
-			lua_gettable(L, x);
-
-			fd = LSOCK_CHECKFD(L, -1);
-
-			highsock = MAX(highsock, fd);
-
-			FD_SET(fd, &set[x - 1]);
-		}
-	}
-
-	stat = select(highsock + 1, &set[R], &set[W], &set[E], t);
-
-	if (-1 == stat)
-		LSOCK_STRERROR(L, NULL);
-
-	/* parse fd_sets back into tables */
-	for (x = 1; x <= 3; x++)
-	{
-		int how_many = luaL_len(L, x);
-
-		/* reuse stat for how many array elems we might have */
-		lua_createtable(L, stat, 0);
-
-		for (y = 1; y <= how_many; y++)
-		{
-			int fd;
-
-			/* push the file handle (socket) userdata */
-			lua_pushnumber(L, y);
-			lua_gettable(L, x);
-
-			fd = LSOCK_CHECKFD(L, -1);
-
-			if (FD_ISSET(fd, &set[y - 1]))
-			{
-				lua_pushnumber(L, y); /* the numeric index */
-				lua_pushvalue(L, -2); /* the file handle */
-				lua_settable(L, -4);  /* the new outgoing table */
-			}
-
-			/* remove the file handle userdata */
-			lua_pop(L, 1);
-		}
-	}
-
-	/* returns the read, write, and exception tables */
-	return 3;
-}
-
-static int api_unread_bytes(lua_State * L)
+	const lsock_constant * list;
+	size_t                 len;
+} constant_tables[] =
 {
-	lsocket s = LSOCK_CHECKSOCK(L, 1);
-
-	size_t available = 0;
-
+	{ portable_constants, LENGTH(portable_constants) },
 #ifdef _WIN32
-	if (ioctlsocket(s, FIONREAD, (u_long *) &available))
-		return LSOCK_STRERROR(L, "ioctlsocket()");
-#else
-	if (ioctl(s, FIONREAD, &available))
-		return LSOCK_STRERROR(L, "ioctl()");
+	{ windows_constants,  LENGTH(windows_constants)  },
 #endif
-
-	lua_pushnumber(L, available);
-	return 1;
-}
-
-static int api_pipe(lua_State * L)
-{
-	lsocket pair[2] = { -1, -1 };
-
-	luaL_Stream * r = NULL;
-	luaL_Stream * w = NULL;
-
-#ifdef _WIN32
-	if (0 == CreatePipe((PHANDLE) &pair[0], (PHANDLE) &pair[1], NULL, (DWORD) luaL_optnumber(L, 1, 0)))
-		return lsock_error(L, GetLastError(), (char * (*)(int)) &strerror, "CreatePipe()");
-#else
-	if (pipe(pair))
-		return LSOCK_STRERROR(L, NULL);
+#ifdef __linux
+	{ linux_constants,    LENGTH(linux_constants)    },
+#endif
+#ifdef __APPLE__
+	{ mac_constants,      LENGTH(mac_constants)      },
 #endif
-
-	r = newfile(L);
-	r->f = fd_to_file(L, pair[0], "rb");
-
-	w = newfile(L);
-	w->f = fd_to_file(L, pair[1], "wb");
-
-	return 2;
-}
-
-
 #ifndef _WIN32
+	{ unix_constants,     LENGTH(unix_constants)     },
+#endif
+};
 
-/* FIXME: Windows -> connect 2 TCP sockets on random (local) port */
-
-static int api_socketpair(lua_State * L)
+static int lsock_constant_cmp(const void * key, const void * c)
 {
-	int pair[2] = { -1, -1 };
-
-	luaL_Stream * one = NULL;
-	luaL_Stream * two = NULL;
-
-	int domain   = luaL_checknumber(L, 1),
-		type     = luaL_checknumber(L, 2),
-		protocol = luaL_checknumber(L, 3);
-
-	if (socketpair(domain, type, protocol, pair))
-		return LSOCK_STRERROR(L, NULL);
+	return strcmp((const char *) key, ((const lsock_constant *) c)->name);
+}
 
-	one = newfile(L);
-	one->f = fd_to_file(L, pair[0], NULL);
+static const lsock_constant * find_constant(const char * name)
+{
+	const lsock_constant * c = NULL;
+	size_t i;
 
-	two = newfile(L);
-	two->f = fd_to_file(L, pair[1], NULL);
+	for (i = 0; NULL == c && i < LENGTH(constant_tables); i++)
+		c = (const lsock_constant *) bsearch(name, constant_tables[i].list, constant_tables[i].len, sizeof(lsock_constant), lsock_constant_cmp);
 
-	return 2;
+	return c;
 }
 
-/* FIXME: Windows -> TransmitFile() */
-
-static int api_sendfile(lua_State * L)
+/* constants[name] -- caches the hit with rawset() so the next access never gets here */
+static int constants_index(lua_State * L)
 {
-	ssize_t sent;
-
-	int    out    =    LSOCK_CHECKFD(L, 1);
-	int    in     =    LSOCK_CHECKFD(L, 2);
-	off_t  offset =   luaL_optnumber(L, 3, 0);
-#ifdef __linux
-	size_t count  = luaL_checknumber(L, 4);
-#endif
-#ifdef __APPLE__
-	off_t count = luaL_checknumber(L, 4);
-#endif
+	const lsock_constant * c = NULL;
 
-#ifdef __linux
-	sent = sendfile(out, in, lua_isnil(L, 3) ? NULL : &offset, count);
-#endif
-#ifdef __APPLE__
-	/* Differences:
-	** 1) out<->in reversed from Linux sendfile()
-	** 2) NULL for the header/trailer structure (Mac OS X sendfile rocks!)
-	** 3) 0 for flags (future expansion); otherwise EINVAL will be returned */
-	sent = sendfile(in, out, offset, &count, NULL, 0);
-#endif
+	if (LUA_TSTRING == lua_type(L, 2))
+		c = find_constant(lua_tostring(L, 2));
 
-	if (-1 == sent)
-		return LSOCK_STRERROR(L, NULL);
+	if (NULL == c)
+	{
+		lua_pushnil(L);
+		return 1;
+	}
 
-#ifdef __APPLE__
-	sent = count;
-#endif
+	lua_pushvalue(L, 2);
+	lua_pushinteger(L, c->value);
+	lua_rawset(L, 1);
 
-	lua_pushnumber(L, sent);
+	lua_pushinteger(L, c->value);
 
 	return 1;
 }
 
-#endif
-
-static int api_getfd(lua_State * L)
+static int constants_next(lua_State * L)
 {
-	lua_pushnumber(L, LSOCK_CHECKFD(L, 1));
-
-	return 1;
-}
-
-#ifdef _WIN32
+	lua_settop(L, 2);
 
-static int lsock_cleanup(lua_State * L)
-{
-	((void) L);
+	if (lua_next(L, 1))
+		return 2;
 
-	WSACleanup();
+	lua_pushnil(L);
 
-	return 0;
+	return 1;
 }
 
-static void lsock_startup(lua_State * L)
+/* pairs(constants) -- fill in everything __index hasn't cached yet, then a plain next() */
+static int constants_pairs(lua_State * L)
 {
-	WSADATA wsaData;
+	size_t t, i;
 
-	int stat = WSAStartup(MAKEWORD(2, 2), &wsaData);
+	for (t = 0; t < LENGTH(constant_tables); t++)
+		for (i = 0; i < constant_tables[t].len; i++)
+		{
+			lua_getfield(L, 1, constant_tables[t].list[i].name); /* through __index, caches it */
+			lua_pop(L, 1);
+		}
 
-	if (stat != 0)
-	{
-		lsock_cleanup(L);
-		luaL_error(L, "WSAStartup() failed [%d]: %s\n", stat, strerror(stat));
-	}
+	lua_pushcfunction(L, &constants_next);
+	lua_pushvalue(L, 1);
+	lua_pushnil(L);
 
-	if (2 != LOBYTE(wsaData.wVersion) || 2 != HIBYTE(wsaData.wVersion))
-	{
-		lsock_cleanup(L);
-		luaL_error(L, "Could not find a usable version of Winsock.dll");
-	}
+	return 3;
 }
 
-#endif
+static luaL_Reg constants_meta[] =
+{
+	{ "__index", constants_index },
+	{ "__pairs", constants_pairs },
+	{ NULL,      NULL            }
+};
 
 static luaL_Reg lsocklib[] =
 {
@@ -1700,38 +12525,122 @@ static luaL_Reg lsocklib[] =
 
 	/* the portable API */
 	REGISTER(accept),
+	REGISTER(accept_until),
+	REGISTER(addrcache),
+	REGISTER(addrcache_clear),
+	REGISTER(addrcache_intern),
+	REGISTER(addrcache_stats),
 	REGISTER(bind),
+	REGISTER(cidr_index),
+	REGISTER(cidr_insert),
+	REGISTER(cidr_lookup),
+	REGISTER(cidr_lookup_batch),
 	REGISTER(should_block),
 	REGISTER(close),
 	REGISTER(connect),
+	REGISTER(connect_any),
+	REGISTER(connect_until),
+	REGISTER(format_addrs),
 	REGISTER(gai_strerror),
 	REGISTER(getaddrinfo),
+	REGISTER(getaddrinfo_cache),
+	REGISTER(getaddrinfo_cache_stats),
+	REGISTER(getaddrinfo_invalidate),
 	REGISTER(getfd),
 	REGISTER(getpeername),
 	REGISTER(getnameinfo),
 	REGISTER(getsockname),
 	REGISTER(getsockopt),
+	REGISTER(histogram),
+	REGISTER(histogram_add),
+	REGISTER(histogram_add_deltas),
+	REGISTER(histogram_reset),
+	REGISTER(histogram_stats),
 	REGISTER(htons),
 	REGISTER(ntohs),
 	REGISTER(htonl),
 	REGISTER(ntohl),
 	REGISTER(listen),
+	REGISTER(monotonic_ns),
 	REGISTER(pack_sockaddr),
+	REGISTER(parse_addrs),
+	REGISTER(pool),
+	REGISTER(pool_checkin),
+	REGISTER(pool_checkout),
+	REGISTER(pool_prune),
+	REGISTER(pool_stats),
 	REGISTER(pipe),
+	REGISTER(rate_limit),
+	REGISTER(rate_limit_stats),
+	REGISTER(rate_limit_wait),
 	REGISTER(recv),
 	REGISTER(recvfrom),
+	REGISTER(recv_until),
 	REGISTER(select),
 	REGISTER(send),
+	REGISTER(send_until),
 	REGISTER(sendto),
 	REGISTER(setsockopt),
 	REGISTER(shutdown),
 	REGISTER(socket),
+	REGISTER(sockopt_apply),
+	REGISTER(sockopt_profile),
 	REGISTER(strerror),
+	REGISTER(timer_add),
+	REGISTER(timer_advance),
+	REGISTER(timer_cancel),
+	REGISTER(timer_next),
+	REGISTER(timer_wheel),
 	REGISTER(unpack_sockaddr),
 	REGISTER(unread_bytes),
 
+	/* Linux-only API */
+#ifdef __linux
+	REGISTER(attach_filter),
+	REGISTER(bpf_assemble),
+	REGISTER(detach_filter),
+	REGISTER(lock_filter),
+	REGISTER(packet_ring),
+	REGISTER(packet_ring_frames),
+	REGISTER(packet_ring_socket),
+	REGISTER(packet_ring_stats),
+	REGISTER(payload_map),
+	REGISTER(payload_memfd),
+	REGISTER(payload_sub),
+	REGISTER(recv_groups),
+	REGISTER(recv_payload),
+	REGISTER(recv_timestamped),
+	REGISTER(recv_tx_timestamps),
+	REGISTER(send_payload),
+	REGISTER(shmring),
+	REGISTER(shmring_attach),
+	REGISTER(shmring_fd),
+	REGISTER(shmring_fds),
+	REGISTER(shmring_recv),
+	REGISTER(shmring_send),
+	REGISTER(syn_data),
+	REGISTER(tcp_info),
+	REGISTER(tcp_info_batch),
+	REGISTER(tcp_info_totable),
+	REGISTER(tcp_info_update),
+	REGISTER(timer_fd),
+	REGISTER(workers),
+	REGISTER(workers_dispatch),
+	REGISTER(workers_stats),
+	REGISTER(workers_stop),
+#endif
+
 	/* Linux + Mac-specific API */
 #ifndef _WIN32
+	REGISTER(recv_fds),
+	REGISTER(resolve),
+	REGISTER(resolver),
+	REGISTER(resolver_cancel),
+	REGISTER(resolver_deadline),
+	REGISTER(resolver_fd),
+	REGISTER(resolver_next),
+	REGISTER(reuseport_group),
+	REGISTER(send_fds),
 	REGISTER(sendfile),
 	REGISTER(socketpair),
 #endif
@@ -1746,241 +12655,32 @@ EXPOSE_SYMBOL int luaopen_lsock(lua_State * L)
 	lsock_startup(L);
 #endif
 
-	luaL_newlib(L, lsocklib);
-
-	lua_newtable(L);
-
-#define CONSTANT(C) PUSHFIELD(L, -1, integer, #C, C)
-
-	/* portable constants (alphabetical) */
-	CONSTANT(AF_APPLETALK);
-	CONSTANT(AF_INET);
-	CONSTANT(AF_INET6);
-	CONSTANT(AF_IPX);
-	CONSTANT(AF_UNSPEC);
-	CONSTANT(AI_ADDRCONFIG);
-	CONSTANT(AI_ALL);
-	CONSTANT(AI_CANONNAME);
-	CONSTANT(AI_NUMERICHOST);
-	CONSTANT(AI_NUMERICSERV);
-	CONSTANT(AI_PASSIVE);
-	CONSTANT(AI_V4MAPPED);
-	CONSTANT(EACCES);
-	CONSTANT(EADDRINUSE);
-	CONSTANT(EADDRNOTAVAIL);
-	CONSTANT(EAFNOSUPPORT);
-	CONSTANT(EAGAIN);
-	CONSTANT(EAI_AGAIN);
-	CONSTANT(EAI_BADFLAGS);
-	CONSTANT(EAI_FAIL);
-	CONSTANT(EAI_FAMILY);
-	CONSTANT(EAI_MEMORY);
-	CONSTANT(EAI_NODATA);
-	CONSTANT(EAI_NONAME);
-	CONSTANT(EAI_SERVICE);
-	CONSTANT(EAI_SOCKTYPE);
-	CONSTANT(EBADF);
-	CONSTANT(ECONNABORTED);
-	CONSTANT(EDESTADDRREQ);
-	CONSTANT(EINTR);
-	CONSTANT(EINVAL);
-	CONSTANT(EIO);
-	CONSTANT(EISDIR);
-	CONSTANT(ELOOP);
-	CONSTANT(EMFILE);
-	CONSTANT(ENAMETOOLONG);
-	CONSTANT(ENFILE);
-	CONSTANT(ENOBUFS);
-	CONSTANT(ENOENT);
-	CONSTANT(ENOMEM);
-	CONSTANT(ENOTCONN);
-	CONSTANT(ENOTDIR);
-	CONSTANT(ENOTSOCK);
-	CONSTANT(EOPNOTSUPP);
-	CONSTANT(EPROTO);
-	CONSTANT(EPROTONOSUPPORT);
-	CONSTANT(EPROTOTYPE);
-	CONSTANT(EROFS);
-	CONSTANT(EWOULDBLOCK);
-	CONSTANT(IPPROTO_AH);
-	CONSTANT(IPPROTO_EGP);
-	CONSTANT(IPPROTO_ESP);
-	CONSTANT(IPPROTO_FRAGMENT);
-	CONSTANT(IPPROTO_ICMP);
-	CONSTANT(IPPROTO_ICMPV6);
-	CONSTANT(IPPROTO_IDP);
-	CONSTANT(IPPROTO_IGMP);
-	CONSTANT(IPPROTO_IP);
-	CONSTANT(IPPROTO_IPV6);
-	CONSTANT(IPPROTO_MAX);
-	CONSTANT(IPPROTO_NONE);
-	CONSTANT(IPPROTO_PIM);
-	CONSTANT(IPPROTO_PUP);
-	CONSTANT(IPPROTO_RAW);
-	CONSTANT(IPPROTO_ROUTING);
-	CONSTANT(IPPROTO_SCTP);
-	CONSTANT(IPPROTO_TCP);
-	CONSTANT(IPPROTO_UDP);
-	CONSTANT(IPV6_CHECKSUM);
-	CONSTANT(IPV6_HOPLIMIT);
-	CONSTANT(IPV6_JOIN_GROUP);
-	CONSTANT(IPV6_LEAVE_GROUP);
-	CONSTANT(IPV6_MULTICAST_HOPS);
-	CONSTANT(IPV6_MULTICAST_IF);
-	CONSTANT(IPV6_MULTICAST_LOOP);
-	CONSTANT(IPV6_PKTINFO);
-	CONSTANT(IPV6_UNICAST_HOPS);
-	CONSTANT(IPV6_V6ONLY);
-	CONSTANT(IP_ADD_MEMBERSHIP);
-	CONSTANT(IP_ADD_SOURCE_MEMBERSHIP);
-	CONSTANT(IP_BLOCK_SOURCE);
-	CONSTANT(IP_DROP_MEMBERSHIP);
-	CONSTANT(IP_DROP_SOURCE_MEMBERSHIP);
-	CONSTANT(IP_HDRINCL);
-	CONSTANT(IP_MULTICAST_IF);
-	CONSTANT(IP_MULTICAST_LOOP);
-	CONSTANT(IP_MULTICAST_TTL);
-	CONSTANT(IP_OPTIONS);
-	CONSTANT(IP_PKTINFO);
-	CONSTANT(IP_TOS);
-	CONSTANT(IP_TTL);
-	CONSTANT(IP_UNBLOCK_SOURCE);
-	CONSTANT(MSG_CTRUNC);
-	CONSTANT(MSG_DONTROUTE);
-	CONSTANT(MSG_OOB);
-	CONSTANT(MSG_PEEK);
-	CONSTANT(MSG_TRUNC);
-	CONSTANT(MSG_WAITALL);
-	CONSTANT(NI_DGRAM);
-	CONSTANT(NI_NAMEREQD);
-	CONSTANT(NI_NOFQDN);
-	CONSTANT(NI_NUMERICHOST);
-	CONSTANT(NI_NUMERICSERV);
-	CONSTANT(PF_APPLETALK);
-	CONSTANT(PF_INET);
-	CONSTANT(PF_INET6);
-	CONSTANT(PF_IPX);
-	CONSTANT(PF_UNSPEC);
-	CONSTANT(SOCK_DGRAM);
-	CONSTANT(SOCK_RAW);
-	CONSTANT(SOCK_RDM);
-	CONSTANT(SOCK_SEQPACKET);
-	CONSTANT(SOCK_STREAM);
-	CONSTANT(SOL_SOCKET);
-	CONSTANT(SOMAXCONN);
-	CONSTANT(SO_ACCEPTCONN);
-	CONSTANT(SO_BROADCAST);
-	CONSTANT(SO_DEBUG);
-	CONSTANT(SO_DONTROUTE);
-	CONSTANT(SO_ERROR);
-	CONSTANT(SO_KEEPALIVE);
-	CONSTANT(SO_LINGER);
-	CONSTANT(SO_OOBINLINE);
-	CONSTANT(SO_RCVBUF);
-	CONSTANT(SO_RCVLOWAT);
-	CONSTANT(SO_RCVTIMEO);
-	CONSTANT(SO_REUSEADDR);
-	CONSTANT(SO_SNDBUF);
-	CONSTANT(SO_SNDLOWAT);
-	CONSTANT(SO_SNDTIMEO);
-	CONSTANT(SO_TYPE);
-	CONSTANT(TCP_MAXSEG);
-	CONSTANT(TCP_NODELAY);
-
-/* Windows-only */
-#ifdef _WIN32
-	CONSTANT(SD_BOTH);
-	CONSTANT(SD_RECEIVE);
-	CONSTANT(SD_SEND);
-	CONSTANT(UDP_CHECKSUM_COVERAGE);
-	CONSTANT(UDP_NOCHECKSUM);
+	lsock_newclass(L, LSOCK_ADDRCACHE,  addrcache_methods,   addrcache_meta  );
+	lsock_newclass(L, LSOCK_CIDR,       cidr_methods,        cidr_meta       );
+	lsock_newclass(L, LSOCK_HISTOGRAM,  histogram_methods,   histogram_meta  );
+	lsock_newclass(L, LSOCK_POOL,       pool_methods,        pool_meta       );
+	lsock_newclass(L, LSOCK_PROFILE,    profile_methods,     profile_meta    );
+	lsock_newclass(L, LSOCK_TIMERWHEEL, timer_wheel_methods, timer_wheel_meta);
+#ifndef _WIN32
+	lsock_newclass(L, LSOCK_RESOLVER,   resolver_methods,    resolver_meta   );
 #endif
-
-/* Linux-only */
 #ifdef __linux
-	CONSTANT(AF_IRDA);
-	CONSTANT(AI_CANONIDN);
-	CONSTANT(AI_IDN);
-	CONSTANT(AI_IDN_ALLOW_UNASSIGNED);
-	CONSTANT(AI_IDN_USE_STD3_ASCII_RULES);
-	CONSTANT(IPPROTO_COMP);
-	CONSTANT(IPPROTO_DCCP);
-	CONSTANT(IPPROTO_DSTOPTS);
-	CONSTANT(IPPROTO_HOPOPTS);
-	CONSTANT(IPPROTO_UDPLITE);
-	CONSTANT(IPV6_ADDRFORM);
-	CONSTANT(IPV6_AUTHHDR);
-	CONSTANT(IPV6_DSTOPTS);
-	CONSTANT(IPV6_HOPOPTS);
-	CONSTANT(IPV6_NEXTHOP);
-	CONSTANT(IPV6_ROUTER_ALERT);
-	CONSTANT(IP_MTU_DISCOVER);
-	CONSTANT(IP_RECVERR);
-	CONSTANT(IP_RECVTOS);
-	CONSTANT(IP_ROUTER_ALERT);
-	CONSTANT(MSG_CONFIRM);
-	CONSTANT(MSG_ERRQUEUE);
-	CONSTANT(MSG_FASTOPEN);
-	CONSTANT(MSG_FIN);
-	CONSTANT(MSG_MORE);
-	CONSTANT(MSG_NOSIGNAL);
-	CONSTANT(MSG_PROXY);
-	CONSTANT(MSG_RST);
-	CONSTANT(MSG_SYN);
-	CONSTANT(MSG_TRYHARD);
-	CONSTANT(MSG_WAITFORONE);
-	CONSTANT(NI_IDN);
-	CONSTANT(NI_IDN_ALLOW_UNASSIGNED);
-	CONSTANT(NI_IDN_USE_STD3_ASCII_RULES);
-	CONSTANT(PF_IRDA);
-	CONSTANT(SOL_IP);
-	CONSTANT(SOL_IPV6);
-	CONSTANT(SOL_TCP);
-	CONSTANT(SOL_UDP);
-	CONSTANT(SO_BINDTODEVICE);
-	CONSTANT(SO_BSDCOMPAT);
-	CONSTANT(SO_DOMAIN);
-	CONSTANT(SO_MARK);
-	CONSTANT(SO_NO_CHECK);
-	CONSTANT(SO_PEEK_OFF);
-	CONSTANT(SO_PRIORITY);
-	CONSTANT(SO_PROTOCOL);
-	CONSTANT(SO_RCVBUFFORCE);
-	CONSTANT(SO_SNDBUFFORCE);
-	CONSTANT(TCP_CORK);
-	CONSTANT(TCP_DEFER_ACCEPT);
-	CONSTANT(TCP_KEEPIDLE);
-	CONSTANT(TCP_LINGER2);
-	CONSTANT(TCP_SYNCNT);
-	CONSTANT(TCP_WINDOW_CLAMP);
-	CONSTANT(UDP_CORK);
+	lsock_newclass(L, LSOCK_FRAME,      frame_methods,       frame_meta      );
+	lsock_newclass(L, LSOCK_PACKETRING, packet_ring_methods, packet_ring_meta);
+	lsock_newclass(L, LSOCK_PAYLOAD,    payload_methods,     payload_meta    );
+	lsock_newclass(L, LSOCK_SHMRING,    shmring_methods,     shmring_meta    );
+	lsock_newclass(L, LSOCK_TCPINFO,    NULL,                tcp_info_meta   );
+	lsock_newclass(L, LSOCK_WORKERS,    workers_methods,     workers_meta    );
+	lsock_newclass(L, LSOCK_WORKER,     worker_methods,      worker_meta     );
 #endif
 
-/* Linux + Mac shared */
-#ifndef _WIN32
-	CONSTANT(EAI_ADDRFAMILY);
-	CONSTANT(EAI_OVERFLOW);
-	CONSTANT(EAI_SYSTEM);
-	CONSTANT(IPPROTO_ENCAP);
-	CONSTANT(IPPROTO_GRE);
-	CONSTANT(IPPROTO_IPIP);
-	CONSTANT(IPPROTO_MTP);
-	CONSTANT(IPPROTO_RSVP);
-	CONSTANT(IPPROTO_TP);
-	CONSTANT(IP_RECVOPTS);
-	CONSTANT(IP_RETOPTS);
-	CONSTANT(MSG_DONTWAIT);
-	CONSTANT(MSG_EOR);
-	CONSTANT(PF_LOCAL);
-	CONSTANT(SHUT_RD);
-	CONSTANT(SHUT_RDWR);
-	CONSTANT(SHUT_WR);
-	CONSTANT(SO_TIMESTAMP);
-	CONSTANT(TCP_KEEPCNT);
-	CONSTANT(TCP_KEEPINTVL);
-#endif
+	luaL_newlib(L, lsocklib);
 
-#undef CONSTANT
+	/* integer constants come from constant_tables via constants_meta */
+	lua_createtable(L, 0, 8);
+	lua_createtable(L, 0, 2);
+	luaL_setfuncs(L, constants_meta, 0);
+	lua_setmetatable(L, -2);
 
 	PUSHFIELD(L, -1, literal, "INADDR_ANY",             "0.0.0.0"        );
 	PUSHFIELD(L, -1, literal, "INADDR_BROADCAST",       "255.255.255.255");